@@ -5,6 +5,7 @@
 #include "SnowflakeS3Client.hpp"
 #include "FileMetadataInitializer.hpp"
 #include "snowflake/client.h"
+#include "memory.h"
 #include "util/Base64.hpp"
 #include "util/ByteArrayStreamBuf.hpp"
 #include "util/Proxy.hpp"
@@ -21,6 +22,7 @@
 #include <aws/core/utils/logging/AWSLogging.h>
 #include <aws/core/utils/logging/DefaultLogSystem.h>
 #include <aws/core/utils/logging/ConsoleLogSystem.h>
+#include <aws/core/utils/memory/MemorySystemInterface.h>
 #include <algorithm>
 #include <iostream>
 #include <fstream>
@@ -38,6 +40,39 @@
 #define AWS_TOKEN "AWS_TOKEN"
 #define SFC_DIGEST "sfc-digest"
 
+#ifdef USE_AWS_MEMORY_MANAGEMENT
+namespace
+{
+/**
+ * Makes the AWS SDK allocate through the memory hooks given to snowflake_global_init. Only takes effect when the SDK
+ * is built with CUSTOM_MEMORY_MANAGEMENT.
+ */
+class SFAwsMemorySystem : public Aws::Utils::Memory::MemorySystemInterface
+{
+public:
+  virtual void Begin()
+  {}
+
+  virtual void End()
+  {}
+
+  // The SDK only asks for the alignment of malloc
+  virtual void* AllocateMemory(std::size_t blockSize, std::size_t alignment, const char *allocationTag)
+  {
+    return global_hooks.alloc(blockSize);
+  }
+
+  virtual void FreeMemory(void* memoryPtr)
+  {
+    global_hooks.dealloc(memoryPtr);
+  }
+};
+
+// Shared by every client since the SDK keeps a single memory system for the process
+SFAwsMemorySystem awsMemorySystem;
+}
+#endif
+
 namespace Snowflake
 {
 namespace Client
@@ -50,6 +85,12 @@ SnowflakeS3Client::SnowflakeS3Client(StageInfo *stageInfo, unsigned int parallel
   m_threadPool(nullptr),
   m_parallel(std::min(parallel, std::thread::hardware_concurrency()))
 {
+#ifdef USE_AWS_MEMORY_MANAGEMENT
+  options.memoryManagementOptions.memoryManager = &awsMemorySystem;
+#endif
+  //TODO move this to global init
+  // Comes first so that nothing the SDK frees was allocated before its memory system was set up
+  Aws::InitAPI(options);
   Aws::Utils::Logging::InitializeAWSLogging(
     Aws::MakeShared<Snowflake::Client::SFAwsLogger>(""));
 
@@ -65,8 +106,6 @@ SnowflakeS3Client::SnowflakeS3Client(StageInfo *stageInfo, unsigned int parallel
     caFile = Aws::String(caBundleFile);
   }
 
-  //TODO move this to global init
-  Aws::InitAPI(options);
   clientConfiguration.region = stageInfo->region;
   clientConfiguration.caFile = caFile;
   clientConfiguration.requestTimeoutMs = 40000;
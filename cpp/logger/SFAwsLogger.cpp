@@ -15,7 +15,8 @@ Snowflake::Client::SFAwsLogger::SFAwsLogger()
 
 LogLevel Snowflake::Client::SFAwsLogger::GetLogLevel() const
 {
-  return (LogLevel)(6 - log_get_level());
+  // Off when nothing is logged, so that the SDK doesn't format messages for nothing
+  return (LogLevel)(6 - log_min_level);
 }
 
 void Snowflake::Client::SFAwsLogger::Log(LogLevel logLevel,
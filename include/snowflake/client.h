@@ -61,6 +61,26 @@ extern "C" {
  */
 #define SF_LOGIN_TIMEOUT 120
 
+/**
+ * Default number of chunk downloader threads
+ */
+#define SF_DEFAULT_CHUNK_DOWNLOAD_THREADS 2
+
+/**
+ * Default maximum number of result chunks downloaded ahead of the consumer
+ */
+#define SF_DEFAULT_CHUNK_PREFETCH_SLOTS 4
+
+/**
+ * Default longest time in milliseconds between checks of a query that is still running
+ */
+#define SF_DEFAULT_QUERY_POLL_MAX_INTERVAL 1000
+
+/**
+ * Default size in bytes from which request bodies are sent gzip compressed
+ */
+#define SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD 65536
+
 /**
  * Snowflake Data types
  *
@@ -207,7 +227,15 @@ typedef enum SF_ATTRIBUTE {
     SF_CON_AUTOCOMMIT,
     SF_DIR_QUERY_URL,
     SF_DIR_QUERY_URL_PARAM,
-    SF_DIR_QUERY_TOKEN
+    SF_DIR_QUERY_TOKEN,
+    SF_CON_CHUNK_DOWNLOAD_THREADS,
+    SF_CON_CHUNK_PREFETCH_SLOTS,
+    SF_CON_CHUNK_ADAPTIVE_PREFETCH,
+    SF_CON_CHUNK_EAGER_DECODE,
+    SF_CON_ARROW_RESULT_FORMAT,
+    SF_CON_CHUNK_MULTI_DOWNLOAD,
+    SF_CON_QUERY_POLL_MAX_INTERVAL,
+    SF_CON_REQUEST_COMPRESSION_THRESHOLD
 } SF_ATTRIBUTE;
 
 /**
@@ -218,16 +246,44 @@ typedef enum SF_GLOBAL_ATTRIBUTE {
     SF_GLOBAL_CA_BUNDLE_FILE,
     SF_GLOBAL_SSL_VERSION,
     SF_GLOBAL_DEBUG,
-    SF_GLOBAL_OCSP_CHECK
+    SF_GLOBAL_OCSP_CHECK,
+    SF_GLOBAL_CHUNK_MEMORY_LIMIT,
+    SF_GLOBAL_CHUNK_SPILL_DIR,
+    // Write log lines from a background thread, see log_set_async
+    SF_GLOBAL_ASYNC_LOG,
+    // Number of log lines dropped because the async queue was full. Read only
+    SF_GLOBAL_ASYNC_LOG_DROPPED
 } SF_GLOBAL_ATTRIBUTE;
 
 /**
  * Attributes for Snowflake statement context.
  */
 typedef enum SF_STMT_ATTRIBUTE {
-    SF_STMT_USER_REALLOC_FUNC
+    SF_STMT_USER_REALLOC_FUNC,
+    SF_STMT_CHUNK_DOWNLOAD_THREADS,
+    SF_STMT_CHUNK_PREFETCH_SLOTS,
+    SF_STMT_CHUNK_ADAPTIVE_PREFETCH,
+    SF_STMT_CHUNK_EAGER_DECODE,
+    SF_STMT_CHUNK_MULTI_DOWNLOAD,
+    SF_STMT_CHUNK_MEMORY_LIMIT,
+    SF_STMT_CHUNK_MEMORY_PEAK,
+    SF_STMT_CHUNK_SPILL_DIR,
+    SF_STMT_RESULT_PARTITIONS,
+    SF_STMT_RESULT_POLL_COUNT
 } SF_STMT_ATTRIBUTE;
 
+/**
+ * Status of a query submitted with snowflake_execute_async.
+ */
+typedef enum SF_QUERY_STATUS {
+    SF_QUERY_STATUS_UNKNOWN,
+    SF_QUERY_STATUS_QUEUED,
+    SF_QUERY_STATUS_RUNNING,
+    SF_QUERY_STATUS_SUCCESS,
+    SF_QUERY_STATUS_FAILED,
+    SF_QUERY_STATUS_ABORTED
+} SF_QUERY_STATUS;
+
 /**
  * Snowflake Error
  */
@@ -290,6 +346,25 @@ typedef struct SF_CONNECT {
 
     char *direct_query_token;
 
+    // Default chunk downloader settings for statements created on this connection
+    uint64 chunk_download_threads;
+    uint64 chunk_prefetch_slots;
+    sf_bool chunk_adaptive_prefetch;
+    sf_bool chunk_eager_decode;
+    sf_bool chunk_multi_download;
+
+    // Ask the server for results in the Arrow IPC format instead of JSON
+    sf_bool arrow_result_format;
+
+    // Longest time in milliseconds between checks of a query that is still running
+    uint64 query_poll_max_interval;
+
+    // Size in bytes from which request bodies are sent gzip compressed, 0 to never compress them
+    uint64 request_compression_threshold;
+
+    // Idle cURL handles and request headers reused by the requests of this connection
+    void *http_session;
+
     // Error
     SF_ERROR_STRUCT error;
 } SF_CONNECT;
@@ -330,7 +405,14 @@ typedef struct SF_STMT {
     SF_CONNECT *connection;
     char *sql_text;
     void *raw_results;
-    void *cur_row;
+    /* First rowset of the result, kept so that fetches can scroll back to it. raw_results points to it while its rows
+     * are fetched */
+    void *first_rowset;
+    /* Partition of the result in raw_results, 0 for the first rowset and n + 1 for chunk n */
+    int64 chunk_index;
+    int64 cur_row_index;
+    /* Number of rows up to and including cur_row_index that snowflake_column_view returns */
+    int64 view_row_count;
     int64 chunk_rowcount;
     int64 total_rowcount;
     int64 total_fieldcount;
@@ -338,6 +420,7 @@ typedef struct SF_STMT {
     void *params;
     void *name_list;
     unsigned int params_len;
+    void *results;
     SF_COLUMN_DESC *desc;
     void *stmt_attrs;
     sf_bool is_dml;
@@ -347,6 +430,68 @@ typedef struct SF_STMT {
      */
     void *(*user_realloc_func)(void*, size_t);
 
+    /**
+     * Number of chunk downloader threads and maximum number of chunks
+     * downloaded ahead of the consumer. If adaptive prefetch is enabled,
+     * the number of chunks in flight is tuned between 1 and
+     * chunk_prefetch_slots based on how fast the results are consumed.
+     */
+    uint64 chunk_download_threads;
+    uint64 chunk_prefetch_slots;
+    sf_bool chunk_adaptive_prefetch;
+
+    /**
+     * If enabled, int64, float64 and boolean columns are converted to their
+     * native types when a chunk is received, on the chunk downloader threads
+     * for downloaded chunks, instead of on every snowflake_column_as_* call.
+     */
+    sf_bool chunk_eager_decode;
+
+    /**
+     * If enabled, a single thread drives all chunk downloads through
+     * curl_multi and chunk_download_threads is the number of threads that
+     * parse the downloaded chunks. Up to chunk_prefetch_slots chunks are
+     * downloaded at once.
+     */
+    sf_bool chunk_multi_download;
+
+    /**
+     * Limit in bytes on the memory of the chunks that are downloading,
+     * waiting to be fetched or being fetched. Downloads are held back until
+     * enough chunks have been fetched to stay below it. 0 means no limit,
+     * the default is the SF_GLOBAL_CHUNK_MEMORY_LIMIT setting.
+     */
+    uint64 chunk_memory_limit;
+
+    /**
+     * Largest amount of chunk memory in bytes used at once by the results of
+     * the last query.
+     */
+    uint64 chunk_memory_peak;
+
+    /**
+     * Directory to write chunks to that are ready to download but don't fit
+     * into chunk_memory_limit. They are read back once the chunks before
+     * them have been fetched. NULL keeps such chunks waiting on the server,
+     * the default is the SF_GLOBAL_CHUNK_SPILL_DIR setting. Has no effect
+     * without a memory limit or with chunk_multi_download.
+     */
+    char *chunk_spill_dir;
+
+    /**
+     * If enabled, result chunks are not downloaded in the background.
+     * Instead the first rowset and every chunk are partitions of the result
+     * that are read with snowflake_partition_open, e.g. one per thread.
+     * snowflake_fetch on the statement itself only returns the first rowset.
+     */
+    sf_bool result_partitions;
+
+    /**
+     * Number of times the result of the last query was checked again
+     * because the query was still running.
+     */
+    uint64 result_poll_count;
+
     SF_CHUNK_DOWNLOADER *chunk_downloader;
     SF_PUT_GET_RESPONSE *put_get_response;
 } SF_STMT;
@@ -364,7 +509,38 @@ typedef struct {
 } SF_BIND_INPUT;
 
 /**
- *
+ * Bind output column context for snowflake_fetch_batch. Every array must
+ * have room for as many rows as are requested from snowflake_fetch_batch.
+ */
+typedef struct {
+    size_t idx; /* One based index of the column */
+    SF_C_TYPE c_type; /* output data type in C. SF_C_TYPE_INT64, SF_C_TYPE_FLOAT64, SF_C_TYPE_BOOLEAN or SF_C_TYPE_STRING */
+    void *value; /* output array of int64, float64 or sf_bool, or for strings max_length bytes per row */
+    size_t max_length; /* size of each string including the null terminator. valid only for SF_C_TYPE_STRING */
+    size_t *len; /* (optional) output array of value lengths. For strings, the full length even if truncated, otherwise the size of the C type */
+    sf_bool *is_null; /* (optional) output array of null indicators */
+    SF_STATUS *status; /* (optional) output array of conversion statuses */
+} SF_BIND_OUTPUT;
+
+/**
+ * Read only view of one column for the rows fetched by snowflake_fetch_view.
+ * Points into the result set and is only valid until the next fetch.
+ */
+typedef struct {
+    SF_C_TYPE c_type; /* SF_C_TYPE_INT64, SF_C_TYPE_FLOAT64 or SF_C_TYPE_BOOLEAN for columns with native values, otherwise SF_C_TYPE_STRING */
+    size_t rows; /* number of rows in the view */
+    const void *values; /* int64, float64 or sf_bool array of native values, NULL for SF_C_TYPE_STRING */
+    const SF_STATUS *status; /* conversion status of every native value, NULL for SF_C_TYPE_STRING */
+    const char *data; /* text of every value. Value i is the null terminated string at data + offsets[i] */
+    const size_t *offsets; /* offset of every value in data */
+    const size_t *lengths; /* length of every value */
+    const sf_bool *is_null; /* null indicator of every value */
+} SF_COLUMN_VIEW;
+
+/**
+ * Memory allocation functions for the library. When passed to snowflake_global_init, they are also used by cURL,
+ * OpenSSL and cJSON, and by the AWS SDK when it is built with custom memory management. Functions left NULL default to
+ * the C library ones.
  */
 typedef struct SF_USER_MEM_HOOKS {
     void *(*alloc_fn)(size_t size);
@@ -387,6 +563,9 @@ typedef struct SF_TIMESTAMP {
 /**
  * Global Snowflake initialization.
  *
+ * OpenSSL only accepts memory hooks before it allocates anything, so hooks must be passed before anything else in
+ * the process uses OpenSSL for them to apply to it.
+ *
  * @return 0 if successful, errno otherwise
  */
 SF_STATUS STDCALL
@@ -621,6 +800,56 @@ snowflake_stmt_get_attr(SF_STMT *sfstmt, SF_STMT_ATTRIBUTE type, void **value);
  */
 SF_STATUS STDCALL snowflake_execute(SF_STMT *sfstmt);
 
+/**
+ * Submits a statement without waiting for it to complete. Only the query id
+ * is set afterwards, see snowflake_sfqid. The result is attached to a
+ * statement with snowflake_fetch_result_by_qid. PUT and GET commands can't be
+ * submitted this way.
+ *
+ * @param sfstmt SNOWFLAKE_STMT context.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_execute_async(SF_STMT *sfstmt);
+
+/**
+ * Gets the status of a query without waiting for it.
+ *
+ * @param sf SNOWFLAKE_CONNECT context.
+ * @param qid Query id.
+ * @param status Set to the status of the query. SF_QUERY_STATUS_UNKNOWN if
+ *        Snowflake doesn't know the query yet.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_query_status(SF_CONNECT *sf, const char *qid, SF_QUERY_STATUS *status);
+
+/**
+ * Waits until any one of several queries has succeeded, failed or been
+ * aborted, so that a single thread can keep many queries in flight.
+ *
+ * @param sf SNOWFLAKE_CONNECT context.
+ * @param qids Query ids.
+ * @param count Number of query ids.
+ * @param timeout_ms Maximum time to wait in milliseconds, negative to wait
+ *        until a query completes.
+ * @param index Set to the index of the completed query.
+ * @param status Set to the status of the completed query.
+ * @return 0 if success, SF_STATUS_ERROR_REQUEST_TIMEOUT if no query completed
+ *         in time, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_query_wait(SF_CONNECT *sf, const char **qids, size_t count, int64 timeout_ms,
+                                       size_t *index, SF_QUERY_STATUS *status);
+
+/**
+ * Attaches the result of a query submitted with snowflake_execute_async to a
+ * statement, waiting for the query to complete if needed. The rows are then
+ * fetched the same way as after snowflake_execute.
+ *
+ * @param sfstmt SNOWFLAKE_STMT context.
+ * @param qid Query id.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_result_by_qid(SF_STMT *sfstmt, const char *qid);
+
 /**
  * Fetches the next row for the statement and stores on the bound buffer
  * if any. Noop if no buffer is bound.
@@ -630,6 +859,121 @@ SF_STATUS STDCALL snowflake_execute(SF_STMT *sfstmt);
  */
 SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt);
 
+/**
+ * Fetches the row at the given position of the result. Only the chunk that
+ * holds the row is downloaded, and the chunks before it are skipped.
+ * Afterwards snowflake_fetch continues with the row after it.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @param row Row number starting from 1. Negative numbers count back from
+ *            the last row, -1 is the last row.
+ * @return 0 if success, SF_STATUS_EOF if there is no such row, in which case
+ *         the position is unchanged, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_absolute(SF_STMT *sfstmt, int64 row);
+
+/**
+ * Fetches the row the given number of rows after the current row, or before
+ * it if offset is negative. snowflake_fetch_relative(sfstmt, 1) is the same
+ * as snowflake_fetch.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @param offset Number of rows to move.
+ * @return 0 if success, SF_STATUS_EOF if there is no such row, in which case
+ *         the position is unchanged, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_relative(SF_STMT *sfstmt, int64 offset);
+
+/**
+ * Binds an output array to a result column for snowflake_fetch_batch. The
+ * binding stays in place for later queries on the same statement, binding the
+ * same column again replaces it.
+ *
+ * @param sfstmt SF_STMT context.
+ * @param sfbind SF_BIND_OUTPUT context. Must stay valid while it is bound.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_bind_result(SF_STMT *sfstmt, SF_BIND_OUTPUT *sfbind);
+
+/**
+ * Binds an array of output columns for snowflake_fetch_batch.
+ *
+ * @param sfstmt SF_STMT context.
+ * @param sfbind_array SF_BIND_OUTPUT array of output columns.
+ * @param size size_t size of the output column array (sfbind_array).
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_bind_result_array(SF_STMT *sfstmt, SF_BIND_OUTPUT *sfbind_array, size_t size);
+
+/**
+ * Fetches up to max_rows rows into the arrays bound with snowflake_bind_result,
+ * one column at a time. Numbers and booleans are converted the same way as by
+ * snowflake_column_as_int64/float64/boolean. Strings are the values as sent by
+ * the server, e.g. dates and timestamps are not formatted. Afterwards the
+ * snowflake_column_as_* functions return the last row of the batch.
+ *
+ * If a value can't be converted, its status is set and the batch is still
+ * filled, but the error of the first such value is returned.
+ *
+ * @param sfstmt SF_STMT context.
+ * @param max_rows Maximum number of rows to fetch.
+ * @param rows_fetched Set to the number of rows fetched.
+ * @return 0 if success, SF_STATUS_EOF if there are no more rows, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_batch(SF_STMT *sfstmt, size_t max_rows, size_t *rows_fetched);
+
+/**
+ * Fetches up to max_rows rows without copying them anywhere. The rows are
+ * read with snowflake_column_view. Fewer rows than asked for are returned at
+ * the end of each result chunk, since a view never spans two chunks.
+ * Afterwards the snowflake_column_as_* functions return the last row.
+ *
+ * @param sfstmt SF_STMT context.
+ * @param max_rows Maximum number of rows to fetch.
+ * @param rows_fetched Set to the number of rows fetched.
+ * @return 0 if success, SF_STATUS_EOF if there are no more rows, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_view(SF_STMT *sfstmt, size_t max_rows, size_t *rows_fetched);
+
+/**
+ * Returns a read only view of one column for the rows fetched by the last
+ * snowflake_fetch_view, or of the current row after snowflake_fetch. int64,
+ * float64 and boolean columns are converted to their native type the first
+ * time they are viewed, unless the result already came with native values.
+ *
+ * @param sfstmt SF_STMT context.
+ * @param idx Column index starting from 1.
+ * @param view Set to the column view.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_column_view(SF_STMT *sfstmt, int idx, SF_COLUMN_VIEW *view);
+
+/**
+ * Returns the number of partitions of the result: the first rowset and every
+ * result chunk.
+ *
+ * @param sfstmt SF_STMT context.
+ * @return the number of partitions, 0 if there is no result.
+ */
+int64 STDCALL snowflake_num_partitions(SF_STMT *sfstmt);
+
+/**
+ * Reads one partition of the result of a query executed with
+ * SF_STMT_RESULT_PARTITIONS enabled into cursor, downloading it on the
+ * calling thread if needed. Afterwards cursor behaves like a statement that
+ * returned only the rows of the partition: snowflake_fetch and the
+ * snowflake_column_as_* functions work as usual, and errors are set on it.
+ * Different cursors can be opened and read on different threads at the same
+ * time, as long as sfstmt itself is not used meanwhile.
+ *
+ * @param sfstmt SF_STMT context the query was executed on.
+ * @param partition Partition index starting from 0.
+ * @param cursor Statement created with snowflake_stmt that receives the
+ *               partition. Its previous result is discarded.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_partition_open(SF_STMT *sfstmt, int64 partition, SF_STMT *cursor);
+
 /**
  * Returns the number of binding parameters in the statement.
  *
@@ -52,24 +52,55 @@ typedef enum SF_LOG_LEVEL {
 
 #define CXX_LOG_NS "C++"
 
-#define log_trace(...) log_log(SF_LOG_TRACE, __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_debug(...) log_log(SF_LOG_DEBUG, __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_info(...)  log_log(SF_LOG_INFO,  __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_warn(...)  log_log(SF_LOG_WARN,  __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_error(...) log_log(SF_LOG_ERROR, __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_fatal(...) log_log(SF_LOG_FATAL, __FILE__, __LINE__, "C", __VA_ARGS__)
-
-#define sf_log_trace(ns, ...) log_log(SF_LOG_TRACE, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_debug(ns, ...) log_log(SF_LOG_DEBUG, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_info(ns, ...)  log_log(SF_LOG_INFO, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_warn(ns, ...)  log_log(SF_LOG_WARN,  __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_error(ns, ...) log_log(SF_LOG_ERROR, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_fatal(ns, ...) log_log(SF_LOG_FATAL, __FILE__, __LINE__, ns, __VA_ARGS__)
+/**
+ * Counters of the async backend.
+ */
+typedef struct SF_LOG_ASYNC_STATS {
+    // Lines put on the queue
+    unsigned long long queued;
+    // Lines dropped because the queue was full
+    unsigned long long dropped;
+    // Writes done by the writer thread, each one covering every line queued since the previous one
+    unsigned long long batches;
+} SF_LOG_ASYNC_STATS;
+
+/**
+ * Whether messages of a level go anywhere. The log macros check it before evaluating their arguments, so a message
+ * that isn't logged costs one comparison. Defining SF_LOG_DISABLED compiles logging out altogether.
+ */
+#ifdef SF_LOG_DISABLED
+#define log_enabled(level) 0
+#else
+#define log_enabled(level) ((level) >= log_min_level)
+#endif
+
+#define SF_LOG_IF_ENABLED(level, ns, ...) \
+    (log_enabled(level) ? log_log(level, __FILE__, __LINE__, ns, __VA_ARGS__) : (void) 0)
+
+#define log_trace(...) SF_LOG_IF_ENABLED(SF_LOG_TRACE, "C", __VA_ARGS__)
+#define log_debug(...) SF_LOG_IF_ENABLED(SF_LOG_DEBUG, "C", __VA_ARGS__)
+#define log_info(...)  SF_LOG_IF_ENABLED(SF_LOG_INFO,  "C", __VA_ARGS__)
+#define log_warn(...)  SF_LOG_IF_ENABLED(SF_LOG_WARN,  "C", __VA_ARGS__)
+#define log_error(...) SF_LOG_IF_ENABLED(SF_LOG_ERROR, "C", __VA_ARGS__)
+#define log_fatal(...) SF_LOG_IF_ENABLED(SF_LOG_FATAL, "C", __VA_ARGS__)
+
+#define sf_log_trace(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_TRACE, ns, __VA_ARGS__)
+#define sf_log_debug(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_DEBUG, ns, __VA_ARGS__)
+#define sf_log_info(ns, ...)  SF_LOG_IF_ENABLED(SF_LOG_INFO,  ns, __VA_ARGS__)
+#define sf_log_warn(ns, ...)  SF_LOG_IF_ENABLED(SF_LOG_WARN,  ns, __VA_ARGS__)
+#define sf_log_error(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_ERROR, ns, __VA_ARGS__)
+#define sf_log_fatal(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_FATAL, ns, __VA_ARGS__)
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+/**
+ * Lowest level that is logged to stderr or the log file. Above SF_LOG_FATAL when neither is on. Kept up to date by
+ * log_set_level, log_set_quiet and log_set_fp.
+ */
+extern int log_min_level;
+
 void log_set_udata(void *udata);
 
 void log_set_lock(log_LockFn fn);
@@ -90,6 +121,24 @@ void
 log_log_va_list(int level, const char *file, int line, const char *ns, 
                 const char *fmt, va_list args);
 
+/**
+ * Turns the async backend on or off. When it is on, log calls format the message and queue it for a writer thread,
+ * which writes it out within a fraction of a second, or right away for FATAL messages. Lines are dropped rather than
+ * waited for when the queue is full. Turning it off writes out whatever is queued.
+ *
+ * @param enable 1 to turn it on, 0 to turn it off.
+ * @param buffer_size size of the queue in bytes, 0 for the default of 1 MB.
+ * @return 0 if successful, -1 if the writer thread or the queue couldn't be created.
+ */
+int log_set_async(int enable, size_t buffer_size);
+
+/**
+ * Waits until every line queued so far is written. Does nothing when the async backend is off.
+ */
+void log_flush(void);
+
+void log_get_async_stats(SF_LOG_ASYNC_STATS *stats);
+
 SF_LOG_LEVEL log_from_str_to_level(const char *level_in_str);
 
 #if defined(__cplusplus)
@@ -22,6 +22,18 @@ typedef CONDITION_VARIABLE SF_CONDITION_HANDLE;
 typedef CRITICAL_SECTION SF_CRITICAL_SECTION_HANDLE;
 typedef SRWLOCK SF_RWLOCK_HANDLE;
 typedef HANDLE SF_MUTEX_HANDLE;
+typedef volatile LONG SF_ATOMIC_INT32;
+typedef volatile LONG64 SF_ATOMIC_INT64;
+
+// Atomic reads see every write made before the matching atomic store
+#define _atomic_load(p) InterlockedCompareExchange((p), 0, 0)
+#define _atomic_store(p, v) InterlockedExchange((p), (v))
+// Counters only, these don't order other memory accesses. _atomic_add64 returns the previous value
+#define _atomic_load64(p) InterlockedCompareExchange64((p), 0, 0)
+#define _atomic_add64(p, v) InterlockedExchangeAdd64((p), (v))
+// Same as _atomic_load and _atomic_store for pointers
+#define _atomic_load_ptr(p) InterlockedCompareExchangePointer((PVOID volatile *) (p), NULL, NULL)
+#define _atomic_store_ptr(p, v) InterlockedExchangePointer((PVOID volatile *) (p), (v))
 
 #define PATH_SEP '\\'
 
@@ -38,6 +50,18 @@ typedef pthread_cond_t SF_CONDITION_HANDLE;
 typedef pthread_mutex_t SF_CRITICAL_SECTION_HANDLE;
 typedef pthread_rwlock_t SF_RWLOCK_HANDLE;
 typedef pthread_mutex_t SF_MUTEX_HANDLE;
+typedef volatile int SF_ATOMIC_INT32;
+typedef volatile long long SF_ATOMIC_INT64;
+
+// Atomic reads see every write made before the matching atomic store
+#define _atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+// Counters only, these don't order other memory accesses. _atomic_add64 returns the previous value
+#define _atomic_load64(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define _atomic_add64(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+// Same as _atomic_load and _atomic_store for pointers
+#define _atomic_load_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _atomic_store_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
 
 #define PATH_SEP '/'
 
@@ -74,6 +98,12 @@ int STDCALL _cond_signal(SF_CONDITION_HANDLE *cond);
 int STDCALL
 _cond_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *lock);
 
+/**
+ * Same as _cond_wait, but gives up after timeout_ms milliseconds. Returns 0 when woken up before that.
+ */
+int STDCALL
+_cond_timed_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *lock, unsigned int timeout_ms);
+
 int STDCALL _cond_term(SF_CONDITION_HANDLE *cond);
 
 int STDCALL _critical_section_init(SF_CRITICAL_SECTION_HANDLE *lock);
@@ -120,6 +150,17 @@ int STDCALL sf_delete_directory_if_exists(const char * directoryName);
 
 void STDCALL sf_get_tmp_dir(char * tmpDir);
 
+/**
+ * Returns a monotonic timestamp in milliseconds, only meaningful when
+ * compared with other values returned by this function.
+ */
+unsigned long long STDCALL sf_get_monotonic_time_millis(void);
+
+/**
+ * Suspends the calling thread for the given number of milliseconds.
+ */
+void STDCALL sf_sleep_ms(unsigned int ms);
+
 #ifdef __cplusplus
 }
 #endif
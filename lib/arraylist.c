@@ -6,7 +6,7 @@
 #include "memory.h"
 
 ARRAY_LIST* STDCALL sf_array_list_init() {
-    ARRAY_LIST *al = (ARRAY_LIST *) calloc(1, sizeof(ARRAY_LIST));
+    ARRAY_LIST *al = (ARRAY_LIST *) SF_CALLOC(1, sizeof(ARRAY_LIST));
     // No spots are used yet
     al->used = 0;
     // Always initialize to 8
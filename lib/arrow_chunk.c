@@ -0,0 +1,941 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arrow_chunk.h"
+#include "memory.h"
+#include <snowflake/logger.h>
+
+// Message header and type union members, see Message.fbs and Schema.fbs in the Arrow format specification
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_DECIMAL 7
+#define ARROW_TYPE_DATE 8
+#define ARROW_TYPE_STRUCT 13
+
+#define ARROW_CONTINUATION 0xFFFFFFFFU
+#define ARROW_MAX_CHILDREN 3
+#define ARROW_MAX_SCALE 38
+// Enough for a 128 bit integer with a sign, a decimal point and leading zeros for the largest scale
+#define ARROW_TEXT_SIZE 128
+
+/**
+ * A flatbuffers table inside of a message's metadata
+ */
+typedef struct ARROW_TABLE {
+    const unsigned char *buf;
+    size_t len;
+    size_t pos;
+    size_t vtable;
+    size_t vtable_size;
+} ARROW_TABLE;
+
+/**
+ * Type of a column, or of one member of a struct column
+ */
+typedef struct ARROW_TYPE_INFO {
+    uint8 type;
+    // Bits per value for fixed width types
+    int32 bit_width;
+    sf_bool is_signed;
+    int64 scale;
+} ARROW_TYPE_INFO;
+
+/**
+ * A column of the schema. Snowflake only sends struct columns for timestamps, their members are found by name.
+ */
+typedef struct ARROW_FIELD {
+    ARROW_TYPE_INFO info;
+    int child_count;
+    ARROW_TYPE_INFO children[ARROW_MAX_CHILDREN];
+    int epoch_child;
+    int fraction_child;
+    int timezone_child;
+} ARROW_FIELD;
+
+/**
+ * Buffers of one column (or struct member) in a record batch body
+ */
+typedef struct ARROW_ARRAY {
+    int64 length;
+    // NULL if no value is null
+    const unsigned char *validity;
+    // Fixed width values, or the offsets into data for utf8 and binary
+    const unsigned char *values;
+    const unsigned char *data;
+    size_t data_len;
+} ARROW_ARRAY;
+
+typedef struct ARROW_COLUMN {
+    ARROW_ARRAY array;
+    ARROW_ARRAY children[ARROW_MAX_CHILDREN];
+} ARROW_COLUMN;
+
+/**
+ * A record batch message found in the stream
+ */
+typedef struct ARROW_BATCH {
+    ARROW_TABLE header;
+    const unsigned char *body;
+    size_t body_len;
+    int64 length;
+} ARROW_BATCH;
+
+/**
+ * Walks the nodes and buffers of a record batch in the order the columns are laid out
+ */
+typedef struct ARROW_BATCH_READER {
+    const ARROW_BATCH *batch;
+    size_t nodes;
+    size_t node_count;
+    size_t next_node;
+    size_t buffers;
+    size_t buffer_count;
+    size_t next_buffer;
+} ARROW_BATCH_READER;
+
+static uint32 read_u16(const unsigned char *p) {
+    return (uint32) p[0] | ((uint32) p[1] << 8);
+}
+
+static uint32 read_u32(const unsigned char *p) {
+    return (uint32) p[0] | ((uint32) p[1] << 8) | ((uint32) p[2] << 16) | ((uint32) p[3] << 24);
+}
+
+static uint64 read_u64(const unsigned char *p) {
+    return (uint64) read_u32(p) | ((uint64) read_u32(p + 4) << 32);
+}
+
+static sf_bool table_init(ARROW_TABLE *table, const unsigned char *buf, size_t len, size_t pos) {
+    int64 vtable;
+    if (pos >= len || len - pos < 4) {
+        return SF_BOOLEAN_FALSE;
+    }
+    // The table starts with the signed distance back to its vtable
+    vtable = (int64) pos - (int64) (int32) read_u32(&buf[pos]);
+    if (vtable < 0 || (uint64) vtable >= len || len - (size_t) vtable < 4) {
+        return SF_BOOLEAN_FALSE;
+    }
+    table->buf = buf;
+    table->len = len;
+    table->pos = pos;
+    table->vtable = (size_t) vtable;
+    table->vtable_size = read_u16(&buf[vtable]);
+    return table->vtable_size >= 4 && table->vtable_size <= len - table->vtable;
+}
+
+// Returns the position of a field that is size bytes long, or 0 if the field is not set
+static size_t table_field(const ARROW_TABLE *table, int id, size_t size) {
+    size_t entry = 4 + 2 * (size_t) id;
+    size_t offset;
+    if (entry + 2 > table->vtable_size) {
+        return 0;
+    }
+    offset = read_u16(&table->buf[table->vtable + entry]);
+    if (offset == 0 || offset > table->len - table->pos || table->len - table->pos - offset < size) {
+        return 0;
+    }
+    return table->pos + offset;
+}
+
+static int64 table_int(const ARROW_TABLE *table, int id, size_t size, int64 default_value) {
+    size_t field = table_field(table, id, size);
+    if (!field) {
+        return default_value;
+    }
+    switch (size) {
+        case 1:
+            return table->buf[field];
+        case 2:
+            return (short) read_u16(&table->buf[field]);
+        case 4:
+            return (int32) read_u32(&table->buf[field]);
+        default:
+            return (int64) read_u64(&table->buf[field]);
+    }
+}
+
+// Follows an offset field to the object it points to. Returns 0 if the field is not set.
+static size_t table_ref(const ARROW_TABLE *table, int id) {
+    size_t field = table_field(table, id, 4);
+    size_t target;
+    if (!field) {
+        return 0;
+    }
+    target = field + read_u32(&table->buf[field]);
+    return target < table->len ? target : 0;
+}
+
+static sf_bool table_child(const ARROW_TABLE *table, int id, ARROW_TABLE *child) {
+    size_t target = table_ref(table, id);
+    return target && table_init(child, table->buf, table->len, target);
+}
+
+// Finds a vector of elem_size byte elements. A missing vector is empty.
+static sf_bool table_vector(const ARROW_TABLE *table, int id, size_t elem_size, size_t *start, size_t *count) {
+    size_t target = table_ref(table, id);
+    *start = 0;
+    *count = 0;
+    if (!target) {
+        return SF_BOOLEAN_TRUE;
+    }
+    if (table->len - target < 4) {
+        return SF_BOOLEAN_FALSE;
+    }
+    *count = read_u32(&table->buf[target]);
+    *start = target + 4;
+    return *count <= (table->len - *start) / elem_size;
+}
+
+static sf_bool vector_table(const ARROW_TABLE *table, size_t start, size_t i, ARROW_TABLE *element) {
+    size_t pos = start + 4 * i;
+    size_t target = pos + read_u32(&table->buf[pos]);
+    return target < table->len && table_init(element, table->buf, table->len, target);
+}
+
+// Copies a string field into buf, truncating it if needed. A missing string is empty.
+static void table_string(const ARROW_TABLE *table, int id, char *buf, size_t buf_size) {
+    size_t start;
+    size_t count;
+    if (!table_vector(table, id, 1, &start, &count)) {
+        count = 0;
+    }
+    if (count >= buf_size) {
+        count = buf_size - 1;
+    }
+    if (count > 0) {
+        memcpy(buf, &table->buf[start], count);
+    }
+    buf[count] = '\0';
+}
+
+static sf_bool parse_type(const ARROW_TABLE *field, ARROW_TYPE_INFO *info) {
+    ARROW_TABLE type;
+    sf_bool has_type = table_child(field, 3, &type);
+    int64 precision;
+    info->type = (uint8) table_int(field, 2, 1, 0);
+    info->bit_width = 0;
+    info->is_signed = SF_BOOLEAN_TRUE;
+    switch (info->type) {
+        case ARROW_TYPE_INT:
+            if (!has_type) {
+                return SF_BOOLEAN_FALSE;
+            }
+            info->bit_width = (int32) table_int(&type, 0, 4, 0);
+            info->is_signed = table_int(&type, 1, 1, 0) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+            return info->bit_width == 8 || info->bit_width == 16 || info->bit_width == 32 || info->bit_width == 64;
+        case ARROW_TYPE_FLOATING_POINT:
+            // HALF = 0, SINGLE = 1, DOUBLE = 2
+            precision = has_type ? table_int(&type, 0, 2, 0) : 0;
+            info->bit_width = precision == 2 ? 64 : precision == 1 ? 32 : 0;
+            return info->bit_width != 0;
+        case ARROW_TYPE_DECIMAL:
+            if (!has_type) {
+                return SF_BOOLEAN_FALSE;
+            }
+            info->scale = table_int(&type, 1, 4, 0);
+            info->bit_width = (int32) table_int(&type, 2, 4, 128);
+            return info->bit_width == 64 || info->bit_width == 128;
+        case ARROW_TYPE_DATE:
+            // DAY = 0 is 32 bits, MILLISECOND = 1 (the default) is 64 bits
+            info->bit_width = has_type && table_int(&type, 0, 2, 1) == 0 ? 32 : 64;
+            return SF_BOOLEAN_TRUE;
+        case ARROW_TYPE_BINARY:
+        case ARROW_TYPE_UTF8:
+        case ARROW_TYPE_BOOL:
+        case ARROW_TYPE_STRUCT:
+            return SF_BOOLEAN_TRUE;
+        default:
+            return SF_BOOLEAN_FALSE;
+    }
+}
+
+// Reads a Field table. Snowflake describes the column in the custom metadata, of which only the scale is needed.
+static sf_bool parse_field(const ARROW_TABLE *table, ARROW_TYPE_INFO *info) {
+    ARROW_TABLE key_value;
+    size_t start;
+    size_t count;
+    size_t i;
+    char key[32];
+    char value[32];
+
+    if (table_ref(table, 4)) {
+        log_error("Dictionary encoded Arrow columns are not supported");
+        return SF_BOOLEAN_FALSE;
+    }
+    info->scale = 0;
+    if (!parse_type(table, info)) {
+        log_error("Unsupported Arrow column type %d", (int) info->type);
+        return SF_BOOLEAN_FALSE;
+    }
+    if (!table_vector(table, 6, 4, &start, &count)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    for (i = 0; i < count; i++) {
+        if (!vector_table(table, start, i, &key_value)) {
+            return SF_BOOLEAN_FALSE;
+        }
+        table_string(&key_value, 0, key, sizeof(key));
+        if (strcmp(key, "scale") == 0) {
+            table_string(&key_value, 1, value, sizeof(value));
+            info->scale = strtoll(value, NULL, 10);
+        }
+    }
+    return info->scale >= 0 && info->scale <= ARROW_MAX_SCALE;
+}
+
+static sf_bool parse_schema(const ARROW_TABLE *schema, int64 column_count, ARROW_FIELD **fields_out,
+                            int64 *field_count_out) {
+    ARROW_TABLE field;
+    ARROW_TABLE child;
+    ARROW_FIELD *fields = NULL;
+    ARROW_FIELD *column;
+    size_t start;
+    size_t count;
+    size_t child_start;
+    size_t child_count;
+    size_t i;
+    size_t j;
+    char name[16];
+
+    // Endianness: Little = 0, Big = 1
+    if (table_int(schema, 0, 2, 0) != 0 || !table_vector(schema, 1, 4, &start, &count) ||
+        (column_count > 0 && (int64) count != column_count) || count == 0) {
+        return SF_BOOLEAN_FALSE;
+    }
+    fields = (ARROW_FIELD *) SF_CALLOC(count, sizeof(ARROW_FIELD));
+    if (!fields) {
+        return SF_BOOLEAN_FALSE;
+    }
+    for (i = 0; i < count; i++) {
+        column = &fields[i];
+        column->epoch_child = -1;
+        column->fraction_child = -1;
+        column->timezone_child = -1;
+        if (!vector_table(schema, start, i, &field) || !parse_field(&field, &column->info) ||
+            !table_vector(&field, 5, 4, &child_start, &child_count)) {
+            goto error;
+        }
+        if (column->info.type != ARROW_TYPE_STRUCT) {
+            continue;
+        }
+        if (child_count > ARROW_MAX_CHILDREN) {
+            goto error;
+        }
+        column->child_count = (int) child_count;
+        for (j = 0; j < child_count; j++) {
+            if (!vector_table(&field, child_start, j, &child) || !parse_field(&child, &column->children[j]) ||
+                (column->children[j].type != ARROW_TYPE_INT && column->children[j].type != ARROW_TYPE_DATE)) {
+                goto error;
+            }
+            table_string(&child, 0, name, sizeof(name));
+            if (strcmp(name, "epoch") == 0) {
+                column->epoch_child = (int) j;
+            } else if (strcmp(name, "fraction") == 0) {
+                column->fraction_child = (int) j;
+            } else if (strcmp(name, "timezone") == 0) {
+                column->timezone_child = (int) j;
+            }
+        }
+        // The epoch carries the column's scale
+        if (column->epoch_child < 0) {
+            goto error;
+        }
+        column->children[column->epoch_child].scale = column->info.scale;
+    }
+    *fields_out = fields;
+    *field_count_out = (int64) count;
+    return SF_BOOLEAN_TRUE;
+
+error:
+    SF_FREE(fields);
+    return SF_BOOLEAN_FALSE;
+}
+
+static sf_bool next_buffer(ARROW_BATCH_READER *reader, const unsigned char **buffer, size_t *buffer_len) {
+    const unsigned char *entry;
+    int64 offset;
+    int64 length;
+    if (reader->next_buffer >= reader->buffer_count) {
+        return SF_BOOLEAN_FALSE;
+    }
+    // struct Buffer { offset: long; length: long; }
+    entry = &reader->batch->header.buf[reader->buffers + 16 * reader->next_buffer++];
+    offset = (int64) read_u64(entry);
+    length = (int64) read_u64(entry + 8);
+    if (offset < 0 || length < 0 || (uint64) offset > reader->batch->body_len ||
+        (uint64) length > reader->batch->body_len - (size_t) offset) {
+        return SF_BOOLEAN_FALSE;
+    }
+    *buffer = length > 0 ? reader->batch->body + offset : NULL;
+    *buffer_len = (size_t) length;
+    return SF_BOOLEAN_TRUE;
+}
+
+static sf_bool read_array(ARROW_BATCH_READER *reader, const ARROW_TYPE_INFO *info, ARROW_ARRAY *array) {
+    const unsigned char *entry;
+    const unsigned char *buffer;
+    size_t buffer_len;
+    size_t length;
+    int64 null_count;
+
+    if (reader->next_node >= reader->node_count) {
+        return SF_BOOLEAN_FALSE;
+    }
+    // struct FieldNode { length: long; null_count: long; }
+    entry = &reader->batch->header.buf[reader->nodes + 16 * reader->next_node++];
+    array->length = (int64) read_u64(entry);
+    null_count = (int64) read_u64(entry + 8);
+    if (array->length != reader->batch->length) {
+        return SF_BOOLEAN_FALSE;
+    }
+    length = (size_t) array->length;
+
+    if (!next_buffer(reader, &buffer, &buffer_len)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    array->validity = NULL;
+    if (null_count > 0) {
+        if (buffer_len < (length + 7) / 8) {
+            return SF_BOOLEAN_FALSE;
+        }
+        array->validity = buffer;
+    }
+
+    array->values = NULL;
+    array->data = NULL;
+    array->data_len = 0;
+    switch (info->type) {
+        case ARROW_TYPE_STRUCT:
+            // Only a validity buffer, the members follow as separate arrays
+            return SF_BOOLEAN_TRUE;
+        case ARROW_TYPE_UTF8:
+        case ARROW_TYPE_BINARY:
+            if (!next_buffer(reader, &array->values, &buffer_len) || buffer_len / 4 < length + 1 ||
+                !next_buffer(reader, &array->data, &array->data_len)) {
+                return SF_BOOLEAN_FALSE;
+            }
+            return SF_BOOLEAN_TRUE;
+        case ARROW_TYPE_BOOL:
+            return next_buffer(reader, &array->values, &buffer_len) && buffer_len >= (length + 7) / 8;
+        default:
+            return next_buffer(reader, &array->values, &buffer_len) &&
+                   buffer_len / (size_t) (info->bit_width / 8) >= length;
+    }
+}
+
+static sf_bool is_valid(const ARROW_ARRAY *array, int64 row) {
+    return !array->validity || (array->validity[row / 8] >> (row % 8)) & 1;
+}
+
+// Reads a signed or unsigned integer of any width as int64. Unsigned 64 bit values above SF_INT64_MAX wrap.
+static int64 int_value(const ARROW_ARRAY *array, const ARROW_TYPE_INFO *info, int64 row) {
+    const unsigned char *p = &array->values[(size_t) row * (size_t) (info->bit_width / 8)];
+    switch (info->bit_width) {
+        case 8:
+            return info->is_signed ? (signed char) p[0] : (int64) p[0];
+        case 16:
+            return info->is_signed ? (short) read_u16(p) : (int64) read_u16(p);
+        case 32:
+            return info->is_signed ? (int32) read_u32(p) : (int64) read_u32(p);
+        default:
+            return (int64) read_u64(p);
+    }
+}
+
+// Writes the digits of a 128 bit magnitude backwards, ending right before end. Returns the first digit.
+static char *format_uint128(uint64 hi, uint64 lo, char *end) {
+    uint32 limbs[4];
+    uint64 cur;
+    uint64 rem;
+    int i;
+    limbs[0] = (uint32) (hi >> 32);
+    limbs[1] = (uint32) hi;
+    limbs[2] = (uint32) (lo >> 32);
+    limbs[3] = (uint32) lo;
+    do {
+        rem = 0;
+        for (i = 0; i < 4; i++) {
+            cur = (rem << 32) | limbs[i];
+            limbs[i] = (uint32) (cur / 10);
+            rem = cur % 10;
+        }
+        *--end = (char) ('0' + rem);
+    } while (limbs[0] || limbs[1] || limbs[2] || limbs[3]);
+    return end;
+}
+
+// Writes an integer magnitude with the decimal point scale digits from the right, the same as the JSON result
+// format does, e.g. 5 with scale 2 is 0.05. Returns the length of the text.
+static size_t format_scaled(char *out, sf_bool negative, uint64 hi, uint64 lo, int64 scale) {
+    char digits[ARROW_TEXT_SIZE];
+    char *first = format_uint128(hi, lo, &digits[sizeof(digits)]);
+    size_t count = (size_t) (&digits[sizeof(digits)] - first);
+    char *p = out;
+    if (negative) {
+        *p++ = '-';
+    }
+    if (scale <= 0) {
+        memcpy(p, first, count);
+        p += count;
+    } else if (count > (size_t) scale) {
+        memcpy(p, first, count - (size_t) scale);
+        p += count - (size_t) scale;
+        *p++ = '.';
+        memcpy(p, first + count - (size_t) scale, (size_t) scale);
+        p += scale;
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', (size_t) scale - count);
+        p += (size_t) scale - count;
+        memcpy(p, first, count);
+        p += count;
+    }
+    return (size_t) (p - out);
+}
+
+static size_t format_int64(char *out, int64 value, int64 scale) {
+    uint64 magnitude = value < 0 ? (uint64) 0 - (uint64) value : (uint64) value;
+    return format_scaled(out, value < 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE, 0, magnitude, scale);
+}
+
+static size_t format_decimal128(char *out, const unsigned char *p, int64 scale) {
+    uint64 lo = read_u64(p);
+    uint64 hi = read_u64(p + 8);
+    sf_bool negative = (hi >> 63) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    if (negative) {
+        // Two's complement negation of the 128 bit value
+        lo = ~lo + 1;
+        hi = ~hi + (lo == 0 ? 1 : 0);
+    }
+    return format_scaled(out, negative, hi, lo, scale);
+}
+
+static size_t format_float64(char *out, float64 value) {
+    if (isnan(value)) {
+        return (size_t) sprintf(out, "NaN");
+    }
+    if (isinf(value)) {
+        return (size_t) sprintf(out, value < 0 ? "-inf" : "inf");
+    }
+    // Use the shortest text that converts back to the same value
+    snprintf(out, ARROW_TEXT_SIZE, "%.15g", value);
+    if (strtod(out, NULL) != value) {
+        snprintf(out, ARROW_TEXT_SIZE, "%.17g", value);
+    }
+    return strlen(out);
+}
+
+// Timestamps with a separate fraction are seconds since the epoch plus nanoseconds. The text keeps scale digits of
+// the fraction, e.g. 1.500000 for scale 6.
+static size_t format_epoch_fraction(char *out, int64 epoch, int64 nanos, int64 scale) {
+    sf_bool negative = epoch < 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    uint64 seconds = negative ? (uint64) 0 - (uint64) epoch : (uint64) epoch;
+    int64 i;
+    size_t len;
+    char *p = out;
+    if (nanos < 0 || nanos > 999999999) {
+        nanos = 0;
+    }
+    // The fraction is always positive, so a negative epoch is rounded down
+    if (negative && nanos > 0) {
+        seconds--;
+        nanos = 1000000000 - nanos;
+    }
+    if (negative) {
+        *p++ = '-';
+    }
+    len = format_scaled(p, SF_BOOLEAN_FALSE, 0, seconds, 0);
+    p += len;
+    if (scale > 9) {
+        scale = 9;
+    }
+    if (scale > 0) {
+        for (i = scale; i < 9; i++) {
+            nanos /= 10;
+        }
+        *p++ = '.';
+        for (i = scale - 1; i >= 0; i--) {
+            p[i] = (char) ('0' + nanos % 10);
+            nanos /= 10;
+        }
+        p += scale;
+    }
+    return (size_t) (p - out);
+}
+
+static size_t format_hex(char *out, const unsigned char *data, size_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t i;
+    for (i = 0; i < len; i++) {
+        out[2 * i] = hex[data[i] >> 4];
+        out[2 * i + 1] = hex[data[i] & 0xF];
+    }
+    return 2 * len;
+}
+
+/**
+ * Appends one value to the chunk as text. A variable length value is appended directly from the batch body,
+ * everything else is formatted into text first.
+ */
+static sf_bool append_value(SF_RESULT_CHUNK *chunk, const ARROW_FIELD *field, const ARROW_COLUMN *column,
+                            int64 row) {
+    const ARROW_TYPE_INFO *info = &field->info;
+    const ARROW_ARRAY *array = &column->array;
+    const ARROW_ARRAY *epoch;
+    char text[ARROW_TEXT_SIZE];
+    char *hex;
+    size_t len = 0;
+    uint32 start;
+    uint32 end;
+    float64 float_value;
+    int64 int_val;
+    sf_bool success;
+
+    if (!is_valid(array, row) ||
+        (info->type == ARROW_TYPE_STRUCT && !is_valid(&column->children[field->epoch_child], row))) {
+        return result_chunk_end_value(chunk, SF_BOOLEAN_TRUE);
+    }
+    switch (info->type) {
+        case ARROW_TYPE_UTF8:
+        case ARROW_TYPE_BINARY:
+            start = read_u32(&array->values[4 * (size_t) row]);
+            end = read_u32(&array->values[4 * (size_t) row + 4]);
+            if (start > end || end > array->data_len) {
+                return SF_BOOLEAN_FALSE;
+            }
+            if (info->type == ARROW_TYPE_UTF8) {
+                return result_chunk_append(chunk, (const char *) array->data + start, end - start) &&
+                       result_chunk_end_value(chunk, SF_BOOLEAN_FALSE);
+            }
+            // Binary values are hex encoded in the JSON result format
+            hex = (char *) SF_MALLOC(2 * (size_t) (end - start) + 1);
+            if (!hex) {
+                return SF_BOOLEAN_FALSE;
+            }
+            len = format_hex(hex, array->data + start, end - start);
+            success = result_chunk_append(chunk, hex, len) && result_chunk_end_value(chunk, SF_BOOLEAN_FALSE);
+            SF_FREE(hex);
+            return success;
+        case ARROW_TYPE_BOOL:
+            text[0] = (array->values[row / 8] >> (row % 8)) & 1 ? '1' : '0';
+            len = 1;
+            break;
+        case ARROW_TYPE_FLOATING_POINT:
+            if (info->bit_width == 64) {
+                memcpy(&float_value, &array->values[8 * (size_t) row], sizeof(float_value));
+            } else {
+                float single;
+                memcpy(&single, &array->values[4 * (size_t) row], sizeof(single));
+                float_value = single;
+            }
+            len = format_float64(text, float_value);
+            break;
+        case ARROW_TYPE_DECIMAL:
+            if (info->bit_width == 128) {
+                len = format_decimal128(text, &array->values[16 * (size_t) row], info->scale);
+            } else {
+                len = format_int64(text, (int64) read_u64(&array->values[8 * (size_t) row]), info->scale);
+            }
+            break;
+        case ARROW_TYPE_DATE:
+            // Dates are days since the epoch in the JSON result format
+            if (info->bit_width == 32) {
+                len = format_int64(text, (int32) read_u32(&array->values[4 * (size_t) row]), 0);
+            } else {
+                int_val = (int64) read_u64(&array->values[8 * (size_t) row]);
+                // Round down to whole days, also before the epoch
+                len = format_int64(text, int_val / 86400000 - (int_val % 86400000 < 0 ? 1 : 0), 0);
+            }
+            break;
+        case ARROW_TYPE_STRUCT:
+            epoch = &column->children[field->epoch_child];
+            if (field->fraction_child >= 0) {
+                len = format_epoch_fraction(text, int_value(epoch, &field->children[field->epoch_child], row),
+                                            int_value(&column->children[field->fraction_child],
+                                                      &field->children[field->fraction_child], row),
+                                            info->scale);
+            } else {
+                len = format_int64(text, int_value(epoch, &field->children[field->epoch_child], row), info->scale);
+            }
+            // TIMESTAMP_TZ values are followed by the time zone offset
+            if (field->timezone_child >= 0) {
+                len += (size_t) snprintf(&text[len], sizeof(text) - len, " %lld",
+                                         (long long) int_value(&column->children[field->timezone_child],
+                                                               &field->children[field->timezone_child], row));
+            }
+            break;
+        default:
+            len = format_int64(text, int_value(array, info, row), info->scale);
+            break;
+    }
+    return result_chunk_append(chunk, text, len) && result_chunk_end_value(chunk, SF_BOOLEAN_FALSE);
+}
+
+/**
+ * Stores the native value of a column that is decoded. Types that map directly are taken from the batch body,
+ * anything else is converted from the text that was just appended.
+ */
+static void decode_value(SF_RESULT_CHUNK *chunk, int64 index, const ARROW_FIELD *field, const ARROW_COLUMN *column,
+                         int64 row, int64 chunk_row) {
+    static const float64 powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+                                            1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    SF_CHUNK_COLUMN *col = &chunk->columns[index];
+    const ARROW_TYPE_INFO *info = &field->info;
+    SF_CHUNK_DECODED_VALUE value;
+    SF_STATUS status = SF_STATUS_SUCCESS;
+    sf_bool is_int = info->type == ARROW_TYPE_INT && (info->is_signed || info->bit_width < 64);
+    int64 int_val;
+
+    if (col->nulls[chunk_row]) {
+        return;
+    }
+    if (col->decoded_type == SF_C_TYPE_INT64 && is_int && info->scale == 0) {
+        value.int_value = int_value(&column->array, info, row);
+    } else if (col->decoded_type == SF_C_TYPE_FLOAT64 && info->type == ARROW_TYPE_FLOATING_POINT &&
+               info->bit_width == 64) {
+        memcpy(&value.float_value, &column->array.values[8 * (size_t) row], sizeof(value.float_value));
+        if (isinf(value.float_value)) {
+            status = SF_STATUS_ERROR_OUT_OF_RANGE;
+        }
+    } else if (col->decoded_type == SF_C_TYPE_FLOAT64 && is_int &&
+               info->scale < (int64) (sizeof(powers_of_ten) / sizeof(powers_of_ten[0])) &&
+               (int_val = int_value(&column->array, info, row)) <= ((int64) 1 << 53) &&
+               int_val >= -((int64) 1 << 53)) {
+        // Both operands are exact, so the division is rounded the same way parsing the text would be
+        value.float_value = (float64) int_val / powers_of_ten[info->scale];
+    } else if (col->decoded_type == SF_C_TYPE_BOOLEAN && info->type == ARROW_TYPE_BOOL) {
+        value.bool_value = (column->array.values[row / 8] >> (row % 8)) & 1 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    } else {
+        status = result_chunk_decode_value(&col->arena[col->offsets[chunk_row]], col->decoded_type, &value);
+    }
+
+    if (col->decoded_type == SF_C_TYPE_INT64) {
+        ((int64 *) col->decoded)[chunk_row] = value.int_value;
+    } else if (col->decoded_type == SF_C_TYPE_FLOAT64) {
+        ((float64 *) col->decoded)[chunk_row] = value.float_value;
+    } else {
+        ((sf_bool *) col->decoded)[chunk_row] = value.bool_value;
+    }
+    col->decode_status[chunk_row] = status;
+}
+
+static sf_bool append_batch(SF_RESULT_CHUNK *chunk, const ARROW_FIELD *fields, ARROW_COLUMN *columns,
+                            const ARROW_BATCH *batch) {
+    ARROW_BATCH_READER reader;
+    int64 i;
+    int64 row;
+    int j;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.batch = batch;
+    if (!table_vector(&batch->header, 1, 16, &reader.nodes, &reader.node_count) ||
+        !table_vector(&batch->header, 2, 16, &reader.buffers, &reader.buffer_count)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    // Columns are laid out depth first, a struct column is followed by its members
+    for (i = 0; i < chunk->column_count; i++) {
+        if (!read_array(&reader, &fields[i].info, &columns[i].array)) {
+            return SF_BOOLEAN_FALSE;
+        }
+        for (j = 0; j < fields[i].child_count; j++) {
+            if (!read_array(&reader, &fields[i].children[j], &columns[i].children[j])) {
+                return SF_BOOLEAN_FALSE;
+            }
+        }
+    }
+
+    for (row = 0; row < batch->length; row++) {
+        for (i = 0; i < chunk->column_count; i++) {
+            if (!append_value(chunk, &fields[i], &columns[i], row)) {
+                return SF_BOOLEAN_FALSE;
+            }
+            if (chunk->columns[i].decoded) {
+                decode_value(chunk, i, &fields[i], &columns[i], row, chunk->row_count);
+            }
+        }
+        if (!result_chunk_end_row(chunk)) {
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+SF_RESULT_CHUNK *STDCALL arrow_chunk_parse(const char *data, size_t len, int64 column_count,
+                                           const SF_C_TYPE *column_types) {
+    const unsigned char *buf = (const unsigned char *) data;
+    SF_RESULT_CHUNK *chunk = NULL;
+    ARROW_FIELD *fields = NULL;
+    ARROW_COLUMN *columns = NULL;
+    ARROW_BATCH *batches = NULL;
+    ARROW_BATCH *grown;
+    ARROW_TABLE message;
+    ARROW_TABLE header;
+    size_t batch_count = 0;
+    size_t batch_cap = 0;
+    size_t pos = 0;
+    size_t i;
+    uint32 size;
+    int64 body_len;
+    int64 header_type;
+    int64 field_count = 0;
+    int64 row_count = 0;
+
+    // Each message is a continuation marker, the metadata size, the flatbuffers metadata and the message body.
+    // A zero size marks the end of the stream.
+    while (len - pos >= 4) {
+        size = read_u32(&buf[pos]);
+        pos += 4;
+        if (size == ARROW_CONTINUATION) {
+            if (len - pos < 4) {
+                goto error;
+            }
+            size = read_u32(&buf[pos]);
+            pos += 4;
+        }
+        if (size == 0) {
+            break;
+        }
+        if (size > len - pos || size < 4 ||
+            !table_init(&message, &buf[pos], size, read_u32(&buf[pos]))) {
+            goto error;
+        }
+        pos += size;
+        header_type = table_int(&message, 1, 1, 0);
+        body_len = table_int(&message, 3, 8, 0);
+        if (body_len < 0 || (uint64) body_len > len - pos || !table_child(&message, 2, &header)) {
+            goto error;
+        }
+
+        if (header_type == ARROW_HEADER_SCHEMA) {
+            if (fields || !parse_schema(&header, column_count, &fields, &field_count)) {
+                goto error;
+            }
+        } else if (header_type == ARROW_HEADER_RECORD_BATCH) {
+            // Compressed bodies are not supported
+            if (!fields || table_ref(&header, 3)) {
+                goto error;
+            }
+            if (batch_count == batch_cap) {
+                batch_cap = batch_cap ? batch_cap * 2 : 4;
+                grown = (ARROW_BATCH *) SF_REALLOC(batches, batch_cap * sizeof(ARROW_BATCH));
+                if (!grown) {
+                    goto error;
+                }
+                batches = grown;
+            }
+            batches[batch_count].header = header;
+            batches[batch_count].body = &buf[pos];
+            batches[batch_count].body_len = (size_t) body_len;
+            batches[batch_count].length = table_int(&header, 0, 8, 0);
+            if (batches[batch_count].length < 0) {
+                goto error;
+            }
+            row_count += batches[batch_count].length;
+            batch_count++;
+        } else {
+            log_error("Unsupported Arrow message type %d", (int) header_type);
+            goto error;
+        }
+        pos += (size_t) body_len;
+    }
+    if (!fields) {
+        goto error;
+    }
+
+    // Size the arenas for the whole stream, text is rarely much larger than the binary values
+    chunk = result_chunk_init(field_count, row_count, len);
+    columns = (ARROW_COLUMN *) SF_CALLOC((size_t) field_count, sizeof(ARROW_COLUMN));
+    if (!chunk || !columns) {
+        goto error;
+    }
+    for (i = 0; column_types && i < (size_t) field_count; i++) {
+        if ((column_types[i] == SF_C_TYPE_INT64 || column_types[i] == SF_C_TYPE_FLOAT64 ||
+             column_types[i] == SF_C_TYPE_BOOLEAN) &&
+            !result_chunk_alloc_decoded(chunk, (int64) i, column_types[i])) {
+            goto error;
+        }
+    }
+    for (i = 0; i < batch_count; i++) {
+        if (!append_batch(chunk, fields, columns, &batches[i])) {
+            goto error;
+        }
+    }
+
+    SF_FREE(fields);
+    SF_FREE(columns);
+    SF_FREE(batches);
+    return chunk;
+
+error:
+    log_error("Invalid Arrow result chunk");
+    result_chunk_term(chunk);
+    SF_FREE(fields);
+    SF_FREE(columns);
+    SF_FREE(batches);
+    return NULL;
+}
+
+static int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    } else if (c == '+') {
+        return 62;
+    } else if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+SF_RESULT_CHUNK *STDCALL arrow_chunk_from_base64(const char *rowset_base64, int64 column_count,
+                                                 const SF_C_TYPE *column_types) {
+    size_t text_len = strlen(rowset_base64);
+    char *data;
+    size_t len = 0;
+    uint32 bits = 0;
+    int bit_count = 0;
+    int value;
+    size_t i;
+    SF_RESULT_CHUNK *chunk;
+
+    if (text_len == 0) {
+        return result_chunk_init(column_count, 0, 0);
+    }
+    data = (char *) SF_MALLOC(text_len / 4 * 3 + 3);
+    if (!data) {
+        return NULL;
+    }
+    for (i = 0; i < text_len && rowset_base64[i] != '='; i++) {
+        if ((value = base64_value(rowset_base64[i])) < 0) {
+            // Line breaks may be inserted by the encoder
+            if (rowset_base64[i] == '\n' || rowset_base64[i] == '\r') {
+                continue;
+            }
+            SF_FREE(data);
+            return NULL;
+        }
+        bits = (bits << 6) | (uint32) value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            data[len++] = (char) ((bits >> bit_count) & 0xFF);
+        }
+    }
+    chunk = arrow_chunk_parse(data, len, column_count, column_types);
+    SF_FREE(data);
+    return chunk;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_ARROW_CHUNK_H
+#define SNOWFLAKE_ARROW_CHUNK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <snowflake/basic_types.h>
+#include <snowflake/client.h>
+#include "result_chunk.h"
+
+/**
+ * Converts an Arrow IPC stream (a schema message followed by record batches) into a result chunk.
+ *
+ * Every value is also stored as the same text the JSON result format would have, so all snowflake_column_as_*
+ * functions keep working. int64, float64 and boolean columns are decoded straight from the binary values.
+ *
+ * Only what Snowflake sends is supported: integer, decimal, floating point, boolean, date, utf8 and binary
+ * columns, and the struct columns used for timestamps. Dictionaries and body compression are not supported.
+ *
+ * @param data Arrow IPC stream.
+ * @param len Length of the stream in bytes.
+ * @param column_count Expected number of columns. If not positive, the number of fields in the schema is used.
+ * @param column_types C type of every column, used to decode int64, float64 and boolean columns. Can be NULL.
+ * @return The new chunk or NULL if the stream is malformed, uses an unsupported type or we are out of memory.
+ */
+SF_RESULT_CHUNK *STDCALL arrow_chunk_parse(const char *data, size_t len, int64 column_count,
+                                           const SF_C_TYPE *column_types);
+
+/**
+ * Converts the base64 encoded Arrow IPC stream Snowflake sends as the first rowset into a result chunk.
+ *
+ * @param rowset_base64 Base64 text. An empty string is a rowset without rows.
+ * @param column_count Number of columns.
+ * @param column_types C type of every column. Can be NULL.
+ * @return The new chunk or NULL if the rowset is malformed.
+ */
+SF_RESULT_CHUNK *STDCALL arrow_chunk_from_base64(const char *rowset_base64, int64 column_count,
+                                                 const SF_C_TYPE *column_types);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_ARROW_CHUNK_H
@@ -9,10 +9,26 @@
 #include "connection.h"
 #include "error.h"
 #include "client_int.h"
+#include <snowflake/logger.h>
 
 static void* chunk_downloader_thread(void *downloader);
+static void* chunk_multi_download_thread(void *downloader);
+static void* chunk_parser_thread(void *downloader);
 static void STDCALL set_shutdown(SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool value);
 static void STDCALL set_error(SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool value);
+static void STDCALL set_download_error(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_ERROR_STRUCT *err);
+static void STDCALL update_prefetch_limit(SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool consumer_waited);
+static sf_bool STDCALL start_threads(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 thread_count);
+static void STDCALL join_threads(SF_CHUNK_DOWNLOADER *chunk_downloader);
+
+// Longest time the multi download thread waits for network activity before checking for new chunks to download
+#define MULTI_DOWNLOAD_WAIT_TIMEOUT_MS 50
+// Downloads of a chunk that may fail with a network error before the result fails
+#define CHUNK_DOWNLOAD_ATTEMPTS 3
+// A chunk the consumer waits for is downloaded a second time once it takes this many times the average download
+// time, but not sooner than the minimum
+#define CHUNK_HEDGE_DELAY_FACTOR 4
+#define CHUNK_HEDGE_MIN_DELAY_MS 200
 
 #define PTHREAD_LOCK_INIT_ERROR_MSG(e, em) \
 switch(e) \
@@ -44,39 +60,395 @@ switch(e) \
 }
 
 sf_bool STDCALL get_shutdown_or_error(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
-    sf_bool ret;
-    _rwlock_rdlock(&chunk_downloader->attr_lock);
-    ret = chunk_downloader->is_shutdown || chunk_downloader->has_error;
-    _rwlock_rdunlock(&chunk_downloader->attr_lock);
-    return ret;
+    return _atomic_load(&chunk_downloader->is_shutdown) || _atomic_load(&chunk_downloader->has_error) ?
+           SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
 }
 
 sf_bool STDCALL get_shutdown(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
-    sf_bool ret;
-    _rwlock_rdlock(&chunk_downloader->attr_lock);
-    ret = chunk_downloader->is_shutdown;
-    _rwlock_rdunlock(&chunk_downloader->attr_lock);
-    return ret;
+    return _atomic_load(&chunk_downloader->is_shutdown) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
 }
 
 static void STDCALL set_shutdown(struct SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool value) {
-    _rwlock_wrlock(&chunk_downloader->attr_lock);
-    chunk_downloader->is_shutdown = value;
-    _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    _atomic_store(&chunk_downloader->is_shutdown, value);
 }
 
 sf_bool STDCALL get_error(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
-    sf_bool ret;
-    _rwlock_rdlock(&chunk_downloader->attr_lock);
-    ret = chunk_downloader->has_error;
-    _rwlock_rdunlock(&chunk_downloader->attr_lock);
-    return ret;
+    return _atomic_load(&chunk_downloader->has_error) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
 }
 
 static void STDCALL set_error(struct SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool value) {
-    _rwlock_wrlock(&chunk_downloader->attr_lock);
-    chunk_downloader->has_error = value;
-    _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    _atomic_store(&chunk_downloader->has_error, value);
+}
+
+/**
+ * Exponentially weighted moving average of chunk timings. Samples are at least
+ * 1ms so that an average of 0 always means that no sample has been seen yet.
+ */
+static uint64 update_average(uint64 average, uint64 sample) {
+    if (sample == 0) {
+        sample = 1;
+    }
+    if (average == 0) {
+        return sample;
+    }
+    return (average * 3 + sample) / 4;
+}
+
+/**
+ * Recomputes the number of chunks allowed ahead of the consumer when adaptive prefetch is enabled.
+ * While one chunk is being downloaded the consumer drains avg_download_time / avg_consume_time chunks,
+ * so that many chunks plus one ready chunk must be in flight for the consumer never to wait.
+ * Must be called with queue_lock held.
+ */
+static void STDCALL update_prefetch_limit(SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool consumer_waited) {
+    uint64 target;
+    if (!chunk_downloader->adaptive_prefetch) {
+        return;
+    }
+
+    target = chunk_downloader->prefetch_limit;
+    if (chunk_downloader->avg_download_time && chunk_downloader->avg_consume_time) {
+        target = (chunk_downloader->avg_download_time + chunk_downloader->avg_consume_time - 1) /
+                 chunk_downloader->avg_consume_time + 1;
+    }
+    // The consumer had to wait, so whatever the averages say we are behind
+    if (consumer_waited && target <= chunk_downloader->prefetch_limit) {
+        target = chunk_downloader->prefetch_limit + 1;
+    }
+    if (target < 1) {
+        target = 1;
+    } else if (target > chunk_downloader->prefetch_slots) {
+        target = chunk_downloader->prefetch_slots;
+    }
+
+    if (target != chunk_downloader->prefetch_limit) {
+        log_debug("Adjusting chunk prefetch limit from %llu to %llu (download %llums, consume %llums)",
+                  chunk_downloader->prefetch_limit, target,
+                  chunk_downloader->avg_download_time, chunk_downloader->avg_consume_time);
+    }
+    if (target > chunk_downloader->prefetch_limit) {
+        chunk_downloader->prefetch_limit = target;
+        _cond_broadcast(&chunk_downloader->producer_cond);
+    } else {
+        chunk_downloader->prefetch_limit = target;
+    }
+}
+
+/**
+ * Estimates the memory of a chunk from its metadata. The values take up at most as much as the chunk text, plus the
+ * offset, length and null flag of every value and their decoded copies. The estimate is 0 if the server did not
+ * send the size of the chunk.
+ */
+static uint64 estimate_chunk_memory(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_QUEUE_ITEM *item) {
+    uint64 value_size = 2 * sizeof(size_t) + sizeof(sf_bool);
+    // The size of a spilled chunk is known exactly
+    uint64 text_size = item->spill ? (uint64) item->spill->size :
+                       item->uncompressed_size > 0 ? (uint64) item->uncompressed_size : 0;
+    if (text_size == 0) {
+        return 0;
+    }
+    if (chunk_downloader->decode_types) {
+        value_size += sizeof(SF_CHUNK_DECODED_VALUE) + sizeof(SF_STATUS);
+    }
+    return text_size +
+           (uint64) (item->row_count > 0 ? item->row_count : 0) * (uint64) chunk_downloader->column_count * value_size;
+}
+
+/**
+ * Sets the memory a chunk counts for and tracks the peak. Must be called with queue_lock held.
+ */
+static void STDCALL set_chunk_memory(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_QUEUE_ITEM *item, uint64 size) {
+    chunk_downloader->memory_used = chunk_downloader->memory_used - item->memory_size + size;
+    item->memory_size = size;
+    if (chunk_downloader->memory_used > chunk_downloader->memory_peak) {
+        chunk_downloader->memory_peak = chunk_downloader->memory_used;
+    }
+}
+
+/**
+ * Whether the next chunk may be started: it has to be within the prefetch limit and fit into the memory limit. With
+ * no chunk ahead of the consumer the next chunk is always allowed, even if it is larger than the limit on its own.
+ * Must be called with queue_lock held.
+ */
+static sf_bool STDCALL can_start_next_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 ahead = chunk_downloader->producer_head - chunk_downloader->consumer_head;
+    if (chunk_downloader->producer_head >= chunk_downloader->queue_size ||
+        ahead >= chunk_downloader->prefetch_limit) {
+        return SF_BOOLEAN_FALSE;
+    }
+    // Chunks on disk are closer to the consumer, so they get the memory first
+    if (chunk_downloader->spilled_chunks > 0) {
+        return SF_BOOLEAN_FALSE;
+    }
+    if (chunk_downloader->memory_limit == 0 || ahead == 0) {
+        return SF_BOOLEAN_TRUE;
+    }
+    return chunk_downloader->memory_used +
+           estimate_chunk_memory(chunk_downloader, &chunk_downloader->queue[chunk_downloader->producer_head]) <=
+           chunk_downloader->memory_limit ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Takes the next chunk off the queue for downloading and reserves its estimated memory. Must be called with
+ * queue_lock held.
+ */
+static uint64 STDCALL start_next_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 index = chunk_downloader->producer_head++;
+    SF_QUEUE_ITEM *item = &chunk_downloader->queue[index];
+    set_chunk_memory(chunk_downloader, item, estimate_chunk_memory(chunk_downloader, item));
+    return index;
+}
+
+/**
+ * Finds the spilled chunk to load next. That is the first chunk on disk, once it fits into the memory limit or the
+ * consumer needs it next. Returns queue_size if there is none. Must be called with queue_lock held.
+ */
+static uint64 STDCALL next_spilled_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 index;
+    SF_QUEUE_ITEM *item;
+    if (chunk_downloader->spilled_chunks == 0) {
+        return chunk_downloader->queue_size;
+    }
+    for (index = chunk_downloader->consumer_head; index < chunk_downloader->producer_head; index++) {
+        item = &chunk_downloader->queue[index];
+        if (item->state == SF_CHUNK_STATE_SPILLED) {
+            if (index == chunk_downloader->consumer_head ||
+                chunk_downloader->memory_used + estimate_chunk_memory(chunk_downloader, item) <=
+                chunk_downloader->memory_limit) {
+                return index;
+            }
+            break;
+        }
+    }
+    return chunk_downloader->queue_size;
+}
+
+/**
+ * Finds the chunk closest to the consumer that waits for another download attempt. Returns queue_size if there is
+ * none. Must be called with queue_lock held.
+ */
+static uint64 STDCALL next_requeued_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 index;
+    if (chunk_downloader->requeued_chunks == 0) {
+        return chunk_downloader->queue_size;
+    }
+    for (index = chunk_downloader->consumer_head; index < chunk_downloader->producer_head; index++) {
+        if (chunk_downloader->queue[index].state == SF_CHUNK_STATE_REQUEUED) {
+            return index;
+        }
+    }
+    return chunk_downloader->queue_size;
+}
+
+/**
+ * Checks whether the chunk the consumer needs next is a straggler, i.e. its download has been running much longer
+ * than downloads usually take. Returns its index if it should be downloaded a second time, queue_size otherwise.
+ * wait_time is set to the time until it becomes a straggler, 0 if there is nothing to wait for. Must be called with
+ * queue_lock held.
+ */
+static uint64 STDCALL next_hedged_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 *wait_time) {
+    uint64 index = chunk_downloader->consumer_head;
+    uint64 delay;
+    uint64 age;
+    SF_QUEUE_ITEM *item;
+    *wait_time = 0;
+    // Without a finished download there is nothing to compare to
+    if (index >= chunk_downloader->queue_size || chunk_downloader->avg_download_time == 0) {
+        return chunk_downloader->queue_size;
+    }
+    item = &chunk_downloader->queue[index];
+    if (item->chunk || item->hedged || item->download_start == 0) {
+        return chunk_downloader->queue_size;
+    }
+    delay = chunk_downloader->avg_download_time * CHUNK_HEDGE_DELAY_FACTOR;
+    if (delay < CHUNK_HEDGE_MIN_DELAY_MS) {
+        delay = CHUNK_HEDGE_MIN_DELAY_MS;
+    }
+    age = sf_get_monotonic_time_millis() - item->download_start;
+    if (age < delay) {
+        *wait_time = delay - age;
+        return chunk_downloader->queue_size;
+    }
+    return index;
+}
+
+/**
+ * Waits for the next job of a download thread. In order of preference that is loading the spilled chunk closest to
+ * the consumer, downloading the chunk the consumer is stuck on a second time, downloading the next chunk into memory,
+ * or writing it to disk if it doesn't fit and spilling is on. The job is claimed before returning. Returns
+ * SF_BOOLEAN_FALSE if there is nothing left to do or on shutdown or error. Must be called with queue_lock held.
+ */
+static sf_bool STDCALL wait_for_download_job(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 *index, sf_bool *load,
+                                             sf_bool *spill, sf_bool *hedge) {
+    SF_QUEUE_ITEM *item;
+    uint64 hedge_wait;
+    while (!get_shutdown_or_error(chunk_downloader)) {
+        *load = SF_BOOLEAN_FALSE;
+        *spill = SF_BOOLEAN_FALSE;
+        *hedge = SF_BOOLEAN_FALSE;
+        if ((*index = next_requeued_chunk(chunk_downloader)) < chunk_downloader->queue_size) {
+            // Memory stays reserved for the chunk while it waits, and it goes back to where it was headed
+            item = &chunk_downloader->queue[*index];
+            chunk_downloader->requeued_chunks--;
+            *spill = item->spill ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+            item->state = *spill ? SF_CHUNK_STATE_SPILLING : SF_CHUNK_STATE_PENDING;
+            return SF_BOOLEAN_TRUE;
+        }
+        if ((*index = next_spilled_chunk(chunk_downloader)) < chunk_downloader->queue_size) {
+            item = &chunk_downloader->queue[*index];
+            item->state = SF_CHUNK_STATE_LOADING;
+            set_chunk_memory(chunk_downloader, item, estimate_chunk_memory(chunk_downloader, item));
+            *load = SF_BOOLEAN_TRUE;
+            return SF_BOOLEAN_TRUE;
+        }
+        if ((*index = next_hedged_chunk(chunk_downloader, &hedge_wait)) < chunk_downloader->queue_size) {
+            item = &chunk_downloader->queue[*index];
+            log_debug("Downloading chunk %llu again after %llums", *index,
+                      sf_get_monotonic_time_millis() - item->download_start);
+            item->hedged = SF_BOOLEAN_TRUE;
+            item->downloads++;
+            chunk_downloader->hedged_chunks++;
+            *hedge = SF_BOOLEAN_TRUE;
+            return SF_BOOLEAN_TRUE;
+        }
+        if (can_start_next_chunk(chunk_downloader)) {
+            *index = start_next_chunk(chunk_downloader);
+            return SF_BOOLEAN_TRUE;
+        }
+        if (chunk_downloader->spill_dir && chunk_downloader->producer_head < chunk_downloader->queue_size) {
+            *index = chunk_downloader->producer_head++;
+            chunk_downloader->queue[*index].state = SF_CHUNK_STATE_SPILLING;
+            chunk_downloader->spilled_chunks++;
+            *spill = SF_BOOLEAN_TRUE;
+            return SF_BOOLEAN_TRUE;
+        }
+        // Spilled chunks still have to be loaded once there is room, and the last chunks may still need hedging
+        if (chunk_downloader->producer_head >= chunk_downloader->queue_size &&
+            chunk_downloader->spilled_chunks == 0 && chunk_downloader->requeued_chunks == 0 && hedge_wait == 0) {
+            break;
+        }
+        if (hedge_wait > 0) {
+            _cond_timed_wait(&chunk_downloader->producer_cond, &chunk_downloader->queue_lock,
+                             (unsigned int) hedge_wait);
+        } else {
+            _cond_wait(&chunk_downloader->producer_cond, &chunk_downloader->queue_lock);
+        }
+    }
+    return SF_BOOLEAN_FALSE;
+}
+
+void STDCALL chunk_downloader_chunk_consumed(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index, uint64 wait_time) {
+    uint64 now = sf_get_monotonic_time_millis();
+    uint64 elapsed;
+    uint64 next = index + 1;
+
+    // The consumer frees the previous chunk when it takes this one
+    chunk_downloader->memory_used -= chunk_downloader->consumer_memory;
+    chunk_downloader->consumer_memory = chunk_downloader->queue[index].memory_size;
+    chunk_downloader->queue[index].memory_size = 0;
+    // Idle threads also have to start watching the next chunk if it is still downloading
+    if (chunk_downloader->memory_limit ||
+        (next < chunk_downloader->queue_size && chunk_downloader->queue[next].download_start != 0)) {
+        _cond_broadcast(&chunk_downloader->producer_cond);
+    }
+
+    // Time between two chunk acquisitions minus the wait is the time spent processing the previous chunk
+    if (chunk_downloader->last_consume_timestamp) {
+        elapsed = now - chunk_downloader->last_consume_timestamp;
+        chunk_downloader->avg_consume_time = update_average(
+          chunk_downloader->avg_consume_time,
+          elapsed > wait_time ? elapsed - wait_time : 0);
+    }
+    chunk_downloader->last_consume_timestamp = now;
+
+    update_prefetch_limit(chunk_downloader, wait_time > 0);
+}
+
+uint64 STDCALL chunk_downloader_find_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, int64 row) {
+    // row_starts[low] <= row < row_starts[high], which skips empty chunks
+    uint64 low = 0;
+    uint64 high = chunk_downloader->queue_size;
+    uint64 middle;
+    if (row < 0 || row >= chunk_downloader->row_starts[high]) {
+        return chunk_downloader->queue_size;
+    }
+    while (high - low > 1) {
+        middle = low + (high - low) / 2;
+        if (chunk_downloader->row_starts[middle] <= row) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+sf_bool STDCALL chunk_downloader_seek(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index) {
+    uint64 thread_count = chunk_downloader->thread_count;
+    uint64 i;
+    SF_QUEUE_ITEM *item;
+    if (get_shutdown_or_error(chunk_downloader) || index > chunk_downloader->queue_size) {
+        return SF_BOOLEAN_FALSE;
+    }
+    log_debug("Seeking from chunk %llu to chunk %llu", chunk_downloader->consumer_head, index);
+
+    // Stop the threads and cancel their downloads
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    set_shutdown(chunk_downloader, SF_BOOLEAN_TRUE);
+    for (i = chunk_downloader->consumer_head; i < chunk_downloader->producer_head; i++) {
+        _atomic_store(&chunk_downloader->queue[i].done, SF_BOOLEAN_TRUE);
+    }
+    _cond_broadcast(&chunk_downloader->consumer_cond);
+    _cond_broadcast(&chunk_downloader->producer_cond);
+    _cond_broadcast(&chunk_downloader->parse_cond);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+    join_threads(chunk_downloader);
+    chunk_downloader->multi_thread_started = SF_BOOLEAN_FALSE;
+    chunk_downloader->thread_count = 0;
+    if (get_error(chunk_downloader)) {
+        // Leave the downloader with no threads and not shut down, so that chunk_downloader_term tears it down
+        set_shutdown(chunk_downloader, SF_BOOLEAN_FALSE);
+        return SF_BOOLEAN_FALSE;
+    }
+
+    // Nothing runs anymore, so the queue can be reset without the lock. Only the chunk the consumer holds still
+    // counts against the memory limit
+    for (i = 0; i < chunk_downloader->queue_size; i++) {
+        item = &chunk_downloader->queue[i];
+        result_chunk_term(item->chunk);
+        item->chunk = NULL;
+        chunk_spill_term(item->spill);
+        item->spill = NULL;
+        SF_FREE(item->body);
+        item->body_len = 0;
+        item->body_cap = 0;
+        item->memory_size = 0;
+        item->attempts = 0;
+        item->download_start = 0;
+        item->downloads = 0;
+        item->hedged = SF_BOOLEAN_FALSE;
+        item->done = 0;
+        item->state = SF_CHUNK_STATE_PENDING;
+    }
+    chunk_downloader->memory_used = chunk_downloader->consumer_memory;
+    chunk_downloader->spilled_chunks = 0;
+    chunk_downloader->requeued_chunks = 0;
+    chunk_downloader->producer_head = index;
+    chunk_downloader->consumer_head = index;
+    // The time until the next chunk is taken isn't spent consuming
+    chunk_downloader->last_consume_timestamp = 0;
+    chunk_downloader->downloads_done = SF_BOOLEAN_FALSE;
+    set_shutdown(chunk_downloader, SF_BOOLEAN_FALSE);
+    // If a thread can't be started, the error is set and the threads that did start stop on their own
+    return start_threads(chunk_downloader, thread_count);
+}
+
+uint64 STDCALL chunk_downloader_memory_peak(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 peak;
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    peak = chunk_downloader->memory_peak;
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+    return peak;
 }
 
 sf_bool STDCALL init_locks(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
@@ -106,6 +478,16 @@ sf_bool STDCALL init_locks(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
         SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
         goto cleanup;
     }
+    if ((pthread_ret = _cond_init(&chunk_downloader->parse_cond)) != 0) {
+        PTHREAD_LOCK_INIT_ERROR_MSG(pthread_ret, error_msg);
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
+        goto cleanup;
+    }
+    if ((pthread_ret = _critical_section_init(&chunk_downloader->free_chunks_lock)) != 0) {
+        PTHREAD_LOCK_INIT_ERROR_MSG(pthread_ret, error_msg);
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
+        goto cleanup;
+    }
     // Success
     ret = SF_BOOLEAN_TRUE;
 
@@ -116,7 +498,9 @@ cleanup:
     _critical_section_term(&chunk_downloader->queue_lock);
     _cond_term(&chunk_downloader->producer_cond);
     _cond_term(&chunk_downloader->consumer_cond);
+    _cond_term(&chunk_downloader->parse_cond);
     _rwlock_term(&chunk_downloader->attr_lock);
+    _critical_section_term(&chunk_downloader->free_chunks_lock);
     return ret;
 }
 
@@ -134,7 +518,19 @@ sf_bool STDCALL fill_queue(struct SF_CHUNK_DOWNLOADER *chunk_downloader, cJSON *
 
         chunk_downloader->queue[i].url = NULL;
         chunk_downloader->queue[i].row_count = 0;
+        chunk_downloader->queue[i].uncompressed_size = 0;
         chunk_downloader->queue[i].chunk = NULL;
+        chunk_downloader->queue[i].memory_size = 0;
+        chunk_downloader->queue[i].spill = NULL;
+        chunk_downloader->queue[i].attempts = 0;
+        chunk_downloader->queue[i].download_start = 0;
+        chunk_downloader->queue[i].downloads = 0;
+        chunk_downloader->queue[i].hedged = SF_BOOLEAN_FALSE;
+        chunk_downloader->queue[i].done = 0;
+        chunk_downloader->queue[i].state = SF_CHUNK_STATE_PENDING;
+        chunk_downloader->queue[i].body = NULL;
+        chunk_downloader->queue[i].body_len = 0;
+        chunk_downloader->queue[i].body_cap = 0;
 
         if (json_copy_string(&chunk_downloader->queue[i].url, chunk, "url")) {
             goto cleanup;
@@ -149,6 +545,9 @@ sf_bool STDCALL fill_queue(struct SF_CHUNK_DOWNLOADER *chunk_downloader, cJSON *
             goto cleanup;
         }
 
+        // Optional, only used to presize the chunk memory
+        json_copy_int(&chunk_downloader->queue[i].uncompressed_size, chunk, "uncompressedSize");
+
         // Free detached chunk
       snowflake_cJSON_Delete(chunk);
         chunk = NULL;
@@ -199,40 +598,242 @@ cleanup:
     return ret;
 }
 
-sf_bool STDCALL download_chunk(char *url, struct curl_slist *headers, cJSON **chunk, SF_ERROR_STRUCT *error, sf_bool insecure_mode) {
+/**
+ * Takes an emptied chunk to parse a download into, NULL if there is none.
+ */
+static SF_RESULT_CHUNK *take_free_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    SF_RESULT_CHUNK *chunk;
+    _critical_section_lock(&chunk_downloader->free_chunks_lock);
+    chunk = chunk_downloader->free_chunks;
+    if (chunk) {
+        chunk_downloader->free_chunks = chunk->next_free;
+        chunk_downloader->free_chunk_count--;
+        chunk_downloader->reused_chunks++;
+        chunk->next_free = NULL;
+    }
+    _critical_section_unlock(&chunk_downloader->free_chunks_lock);
+    return chunk;
+}
+
+void STDCALL chunk_downloader_release_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_RESULT_CHUNK *chunk) {
+    uint64 max_free;
+    if (!chunk) {
+        return;
+    }
+    // A memory limit leaves no room for spare chunks
+    if (!chunk_downloader || chunk_downloader->arrow_format || chunk_downloader->memory_limit > 0 ||
+        chunk->column_count != chunk_downloader->column_count) {
+        result_chunk_term(chunk);
+        return;
+    }
+    // One spare chunk per thread covers the chunks that are parsed at once
+    max_free = chunk_downloader->thread_count > 0 ? chunk_downloader->thread_count : 1;
+    result_chunk_clear(chunk);
+    _critical_section_lock(&chunk_downloader->free_chunks_lock);
+    if (chunk_downloader->free_chunk_count < max_free) {
+        chunk->next_free = chunk_downloader->free_chunks;
+        chunk_downloader->free_chunks = chunk;
+        chunk_downloader->free_chunk_count++;
+        chunk = NULL;
+    }
+    _critical_section_unlock(&chunk_downloader->free_chunks_lock);
+    result_chunk_term(chunk);
+}
+
+/**
+ * Checks that a parsed chunk has as many rows as the result metadata says. The cursor walks the chunk by its own row
+ * count, so a short chunk would otherwise silently drop rows from the result.
+ */
+static sf_bool check_chunk_row_count(const SF_RESULT_CHUNK *chunk, int64 row_count, SF_ERROR_STRUCT *error) {
+    if (chunk->row_count == row_count) {
+        return SF_BOOLEAN_TRUE;
+    }
+    log_error("Result chunk has %lld rows, expected %lld", chunk->row_count, row_count);
+    SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_RESPONSE, "Result chunk row count does not match rowCount.",
+                        SF_SQLSTATE_UNABLE_TO_CONNECT);
+    return SF_BOOLEAN_FALSE;
+}
+
+sf_bool STDCALL download_chunk(CURL *curl, char *url, struct curl_slist *headers, int64 column_count,
+                               int64 row_count, int64 uncompressed_size, sf_bool arrow_format,
+                               const SF_C_TYPE *column_types, SF_CHUNK_SPILL *spill, SF_ATOMIC_INT32 *cancel,
+                               SF_RESULT_CHUNK **chunk, SF_ERROR_STRUCT *error, sf_bool insecure_mode) {
     sf_bool ret = SF_BOOLEAN_FALSE;
-    CURL *curl = NULL;
-    curl = curl_easy_init();
+    // Rows are parsed into the chunk as they are received instead of being buffered
+    SF_CHUNK_PARSER parser;
+    chunk_parser_init(&parser, column_count, row_count,
+                      uncompressed_size > 0 ? (size_t) uncompressed_size : 0);
+    // The caller may pass in an empty chunk to parse into
+    if (*chunk) {
+        chunk_parser_set_chunk(&parser, *chunk);
+        *chunk = NULL;
+    }
+    if (arrow_format) {
+        chunk_parser_set_arrow(&parser, column_types);
+    }
+    // Or written to disk as they are, to be parsed once there is room
+    if (spill) {
+        chunk_parser_set_spill(&parser, spill);
+    }
 
-    if (!curl || !http_perform(curl, GET_REQUEST_TYPE, url, headers, NULL, chunk, DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, SF_BOOLEAN_TRUE, error, insecure_mode)) {
+    if (!http_perform(curl, GET_REQUEST_TYPE, url, headers, NULL, 0, NULL, DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, &parser,
+                      cancel, error, insecure_mode, NULL)) {
         // Error set in perform function
         goto cleanup;
     }
 
+    // Make sure the chunk was complete
+    if (!chunk_parser_finish(&parser, chunk)) {
+        if (arrow_format) {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_RESPONSE,
+                                "Unable to parse Arrow result chunk.",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+        } else {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON,
+                                "Unable to parse JSON text response.",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+        }
+        goto cleanup;
+    }
+    // Spilled chunks are checked once they are parsed
+    if (*chunk && !check_chunk_row_count(*chunk, row_count, error)) {
+        result_chunk_term(*chunk);
+        *chunk = NULL;
+        goto cleanup;
+    }
+
     ret = SF_BOOLEAN_TRUE;
 
 cleanup:
-    curl_easy_cleanup(curl);
+    chunk_parser_term(&parser);
+
+    return ret;
+}
 
+/**
+ * Parses a chunk that was written to disk.
+ */
+static sf_bool STDCALL load_spilled_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_QUEUE_ITEM *item,
+                                          SF_RESULT_CHUNK **chunk, SF_ERROR_STRUCT *error) {
+    SF_CHUNK_PARSER parser;
+    const char *data;
+    size_t len;
+    sf_bool ret;
+    if (!(data = chunk_spill_map(item->spill, &len))) {
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_GENERAL, "Unable to read spilled result chunk", "");
+        return SF_BOOLEAN_FALSE;
+    }
+    chunk_parser_init(&parser, chunk_downloader->column_count, item->row_count, len);
+    if (chunk_downloader->arrow_format) {
+        chunk_parser_set_arrow(&parser, chunk_downloader->decode_types);
+    }
+    ret = chunk_parser_feed(&parser, data, len) && chunk_parser_finish(&parser, chunk);
+    chunk_parser_term(&parser);
+    if (!ret) {
+        SET_SNOWFLAKE_ERROR(error,
+                            chunk_downloader->arrow_format ? SF_STATUS_ERROR_BAD_RESPONSE : SF_STATUS_ERROR_BAD_JSON,
+                            "Unable to parse spilled result chunk.", SF_SQLSTATE_UNABLE_TO_CONNECT);
+    } else if (!check_chunk_row_count(*chunk, item->row_count, error)) {
+        result_chunk_term(*chunk);
+        *chunk = NULL;
+        ret = SF_BOOLEAN_FALSE;
+    }
     return ret;
 }
 
+/**
+ * Starts the multi download thread if needed and thread_count download or parser threads. thread_count is the
+ * number of threads that were started, also if one of them can't be started.
+ */
+static sf_bool STDCALL start_threads(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 thread_count) {
+    const char *error_msg = NULL;
+    uint64 i;
+    int pthread_ret;
+
+    // In multi download mode all downloads run on one extra thread and the other threads only parse
+    if (chunk_downloader->multi_download) {
+        if ((pthread_ret = _thread_init(
+              &chunk_downloader->multi_thread,
+              chunk_multi_download_thread,
+              (void *)chunk_downloader)) != 0) {
+            goto error;
+        }
+        chunk_downloader->multi_thread_started = SF_BOOLEAN_TRUE;
+    }
+
+    for (i = 0; i < thread_count; i++) {
+        if ((pthread_ret = _thread_init(
+              &chunk_downloader->threads[i],
+              chunk_downloader->multi_download ? chunk_parser_thread : chunk_downloader_thread,
+              (void *)chunk_downloader)) != 0) {
+            goto error;
+        }
+        chunk_downloader->thread_count++;
+    }
+    return SF_BOOLEAN_TRUE;
+
+error:
+    _rwlock_wrlock(&chunk_downloader->attr_lock);
+    if (!chunk_downloader->has_error) {
+        PTHREAD_CREATE_ERROR_MSG(pthread_ret, error_msg);
+        SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
+        set_error(chunk_downloader, SF_BOOLEAN_TRUE);
+    }
+    _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    return SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Joins all threads once shutdown has been set and they have been woken up.
+ */
+static void STDCALL join_threads(SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    const char *error_msg;
+    uint64 i;
+    int pthread_ret;
+    if (chunk_downloader->multi_thread_started &&
+        (pthread_ret = _thread_join(chunk_downloader->multi_thread)) != 0) {
+        _rwlock_wrlock(&chunk_downloader->attr_lock);
+        if (!chunk_downloader->has_error) {
+            PTHREAD_JOIN_ERROR_MSG(pthread_ret, error_msg);
+            SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
+            set_error(chunk_downloader, SF_BOOLEAN_TRUE);
+        }
+        _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    }
+    for (i = 0; i < chunk_downloader->thread_count; i++) {
+        if ((pthread_ret = _thread_join(chunk_downloader->threads[i])) != 0) {
+            _rwlock_wrlock(&chunk_downloader->attr_lock);
+            if (!chunk_downloader->has_error) {
+                PTHREAD_JOIN_ERROR_MSG(pthread_ret, error_msg);
+                SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
+                set_error(chunk_downloader, SF_BOOLEAN_TRUE);
+            }
+            _rwlock_wrunlock(&chunk_downloader->attr_lock);
+        }
+    }
+}
+
 SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
                                                    cJSON *chunk_headers,
                                                    cJSON *chunks,
+                                                   int64 column_count,
+                                                   const SF_C_TYPE *decode_types,
+                                                   sf_bool arrow_format,
                                                    uint64 thread_count,
                                                    uint64 fetch_slots,
+                                                   sf_bool adaptive_prefetch,
+                                                   sf_bool multi_download,
+                                                   uint64 memory_limit,
+                                                   const char *spill_dir,
                                                    SF_ERROR_STRUCT *sf_error,
                                                    sf_bool insecure_mode) {
     struct SF_CHUNK_DOWNLOADER *chunk_downloader = NULL;
-    const char *error_msg = NULL;
     int chunk_count;
-    int i;
-    int pthread_ret;
+    uint64 i;
     size_t qrmk_len = 1;
-    // We need thread_count, fetch_slots, chunks, and either qrmk or chunk_headers
-    if (thread_count <= 0 ||
-            fetch_slots <= 0 ||
+    // We need fetch_slots, chunks, and either qrmk or chunk_headers. Without threads, chunks are only downloaded on
+    // request
+    if (fetch_slots <= 0 ||
             !chunks ||
             !snowflake_cJSON_IsArray(chunks) ||
             strcmp(chunks->string, "chunks") != 0) {
@@ -246,16 +847,43 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
     // Initialize default values
     chunk_downloader->threads = NULL;
     chunk_downloader->queue = NULL;
+    chunk_downloader->row_starts = NULL;
     chunk_downloader->qrmk = NULL;
     chunk_downloader->chunk_headers = NULL;
     chunk_downloader->thread_count = 0;
+    chunk_downloader->on_demand = thread_count == 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
     chunk_downloader->queue_size = 0;
     chunk_downloader->producer_head = 0;
     chunk_downloader->consumer_head = 0;
+    chunk_downloader->prefetch_slots = fetch_slots;
+    chunk_downloader->adaptive_prefetch = adaptive_prefetch;
+    // Adaptive prefetch starts out with one chunk per thread and adjusts from there
+    chunk_downloader->prefetch_limit = adaptive_prefetch && thread_count < fetch_slots ?
+                                       thread_count : fetch_slots;
+    chunk_downloader->avg_download_time = 0;
+    chunk_downloader->avg_consume_time = 0;
+    chunk_downloader->last_consume_timestamp = 0;
+    chunk_downloader->memory_limit = memory_limit;
+    chunk_downloader->memory_used = 0;
+    chunk_downloader->memory_peak = 0;
+    chunk_downloader->consumer_memory = 0;
+    chunk_downloader->spill_dir = NULL;
+    chunk_downloader->spilled_chunks = 0;
+    chunk_downloader->requeued_chunks = 0;
+    chunk_downloader->hedged_chunks = 0;
     chunk_downloader->is_shutdown = SF_BOOLEAN_FALSE;
     chunk_downloader->has_error = SF_BOOLEAN_FALSE;
     chunk_downloader->sf_error = sf_error;
     chunk_downloader->insecure_mode = insecure_mode;
+    chunk_downloader->column_count = column_count;
+    chunk_downloader->free_chunks = NULL;
+    chunk_downloader->free_chunk_count = 0;
+    chunk_downloader->reused_chunks = 0;
+    chunk_downloader->decode_types = NULL;
+    chunk_downloader->arrow_format = arrow_format;
+    chunk_downloader->multi_download = multi_download;
+    chunk_downloader->multi_thread_started = SF_BOOLEAN_FALSE;
+    chunk_downloader->downloads_done = SF_BOOLEAN_FALSE;
 
     // Initialize chunk_headers or qrmk
     if (chunk_headers) {
@@ -268,6 +896,24 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
         strncpy(chunk_downloader->qrmk, qrmk, qrmk_len);
     }
 
+    // Spilling only makes sense with a memory limit. The multi download thread keeps every body in memory
+    if (spill_dir && *spill_dir && memory_limit > 0 && !multi_download) {
+        chunk_downloader->spill_dir = (char *) SF_CALLOC(1, strlen(spill_dir) + 1);
+        if (!chunk_downloader->spill_dir) {
+            goto cleanup;
+        }
+        strcpy(chunk_downloader->spill_dir, spill_dir);
+    }
+
+    // Keep our own copy of the column types to decode to
+    if (decode_types && column_count > 0) {
+        chunk_downloader->decode_types = (SF_C_TYPE *) SF_CALLOC((size_t) column_count, sizeof(SF_C_TYPE));
+        if (!chunk_downloader->decode_types) {
+            goto cleanup;
+        }
+        memcpy(chunk_downloader->decode_types, decode_types, (size_t) column_count * sizeof(SF_C_TYPE));
+    }
+
     // Initialize mutexes and conditional variables
     if (!init_locks(chunk_downloader)) {
         goto cleanup;
@@ -275,9 +921,11 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
 
     // Initialize queue and thread memory
     chunk_count = snowflake_cJSON_GetArraySize(chunks);
-    chunk_downloader->threads = (SF_THREAD_HANDLE *)SF_CALLOC((int)thread_count, sizeof(SF_THREAD_HANDLE));
+    if (thread_count > 0) {
+        chunk_downloader->threads = (SF_THREAD_HANDLE *)SF_CALLOC((int)thread_count, sizeof(SF_THREAD_HANDLE));
+    }
     chunk_downloader->queue = (SF_QUEUE_ITEM *) SF_CALLOC(chunk_count, sizeof(SF_QUEUE_ITEM));
-    if (!chunk_downloader->threads || !chunk_downloader->queue) {
+    if ((thread_count > 0 && !chunk_downloader->threads) || !chunk_downloader->queue) {
         goto cleanup;
     }
 
@@ -286,27 +934,34 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
         goto cleanup;
     }
 
-    // Initialize threads
-    for (i = 0; i < thread_count; i++) {
-        // If non-zero exit code, terminate chunk downloader
-        if ((pthread_ret = _thread_init(
-              &chunk_downloader->threads[i],
-              chunk_downloader_thread,
-              (void *)chunk_downloader)) != 0) {
-            chunk_downloader_term(chunk_downloader);
-            PTHREAD_CREATE_ERROR_MSG(pthread_ret, error_msg);
-            SET_SNOWFLAKE_ERROR(sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-            return NULL;
+    // Row index for seeking
+    chunk_downloader->row_starts = (int64 *) SF_CALLOC(chunk_downloader->queue_size + 1, sizeof(int64));
+    if (!chunk_downloader->row_starts) {
+        for (i = 0; i < chunk_downloader->queue_size; i++) {
+            SF_FREE(chunk_downloader->queue[i].url);
         }
+        goto cleanup;
+    }
+    for (i = 0; i < chunk_downloader->queue_size; i++) {
+        chunk_downloader->row_starts[i + 1] = chunk_downloader->row_starts[i] +
+                                              (chunk_downloader->queue[i].row_count > 0 ?
+                                               chunk_downloader->queue[i].row_count : 0);
+    }
 
-        chunk_downloader->thread_count++;
+    // If a thread can't be started, terminate chunk downloader
+    if (!chunk_downloader->on_demand && !start_threads(chunk_downloader, thread_count)) {
+        chunk_downloader_term(chunk_downloader);
+        return NULL;
     }
 
     return chunk_downloader;
 
 cleanup:
     if (chunk_downloader) {
+        SF_FREE(chunk_downloader->row_starts);
         SF_FREE(chunk_downloader->qrmk);
+        SF_FREE(chunk_downloader->spill_dir);
+        SF_FREE(chunk_downloader->decode_types);
         curl_slist_free_all(chunk_downloader->chunk_headers);
         SF_FREE(chunk_downloader->queue);
         SF_FREE(chunk_downloader->threads);
@@ -320,6 +975,7 @@ cleanup:
 sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
     int pthread_ret;
     const char *error_msg;
+    SF_RESULT_CHUNK *chunk;
     uint64 i;
     if (!chunk_downloader) {
         return SF_BOOLEAN_FALSE;
@@ -330,7 +986,7 @@ sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_download
         if (!chunk_downloader->has_error) {
             PTHREAD_LOCK_INIT_ERROR_MSG(pthread_ret, error_msg);
             SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-            chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+            set_error(chunk_downloader, SF_BOOLEAN_TRUE);
         }
         _rwlock_wrunlock(&chunk_downloader->attr_lock);
         return SF_BOOLEAN_FALSE;
@@ -339,6 +995,7 @@ sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_download
     do {
         // Already shutting down, just return false
         if (get_shutdown(chunk_downloader)) {
+            _critical_section_unlock(&chunk_downloader->queue_lock);
             return SF_BOOLEAN_FALSE;
         }
 
@@ -346,33 +1003,20 @@ sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_download
 
         if (_cond_broadcast(&chunk_downloader->consumer_cond) ||
             _cond_broadcast(&chunk_downloader->producer_cond) ||
+            _cond_broadcast(&chunk_downloader->parse_cond) ||
                 (_critical_section_unlock(&chunk_downloader->queue_lock))) {
             // Something went wrong with either notifying the producer/consumer or releasing the queue lock
             // Set and error and then try to continue with cleanup
             _rwlock_wrlock(&chunk_downloader->attr_lock);
             if (!chunk_downloader->has_error) {
                 SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, "Error during condition broadcast", "");
-                chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+                set_error(chunk_downloader, SF_BOOLEAN_TRUE);
             }
             _rwlock_wrunlock(&chunk_downloader->attr_lock);
         }
 
         // Join all the threads
-        for (i = 0; i < chunk_downloader->thread_count; i++) {
-            if ((pthread_ret = _thread_join(chunk_downloader->threads[i])) != 0) {
-                if (!get_error(chunk_downloader)) {
-                    PTHREAD_JOIN_ERROR_MSG(pthread_ret, error_msg);
-                    SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-                }
-                _rwlock_wrlock(&chunk_downloader->attr_lock);
-                if (!chunk_downloader->has_error) {
-                    PTHREAD_JOIN_ERROR_MSG(pthread_ret, error_msg);
-                    SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-                    chunk_downloader->has_error = SF_BOOLEAN_TRUE;
-                }
-                _rwlock_wrunlock(&chunk_downloader->attr_lock);
-            }
-        }
+        join_threads(chunk_downloader);
     } while (0);
 
     // Free chunk downloader memory
@@ -380,14 +1024,25 @@ sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_download
     // Free all the memory of the items in the queue before freeing queue memory
     for (i = 0; i < chunk_downloader->queue_size; i++) {
         SF_FREE(chunk_downloader->queue[i].url);
-      snowflake_cJSON_Delete(chunk_downloader->queue[i].chunk);
+        SF_FREE(chunk_downloader->queue[i].body);
+        chunk_spill_term(chunk_downloader->queue[i].spill);
+        result_chunk_term(chunk_downloader->queue[i].chunk);
     }
     SF_FREE(chunk_downloader->queue);
+    while ((chunk = chunk_downloader->free_chunks)) {
+        chunk_downloader->free_chunks = chunk->next_free;
+        result_chunk_term(chunk);
+    }
+    SF_FREE(chunk_downloader->row_starts);
     SF_FREE(chunk_downloader->qrmk);
+    SF_FREE(chunk_downloader->spill_dir);
+    SF_FREE(chunk_downloader->decode_types);
     curl_slist_free_all(chunk_downloader->chunk_headers);
     _critical_section_term(&chunk_downloader->queue_lock);
+    _critical_section_term(&chunk_downloader->free_chunks_lock);
     _cond_term(&chunk_downloader->producer_cond);
     _cond_term(&chunk_downloader->consumer_cond);
+    _cond_term(&chunk_downloader->parse_cond);
     _rwlock_term(&chunk_downloader->attr_lock);
     SF_FREE(chunk_downloader);
 
@@ -396,60 +1051,161 @@ sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_download
 
 static void * chunk_downloader_thread(void *downloader) {
     struct SF_CHUNK_DOWNLOADER *chunk_downloader = (SF_CHUNK_DOWNLOADER *) downloader;
-    cJSON *chunk = NULL;
+    SF_RESULT_CHUNK *chunk = NULL;
+    SF_QUEUE_ITEM *item;
+    SF_CHUNK_SPILL *loaded_spill;
     uint64 index;
+    uint64 download_start;
+    sf_bool load;
+    sf_bool spill;
+    sf_bool hedge;
+    sf_bool lost;
+    sf_bool success;
     // Create err per thread so we don't have to lock the chunk downloader err
     SF_ERROR_STRUCT err;
+    // Kept for all chunks of this thread. http_perform resets the options after every request, but the handle holds
+    // on to its connection, so chunks from the same host don't need another TCP and TLS handshake.
+    CURL *curl = curl_easy_init();
     memset(&err, 0, sizeof(err));
     clear_snowflake_error(&err);
+    if (!curl) {
+        SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_OUT_OF_MEMORY, "Unable to create cURL handle", "");
+        set_download_error(chunk_downloader, &err);
+        clear_snowflake_error(&err);
+        _thread_exit();
+        return NULL;
+    }
 
     // Loop forever until shutdown
     while (1) {
         // Reset from previous loop
         chunk = NULL;
+        loaded_spill = NULL;
         _critical_section_lock(&chunk_downloader->queue_lock);
 
-        // If we've downloaded chunks == # of threads, wait until the consumer consumes a chunk.
-        // Ensure that the producer_head is less than the queue_size to ensure that we still have items to process
-        // If we're shutting down or an err has occurred, skip
-        while ((chunk_downloader->producer_head - chunk_downloader->consumer_head) >= chunk_downloader->thread_count &&
-                chunk_downloader->producer_head < chunk_downloader->queue_size &&
-                !get_shutdown_or_error(chunk_downloader)) {
-            _cond_wait(&chunk_downloader->producer_cond, &chunk_downloader->queue_lock);
-        }
-
-        // If we're shutting down, or we have reached the end of the results, then break
-        if (get_shutdown_or_error(chunk_downloader) || chunk_downloader->producer_head >= chunk_downloader->queue_size) {
+        // Wait until the consumer makes room if we've got as many chunks in flight as the prefetch limit or the
+        // memory limit allows. Stop if we're shutting down, an err has occurred or we reached the end of the results
+        if (!wait_for_download_job(chunk_downloader, &index, &load, &spill, &hedge)) {
             break;
         }
-
-        // Get queue item and set it locally
-        index = chunk_downloader->producer_head++;
+        item = &chunk_downloader->queue[index];
+        // Downloads into memory are watched for stragglers. Idle threads watch the chunk the consumer needs next
+        if (!load && !spill && !hedge) {
+            item->download_start = sf_get_monotonic_time_millis();
+            item->downloads++;
+            if (index == chunk_downloader->consumer_head) {
+                _cond_broadcast(&chunk_downloader->producer_cond);
+            }
+        }
 
         // Unlock since we have our queue item, and don't need the lock while we're processing the queue
         _critical_section_unlock(&chunk_downloader->queue_lock);
 
-        // Download chunk
-        if (!download_chunk(chunk_downloader->queue[index].url, chunk_downloader->chunk_headers,
-                            &chunk, &err, chunk_downloader->insecure_mode)) {
-            _rwlock_wrlock(&chunk_downloader->attr_lock);
-            if (!chunk_downloader->has_error) {
-                copy_snowflake_error(chunk_downloader->sf_error, &err);
-                chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+        download_start = sf_get_monotonic_time_millis();
+        if (load) {
+            success = load_spilled_chunk(chunk_downloader, item, &chunk, &err);
+        } else if (spill && !item->spill &&
+                   !(item->spill = chunk_spill_create(chunk_downloader->spill_dir, chunk_downloader, index))) {
+            SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_GENERAL, "Unable to create result chunk spill file", "");
+            success = SF_BOOLEAN_FALSE;
+        } else {
+            // Download chunk, into the memory of a chunk the consumer is done with if there is one
+            chunk = spill ? NULL : take_free_chunk(chunk_downloader);
+            success = download_chunk(curl, item->url, chunk_downloader->chunk_headers,
+                                     chunk_downloader->column_count, item->row_count, item->uncompressed_size,
+                                     chunk_downloader->arrow_format, chunk_downloader->decode_types, item->spill,
+                                     &item->done, &chunk, &err, chunk_downloader->insecure_mode);
+        }
+        // The threads are stopping for a seek or term, which also cancels downloads. Whatever came out is dropped
+        if (get_shutdown(chunk_downloader)) {
+            result_chunk_term(chunk);
+            clear_snowflake_error(&err);
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            break;
+        }
+        if (!load && !spill) {
+            // Only the first download of a hedged chunk to succeed counts. A failed one is left to the other
+            // download if that is still running.
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            item->downloads--;
+            lost = _atomic_load(&item->done) || (!success && item->downloads > 0) ?
+                   SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+            if (success && !lost) {
+                _atomic_store(&item->done, SF_BOOLEAN_TRUE);
+                item->download_start = 0;
             }
-            _rwlock_wrunlock(&chunk_downloader->attr_lock);
+            _critical_section_unlock(&chunk_downloader->queue_lock);
+            if (lost) {
+                log_debug("Dropping %s download of chunk %llu", hedge ? "second" : "first", index);
+                result_chunk_term(chunk);
+                clear_snowflake_error(&err);
+                continue;
+            }
+        }
+        if (!success && !load && err.error_code == SF_STATUS_ERROR_CURL &&
+            ++item->attempts < CHUNK_DOWNLOAD_ATTEMPTS) {
+            // The network failed even after retries. Put the chunk back for the next free thread rather than
+            // failing the whole result
+            log_warn("Requeuing chunk %llu after failed download: %s", index, err.msg ? err.msg : "");
+            clear_snowflake_error(&err);
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            item->download_start = 0;
+            item->hedged = SF_BOOLEAN_FALSE;
+            item->state = SF_CHUNK_STATE_REQUEUED;
+            chunk_downloader->requeued_chunks++;
+            _cond_broadcast(&chunk_downloader->producer_cond);
+            _critical_section_unlock(&chunk_downloader->queue_lock);
+            continue;
+        }
+        if (!success) {
+            set_download_error(chunk_downloader, &err);
+            // Hold the lock again so that it can be released after the loop
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            break;
+        }
+
+        // Convert the values to their native types here so that the consumer doesn't have to
+        if (chunk && chunk_downloader->decode_types && !result_chunk_decode(chunk, chunk_downloader->decode_types)) {
+            result_chunk_term(chunk);
+            SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_OUT_OF_MEMORY, "Out of memory decoding result chunk", "");
+            set_download_error(chunk_downloader, &err);
+            _critical_section_lock(&chunk_downloader->queue_lock);
             break;
         }
 
-        // Gain back lock to set cJSON blob
+        // Gain back lock to set the chunk
         _critical_section_lock(&chunk_downloader->queue_lock);
 
         if (get_error(chunk_downloader)) {
+            result_chunk_term(chunk);
             break;
         }
 
+        if (spill) {
+            // The chunk waits on disk until a thread has room to load it
+            log_debug("Spilled chunk %llu to disk", index);
+            item->state = SF_CHUNK_STATE_SPILLED;
+            _cond_broadcast(&chunk_downloader->producer_cond);
+            _critical_section_unlock(&chunk_downloader->queue_lock);
+            continue;
+        }
+        if (load) {
+            // Once no chunk is left on disk, new chunks are downloaded into memory again
+            item->state = SF_CHUNK_STATE_PENDING;
+            loaded_spill = item->spill;
+            item->spill = NULL;
+            chunk_downloader->spilled_chunks--;
+            _cond_broadcast(&chunk_downloader->producer_cond);
+        } else {
+            chunk_downloader->avg_download_time = update_average(
+              chunk_downloader->avg_download_time,
+              sf_get_monotonic_time_millis() - download_start);
+            update_prefetch_limit(chunk_downloader, SF_BOOLEAN_FALSE);
+        }
+
         // Set the chunk
-        chunk_downloader->queue[index].chunk = chunk;
+        item->chunk = chunk;
+        set_chunk_memory(chunk_downloader, item, result_chunk_memory_size(chunk));
 
         // Notify the consumer that we have a chunk ready
         if (_cond_signal(&chunk_downloader->consumer_cond)) {
@@ -457,7 +1213,7 @@ static void * chunk_downloader_thread(void *downloader) {
             if (!chunk_downloader->has_error) {
                 SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD,
                                     "Error sending consumer signal to notify of chunk downloaded", "");
-                chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+                set_error(chunk_downloader, SF_BOOLEAN_TRUE);
             }
             _rwlock_wrunlock(&chunk_downloader->attr_lock);
             break;
@@ -465,9 +1221,403 @@ static void * chunk_downloader_thread(void *downloader) {
 
         // Drop the lock
         _critical_section_unlock(&chunk_downloader->queue_lock);
+        chunk_spill_term(loaded_spill);
+    }
+
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+    curl_easy_cleanup(curl);
+    clear_snowflake_error(&err);
+    _thread_exit();
+    return NULL;
+}
+
+sf_bool STDCALL chunk_downloader_download_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index,
+                                                SF_RESULT_CHUNK **chunk, SF_ERROR_STRUCT *error) {
+    SF_QUEUE_ITEM *item;
+    // A handle of our own, cached connections are shared by all handles
+    CURL *curl;
+    sf_bool ret;
+    *chunk = NULL;
+    if (index >= chunk_downloader->queue_size) {
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_BOUNDS, "Chunk index out of range", "");
+        return SF_BOOLEAN_FALSE;
+    }
+    if (!(curl = curl_easy_init())) {
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY, "Unable to create cURL handle", "");
+        return SF_BOOLEAN_FALSE;
+    }
+    // Only fields that don't change after init are read
+    item = &chunk_downloader->queue[index];
+    *chunk = take_free_chunk(chunk_downloader);
+    ret = download_chunk(curl, item->url, chunk_downloader->chunk_headers, chunk_downloader->column_count,
+                         item->row_count, item->uncompressed_size, chunk_downloader->arrow_format,
+                         chunk_downloader->decode_types, NULL, NULL, chunk, error, chunk_downloader->insecure_mode);
+    curl_easy_cleanup(curl);
+    if (ret && *chunk && chunk_downloader->decode_types &&
+        !result_chunk_decode(*chunk, chunk_downloader->decode_types)) {
+        result_chunk_term(*chunk);
+        *chunk = NULL;
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY, "Out of memory decoding result chunk", "");
+        ret = SF_BOOLEAN_FALSE;
+    }
+    return ret;
+}
+
+/**
+ * Records the first error of the chunk downloader and wakes up everyone waiting on it.
+ */
+static void STDCALL set_download_error(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_ERROR_STRUCT *err) {
+    _rwlock_wrlock(&chunk_downloader->attr_lock);
+    if (!chunk_downloader->has_error) {
+        copy_snowflake_error(chunk_downloader->sf_error, err);
+        set_error(chunk_downloader, SF_BOOLEAN_TRUE);
+    }
+    _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    _cond_broadcast(&chunk_downloader->consumer_cond);
+    _cond_broadcast(&chunk_downloader->parse_cond);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+}
+
+/**
+ * cURL write callback of the multi download thread. The response is only collected here, parsing is left to the
+ * parser threads so that the download thread can keep all transfers going.
+ */
+static size_t chunk_body_write_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    SF_QUEUE_ITEM *item = (SF_QUEUE_ITEM *) userdata;
+    size_t data_size = size * nmemb;
+    size_t new_cap;
+    char *new_body;
+    if (item->body_len + data_size > item->body_cap) {
+        new_cap = item->body_cap ? item->body_cap : 16 * 1024;
+        while (new_cap < item->body_len + data_size) {
+            new_cap *= 2;
+        }
+        new_body = (char *) SF_REALLOC(item->body, new_cap);
+        if (!new_body) {
+            // Makes cURL fail the transfer with CURLE_WRITE_ERROR
+            return 0;
+        }
+        item->body = new_body;
+        item->body_cap = new_cap;
+    }
+    memcpy(item->body + item->body_len, data, data_size);
+    item->body_len += data_size;
+    return data_size;
+}
+
+/**
+ * Sets up the transfer of a chunk and adds it to the multi handle.
+ */
+static sf_bool STDCALL start_chunk_transfer(SF_CHUNK_DOWNLOADER *chunk_downloader, CURLM *multi, CURL *curl,
+                                            uint64 index) {
+    SF_QUEUE_ITEM *item = &chunk_downloader->queue[index];
+    item->body_len = 0;
+    // Presize the body when we know how large the chunk is
+    if (!item->body && item->uncompressed_size > 0) {
+        item->body = (char *) SF_MALLOC((size_t) item->uncompressed_size);
+        item->body_cap = item->body ? (size_t) item->uncompressed_size : 0;
+    }
+    if (!http_set_options(curl, GET_REQUEST_TYPE, item->url, chunk_downloader->chunk_headers, NULL, 0,
+                          chunk_body_write_cb, (void *) item, SF_BOOLEAN_TRUE,
+                          chunk_downloader->insecure_mode) ||
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *) (size_t) index) != CURLE_OK) {
+        return SF_BOOLEAN_FALSE;
+    }
+    return curl_multi_add_handle(multi, curl) == CURLM_OK ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Handles a finished transfer. Returns false if the chunk can't be downloaded, in which case the error is set.
+ * Transfers that failed with a retryable HTTP code are started again and downloaded is set to false.
+ */
+static sf_bool STDCALL finish_chunk_transfer(SF_CHUNK_DOWNLOADER *chunk_downloader, CURLM *multi, CURL *curl,
+                                             CURLcode result, uint64 download_start, sf_bool *downloaded,
+                                             SF_ERROR_STRUCT *err) {
+    char msg[1024];
+    long int http_code = 0;
+    void *private_data = NULL;
+    uint64 index;
+
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &private_data);
+    index = (uint64) (size_t) private_data;
+    curl_multi_remove_handle(multi, curl);
+    *downloaded = SF_BOOLEAN_FALSE;
+
+    if (result != CURLE_OK) {
+        snprintf(msg, sizeof(msg), "curl_multi_perform() failed: %s", curl_easy_strerror(result));
+        log_error(msg);
+        // Network errors get a few more tries from the start. A write error means we ran out of memory
+        if (result != CURLE_WRITE_ERROR && ++chunk_downloader->queue[index].attempts < CHUNK_DOWNLOAD_ATTEMPTS) {
+            log_debug("Retrying chunk %llu after failed download", index);
+            chunk_downloader->queue[index].body_len = 0;
+            if (curl_multi_add_handle(multi, curl) == CURLM_OK) {
+                return SF_BOOLEAN_TRUE;
+            }
+        }
+        SET_SNOWFLAKE_ERROR(err, SF_STATUS_ERROR_CURL, msg, SF_SQLSTATE_UNABLE_TO_CONNECT);
+        return SF_BOOLEAN_FALSE;
+    }
+    if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code) != CURLE_OK) {
+        SET_SNOWFLAKE_ERROR(err, SF_STATUS_ERROR_CURL, "Unable to get http response code",
+                            SF_SQLSTATE_UNABLE_TO_CONNECT);
+        return SF_BOOLEAN_FALSE;
+    }
+    if (http_code != 200) {
+        if (!is_retryable_http_code(http_code)) {
+            SET_SNOWFLAKE_ERROR(err, SF_STATUS_ERROR_RETRY, "Received unretryable http code",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            return SF_BOOLEAN_FALSE;
+        }
+        // Same as http_perform, retry right away. The options are still set on the handle.
+        log_debug("Retrying chunk %llu after http code %ld", index, http_code);
+        chunk_downloader->queue[index].body_len = 0;
+        if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+            SET_SNOWFLAKE_ERROR(err, SF_STATUS_ERROR_CURL, "Unable to restart chunk download",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            return SF_BOOLEAN_FALSE;
+        }
+        return SF_BOOLEAN_TRUE;
+    }
+
+    // Hand the body over to the parser threads
+    *downloaded = SF_BOOLEAN_TRUE;
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    chunk_downloader->queue[index].state = SF_CHUNK_STATE_DOWNLOADED;
+    chunk_downloader->avg_download_time = update_average(
+      chunk_downloader->avg_download_time,
+      sf_get_monotonic_time_millis() - download_start);
+    update_prefetch_limit(chunk_downloader, SF_BOOLEAN_FALSE);
+    _cond_signal(&chunk_downloader->parse_cond);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+
+    curl_easy_reset(curl);
+    return SF_BOOLEAN_TRUE;
+}
+
+/**
+ * Downloads every chunk through a single curl multi handle. As many chunks as the prefetch limit allows are
+ * transferred at once, each on its own easy handle.
+ */
+static void * chunk_multi_download_thread(void *downloader) {
+    struct SF_CHUNK_DOWNLOADER *chunk_downloader = (SF_CHUNK_DOWNLOADER *) downloader;
+    uint64 slot_count = chunk_downloader->prefetch_slots;
+    CURLM *multi = curl_multi_init();
+    // One easy handle per transfer slot, reused for later chunks. busy is the index of the chunk + 1, 0 if free
+    CURL **handles = (CURL **) SF_CALLOC((size_t) slot_count, sizeof(CURL *));
+    uint64 *busy = (uint64 *) SF_CALLOC((size_t) slot_count, sizeof(uint64));
+    uint64 *download_start = (uint64 *) SF_CALLOC((size_t) slot_count, sizeof(uint64));
+    uint64 active = 0;
+    uint64 index;
+    uint64 slot;
+    int running;
+    int numfds;
+    int msgs_left;
+    CURLMsg *msg;
+    sf_bool failed = SF_BOOLEAN_FALSE;
+    sf_bool downloaded;
+    SF_ERROR_STRUCT err;
+    memset(&err, 0, sizeof(err));
+    clear_snowflake_error(&err);
+
+    if (!multi || !handles || !busy || !download_start) {
+        SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_OUT_OF_MEMORY, "Unable to create multi chunk downloader", "");
+        failed = SF_BOOLEAN_TRUE;
+        goto cleanup;
+    }
+
+    while (1) {
+        _critical_section_lock(&chunk_downloader->queue_lock);
+        // Wait for room ahead of the consumer if nothing is in flight
+        while (active == 0 &&
+               !can_start_next_chunk(chunk_downloader) &&
+               chunk_downloader->producer_head < chunk_downloader->queue_size &&
+               !get_shutdown_or_error(chunk_downloader)) {
+            _cond_wait(&chunk_downloader->producer_cond, &chunk_downloader->queue_lock);
+        }
+        if (get_shutdown_or_error(chunk_downloader) ||
+            (active == 0 && chunk_downloader->producer_head >= chunk_downloader->queue_size)) {
+            _critical_section_unlock(&chunk_downloader->queue_lock);
+            break;
+        }
+
+        // Start as many chunks as the prefetch and memory limits allow. Chunks waiting for the parser or consumer
+        // count too, so there is always a free slot.
+        for (slot = 0; slot < slot_count && can_start_next_chunk(chunk_downloader); slot++) {
+            if (busy[slot]) {
+                continue;
+            }
+            if (!handles[slot]) {
+                handles[slot] = curl_easy_init();
+            }
+            index = start_next_chunk(chunk_downloader);
+            if (!handles[slot] || !start_chunk_transfer(chunk_downloader, multi, handles[slot], index)) {
+                _critical_section_unlock(&chunk_downloader->queue_lock);
+                SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_CURL, "Unable to start chunk download",
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+                failed = SF_BOOLEAN_TRUE;
+                goto cleanup;
+            }
+            busy[slot] = index + 1;
+            download_start[slot] = sf_get_monotonic_time_millis();
+            active++;
+        }
+        _critical_section_unlock(&chunk_downloader->queue_lock);
+
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_CURL, "curl_multi_perform() failed",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            failed = SF_BOOLEAN_TRUE;
+            goto cleanup;
+        }
+        while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            for (slot = 0; slot < slot_count && handles[slot] != msg->easy_handle; slot++);
+            if (slot == slot_count) {
+                continue;
+            }
+            if (!finish_chunk_transfer(chunk_downloader, multi, handles[slot], msg->data.result,
+                                       download_start[slot], &downloaded, &err)) {
+                busy[slot] = 0;
+                failed = SF_BOOLEAN_TRUE;
+                goto cleanup;
+            }
+            // A retried chunk keeps its slot
+            if (downloaded) {
+                busy[slot] = 0;
+                active--;
+            }
+        }
+
+        // Consumer progress isn't signalled to the multi handle, so only wait a little before starting more chunks
+        if (active > 0 &&
+            curl_multi_wait(multi, NULL, 0, MULTI_DOWNLOAD_WAIT_TIMEOUT_MS, &numfds) != CURLM_OK) {
+            SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_CURL, "curl_multi_wait() failed",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            failed = SF_BOOLEAN_TRUE;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (failed) {
+        set_download_error(chunk_downloader, &err);
+    }
+    for (slot = 0; handles && slot < slot_count; slot++) {
+        if (handles[slot]) {
+            if (busy[slot]) {
+                curl_multi_remove_handle(multi, handles[slot]);
+            }
+            curl_easy_cleanup(handles[slot]);
+        }
+    }
+    if (multi) {
+        curl_multi_cleanup(multi);
+    }
+    SF_FREE(handles);
+    SF_FREE(busy);
+    SF_FREE(download_start);
+
+    // Let the parser threads finish once they have parsed everything that was downloaded
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    chunk_downloader->downloads_done = SF_BOOLEAN_TRUE;
+    _cond_broadcast(&chunk_downloader->parse_cond);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+    clear_snowflake_error(&err);
+    _thread_exit();
+    return NULL;
+}
+
+/**
+ * Parses the chunks downloaded by the multi download thread, the chunk closest to the consumer first.
+ */
+static void * chunk_parser_thread(void *downloader) {
+    struct SF_CHUNK_DOWNLOADER *chunk_downloader = (SF_CHUNK_DOWNLOADER *) downloader;
+    SF_RESULT_CHUNK *chunk = NULL;
+    SF_QUEUE_ITEM *item;
+    SF_CHUNK_PARSER parser;
+    uint64 index;
+    sf_bool found;
+    sf_bool parsed;
+    SF_ERROR_STRUCT err;
+    memset(&err, 0, sizeof(err));
+    clear_snowflake_error(&err);
+
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    while (1) {
+        found = SF_BOOLEAN_FALSE;
+        for (index = chunk_downloader->consumer_head; index < chunk_downloader->producer_head; index++) {
+            if (chunk_downloader->queue[index].state == SF_CHUNK_STATE_DOWNLOADED) {
+                found = SF_BOOLEAN_TRUE;
+                break;
+            }
+        }
+        if (get_shutdown_or_error(chunk_downloader) || (!found && chunk_downloader->downloads_done)) {
+            break;
+        }
+        if (!found) {
+            _cond_wait(&chunk_downloader->parse_cond, &chunk_downloader->queue_lock);
+            continue;
+        }
+
+        item = &chunk_downloader->queue[index];
+        item->state = SF_CHUNK_STATE_PARSING;
+        _critical_section_unlock(&chunk_downloader->queue_lock);
+
+        chunk = NULL;
+        chunk_parser_init(&parser, chunk_downloader->column_count, item->row_count,
+                          item->uncompressed_size > 0 ? (size_t) item->uncompressed_size : 0);
+        if (chunk_downloader->arrow_format) {
+            chunk_parser_set_arrow(&parser, chunk_downloader->decode_types);
+        } else if ((chunk = take_free_chunk(chunk_downloader))) {
+            chunk_parser_set_chunk(&parser, chunk);
+            chunk = NULL;
+        }
+        parsed = chunk_parser_feed(&parser, item->body, item->body_len) && chunk_parser_finish(&parser, &chunk);
+        chunk_parser_term(&parser);
+        SF_FREE(item->body);
+        item->body_len = 0;
+        item->body_cap = 0;
+        if (!parsed) {
+            if (chunk_downloader->arrow_format) {
+                SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_BAD_RESPONSE, "Unable to parse Arrow result chunk.",
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+            } else {
+                SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_BAD_JSON, "Unable to parse JSON text response.",
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+            }
+            set_download_error(chunk_downloader, &err);
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            break;
+        }
+        if (!check_chunk_row_count(chunk, item->row_count, &err)) {
+            result_chunk_term(chunk);
+            set_download_error(chunk_downloader, &err);
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            break;
+        }
+        if (chunk_downloader->decode_types && !result_chunk_decode(chunk, chunk_downloader->decode_types)) {
+            result_chunk_term(chunk);
+            SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_OUT_OF_MEMORY, "Out of memory decoding result chunk", "");
+            set_download_error(chunk_downloader, &err);
+            _critical_section_lock(&chunk_downloader->queue_lock);
+            break;
+        }
+
+        _critical_section_lock(&chunk_downloader->queue_lock);
+        if (get_error(chunk_downloader)) {
+            result_chunk_term(chunk);
+            break;
+        }
+        item->chunk = chunk;
+        set_chunk_memory(chunk_downloader, item, result_chunk_memory_size(chunk));
+        _cond_signal(&chunk_downloader->consumer_cond);
     }
 
     _critical_section_unlock(&chunk_downloader->queue_lock);
+    clear_snowflake_error(&err);
     _thread_exit();
     return NULL;
 }
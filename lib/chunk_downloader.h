@@ -18,15 +18,56 @@ extern "C" {
 #include <snowflake/client.h>
 #include "snowflake/platform.h"
 #include "cJSON.h"
+#include "result_chunk.h"
+#include "chunk_spill.h"
+
+/**
+ * Progress of a chunk that is downloaded in multi download mode or spilled to disk. Chunks are ready for the
+ * consumer once the chunk is set.
+ */
+typedef enum SF_CHUNK_STATE {
+    SF_CHUNK_STATE_PENDING,
+    SF_CHUNK_STATE_DOWNLOADED,
+    SF_CHUNK_STATE_PARSING,
+    SF_CHUNK_STATE_SPILLING,
+    SF_CHUNK_STATE_SPILLED,
+    SF_CHUNK_STATE_LOADING,
+    SF_CHUNK_STATE_REQUEUED
+} SF_CHUNK_STATE;
 
 typedef struct SF_QUEUE_ITEM {
     char *url;
     int64 row_count;
-    cJSON *chunk;
+    // Size of the chunk JSON text, 0 if the server did not send it
+    int64 uncompressed_size;
+    SF_RESULT_CHUNK *chunk;
+    // Bytes this chunk adds to memory_used, estimated until the chunk is parsed
+    uint64 memory_size;
+    // Raw chunk bytes on disk while the chunk doesn't fit into the memory limit
+    SF_CHUNK_SPILL *spill;
+
+    // Downloads of this chunk that failed so far
+    int attempts;
+    // Start of the download into memory in milliseconds, 0 if there is none. Protected by queue_lock
+    uint64 download_start;
+    // Number of downloads of this chunk that are running, two once it has been hedged. Protected by queue_lock
+    int downloads;
+    sf_bool hedged;
+    // Set once a download of the chunk succeeded, which makes the other download of a hedged chunk give up
+    SF_ATOMIC_INT32 done;
+
+    SF_CHUNK_STATE state;
+    // Multi download mode only. The response is kept until a parser thread picks it up
+    char *body;
+    size_t body_len;
+    size_t body_cap;
 } SF_QUEUE_ITEM;
 
 struct SF_CHUNK_DOWNLOADER {
     uint64 thread_count;
+    // Created without threads. Chunks are only downloaded by chunk_downloader_download_chunk and the queue is not
+    // consumed
+    sf_bool on_demand;
 
     // Threads
     SF_THREAD_HANDLE *threads;
@@ -43,17 +84,75 @@ struct SF_CHUNK_DOWNLOADER {
     uint64 producer_head;
     uint64 consumer_head;
     uint64 queue_size;
+    // Number of rows before each chunk. Has queue_size + 1 entries, the last one is the number of rows of all chunks
+    int64 *row_starts;
+
+    // Maximum number of chunks that may be downloading or waiting for the consumer at once
+    uint64 prefetch_slots;
+    // Current limit on chunks ahead of the consumer. Equal to prefetch_slots unless adaptive prefetch is on
+    uint64 prefetch_limit;
+    sf_bool adaptive_prefetch;
+
+    // Adaptive prefetch statistics in milliseconds. Protected by queue_lock
+    uint64 avg_download_time;
+    uint64 avg_consume_time;
+    uint64 last_consume_timestamp;
+
+    // Limit on the memory of chunks that are downloading, waiting for the consumer or held by it, in bytes. 0 means
+    // no limit. The counters are protected by queue_lock
+    uint64 memory_limit;
+    uint64 memory_used;
+    uint64 memory_peak;
+    // Memory of the chunk the consumer took last, released when it takes the next one
+    uint64 consumer_memory;
+    // Directory that chunks which don't fit into the memory limit are written to, NULL to wait for memory instead.
+    // Only used with a memory limit and without multi download
+    char *spill_dir;
+    // Number of chunks that are being written to or waiting on disk. Protected by queue_lock
+    uint64 spilled_chunks;
+    // Number of chunks waiting for another download attempt. Protected by queue_lock
+    uint64 requeued_chunks;
+    // Number of chunks that were downloaded a second time because the first download took too long. Protected by
+    // queue_lock
+    uint64 hedged_chunks;
+
+    // Number of columns in every row of the result
+    int64 column_count;
+
+    // Chunks the consumer is done with, emptied and waiting to be parsed into again so that long scans don't
+    // allocate and free the memory of every chunk. Only kept for JSON results without a memory limit. Linked through
+    // next_free and protected by free_chunks_lock
+    SF_CRITICAL_SECTION_HANDLE free_chunks_lock;
+    SF_RESULT_CHUNK *free_chunks;
+    uint64 free_chunk_count;
+    // Number of chunks that were parsed into a reused chunk
+    uint64 reused_chunks;
+
+    // C type of every column if the download threads should decode the chunks, NULL otherwise
+    SF_C_TYPE *decode_types;
+
+    // Chunks are Arrow IPC streams instead of JSON rows
+    sf_bool arrow_format;
+
+    // In multi download mode a single thread runs every download through a curl multi handle and the threads above
+    // only parse the downloaded chunks
+    sf_bool multi_download;
+    SF_THREAD_HANDLE multi_thread;
+    sf_bool multi_thread_started;
+    SF_CONDITION_HANDLE parse_cond;
+    // Set once the multi download thread has finished. Protected by queue_lock
+    sf_bool downloads_done;
 
     // Chunk downloader connection attributes
     char *qrmk;
     struct curl_slist *chunk_headers;
 
-    // Error/shutdown flags
-    sf_bool is_shutdown;
-    sf_bool has_error;
+    // Error/shutdown flags. Atomic so that they can be checked on every fetch without taking a lock
+    SF_ATOMIC_INT32 is_shutdown;
+    SF_ATOMIC_INT32 has_error;
 
-    // Chunk downloader attribute read-write lock. If you need to acquire both the queue_lock and attr_lock,
-    // ALWAYS acquire the queue_lock first, otherwise we can deadlock
+    // Taken for writing while the first error is recorded in sf_error. If you need to acquire both the queue_lock
+    // and attr_lock, ALWAYS acquire the queue_lock first, otherwise we can deadlock
     SF_RWLOCK_HANDLE attr_lock;
 
     // Snowflake statement error
@@ -66,11 +165,70 @@ struct SF_CHUNK_DOWNLOADER {
 SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
                                                    cJSON* chunk_headers,
                                                    cJSON *chunks,
+                                                   int64 column_count,
+                                                   const SF_C_TYPE *decode_types,
+                                                   sf_bool arrow_format,
                                                    uint64 thread_count,
                                                    uint64 fetch_slots,
+                                                   sf_bool adaptive_prefetch,
+                                                   sf_bool multi_download,
+                                                   uint64 memory_limit,
+                                                   const char *spill_dir,
                                                    SF_ERROR_STRUCT *sf_error,
                                                    sf_bool insecure_mode);
 sf_bool STDCALL chunk_downloader_term(SF_CHUNK_DOWNLOADER *chunk_downloader);
+/**
+ * Downloads and parses a chunk on the calling thread, apart from the queue. The chunk is decoded the same way the
+ * download threads would. Can be called from several threads at once.
+ *
+ * @param chunk_downloader Chunk downloader
+ * @param index Queue index of the chunk
+ * @param chunk Set to the chunk, which the caller owns
+ * @param error Set if the chunk can't be downloaded
+ * @return SF_BOOLEAN_FALSE on error
+ */
+sf_bool STDCALL chunk_downloader_download_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index,
+                                                SF_RESULT_CHUNK **chunk, SF_ERROR_STRUCT *error);
+/**
+ * Hands back a chunk the consumer is done with. The chunk is kept for reuse by the next download or freed.
+ *
+ * @param chunk_downloader Chunk downloader. Can be NULL, in which case the chunk is freed.
+ * @param chunk Chunk that came from this chunk downloader. Can be NULL.
+ */
+void STDCALL chunk_downloader_release_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, SF_RESULT_CHUNK *chunk);
+/**
+ * Records that the consumer has taken a chunk off the queue and frees up the memory budget of the chunk it took
+ * before. Must be called with queue_lock held.
+ *
+ * @param chunk_downloader Chunk downloader
+ * @param index Queue index of the chunk
+ * @param wait_time Time in milliseconds the consumer spent waiting for the chunk
+ */
+void STDCALL chunk_downloader_chunk_consumed(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index, uint64 wait_time);
+/**
+ * Finds the chunk that holds a row.
+ *
+ * @param chunk_downloader Chunk downloader
+ * @param row Index of the row counted from the first row of the first chunk
+ * @return Queue index of the chunk, or queue_size if the row is past the last chunk
+ */
+uint64 STDCALL chunk_downloader_find_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, int64 row);
+/**
+ * Makes the consumer continue with the given chunk, before or after the chunks it would take next. The threads are
+ * stopped, everything they downloaded so far is dropped and they start over with the chunk, so chunks that are
+ * skipped and weren't started yet are never downloaded. Must be called by the consumer without queue_lock held.
+ *
+ * @param chunk_downloader Chunk downloader
+ * @param index Queue index of the chunk the consumer takes next
+ * @return SF_BOOLEAN_FALSE if the threads can't be restarted or the downloader already failed
+ */
+sf_bool STDCALL chunk_downloader_seek(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index);
+/**
+ * Returns the largest amount of chunk memory in bytes that was in use at once.
+ *
+ * @param chunk_downloader Chunk downloader
+ */
+uint64 STDCALL chunk_downloader_memory_peak(SF_CHUNK_DOWNLOADER *chunk_downloader);
 sf_bool STDCALL get_shutdown_or_error(SF_CHUNK_DOWNLOADER *chunk_downloader);
 sf_bool STDCALL get_shutdown(SF_CHUNK_DOWNLOADER *chunk_downloader);
 sf_bool STDCALL get_error(SF_CHUNK_DOWNLOADER *chunk_downloader);
@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "chunk_parser.h"
+#include "arrow_chunk.h"
+#include "memory.h"
+#include <snowflake/logger.h>
+
+static sf_bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static sf_bool is_literal_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '+' || c == '-' || c == '.';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Appends bytes to the current cell value, which is written straight into the result chunk.
+ */
+static sf_bool append_value(SF_CHUNK_PARSER *parser, const char *data, size_t len) {
+    if (!result_chunk_append(parser->chunk, data, len)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    parser->value_len += len;
+    return SF_BOOLEAN_TRUE;
+}
+
+static sf_bool append_utf8(SF_CHUNK_PARSER *parser, uint32 code_point) {
+    char buf[4];
+    size_t len;
+    if (code_point < 0x80) {
+        buf[0] = (char) code_point;
+        len = 1;
+    } else if (code_point < 0x800) {
+        buf[0] = (char) (0xC0 | (code_point >> 6));
+        buf[1] = (char) (0x80 | (code_point & 0x3F));
+        len = 2;
+    } else if (code_point < 0x10000) {
+        buf[0] = (char) (0xE0 | (code_point >> 12));
+        buf[1] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+        buf[2] = (char) (0x80 | (code_point & 0x3F));
+        len = 3;
+    } else {
+        buf[0] = (char) (0xF0 | (code_point >> 18));
+        buf[1] = (char) (0x80 | ((code_point >> 12) & 0x3F));
+        buf[2] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+        buf[3] = (char) (0x80 | (code_point & 0x3F));
+        len = 4;
+    }
+    return append_value(parser, buf, len);
+}
+
+/**
+ * A high surrogate that is not followed by a low surrogate is written out on its own.
+ */
+static sf_bool flush_high_surrogate(SF_CHUNK_PARSER *parser) {
+    uint32 code_point = parser->high_surrogate;
+    if (code_point) {
+        parser->high_surrogate = 0;
+        return append_utf8(parser, code_point);
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+static sf_bool add_cell(SF_CHUNK_PARSER *parser, sf_bool is_null) {
+    parser->value_len = 0;
+    if (!result_chunk_end_value(parser->chunk, is_null)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    parser->state = CHUNK_PARSER_VALUE_END;
+    return SF_BOOLEAN_TRUE;
+}
+
+static sf_bool add_literal(SF_CHUNK_PARSER *parser) {
+    if (parser->value_len == 4 && memcmp(result_chunk_current_value(parser->chunk), "null", 4) == 0) {
+        return add_cell(parser, SF_BOOLEAN_TRUE);
+    }
+    // Numbers and booleans are kept as their text like any other value
+    return add_cell(parser, SF_BOOLEAN_FALSE);
+}
+
+static sf_bool create_chunk(SF_CHUNK_PARSER *parser) {
+    if (!parser->chunk) {
+        parser->chunk = result_chunk_init(parser->column_count, parser->row_capacity, parser->size_hint);
+    }
+    return parser->chunk ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+static sf_bool start_row(SF_CHUNK_PARSER *parser) {
+    parser->state = CHUNK_PARSER_VALUE_START;
+    return create_chunk(parser);
+}
+
+static sf_bool end_row(SF_CHUNK_PARSER *parser) {
+    // Fails if the row does not have a value for every column
+    if (!result_chunk_end_row(parser->chunk)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    parser->row_count++;
+    parser->row_expected = SF_BOOLEAN_FALSE;
+    parser->state = CHUNK_PARSER_ROW_END;
+    return SF_BOOLEAN_TRUE;
+}
+
+void STDCALL chunk_parser_init(SF_CHUNK_PARSER *parser, int64 column_count, int64 row_capacity, size_t size_hint) {
+    memset(parser, 0, sizeof(SF_CHUNK_PARSER));
+    parser->state = CHUNK_PARSER_ROW_START;
+    parser->column_count = column_count;
+    parser->row_capacity = row_capacity;
+    parser->size_hint = size_hint;
+}
+
+void STDCALL chunk_parser_set_arrow(SF_CHUNK_PARSER *parser, const SF_C_TYPE *column_types) {
+    parser->arrow = SF_BOOLEAN_TRUE;
+    parser->column_types = column_types;
+}
+
+void STDCALL chunk_parser_set_spill(SF_CHUNK_PARSER *parser, SF_CHUNK_SPILL *spill) {
+    parser->spill = spill;
+}
+
+void STDCALL chunk_parser_set_chunk(SF_CHUNK_PARSER *parser, SF_RESULT_CHUNK *chunk) {
+    result_chunk_term(parser->chunk);
+    parser->chunk = chunk;
+}
+
+void STDCALL chunk_parser_reset(SF_CHUNK_PARSER *parser) {
+    SF_CHUNK_SPILL *spill = parser->spill;
+    sf_bool arrow = parser->arrow;
+    const SF_C_TYPE *column_types = parser->column_types;
+    char *raw = parser->raw;
+    size_t raw_cap = parser->raw_cap;
+    SF_RESULT_CHUNK *chunk = parser->chunk;
+    chunk_parser_init(parser, parser->column_count, parser->row_capacity, parser->size_hint);
+    // Keep the format, the raw buffer and the memory of the chunk for the next attempt
+    if (chunk) {
+        result_chunk_clear(chunk);
+    }
+    parser->chunk = chunk;
+    parser->arrow = arrow;
+    parser->column_types = column_types;
+    parser->raw = raw;
+    parser->raw_cap = raw_cap;
+    parser->spill = spill;
+    if (spill && !chunk_spill_truncate(spill)) {
+        parser->state = CHUNK_PARSER_ERROR;
+    }
+}
+
+void STDCALL chunk_parser_term(SF_CHUNK_PARSER *parser) {
+    result_chunk_term(parser->chunk);
+    parser->chunk = NULL;
+    SF_FREE(parser->raw);
+    parser->raw_len = 0;
+    parser->raw_cap = 0;
+}
+
+static sf_bool append_raw(SF_CHUNK_PARSER *parser, const char *data, size_t len) {
+    size_t cap = parser->raw_cap ? parser->raw_cap : (parser->size_hint > 0 ? parser->size_hint : 4096);
+    char *raw;
+    while (cap < parser->raw_len + len) {
+        cap *= 2;
+    }
+    if (cap != parser->raw_cap) {
+        raw = (char *) SF_REALLOC(parser->raw, cap);
+        if (!raw) {
+            parser->state = CHUNK_PARSER_ERROR;
+            return SF_BOOLEAN_FALSE;
+        }
+        parser->raw = raw;
+        parser->raw_cap = cap;
+    }
+    memcpy(&parser->raw[parser->raw_len], data, len);
+    parser->raw_len += len;
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL chunk_parser_feed(SF_CHUNK_PARSER *parser, const char *data, size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+    const char *run;
+    char c;
+    int digit;
+    uint32 code_point;
+
+    if (parser->spill) {
+        if (parser->state == CHUNK_PARSER_ERROR || !chunk_spill_write(parser->spill, data, len)) {
+            parser->state = CHUNK_PARSER_ERROR;
+            return SF_BOOLEAN_FALSE;
+        }
+        return SF_BOOLEAN_TRUE;
+    }
+    if (parser->arrow) {
+        return append_raw(parser, data, len);
+    }
+
+    while (p < end) {
+        c = *p;
+        switch (parser->state) {
+            case CHUNK_PARSER_ROW_START:
+                if (!is_whitespace(c)) {
+                    if (c != '[' || !start_row(parser)) {
+                        goto error;
+                    }
+                }
+                p++;
+                break;
+            case CHUNK_PARSER_ROW_END:
+                if (!is_whitespace(c)) {
+                    if (c != ',') {
+                        goto error;
+                    }
+                    parser->row_expected = SF_BOOLEAN_TRUE;
+                    parser->state = CHUNK_PARSER_ROW_START;
+                }
+                p++;
+                break;
+            case CHUNK_PARSER_VALUE_START:
+                if (is_whitespace(c)) {
+                    p++;
+                } else if (c == '"') {
+                    parser->value_len = 0;
+                    parser->state = CHUNK_PARSER_STRING;
+                    p++;
+                } else if (c == ']' && parser->chunk->cur_column == 0) {
+                    // Empty row
+                    if (!end_row(parser)) {
+                        goto error;
+                    }
+                    p++;
+                } else if (c == '[' || c == '{') {
+                    // Nested values are kept as their raw JSON text
+                    parser->value_len = 0;
+                    parser->nested_depth = 0;
+                    parser->nested_in_string = SF_BOOLEAN_FALSE;
+                    parser->nested_escape = SF_BOOLEAN_FALSE;
+                    parser->state = CHUNK_PARSER_NESTED;
+                } else if (is_literal_char(c)) {
+                    parser->value_len = 0;
+                    parser->state = CHUNK_PARSER_LITERAL;
+                } else {
+                    goto error;
+                }
+                break;
+            case CHUNK_PARSER_VALUE_END:
+                if (c == ',') {
+                    parser->state = CHUNK_PARSER_VALUE_START;
+                } else if (c == ']') {
+                    if (!end_row(parser)) {
+                        goto error;
+                    }
+                } else if (!is_whitespace(c)) {
+                    goto error;
+                }
+                p++;
+                break;
+            case CHUNK_PARSER_STRING:
+                // Copy everything up to the next quote or escape in one go
+                run = p;
+                while (p < end && *p != '"' && *p != '\\') {
+                    p++;
+                }
+                if (p > run && (!flush_high_surrogate(parser) || !append_value(parser, run, (size_t) (p - run)))) {
+                    goto error;
+                }
+                if (p == end) {
+                    break;
+                }
+                if (*p == '"') {
+                    if (!flush_high_surrogate(parser) || !add_cell(parser, SF_BOOLEAN_FALSE)) {
+                        goto error;
+                    }
+                } else {
+                    parser->state = CHUNK_PARSER_STRING_ESCAPE;
+                }
+                p++;
+                break;
+            case CHUNK_PARSER_STRING_ESCAPE:
+                p++;
+                if (c == 'u') {
+                    parser->unicode = 0;
+                    parser->unicode_digits = 0;
+                    parser->state = CHUNK_PARSER_STRING_UNICODE;
+                    break;
+                }
+                switch (c) {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        break;
+                    case 'b':
+                        c = '\b';
+                        break;
+                    case 'f':
+                        c = '\f';
+                        break;
+                    case 'n':
+                        c = '\n';
+                        break;
+                    case 'r':
+                        c = '\r';
+                        break;
+                    case 't':
+                        c = '\t';
+                        break;
+                    default:
+                        goto error;
+                }
+                if (!flush_high_surrogate(parser) || !append_value(parser, &c, 1)) {
+                    goto error;
+                }
+                parser->state = CHUNK_PARSER_STRING;
+                break;
+            case CHUNK_PARSER_STRING_UNICODE:
+                if ((digit = hex_value(c)) < 0) {
+                    goto error;
+                }
+                p++;
+                parser->unicode = (parser->unicode << 4) | (uint32) digit;
+                if (++parser->unicode_digits < 4) {
+                    break;
+                }
+                code_point = parser->unicode;
+                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                    if (!flush_high_surrogate(parser)) {
+                        goto error;
+                    }
+                    parser->high_surrogate = code_point;
+                } else if (code_point >= 0xDC00 && code_point <= 0xDFFF && parser->high_surrogate) {
+                    code_point = 0x10000 + ((parser->high_surrogate - 0xD800) << 10) + (code_point - 0xDC00);
+                    parser->high_surrogate = 0;
+                    if (!append_utf8(parser, code_point)) {
+                        goto error;
+                    }
+                } else if (!flush_high_surrogate(parser) || !append_utf8(parser, code_point)) {
+                    goto error;
+                }
+                parser->state = CHUNK_PARSER_STRING;
+                break;
+            case CHUNK_PARSER_LITERAL:
+                if (is_literal_char(c)) {
+                    if (!append_value(parser, &c, 1)) {
+                        goto error;
+                    }
+                    p++;
+                } else if (!add_literal(parser)) {
+                    goto error;
+                }
+                // The delimiter is handled in the value end state
+                break;
+            case CHUNK_PARSER_NESTED:
+                if (!append_value(parser, &c, 1)) {
+                    goto error;
+                }
+                p++;
+                if (parser->nested_in_string) {
+                    if (parser->nested_escape) {
+                        parser->nested_escape = SF_BOOLEAN_FALSE;
+                    } else if (c == '\\') {
+                        parser->nested_escape = SF_BOOLEAN_TRUE;
+                    } else if (c == '"') {
+                        parser->nested_in_string = SF_BOOLEAN_FALSE;
+                    }
+                } else if (c == '"') {
+                    parser->nested_in_string = SF_BOOLEAN_TRUE;
+                } else if (c == '[' || c == '{') {
+                    parser->nested_depth++;
+                } else if ((c == ']' || c == '}') && --parser->nested_depth == 0) {
+                    if (!add_cell(parser, SF_BOOLEAN_FALSE)) {
+                        goto error;
+                    }
+                }
+                break;
+            default:
+                return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    return SF_BOOLEAN_TRUE;
+
+error:
+    log_error("Invalid result chunk data after %lld rows", parser->row_count);
+    parser->state = CHUNK_PARSER_ERROR;
+    return SF_BOOLEAN_FALSE;
+}
+
+sf_bool STDCALL chunk_parser_finish(SF_CHUNK_PARSER *parser, SF_RESULT_CHUNK **chunk) {
+    if (parser->spill) {
+        *chunk = NULL;
+        return parser->state != CHUNK_PARSER_ERROR && chunk_spill_close(parser->spill) ? SF_BOOLEAN_TRUE
+                                                                                       : SF_BOOLEAN_FALSE;
+    }
+    if (parser->arrow) {
+        *chunk = arrow_chunk_parse(parser->raw, parser->raw_len, parser->column_count, parser->column_types);
+        return *chunk ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    }
+    if (parser->state != CHUNK_PARSER_ROW_END &&
+        (parser->state != CHUNK_PARSER_ROW_START || parser->row_expected)) {
+        log_error("Result chunk ended in the middle of row %lld", parser->row_count + 1);
+        return SF_BOOLEAN_FALSE;
+    }
+    if (!create_chunk(parser)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    *chunk = parser->chunk;
+    parser->chunk = NULL;
+    return SF_BOOLEAN_TRUE;
+}
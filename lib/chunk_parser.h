@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_CHUNK_PARSER_H
+#define SNOWFLAKE_CHUNK_PARSER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <snowflake/basic_types.h>
+#include "result_chunk.h"
+#include "chunk_spill.h"
+
+/**
+ * Parser state. See chunk_parser.c for the transitions.
+ */
+typedef enum SF_CHUNK_PARSER_STATE {
+    CHUNK_PARSER_ROW_START,
+    CHUNK_PARSER_ROW_END,
+    CHUNK_PARSER_VALUE_START,
+    CHUNK_PARSER_VALUE_END,
+    CHUNK_PARSER_STRING,
+    CHUNK_PARSER_STRING_ESCAPE,
+    CHUNK_PARSER_STRING_UNICODE,
+    CHUNK_PARSER_LITERAL,
+    CHUNK_PARSER_NESTED,
+    CHUNK_PARSER_ERROR
+} SF_CHUNK_PARSER_STATE;
+
+/**
+ * Push parser for result chunks. A chunk is a comma separated list of JSON arrays, one per row, without the
+ * enclosing brackets. Bytes are fed as they arrive from the network and every value is written straight into a
+ * columnar result chunk, so neither the raw chunk text nor a JSON tree ever has to be held in memory.
+ */
+typedef struct SF_CHUNK_PARSER {
+    SF_CHUNK_PARSER_STATE state;
+
+    // Set after a comma between rows so that a trailing comma is rejected
+    sf_bool row_expected;
+
+    // Length of the current cell value so far
+    size_t value_len;
+
+    // \uXXXX escape handling
+    uint32 unicode;
+    int unicode_digits;
+    uint32 high_surrogate;
+
+    // Nesting level and string state for nested arrays/objects which are kept as raw JSON text
+    int nested_depth;
+    sf_bool nested_in_string;
+    sf_bool nested_escape;
+
+    // Parsed rows and the settings the result chunk is created with
+    SF_RESULT_CHUNK *chunk;
+    int64 column_count;
+    int64 row_capacity;
+    size_t size_hint;
+    int64 row_count;
+
+    // Arrow chunks can't be converted piece by piece, so the raw bytes are collected until the chunk is complete
+    sf_bool arrow;
+    const SF_C_TYPE *column_types;
+    char *raw;
+    size_t raw_len;
+    size_t raw_cap;
+
+    // If set, the raw bytes are written to this scratch file instead of being parsed
+    SF_CHUNK_SPILL *spill;
+} SF_CHUNK_PARSER;
+
+/**
+ * Initializes a chunk parser.
+ *
+ * @param parser Parser to initialize.
+ * @param column_count Number of columns in every row.
+ * @param row_capacity Expected number of rows, 0 if unknown.
+ * @param size_hint Expected size of the parsed values in bytes, 0 if unknown.
+ */
+void STDCALL chunk_parser_init(SF_CHUNK_PARSER *parser, int64 column_count, int64 row_capacity, size_t size_hint);
+
+/**
+ * Switches the parser to Arrow IPC chunks. The chunk is converted with arrow_chunk_parse in chunk_parser_finish.
+ *
+ * @param parser Parser to switch.
+ * @param column_types C type of every column, see arrow_chunk_parse. Must stay valid while the parser is used.
+ */
+void STDCALL chunk_parser_set_arrow(SF_CHUNK_PARSER *parser, const SF_C_TYPE *column_types);
+
+/**
+ * Makes the parser write the raw chunk bytes to a scratch file instead of parsing them. chunk_parser_finish then
+ * completes the file and returns no rows; the file is parsed later from chunk_spill_map.
+ *
+ * @param parser Parser to switch.
+ * @param spill Scratch file. Owned by the caller.
+ */
+void STDCALL chunk_parser_set_spill(SF_CHUNK_PARSER *parser, SF_CHUNK_SPILL *spill);
+
+/**
+ * Makes the parser fill an existing chunk instead of creating one, which saves allocating the chunk's memory again.
+ *
+ * @param parser Parser that hasn't been fed yet.
+ * @param chunk Empty chunk with the parser's column count, see result_chunk_clear. Owned by the parser from now on.
+ */
+void STDCALL chunk_parser_set_chunk(SF_CHUNK_PARSER *parser, SF_RESULT_CHUNK *chunk);
+
+/**
+ * Discards all parsed rows and partial state so that the parser can start over, e.g. when a download is retried.
+ *
+ * @param parser Parser to reset.
+ */
+void STDCALL chunk_parser_reset(SF_CHUNK_PARSER *parser);
+
+/**
+ * Frees the memory held by the parser, including any rows that were not taken with chunk_parser_finish.
+ *
+ * @param parser Parser to terminate.
+ */
+void STDCALL chunk_parser_term(SF_CHUNK_PARSER *parser);
+
+/**
+ * Parses the next piece of a chunk.
+ *
+ * @param parser Chunk parser.
+ * @param data Chunk bytes.
+ * @param len Number of bytes in data.
+ * @return SF_BOOLEAN_TRUE if the data is valid so far, SF_BOOLEAN_FALSE on a syntax error.
+ */
+sf_bool STDCALL chunk_parser_feed(SF_CHUNK_PARSER *parser, const char *data, size_t len);
+
+/**
+ * Checks that the chunk ended on a row boundary and hands the parsed rows over to the caller.
+ *
+ * @param parser Chunk parser.
+ * @param chunk Set to the parsed rows on success, NULL if the chunk was written to a scratch file. The caller owns
+ *              it and frees it with result_chunk_term.
+ * @return SF_BOOLEAN_TRUE on success, SF_BOOLEAN_FALSE if the chunk was truncated or invalid.
+ */
+sf_bool STDCALL chunk_parser_finish(SF_CHUNK_PARSER *parser, SF_RESULT_CHUNK **chunk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_CHUNK_PARSER_H
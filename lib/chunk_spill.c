@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "chunk_spill.h"
+#include "memory.h"
+#include <snowflake/logger.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#define SPILL_PATH_SEP '\\'
+#define spill_pid() ((unsigned long) GetCurrentProcessId())
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#define SPILL_PATH_SEP '/'
+#define spill_pid() ((unsigned long) getpid())
+#endif
+
+/**
+ * Creates the file for writing, only readable by the current user. Fails if the path exists, so that a file or link
+ * someone else put into the spill directory is never written to.
+ */
+static FILE *spill_open_exclusive(const char *path) {
+    FILE *file;
+#ifdef _WIN32
+    int fd = _open(path, _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!(file = _fdopen(fd, "wb"))) {
+        _close(fd);
+    }
+#else
+    int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!(file = fdopen(fd, "wb"))) {
+        close(fd);
+    }
+#endif
+    return file;
+}
+
+SF_CHUNK_SPILL *STDCALL chunk_spill_create(const char *dir, const void *owner, uint64 index) {
+    SF_CHUNK_SPILL *spill = (SF_CHUNK_SPILL *) SF_CALLOC(1, sizeof(SF_CHUNK_SPILL));
+    size_t path_len = strlen(dir) + 64;
+    if (!spill) {
+        return NULL;
+    }
+    spill->path = (char *) SF_CALLOC(1, path_len);
+    if (!spill->path) {
+        SF_FREE(spill);
+        return NULL;
+    }
+    snprintf(spill->path, path_len, "%s%csf_chunk_%lu_%p_%llu.tmp", dir, SPILL_PATH_SEP, spill_pid(), owner,
+             (unsigned long long) index);
+    spill->file = spill_open_exclusive(spill->path);
+    if (!spill->file) {
+        log_error("Unable to create chunk spill file %s", spill->path);
+        SF_FREE(spill->path);
+        SF_FREE(spill);
+        return NULL;
+    }
+    return spill;
+}
+
+sf_bool STDCALL chunk_spill_write(SF_CHUNK_SPILL *spill, const char *data, size_t len) {
+    if (!spill->file || fwrite(data, 1, len, spill->file) != len) {
+        log_error("Unable to write chunk spill file %s", spill->path);
+        return SF_BOOLEAN_FALSE;
+    }
+    spill->size += len;
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL chunk_spill_truncate(SF_CHUNK_SPILL *spill) {
+    // The file is truncated through the open handle instead of being opened again by name
+    if (!spill->file || fflush(spill->file) != 0) {
+        return SF_BOOLEAN_FALSE;
+    }
+#ifdef _WIN32
+    if (_chsize_s(_fileno(spill->file), 0) != 0) {
+#else
+    if (ftruncate(fileno(spill->file), 0) != 0) {
+#endif
+        log_error("Unable to truncate chunk spill file %s", spill->path);
+        return SF_BOOLEAN_FALSE;
+    }
+    rewind(spill->file);
+    spill->size = 0;
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL chunk_spill_close(SF_CHUNK_SPILL *spill) {
+    sf_bool ret = SF_BOOLEAN_FALSE;
+    if (spill->file) {
+        ret = fclose(spill->file) == 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+        spill->file = NULL;
+    }
+    return ret;
+}
+
+const char *STDCALL chunk_spill_map(SF_CHUNK_SPILL *spill, size_t *len) {
+    *len = spill->size;
+    if (spill->data) {
+        return spill->data;
+    }
+    // Empty files can't be mapped
+    if (spill->size == 0) {
+        return "";
+    }
+#ifdef _WIN32
+    spill->map_file = CreateFileA(spill->path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (spill->map_file == INVALID_HANDLE_VALUE) {
+        spill->map_file = NULL;
+        goto error;
+    }
+    spill->mapping = CreateFileMappingA(spill->map_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!spill->mapping) {
+        goto error;
+    }
+    spill->data = (char *) MapViewOfFile(spill->mapping, FILE_MAP_READ, 0, 0, spill->size);
+    if (!spill->data) {
+        goto error;
+    }
+#else
+    int fd = open(spill->path, O_RDONLY);
+    void *data;
+    if (fd < 0) {
+        goto error;
+    }
+    data = mmap(NULL, spill->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file is closed
+    close(fd);
+    if (data == MAP_FAILED) {
+        goto error;
+    }
+    // The chunk is read front to back once
+    madvise(data, spill->size, MADV_SEQUENTIAL);
+    spill->data = (char *) data;
+#endif
+    return spill->data;
+
+error:
+    log_error("Unable to map chunk spill file %s", spill->path);
+    return NULL;
+}
+
+void STDCALL chunk_spill_term(SF_CHUNK_SPILL *spill) {
+    if (!spill) {
+        return;
+    }
+    if (spill->file) {
+        fclose(spill->file);
+    }
+#ifdef _WIN32
+    if (spill->data) {
+        UnmapViewOfFile(spill->data);
+    }
+    if (spill->mapping) {
+        CloseHandle(spill->mapping);
+    }
+    if (spill->map_file) {
+        CloseHandle(spill->map_file);
+    }
+#else
+    if (spill->data) {
+        munmap(spill->data, spill->size);
+    }
+#endif
+    remove(spill->path);
+    SF_FREE(spill->path);
+    SF_FREE(spill);
+}
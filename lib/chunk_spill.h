@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_CHUNK_SPILL_H
+#define SNOWFLAKE_CHUNK_SPILL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <snowflake/basic_types.h>
+#include <snowflake/platform.h>
+
+/**
+ * Raw bytes of a result chunk kept in a scratch file until there is room to parse it. The file is written once,
+ * then mapped into memory to be read, and deleted when the spill is freed.
+ */
+typedef struct SF_CHUNK_SPILL {
+    char *path;
+    // Open while the chunk is being written
+    FILE *file;
+    size_t size;
+
+    // Mapped file contents, NULL until chunk_spill_map is called
+    char *data;
+#ifdef _WIN32
+    HANDLE map_file;
+    HANDLE mapping;
+#endif
+} SF_CHUNK_SPILL;
+
+/**
+ * Creates an empty scratch file for a chunk, only readable by the current user.
+ *
+ * @param dir Directory to create the file in.
+ * @param owner Makes the file name unique together with index, e.g. the chunk downloader.
+ * @param index Index of the chunk.
+ * @return The spill or NULL if the file can't be created or already exists.
+ */
+SF_CHUNK_SPILL *STDCALL chunk_spill_create(const char *dir, const void *owner, uint64 index);
+
+/**
+ * Appends bytes to the file.
+ *
+ * @param spill Chunk spill.
+ * @param data Bytes to append.
+ * @param len Number of bytes.
+ * @return SF_BOOLEAN_FALSE if the bytes can't be written, e.g. because the disk is full.
+ */
+sf_bool STDCALL chunk_spill_write(SF_CHUNK_SPILL *spill, const char *data, size_t len);
+
+/**
+ * Discards everything written so far, e.g. when a download is retried. Only possible before chunk_spill_close.
+ *
+ * @param spill Chunk spill.
+ * @return SF_BOOLEAN_FALSE if the file can't be truncated.
+ */
+sf_bool STDCALL chunk_spill_truncate(SF_CHUNK_SPILL *spill);
+
+/**
+ * Completes the file. Nothing can be written afterwards.
+ *
+ * @param spill Chunk spill.
+ * @return SF_BOOLEAN_FALSE if the buffered bytes can't be written.
+ */
+sf_bool STDCALL chunk_spill_close(SF_CHUNK_SPILL *spill);
+
+/**
+ * Maps the completed file into memory.
+ *
+ * @param spill Chunk spill.
+ * @param len Set to the size of the file.
+ * @return The file contents, valid until chunk_spill_term, or NULL if the file can't be mapped.
+ */
+const char *STDCALL chunk_spill_map(SF_CHUNK_SPILL *spill, size_t *len);
+
+/**
+ * Unmaps and deletes the file and frees the spill.
+ *
+ * @param spill Chunk spill. Can be NULL.
+ */
+void STDCALL chunk_spill_term(SF_CHUNK_SPILL *spill);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_CHUNK_SPILL_H
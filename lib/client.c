@@ -16,6 +16,8 @@
 #include "results.h"
 #include "error.h"
 #include "chunk_downloader.h"
+#include "arrow_chunk.h"
+#include "timezone.h"
 
 #define curl_easier_escape(curl, string) curl_easy_escape(curl, string, 0)
 
@@ -25,9 +27,12 @@ char *CA_BUNDLE_FILE;
 int32 SSL_VERSION;
 sf_bool DEBUG;
 sf_bool SF_OCSP_CHECK;
+uint64 CHUNK_MEMORY_LIMIT;
+char *CHUNK_SPILL_DIR;
 
 static char *LOG_PATH = NULL;
 static FILE *LOG_FP = NULL;
+static sf_bool ASYNC_LOG;
 
 static SF_MUTEX_HANDLE log_lock;
 static SF_MUTEX_HANDLE gmlocaltime_lock;
@@ -269,6 +274,44 @@ void STDCALL _snowflake_memory_hooks_setup(SF_USER_MEM_HOOKS *hooks) {
     }
 }
 
+/*
+ * Allocation functions handed to cURL and OpenSSL, so that they allocate through the same hooks as the library.
+ */
+static char *_snowflake_hook_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = (char *) global_hooks.alloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+static void *_snowflake_crypto_malloc(size_t size, const char *file, int line) {
+    return global_hooks.alloc(size);
+}
+
+static void *_snowflake_crypto_realloc(void *ptr, size_t size, const char *file, int line) {
+    return global_hooks.realloc(ptr, size);
+}
+
+static void _snowflake_crypto_free(void *ptr, const char *file, int line) {
+    global_hooks.dealloc(ptr);
+}
+
+/**
+ * Makes OpenSSL and cJSON allocate through the memory hooks. cURL is given them by curl_global_init_mem.
+ */
+static void STDCALL _snowflake_library_memory_hooks_setup() {
+    cJSON_Hooks cjson_hooks;
+    // Fails once OpenSSL has allocated anything, so it must come before cURL initializes it
+    if (!CRYPTO_set_mem_functions(_snowflake_crypto_malloc, _snowflake_crypto_realloc, _snowflake_crypto_free)) {
+        log_warn("OpenSSL was initialized before snowflake_global_init and keeps its own allocator");
+    }
+    cjson_hooks.malloc_fn = global_hooks.alloc;
+    cjson_hooks.free_fn = global_hooks.dealloc;
+    snowflake_cJSON_InitHooks(&cjson_hooks);
+}
+
 /*
  * Initializes logging file
  */
@@ -358,6 +401,9 @@ cleanup:
  */
 static void STDCALL log_term() {
     SF_FREE(LOG_PATH);
+    // Writes out the queued lines while the log file is still open
+    log_set_async(0, 0);
+    ASYNC_LOG = SF_BOOLEAN_FALSE;
     if (LOG_FP) {
         fclose(LOG_FP);
         log_set_fp(NULL);
@@ -471,21 +517,35 @@ SF_STATUS STDCALL snowflake_global_init(
     SSL_VERSION = CURL_SSLVERSION_TLSv1_2;
     DEBUG = SF_BOOLEAN_FALSE;
     SF_OCSP_CHECK = SF_BOOLEAN_TRUE;
+    CHUNK_MEMORY_LIMIT = 0;
+    CHUNK_SPILL_DIR = NULL;
 
     _snowflake_memory_hooks_setup(hooks);
     sf_memory_init();
     sf_error_init();
+    sf_timezone_init();
     if (!log_init(log_path, log_level)) {
         // no way to log error because log_init failed.
         fprintf(stderr, "Error during log initialization");
         goto cleanup;
     }
-    CURLcode curl_ret = curl_global_init(CURL_GLOBAL_DEFAULT);
+    CURLcode curl_ret;
+    if (hooks) {
+        _snowflake_library_memory_hooks_setup();
+        curl_ret = curl_global_init_mem(CURL_GLOBAL_DEFAULT, global_hooks.alloc, global_hooks.dealloc,
+                                        global_hooks.realloc, _snowflake_hook_strdup, global_hooks.calloc);
+    } else {
+        curl_ret = curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
     if (curl_ret != CURLE_OK) {
         log_fatal("curl_global_init() failed: %s",
                   curl_easy_strerror(curl_ret));
         goto cleanup;
     }
+    if (!http_share_init()) {
+        log_fatal("Failed to create the cURL shares");
+        goto cleanup;
+    }
 
     ret = SF_STATUS_SUCCESS;
 
@@ -494,12 +554,15 @@ cleanup:
 }
 
 SF_STATUS STDCALL snowflake_global_term() {
+    http_share_term();
     curl_global_cleanup();
 
     // Cleanup Constants
     SF_FREE(CA_BUNDLE_FILE);
+    SF_FREE(CHUNK_SPILL_DIR);
 
     log_term();
+    sf_timezone_term();
     sf_alloc_map_to_log(SF_BOOLEAN_TRUE);
     sf_error_term();
     sf_memory_term();
@@ -529,6 +592,18 @@ snowflake_global_set_attribute(SF_GLOBAL_ATTRIBUTE type, const void *value) {
         case SF_GLOBAL_OCSP_CHECK:
             SF_OCSP_CHECK = *(sf_bool *) value;
             break;
+        case SF_GLOBAL_CHUNK_MEMORY_LIMIT:
+            CHUNK_MEMORY_LIMIT = *(uint64 *) value;
+            break;
+        case SF_GLOBAL_CHUNK_SPILL_DIR:
+            alloc_buffer_and_copy(&CHUNK_SPILL_DIR, value);
+            break;
+        case SF_GLOBAL_ASYNC_LOG:
+            if (log_set_async(*(sf_bool *) value, 0) != 0) {
+                return SF_STATUS_ERROR_GENERAL;
+            }
+            ASYNC_LOG = *(sf_bool *) value;
+            break;
         default:
             break;
     }
@@ -537,6 +612,7 @@ snowflake_global_set_attribute(SF_GLOBAL_ATTRIBUTE type, const void *value) {
 
 SF_STATUS STDCALL
 snowflake_global_get_attribute(SF_GLOBAL_ATTRIBUTE type, void *value) {
+    SF_LOG_ASYNC_STATS log_stats;
     switch (type) {
         case SF_GLOBAL_DISABLE_VERIFY_PEER:
             *((sf_bool *) value) = DISABLE_VERIFY_PEER;
@@ -555,6 +631,21 @@ snowflake_global_get_attribute(SF_GLOBAL_ATTRIBUTE type, void *value) {
         case SF_GLOBAL_OCSP_CHECK:
             *((sf_bool *) value) = SF_OCSP_CHECK;
             break;
+        case SF_GLOBAL_CHUNK_MEMORY_LIMIT:
+            *((uint64 *) value) = CHUNK_MEMORY_LIMIT;
+            break;
+        case SF_GLOBAL_CHUNK_SPILL_DIR:
+            if (CHUNK_SPILL_DIR) {
+                strncpy(value, CHUNK_SPILL_DIR, strlen(CHUNK_SPILL_DIR) + 1);
+            }
+            break;
+        case SF_GLOBAL_ASYNC_LOG:
+            *((sf_bool *) value) = ASYNC_LOG;
+            break;
+        case SF_GLOBAL_ASYNC_LOG_DROPPED:
+            log_get_async_stats(&log_stats);
+            *((uint64 *) value) = log_stats.dropped;
+            break;
         default:
             break;
     }
@@ -601,6 +692,19 @@ SF_CONNECT *STDCALL snowflake_init() {
         sf->directURL_param = NULL;
         sf->directURL = NULL;
         sf->direct_query_token = NULL;
+
+        sf->chunk_download_threads = SF_DEFAULT_CHUNK_DOWNLOAD_THREADS;
+        sf->chunk_prefetch_slots = SF_DEFAULT_CHUNK_PREFETCH_SLOTS;
+        sf->chunk_adaptive_prefetch = SF_BOOLEAN_FALSE;
+        sf->chunk_eager_decode = SF_BOOLEAN_FALSE;
+        sf->chunk_multi_download = SF_BOOLEAN_FALSE;
+        sf->arrow_result_format = SF_BOOLEAN_FALSE;
+        sf->query_poll_max_interval = SF_DEFAULT_QUERY_POLL_MAX_INTERVAL;
+        sf->request_compression_threshold = SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD;
+        // Without it every request sets up its own handle and header
+        if (!http_session_init(sf)) {
+            log_warn("Unable to create the HTTP session of the connection");
+        }
     }
 
     return sf;
@@ -622,17 +726,20 @@ SF_STATUS STDCALL snowflake_term(SF_CONNECT *sf) {
         };
         if (request(sf, &resp, DELETE_SESSION_URL, url_params,
                     sizeof(url_params) / sizeof(URL_KEY_VALUE), NULL, NULL,
-                    POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE)) {
-            s_resp = snowflake_cJSON_Print(resp);
-            log_trace("JSON response:\n%s", s_resp);
+                    POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE, SF_BOOLEAN_TRUE)) {
+            if (log_enabled(SF_LOG_TRACE)) {
+                s_resp = snowflake_cJSON_Print(resp);
+                log_trace("JSON response:\n%s", s_resp);
+            }
             /* Even if the session deletion fails, it will be cleaned after 7 days.
              * Catching error here won't help
              */
         }
         snowflake_cJSON_Delete(resp);
-        SF_FREE(s_resp);
+        snowflake_cJSON_free(s_resp);
     }
 
+    http_session_term(sf);
     _mutex_term(&sf->mutex_sequence_counter);
     _mutex_term(&sf->mutex_parameters);
     SF_FREE(sf->host);
@@ -738,9 +845,11 @@ SF_STATUS STDCALL snowflake_connect(SF_CONNECT *sf) {
     // Send request and get data
     if (request(sf, &resp, SESSION_URL, url_params,
                 sizeof(url_params) / sizeof(URL_KEY_VALUE), s_body, NULL,
-                POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE)) {
-        s_resp = snowflake_cJSON_Print(resp);
-        log_trace("Here is JSON response:\n%s", s_resp);
+                POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE, SF_BOOLEAN_TRUE)) {
+        if (log_enabled(SF_LOG_TRACE)) {
+            s_resp = snowflake_cJSON_Print(resp);
+            log_trace("Here is JSON response:\n%s", s_resp);
+        }
         if ((json_error = json_copy_bool(&success, resp, "success")) !=
             SF_JSON_ERROR_NONE) {
             log_error("JSON error: %d", json_error);
@@ -808,8 +917,8 @@ cleanup:
     }
     snowflake_cJSON_Delete(body);
     snowflake_cJSON_Delete(resp);
-    SF_FREE(s_body);
-    SF_FREE(s_resp);
+    snowflake_cJSON_free(s_body);
+    snowflake_cJSON_free(s_resp);
 
     return ret;
 }
@@ -920,7 +1029,34 @@ SF_STATUS STDCALL snowflake_set_attribute(
         break;
         case SF_DIR_QUERY_TOKEN:
             alloc_buffer_and_copy(&sf->direct_query_token, value);
+            http_session_reset_headers(sf);
         break;
+        case SF_CON_CHUNK_DOWNLOAD_THREADS:
+            sf->chunk_download_threads = value && *((uint64 *) value) > 0 ?
+              *((uint64 *) value) : SF_DEFAULT_CHUNK_DOWNLOAD_THREADS;
+            break;
+        case SF_CON_CHUNK_PREFETCH_SLOTS:
+            sf->chunk_prefetch_slots = value && *((uint64 *) value) > 0 ?
+              *((uint64 *) value) : SF_DEFAULT_CHUNK_PREFETCH_SLOTS;
+            break;
+        case SF_CON_CHUNK_ADAPTIVE_PREFETCH:
+            sf->chunk_adaptive_prefetch = value ? *((sf_bool *) value) : SF_BOOLEAN_FALSE;
+            break;
+        case SF_CON_CHUNK_EAGER_DECODE:
+            sf->chunk_eager_decode = value ? *((sf_bool *) value) : SF_BOOLEAN_FALSE;
+            break;
+        case SF_CON_ARROW_RESULT_FORMAT:
+            sf->arrow_result_format = value ? *((sf_bool *) value) : SF_BOOLEAN_FALSE;
+            break;
+        case SF_CON_CHUNK_MULTI_DOWNLOAD:
+            sf->chunk_multi_download = value ? *((sf_bool *) value) : SF_BOOLEAN_FALSE;
+            break;
+        case SF_CON_QUERY_POLL_MAX_INTERVAL:
+            sf->query_poll_max_interval = value ? *((uint64 *) value) : SF_DEFAULT_QUERY_POLL_MAX_INTERVAL;
+            break;
+        case SF_CON_REQUEST_COMPRESSION_THRESHOLD:
+            sf->request_compression_threshold = value ? *((uint64 *) value) : SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD;
+            break;
         default:
             SET_SNOWFLAKE_ERROR(&sf->error, SF_STATUS_ERROR_BAD_ATTRIBUTE_TYPE,
                                 "Invalid attribute type",
@@ -1063,6 +1199,31 @@ static void STDCALL _snowflake_deallocate_named_param_list(void * name_list)
     SF_FREE(name_list);
 }
 
+/**
+ * Hands the chunk in raw_results back to the chunk downloader for reuse unless it is the first rowset, which is kept
+ * until the result is freed.
+ *
+ * @param sfstmt
+ */
+static void STDCALL _snowflake_release_chunk(SF_STMT *sfstmt) {
+    if (sfstmt->raw_results != sfstmt->first_rowset) {
+        chunk_downloader_release_chunk(sfstmt->chunk_downloader, (SF_RESULT_CHUNK *) sfstmt->raw_results);
+    }
+    sfstmt->raw_results = NULL;
+}
+
+/**
+ * Frees the rows of the result.
+ *
+ * @param sfstmt
+ */
+static void STDCALL _snowflake_free_results(SF_STMT *sfstmt) {
+    _snowflake_release_chunk(sfstmt);
+    result_chunk_term((SF_RESULT_CHUNK *) sfstmt->first_rowset);
+    sfstmt->first_rowset = NULL;
+    sfstmt->chunk_index = 0;
+}
+
 /**
  * Resets SNOWFLAKE_STMT parameters.
  *
@@ -1080,18 +1241,10 @@ static void STDCALL _snowflake_stmt_reset(SF_STMT *sfstmt) {
     }
     sfstmt->sql_text = NULL;
 
-    if (sfstmt->cur_row) {
-        snowflake_cJSON_Delete(sfstmt->cur_row);
-        sfstmt->cur_row = NULL;
-    }
-    sfstmt->cur_row = NULL;
-
-    if (sfstmt->raw_results) {
-        snowflake_cJSON_Delete(sfstmt->raw_results);
-        sfstmt->raw_results = NULL;
-    }
-    sfstmt->raw_results = NULL;
+    sfstmt->cur_row_index = -1;
+    sfstmt->view_row_count = 0;
 
+    _snowflake_free_results(sfstmt);
 
     if (_snowflake_get_current_param_style(sfstmt) == NAMED)
     {
@@ -1120,7 +1273,10 @@ static void STDCALL _snowflake_stmt_reset(SF_STMT *sfstmt) {
     sfstmt->total_fieldcount = -1;
     sfstmt->total_row_index = -1;
 
-    // Destroy chunk downloader
+    // Destroy chunk downloader, keeping its statistics
+    if (sfstmt->chunk_downloader) {
+        sfstmt->chunk_memory_peak = chunk_downloader_memory_peak(sfstmt->chunk_downloader);
+    }
     chunk_downloader_term(sfstmt->chunk_downloader);
     sfstmt->chunk_downloader = NULL;
 
@@ -1182,6 +1338,13 @@ SF_STMT *STDCALL snowflake_stmt(SF_CONNECT *sf) {
     if (sfstmt) {
         _snowflake_stmt_reset(sfstmt);
         sfstmt->connection = sf;
+        sfstmt->chunk_download_threads = sf->chunk_download_threads;
+        sfstmt->chunk_prefetch_slots = sf->chunk_prefetch_slots;
+        sfstmt->chunk_adaptive_prefetch = sf->chunk_adaptive_prefetch;
+        sfstmt->chunk_eager_decode = sf->chunk_eager_decode;
+        sfstmt->chunk_multi_download = sf->chunk_multi_download;
+        sfstmt->chunk_memory_limit = CHUNK_MEMORY_LIMIT;
+        alloc_buffer_and_copy(&sfstmt->chunk_spill_dir, CHUNK_SPILL_DIR);
     }
     return sfstmt;
 }
@@ -1208,6 +1371,9 @@ void STDCALL snowflake_bind_input_init(SF_BIND_INPUT * input)
 void STDCALL snowflake_stmt_term(SF_STMT *sfstmt) {
     if (sfstmt) {
         _snowflake_stmt_reset(sfstmt);
+        // Result bindings survive a reset, they are only released here
+        sf_array_list_deallocate(sfstmt->results);
+        SF_FREE(sfstmt->chunk_spill_dir);
         SF_FREE(sfstmt);
     }
 }
@@ -1325,42 +1491,36 @@ SF_STATUS STDCALL snowflake_query(
     return SF_STATUS_SUCCESS;
 }
 
-SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt) {
-    if (!sfstmt) {
-        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
-    }
-    clear_snowflake_error(&sfstmt->error);
+/**
+ * Moves on to the next downloaded chunk once all rows of the current one have been consumed.
+ *
+ * @return SF_STATUS_SUCCESS if there is a new chunk, SF_STATUS_EOF at the end of the results, an error otherwise.
+ */
+static SF_STATUS STDCALL _snowflake_next_chunk(SF_STMT *sfstmt) {
     SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
     sf_bool get_chunk_success = SF_BOOLEAN_TRUE;
-    int64 i;
     uint64 index;
-    if (sfstmt->cur_row != NULL) {
-        snowflake_cJSON_Delete(sfstmt->cur_row);
-        sfstmt->cur_row = NULL;
-    }
-
-    // Check for chunk_downloader error
-    if (sfstmt->chunk_downloader && get_error(sfstmt->chunk_downloader)) {
-        goto cleanup;
-    }
-
-    // If no more results, set return to SF_STATUS_EOF
-    if (sfstmt->chunk_rowcount == 0) {
-        if (sfstmt->chunk_downloader) {
-            log_debug("Fetching next chunk from chunk downloader.");
-            _critical_section_lock(&sfstmt->chunk_downloader->queue_lock);
-            do {
-                if (sfstmt->chunk_downloader->consumer_head >=
-                    sfstmt->chunk_downloader->queue_size) {
-                    // No more chunks, set EOL and break
-                    log_debug("Out of chunks, setting EOL.");
-                    snowflake_cJSON_Delete(sfstmt->raw_results);
-                    sfstmt->raw_results = NULL;
-                    ret = SF_STATUS_EOF;
-                    break;
-                } else {
-                    // Get index and increment
-                    index = sfstmt->chunk_downloader->consumer_head;
+    uint64 wait_start;
+    uint64 wait_time;
+
+    // The chunks of a partitioned result are read through snowflake_partition_open
+    if (sfstmt->chunk_downloader && !sfstmt->chunk_downloader->on_demand) {
+        log_debug("Fetching next chunk from chunk downloader.");
+        _critical_section_lock(&sfstmt->chunk_downloader->queue_lock);
+        do {
+            if (sfstmt->chunk_downloader->consumer_head >=
+                sfstmt->chunk_downloader->queue_size) {
+                // No more chunks, set EOL and break
+                log_debug("Out of chunks, setting EOL.");
+                _snowflake_release_chunk(sfstmt);
+                ret = SF_STATUS_EOF;
+                break;
+            } else {
+                // Get index and increment
+                index = sfstmt->chunk_downloader->consumer_head;
+                wait_time = 0;
+                if (sfstmt->chunk_downloader->queue[index].chunk == NULL) {
+                    wait_start = sf_get_monotonic_time_millis();
                     while (
                         sfstmt->chunk_downloader->queue[index].chunk == NULL &&
                         !get_shutdown_or_error(
@@ -1369,52 +1529,88 @@ SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt) {
                             &sfstmt->chunk_downloader->consumer_cond,
                             &sfstmt->chunk_downloader->queue_lock);
                     }
+                    // Count any wait as at least 1ms so the downloader knows the consumer was starved
+                    wait_time = sf_get_monotonic_time_millis() - wait_start + 1;
+                }
 
-                    if (get_error(sfstmt->chunk_downloader)) {
-                        get_chunk_success = SF_BOOLEAN_FALSE;
-                        break;
-                    } else if (get_shutdown(sfstmt->chunk_downloader)) {
-                        get_chunk_success = SF_BOOLEAN_FALSE;
-                        break;
-                    }
+                if (get_error(sfstmt->chunk_downloader)) {
+                    get_chunk_success = SF_BOOLEAN_FALSE;
+                    break;
+                } else if (get_shutdown(sfstmt->chunk_downloader)) {
+                    get_chunk_success = SF_BOOLEAN_FALSE;
+                    break;
+                }
 
-                    sfstmt->chunk_downloader->consumer_head++;
-
-                    // Delete old cJSON results struct
-                    snowflake_cJSON_Delete((cJSON *) sfstmt->raw_results);
-                    // Set new chunk and remove chunk reference from locked array
-                    sfstmt->raw_results = sfstmt->chunk_downloader->queue[index].chunk;
-                    sfstmt->chunk_downloader->queue[index].chunk = NULL;
-                    sfstmt->chunk_rowcount = sfstmt->chunk_downloader->queue[index].row_count;
-                    log_debug("Acquired chunk %llu from chunk downloader",
-                              index);
-                    if (_cond_signal(
-                        &sfstmt->chunk_downloader->producer_cond)) {
-                        SET_SNOWFLAKE_ERROR(&sfstmt->error,
-                                            SF_STATUS_ERROR_PTHREAD,
-                                            "Unable to send signal using produce_cond",
-                                            "");
-                        get_chunk_success = SF_BOOLEAN_FALSE;
-                        break;
-                    }
+                sfstmt->chunk_downloader->consumer_head++;
+
+                // Free the old chunk
+                _snowflake_release_chunk(sfstmt);
+                // Set new chunk and remove chunk reference from locked array
+                sfstmt->raw_results = sfstmt->chunk_downloader->queue[index].chunk;
+                sfstmt->chunk_index = (int64) index + 1;
+                sfstmt->chunk_downloader->queue[index].chunk = NULL;
+                // The downloader checked that the chunk has the rows the metadata says it has
+                sfstmt->chunk_rowcount = sfstmt->raw_results ? ((SF_RESULT_CHUNK *) sfstmt->raw_results)->row_count
+                                                             : 0;
+                chunk_downloader_chunk_consumed(sfstmt->chunk_downloader, index, wait_time);
+                log_debug("Acquired chunk %llu from chunk downloader",
+                          index);
+                if (_cond_signal(
+                    &sfstmt->chunk_downloader->producer_cond)) {
+                    SET_SNOWFLAKE_ERROR(&sfstmt->error,
+                                        SF_STATUS_ERROR_PTHREAD,
+                                        "Unable to send signal using produce_cond",
+                                        "");
+                    get_chunk_success = SF_BOOLEAN_FALSE;
+                    break;
                 }
             }
-            while (0);
-            _critical_section_unlock(&sfstmt->chunk_downloader->queue_lock);
-        } else {
-            // If there is no chunk downloader set, then we've truly reached the end of the results and should set EOL
-            log_debug("No chunk downloader set, end of results.");
-            ret = SF_STATUS_EOF;
         }
+        while (0);
+        _critical_section_unlock(&sfstmt->chunk_downloader->queue_lock);
+    } else {
+        // If there is no chunk downloader set, then we've truly reached the end of the results and should set EOL
+        log_debug("No chunk downloader set, end of results.");
+        ret = SF_STATUS_EOF;
+    }
+
+    if (ret == SF_STATUS_EOF || !get_chunk_success) {
+        return ret;
+    }
+    return SF_STATUS_SUCCESS;
+}
+
+SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    SF_RESULT_CHUNK *chunk;
+    sfstmt->cur_row_index = -1;
+    sfstmt->view_row_count = 0;
+
+    // Check for chunk_downloader error
+    if (sfstmt->chunk_downloader && get_error(sfstmt->chunk_downloader)) {
+        goto cleanup;
+    }
 
-        // If we've reached the end, or we have an error getting the next chunk, goto cleanup and return status
-        if (ret == SF_STATUS_EOF || !get_chunk_success) {
+    // If no more results in this chunk, get the next one or return SF_STATUS_EOF
+    while (sfstmt->chunk_rowcount == 0) {
+        if ((ret = _snowflake_next_chunk(sfstmt)) != SF_STATUS_SUCCESS) {
             goto cleanup;
         }
     }
 
-    // Get next result row
-    sfstmt->cur_row = snowflake_cJSON_DetachItemFromArray(sfstmt->raw_results, 0);
+    // Get next result row. Rows are consumed from the front of the chunk, so the remaining row count gives the index
+    chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+    if (!chunk) {
+        // Nothing has been executed
+        ret = SF_STATUS_EOF;
+        goto cleanup;
+    }
+    sfstmt->cur_row_index = chunk->row_count - sfstmt->chunk_rowcount;
+    sfstmt->view_row_count = 1;
     sfstmt->chunk_rowcount--;
     sfstmt->total_row_index++;
     ret = SF_STATUS_SUCCESS;
@@ -1423,204 +1619,1011 @@ cleanup:
     return ret;
 }
 
-static SF_STATUS STDCALL
-_snowflake_internal_query(SF_CONNECT *sf, const char *sql) {
-    if (!sf) {
-        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
-    }
+/**
+ * Makes a row of the result the current row as if it had just been fetched, loading the chunk that holds it first.
+ *
+ * @param sfstmt
+ * @param row Index of the row in the result, starting from 0
+ * @return 0 if success, SF_STATUS_EOF if there is no such row, otherwise an errno is returned
+ */
+static SF_STATUS STDCALL _snowflake_seek_row(SF_STMT *sfstmt, int64 row) {
+    SF_CHUNK_DOWNLOADER *chunk_downloader = sfstmt->chunk_downloader;
+    SF_RESULT_CHUNK *chunk;
     SF_STATUS ret;
-    SF_STMT *sfstmt = snowflake_stmt(sf);
-    if (sfstmt == NULL) {
-        ret = SF_STATUS_ERROR_OUT_OF_MEMORY;
-        SET_SNOWFLAKE_ERROR(
-            &sf->error,
-            SF_STATUS_ERROR_OUT_OF_MEMORY,
-            "Out of memory in creating SF_STMT. ",
-            SF_SQLSTATE_UNABLE_TO_CONNECT);
-        goto error;
+    int64 first_rows = sfstmt->first_rowset ? ((SF_RESULT_CHUNK *) sfstmt->first_rowset)->row_count : 0;
+    int64 chunk_index = 0;
+    int64 chunk_start = 0;
+    uint64 index;
+
+    if (chunk_downloader && get_error(chunk_downloader)) {
+        return SF_STATUS_ERROR_GENERAL;
     }
-    ret = snowflake_query(sfstmt, sql, 0);
-    if (ret != SF_STATUS_SUCCESS) {
-        snowflake_propagate_error(sf, sfstmt);
-        goto error;
+    if (row < 0 || !sfstmt->first_rowset) {
+        return SF_STATUS_EOF;
+    }
+    if (row >= first_rows) {
+        if (!chunk_downloader ||
+            (index = chunk_downloader_find_chunk(chunk_downloader, row - first_rows)) >= chunk_downloader->queue_size) {
+            return SF_STATUS_EOF;
+        }
+        chunk_index = (int64) index + 1;
+        chunk_start = first_rows + chunk_downloader->row_starts[index];
     }
 
-error:
-    snowflake_stmt_term(sfstmt);
-    return ret;
-}
+    // Load the chunk unless the row is in the current one
+    if (chunk_index != sfstmt->chunk_index || !sfstmt->raw_results) {
+        if (chunk_index == 0) {
+            // The chunk downloader has to continue with the first chunk after the first rowset
+            if (chunk_downloader && !chunk_downloader->on_demand && chunk_downloader->consumer_head != 0 &&
+                !chunk_downloader_seek(chunk_downloader, 0)) {
+                return sfstmt->error.error_code ? sfstmt->error.error_code : SF_STATUS_ERROR_GENERAL;
+            }
+            _snowflake_release_chunk(sfstmt);
+            sfstmt->raw_results = sfstmt->first_rowset;
+            sfstmt->chunk_index = 0;
+        } else if (chunk_downloader->on_demand) {
+            if (!chunk_downloader_download_chunk(chunk_downloader, index, &chunk, &sfstmt->error)) {
+                return sfstmt->error.error_code;
+            }
+            _snowflake_release_chunk(sfstmt);
+            sfstmt->raw_results = chunk;
+            sfstmt->chunk_index = chunk_index;
+        } else {
+            // Only the consumer moves consumer_head, so it can be read without the lock
+            if (chunk_downloader->consumer_head != index && !chunk_downloader_seek(chunk_downloader, index)) {
+                return sfstmt->error.error_code ? sfstmt->error.error_code : SF_STATUS_ERROR_GENERAL;
+            }
+            if ((ret = _snowflake_next_chunk(sfstmt)) != SF_STATUS_SUCCESS) {
+                return ret == SF_STATUS_EOF ? SF_STATUS_ERROR_GENERAL : ret;
+            }
+        }
+    }
 
-SF_STATUS STDCALL snowflake_trans_begin(SF_CONNECT *sf) {
-    return _snowflake_internal_query(sf, _SF_STMT_SQL_BEGIN);
+    chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+    sfstmt->cur_row_index = row - chunk_start;
+    sfstmt->view_row_count = 1;
+    sfstmt->chunk_rowcount = chunk->row_count - sfstmt->cur_row_index - 1;
+    sfstmt->total_row_index = row + 1;
+    return SF_STATUS_SUCCESS;
 }
 
-SF_STATUS STDCALL snowflake_trans_commit(SF_CONNECT *sf) {
-    return _snowflake_internal_query(sf, _SF_STMT_SQL_COMMIT);
+SF_STATUS STDCALL snowflake_fetch_absolute(SF_STMT *sfstmt, int64 row) {
+    int64 row_count;
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    if (row < 0) {
+        row_count = sfstmt->first_rowset ? ((SF_RESULT_CHUNK *) sfstmt->first_rowset)->row_count : 0;
+        if (sfstmt->chunk_downloader) {
+            row_count += sfstmt->chunk_downloader->row_starts[sfstmt->chunk_downloader->queue_size];
+        }
+        row += row_count + 1;
+    }
+    return _snowflake_seek_row(sfstmt, row - 1);
 }
 
-SF_STATUS STDCALL snowflake_trans_rollback(SF_CONNECT *sf) {
-    return _snowflake_internal_query(sf, _SF_STMT_SQL_ROLLBACK);
+SF_STATUS STDCALL snowflake_fetch_relative(SF_STMT *sfstmt, int64 offset) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    // total_row_index is the number of the current row
+    return _snowflake_seek_row(sfstmt, sfstmt->total_row_index + offset - 1);
 }
 
-int64 STDCALL snowflake_affected_rows(SF_STMT *sfstmt) {
-    size_t i;
-    int64 ret = -1;
-    cJSON *row = NULL;
-    cJSON *raw_row_result;
-    clear_snowflake_error(&sfstmt->error);
+SF_STATUS STDCALL snowflake_bind_result(SF_STMT *sfstmt, SF_BIND_OUTPUT *sfbind) {
     if (!sfstmt) {
-        /* no way to set the error other than return value */
-        return ret;
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
     }
-    if (snowflake_cJSON_GetArraySize(sfstmt->raw_results) == 0) {
-        /* no affected rows is determined. The potential cause is
-         * the query is not DML or no stmt was executed at all . */
-        SET_SNOWFLAKE_STMT_ERROR(
-            &sfstmt->error,
-            SF_STATUS_ERROR_APPLICATION_ERROR, "No results found.",
-            SF_SQLSTATE_NO_DATA, sfstmt->sfqid);
-        sfstmt->error.error_code = SF_STATUS_ERROR_APPLICATION_ERROR;
-        return ret;
+    clear_snowflake_error(&sfstmt->error);
+    if (!sfbind) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_NULL_POINTER,
+                                 "sfbind must not be NULL", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    if (sfbind->idx == 0) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_BOUNDS,
+                                 "Column index must be greater than 0", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_BOUNDS;
+    }
+    if ((sfbind->c_type != SF_C_TYPE_INT64 && sfbind->c_type != SF_C_TYPE_FLOAT64 &&
+         sfbind->c_type != SF_C_TYPE_BOOLEAN && sfbind->c_type != SF_C_TYPE_STRING) ||
+        !sfbind->value || (sfbind->c_type == SF_C_TYPE_STRING && sfbind->max_length == 0)) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_BAD_DATA_OUTPUT_TYPE,
+                                 "Unsupported output type or missing output buffer", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_BAD_DATA_OUTPUT_TYPE;
     }
 
-    if (sfstmt->is_dml) {
-        row = snowflake_cJSON_DetachItemFromArray(sfstmt->raw_results, 0);
-        ret = 0;
-        for (i = 0; i < (size_t) sfstmt->total_fieldcount; ++i) {
-            raw_row_result = snowflake_cJSON_GetArrayItem(row, (int) i);
-            ret += (int64) strtoll(raw_row_result->valuestring, NULL, 10);
-        }
-        snowflake_cJSON_Delete(row);
-    } else {
-        ret = sfstmt->total_rowcount;
+    if (sfstmt->results == NULL && (sfstmt->results = sf_array_list_init()) == NULL) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                 "Out of memory binding result column", SF_SQLSTATE_MEMORY_ALLOCATION_ERROR,
+                                 sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_MEMORY;
     }
-    return ret;
+    sf_array_list_set(sfstmt->results, sfbind, sfbind->idx - 1);
+    return SF_STATUS_SUCCESS;
 }
 
-SF_STATUS STDCALL
-snowflake_prepare(SF_STMT *sfstmt, const char *command, size_t command_size) {
+SF_STATUS STDCALL snowflake_bind_result_array(SF_STMT *sfstmt, SF_BIND_OUTPUT *sfbind_array, size_t size) {
+    size_t i;
+    SF_STATUS ret;
     if (!sfstmt) {
         return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
     }
-    clear_snowflake_error(&sfstmt->error);
-    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
-    size_t sql_text_size = 1; // Don't forget about null terminator
-    if (!command) {
-        goto cleanup;
-    }
-    _snowflake_stmt_reset(sfstmt);
-    // Set sql_text to command
-    if (command_size == 0) {
-        log_debug("Command size is 0, using to strlen to find query length.");
-        sql_text_size += strlen(command);
-    } else {
-        log_debug("Command size non-zero, setting as sql text size.");
-        sql_text_size += command_size;
+    for (i = 0; i < size; i++) {
+        if ((ret = snowflake_bind_result(sfstmt, &sfbind_array[i])) != SF_STATUS_SUCCESS) {
+            return ret;
+        }
     }
-    sfstmt->sql_text = (char *) SF_CALLOC(1, sql_text_size);
-    memcpy(sfstmt->sql_text, command, sql_text_size - 1);
-    // Null terminate
-    sfstmt->sql_text[sql_text_size - 1] = '\0';
+    return SF_STATUS_SUCCESS;
+}
 
-    ret = SF_STATUS_SUCCESS;
+/**
+ * Fills rows [first_row, first_row + count) of one bound column, starting at position offset of the output arrays.
+ *
+ * @return SF_STATUS_SUCCESS or the status of the first value that could not be converted.
+ */
+static SF_STATUS STDCALL _snowflake_fetch_batch_column(SF_STMT *sfstmt, SF_RESULT_CHUNK *chunk, int64 first_row,
+                                                       size_t count, SF_BIND_OUTPUT *output, size_t offset) {
+    int64 column = (int64) output->idx - 1;
+    SF_C_TYPE column_type = sfstmt->desc[column].c_type;
+    SF_STATUS ret = SF_STATUS_SUCCESS;
+    SF_STATUS status;
+    SF_CHUNK_DECODED_VALUE converted;
+    const char *value;
+    char *str;
+    size_t value_len;
+    size_t copy_len;
+    size_t i;
+    size_t pos;
+    int64 row;
 
-cleanup:
-    return ret;
-}
+    for (i = 0; i < count; i++) {
+        row = first_row + (int64) i;
+        pos = offset + i;
+        status = SF_STATUS_SUCCESS;
+        memset(&converted, 0, sizeof(converted));
+        value = result_chunk_get_value(chunk, row, column, &value_len);
+
+        // A NULL reads as zero, false or an empty string, the same as with snowflake_column_as_*
+        switch (output->c_type) {
+            case SF_C_TYPE_INT64:
+            case SF_C_TYPE_FLOAT64:
+                if (value) {
+                    if (!result_chunk_get_decoded(chunk, row, column, output->c_type, &converted, &status)) {
+                        status = result_chunk_decode_value(value, output->c_type, &converted);
+                    }
+                }
+                if (output->c_type == SF_C_TYPE_INT64) {
+                    ((int64 *) output->value)[pos] = converted.int_value;
+                    value_len = sizeof(int64);
+                } else {
+                    ((float64 *) output->value)[pos] = converted.float_value;
+                    value_len = sizeof(float64);
+                }
+                break;
+            case SF_C_TYPE_BOOLEAN:
+                if (value) {
+                    if (column_type == SF_C_TYPE_STRING) {
+                        converted.bool_value = value_len > 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+                    } else if (column_type != SF_C_TYPE_BOOLEAN && column_type != SF_C_TYPE_INT64 &&
+                               column_type != SF_C_TYPE_FLOAT64) {
+                        status = SF_STATUS_ERROR_CONVERSION_FAILURE;
+                    } else {
+                        if (!result_chunk_get_decoded(chunk, row, column, column_type, &converted, &status)) {
+                            status = result_chunk_decode_value(value, column_type, &converted);
+                        }
+                        if (column_type == SF_C_TYPE_INT64) {
+                            converted.bool_value = converted.int_value != 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+                        } else if (column_type == SF_C_TYPE_FLOAT64) {
+                            converted.bool_value = converted.float_value != 0.0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+                        }
+                    }
+                }
+                ((sf_bool *) output->value)[pos] = status == SF_STATUS_SUCCESS ? converted.bool_value : SF_BOOLEAN_FALSE;
+                value_len = sizeof(sf_bool);
+                break;
+            default:
+                // Strings are truncated to fit and always null terminated
+                str = &((char *) output->value)[pos * output->max_length];
+                copy_len = value_len < output->max_length ? value_len : output->max_length - 1;
+                if (copy_len > 0) {
+                    memcpy(str, value, copy_len);
+                }
+                str[copy_len] = '\0';
+                if (copy_len < value_len) {
+                    status = SF_STATUS_ERROR_BUFFER_TOO_SMALL;
+                }
+                break;
+        }
 
-SF_STATUS STDCALL snowflake_execute(SF_STMT *sfstmt) {
-    return _snowflake_execute_ex(sfstmt, _is_put_get_command(sfstmt->sql_text));
+        if (!value) {
+            value_len = 0;
+        }
+        if (output->len) {
+            output->len[pos] = value_len;
+        }
+        if (output->is_null) {
+            output->is_null[pos] = value ? SF_BOOLEAN_FALSE : SF_BOOLEAN_TRUE;
+        }
+        if (output->status) {
+            output->status[pos] = status;
+        }
+        if (status != SF_STATUS_SUCCESS && ret == SF_STATUS_SUCCESS) {
+            ret = status;
+        }
+    }
+    return ret;
 }
 
-SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
-                                        sf_bool is_put_get_command) {
+SF_STATUS STDCALL snowflake_fetch_batch(SF_STMT *sfstmt, size_t max_rows, size_t *rows_fetched) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    SF_STATUS conversion_status = SF_STATUS_SUCCESS;
+    SF_STATUS status;
+    ARRAY_LIST *results = (ARRAY_LIST *) sfstmt->results;
+    SF_BIND_OUTPUT *output;
+    SF_RESULT_CHUNK *chunk;
+    size_t fetched = 0;
+    size_t count;
+    size_t i;
+    int64 first_row;
+
+    if (rows_fetched == NULL) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_NULL_POINTER,
+                                 "rows_fetched must not be NULL", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    *rows_fetched = 0;
+
+    // Every bound column has to exist in this result
+    for (i = 0; results && i < results->size; i++) {
+        if (sf_array_list_get(results, i) && (int64) i >= sfstmt->total_fieldcount) {
+            SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_BOUNDS,
+                                     "Bound column index must be between 1 and snowflake_num_fields()", "",
+                                     sfstmt->sfqid);
+            return SF_STATUS_ERROR_OUT_OF_BOUNDS;
+        }
+    }
+
+    sfstmt->cur_row_index = -1;
+    sfstmt->view_row_count = 0;
+
+    // Check for chunk_downloader error
+    if (sfstmt->chunk_downloader && get_error(sfstmt->chunk_downloader)) {
+        goto cleanup;
+    }
+
+    while (fetched < max_rows) {
+        if (sfstmt->chunk_rowcount == 0) {
+            if ((ret = _snowflake_next_chunk(sfstmt)) == SF_STATUS_EOF) {
+                break;
+            } else if (ret != SF_STATUS_SUCCESS) {
+                goto cleanup;
+            }
+            continue;
+        }
+        chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+        if (!chunk) {
+            // Nothing has been executed
+            break;
+        }
+
+        // Take as many rows as we can from the current chunk, one column at a time
+        count = max_rows - fetched;
+        if ((int64) count > sfstmt->chunk_rowcount) {
+            count = (size_t) sfstmt->chunk_rowcount;
+        }
+        first_row = chunk->row_count - sfstmt->chunk_rowcount;
+        for (i = 0; results && i < results->size; i++) {
+            output = (SF_BIND_OUTPUT *) sf_array_list_get(results, i);
+            if (output && (status = _snowflake_fetch_batch_column(sfstmt, chunk, first_row, count, output,
+                                                                  fetched)) != SF_STATUS_SUCCESS &&
+                conversion_status == SF_STATUS_SUCCESS) {
+                conversion_status = status;
+            }
+        }
+
+        sfstmt->cur_row_index = first_row + (int64) count - 1;
+        sfstmt->chunk_rowcount -= (int64) count;
+        sfstmt->total_row_index += (int64) count;
+        fetched += count;
+    }
+
+    *rows_fetched = fetched;
+    if (fetched == 0 && max_rows > 0) {
+        ret = SF_STATUS_EOF;
+        goto cleanup;
+    }
+    ret = conversion_status;
+    if (ret != SF_STATUS_SUCCESS) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, ret,
+                                 "Failed to convert one or more values in the batch", "", sfstmt->sfqid);
+    }
+
+cleanup:
+    return ret;
+}
+
+SF_STATUS STDCALL snowflake_fetch_view(SF_STMT *sfstmt, size_t max_rows, size_t *rows_fetched) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    SF_RESULT_CHUNK *chunk;
+    int64 count;
+
+    if (rows_fetched == NULL) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_NULL_POINTER,
+                                 "rows_fetched must not be NULL", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    *rows_fetched = 0;
+    sfstmt->cur_row_index = -1;
+    sfstmt->view_row_count = 0;
+    if (max_rows == 0) {
+        return SF_STATUS_SUCCESS;
+    }
+
+    // Check for chunk_downloader error
+    if (sfstmt->chunk_downloader && get_error(sfstmt->chunk_downloader)) {
+        goto cleanup;
+    }
+
+    // A view covers one chunk only, so move on to the next chunk only once this one is used up
+    while (sfstmt->chunk_rowcount == 0) {
+        if ((ret = _snowflake_next_chunk(sfstmt)) != SF_STATUS_SUCCESS) {
+            goto cleanup;
+        }
+    }
+    chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+    if (!chunk) {
+        // Nothing has been executed
+        ret = SF_STATUS_EOF;
+        goto cleanup;
+    }
+
+    count = (int64) max_rows < sfstmt->chunk_rowcount ? (int64) max_rows : sfstmt->chunk_rowcount;
+    sfstmt->cur_row_index = chunk->row_count - sfstmt->chunk_rowcount + count - 1;
+    sfstmt->view_row_count = count;
+    sfstmt->chunk_rowcount -= count;
+    sfstmt->total_row_index += count;
+    *rows_fetched = (size_t) count;
+    ret = SF_STATUS_SUCCESS;
+
+cleanup:
+    return ret;
+}
+
+int64 STDCALL snowflake_num_partitions(SF_STMT *sfstmt) {
+    if (!sfstmt || !sfstmt->first_rowset) {
+        return 0;
+    }
+    return 1 + (sfstmt->chunk_downloader ? (int64) sfstmt->chunk_downloader->queue_size : 0);
+}
+
+SF_STATUS STDCALL snowflake_partition_open(SF_STMT *sfstmt, int64 partition, SF_STMT *cursor) {
+    SF_RESULT_CHUNK *chunk = NULL;
+    SF_COLUMN_DESC *desc = NULL;
+    int64 i;
+    if (!sfstmt || !cursor) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    // Resetting the statement would discard the result
+    if (cursor == sfstmt) {
+        clear_snowflake_error(&sfstmt->error);
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_GENERAL,
+                                 "A partition can't be opened on the statement itself", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_GENERAL;
+    }
+    _snowflake_stmt_reset(cursor);
+    if (partition < 0 || partition >= snowflake_num_partitions(sfstmt)) {
+        SET_SNOWFLAKE_STMT_ERROR(&cursor->error, SF_STATUS_ERROR_OUT_OF_BOUNDS,
+                                 "Partition must be between 0 and snowflake_num_partitions() - 1", "",
+                                 sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_BOUNDS;
+    }
+    // Otherwise the chunks are consumed by the download threads
+    if (sfstmt->chunk_downloader && !sfstmt->chunk_downloader->on_demand) {
+        SET_SNOWFLAKE_STMT_ERROR(&cursor->error, SF_STATUS_ERROR_GENERAL,
+                                 "Partitions require SF_STMT_RESULT_PARTITIONS when the query is executed", "",
+                                 sfstmt->sfqid);
+        return SF_STATUS_ERROR_GENERAL;
+    }
+
+    // The first rowset stays with the statement, the cursor gets a copy
+    if (partition == 0) {
+        chunk = result_chunk_copy((SF_RESULT_CHUNK *) sfstmt->first_rowset);
+        if (!chunk) {
+            SET_SNOWFLAKE_STMT_ERROR(&cursor->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                     "Out of memory copying results.", SF_SQLSTATE_MEMORY_ALLOCATION_ERROR,
+                                     sfstmt->sfqid);
+            return SF_STATUS_ERROR_OUT_OF_MEMORY;
+        }
+    } else if (!chunk_downloader_download_chunk(sfstmt->chunk_downloader, (uint64) partition - 1, &chunk,
+                                                &cursor->error)) {
+        return cursor->error.error_code;
+    }
+
+    if (sfstmt->desc && sfstmt->total_fieldcount > 0) {
+        desc = (SF_COLUMN_DESC *) SF_CALLOC((size_t) sfstmt->total_fieldcount, sizeof(SF_COLUMN_DESC));
+        if (!desc) {
+            result_chunk_term(chunk);
+            SET_SNOWFLAKE_STMT_ERROR(&cursor->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                     "Out of memory copying column metadata.", SF_SQLSTATE_MEMORY_ALLOCATION_ERROR,
+                                     sfstmt->sfqid);
+            return SF_STATUS_ERROR_OUT_OF_MEMORY;
+        }
+        for (i = 0; i < sfstmt->total_fieldcount; i++) {
+            desc[i] = sfstmt->desc[i];
+            desc[i].name = NULL;
+            alloc_buffer_and_copy(&desc[i].name, sfstmt->desc[i].name);
+        }
+    }
+
+    strncpy(cursor->sfqid, sfstmt->sfqid, SF_UUID4_LEN);
+    cursor->is_dml = sfstmt->is_dml;
+    cursor->desc = desc;
+    cursor->total_fieldcount = sfstmt->total_fieldcount;
+    cursor->raw_results = chunk;
+    cursor->first_rowset = chunk;
+    cursor->chunk_rowcount = chunk->row_count;
+    cursor->total_rowcount = chunk->row_count;
+    cursor->total_row_index = 0;
+    return SF_STATUS_SUCCESS;
+}
+
+SF_STATUS STDCALL snowflake_column_view(SF_STMT *sfstmt, int idx, SF_COLUMN_VIEW *view) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    SF_RESULT_CHUNK *chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+    SF_CHUNK_COLUMN *column;
+    SF_C_TYPE c_type;
+    int64 first_row;
+
+    if (view == NULL) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_NULL_POINTER,
+                                 "view must not be NULL", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    memset(view, 0, sizeof(SF_COLUMN_VIEW));
+    if (idx <= 0 || idx > sfstmt->total_fieldcount) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_BOUNDS,
+                                 "Column index must be between 1 and snowflake_num_fields()", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_BOUNDS;
+    }
+    if (!chunk || sfstmt->view_row_count <= 0 || idx > chunk->column_count) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_BOUNDS,
+                                 "No rows have been fetched with snowflake_fetch_view", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_BOUNDS;
+    }
+
+    column = &chunk->columns[idx - 1];
+    c_type = sfstmt->desc[idx - 1].c_type;
+    if (c_type == SF_C_TYPE_INT64 || c_type == SF_C_TYPE_FLOAT64 || c_type == SF_C_TYPE_BOOLEAN) {
+        if (!result_chunk_decode_column(chunk, idx - 1, c_type)) {
+            SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                     "Out of memory decoding results.", SF_SQLSTATE_MEMORY_ALLOCATION_ERROR,
+                                     sfstmt->sfqid);
+            return SF_STATUS_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    if (!column->decoded || column->decoded_type != c_type) {
+        c_type = SF_C_TYPE_STRING;
+    }
+
+    first_row = sfstmt->cur_row_index - sfstmt->view_row_count + 1;
+    view->c_type = c_type;
+    view->rows = (size_t) sfstmt->view_row_count;
+    if (c_type == SF_C_TYPE_INT64) {
+        view->values = &((const int64 *) column->decoded)[first_row];
+    } else if (c_type == SF_C_TYPE_FLOAT64) {
+        view->values = &((const float64 *) column->decoded)[first_row];
+    } else if (c_type == SF_C_TYPE_BOOLEAN) {
+        view->values = &((const sf_bool *) column->decoded)[first_row];
+    }
+    if (view->values) {
+        view->status = &column->decode_status[first_row];
+    }
+    view->data = column->arena;
+    view->offsets = &column->offsets[first_row];
+    view->lengths = &column->lengths[first_row];
+    view->is_null = &column->nulls[first_row];
+    return SF_STATUS_SUCCESS;
+}
+
+static SF_STATUS STDCALL
+_snowflake_internal_query(SF_CONNECT *sf, const char *sql) {
+    if (!sf) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+    SF_STATUS ret;
+    SF_STMT *sfstmt = snowflake_stmt(sf);
+    if (sfstmt == NULL) {
+        ret = SF_STATUS_ERROR_OUT_OF_MEMORY;
+        SET_SNOWFLAKE_ERROR(
+            &sf->error,
+            SF_STATUS_ERROR_OUT_OF_MEMORY,
+            "Out of memory in creating SF_STMT. ",
+            SF_SQLSTATE_UNABLE_TO_CONNECT);
+        goto error;
+    }
+    ret = snowflake_query(sfstmt, sql, 0);
+    if (ret != SF_STATUS_SUCCESS) {
+        snowflake_propagate_error(sf, sfstmt);
+        goto error;
+    }
+
+error:
+    snowflake_stmt_term(sfstmt);
+    return ret;
+}
+
+SF_STATUS STDCALL snowflake_trans_begin(SF_CONNECT *sf) {
+    return _snowflake_internal_query(sf, _SF_STMT_SQL_BEGIN);
+}
+
+SF_STATUS STDCALL snowflake_trans_commit(SF_CONNECT *sf) {
+    return _snowflake_internal_query(sf, _SF_STMT_SQL_COMMIT);
+}
+
+SF_STATUS STDCALL snowflake_trans_rollback(SF_CONNECT *sf) {
+    return _snowflake_internal_query(sf, _SF_STMT_SQL_ROLLBACK);
+}
+
+int64 STDCALL snowflake_affected_rows(SF_STMT *sfstmt) {
+    int64 i;
+    int64 ret = -1;
+    SF_RESULT_CHUNK *chunk;
+    const char *value;
+    clear_snowflake_error(&sfstmt->error);
+    if (!sfstmt) {
+        /* no way to set the error other than return value */
+        return ret;
+    }
+    chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+    if (!chunk || sfstmt->chunk_rowcount <= 0) {
+        /* no affected rows is determined. The potential cause is
+         * the query is not DML or no stmt was executed at all . */
+        SET_SNOWFLAKE_STMT_ERROR(
+            &sfstmt->error,
+            SF_STATUS_ERROR_APPLICATION_ERROR, "No results found.",
+            SF_SQLSTATE_NO_DATA, sfstmt->sfqid);
+        sfstmt->error.error_code = SF_STATUS_ERROR_APPLICATION_ERROR;
+        return ret;
+    }
+
+    if (sfstmt->is_dml) {
+        // The counts are in the first row that has not been fetched yet
+        ret = 0;
+        for (i = 0; i < sfstmt->total_fieldcount && i < chunk->column_count; ++i) {
+            value = result_chunk_get_value(chunk, chunk->row_count - sfstmt->chunk_rowcount, i, NULL);
+            if (value) {
+                ret += (int64) strtoll(value, NULL, 10);
+            }
+        }
+    } else {
+        ret = sfstmt->total_rowcount;
+    }
+    return ret;
+}
+
+SF_STATUS STDCALL
+snowflake_prepare(SF_STMT *sfstmt, const char *command, size_t command_size) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    size_t sql_text_size = 1; // Don't forget about null terminator
+    if (!command) {
+        goto cleanup;
+    }
+    _snowflake_stmt_reset(sfstmt);
+    // Set sql_text to command
+    if (command_size == 0) {
+        log_debug("Command size is 0, using to strlen to find query length.");
+        sql_text_size += strlen(command);
+    } else {
+        log_debug("Command size non-zero, setting as sql text size.");
+        sql_text_size += command_size;
+    }
+    sfstmt->sql_text = (char *) SF_CALLOC(1, sql_text_size);
+    memcpy(sfstmt->sql_text, command, sql_text_size - 1);
+    // Null terminate
+    sfstmt->sql_text[sql_text_size - 1] = '\0';
+
+    ret = SF_STATUS_SUCCESS;
+
+cleanup:
+    return ret;
+}
+
+SF_STATUS STDCALL snowflake_execute(SF_STMT *sfstmt) {
+    return _snowflake_execute_ex(sfstmt, _is_put_get_command(sfstmt->sql_text));
+}
+
+/**
+ * Reads the response of a finished query into the statement: the column metadata, the first rowset and the chunk
+ * downloader for the rest of a result, the instructions of a put/get command, or the error of a failed query.
+ *
+ * @param sfstmt
+ * @param resp Response of the query request or of its result URL
+ * @param is_put_get_command
+ * @return 0 if success, otherwise an errno is returned
+ */
+static SF_STATUS STDCALL _snowflake_process_query_response(SF_STMT *sfstmt, cJSON *resp,
+                                                           sf_bool is_put_get_command) {
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    SF_JSON_ERROR json_error;
+    const char *error_msg;
+    cJSON *data = NULL;
+    cJSON *rowtype = NULL;
+    cJSON *chunks = NULL;
+    cJSON *chunk_headers = NULL;
+    cJSON *result_format = NULL;
+    char *qrmk = NULL;
+    char *s_resp = NULL;
+    SF_C_TYPE *decode_types = NULL;
+    sf_bool arrow_format = SF_BOOLEAN_FALSE;
+    sf_bool success = SF_BOOLEAN_FALSE;
+    size_t i;
+
+    // Printing the response takes as long as parsing it, only do it when it is logged
+    if (log_enabled(SF_LOG_TRACE)) {
+        s_resp = snowflake_cJSON_Print(resp);
+        log_trace("Here is JSON response:\n%s", s_resp);
+    }
+    data = snowflake_cJSON_GetObjectItem(resp, "data");
+    if (json_copy_string_no_alloc(sfstmt->sfqid, data, "queryId",
+                                  SF_UUID4_LEN) && !is_put_get_command) {
+        log_debug("No valid sfqid found in response");
+    }
+    if ((json_error = json_copy_bool(&success, resp, "success")) ==
+        SF_JSON_ERROR_NONE && success) {
+        if (is_put_get_command) {
+            sfstmt->put_get_response = sf_put_get_response_allocate();
+
+            json_detach_array_from_object(
+                (cJSON **) (&sfstmt->put_get_response->src_list),
+                data, "src_locations");
+            json_copy_string_no_alloc(sfstmt->put_get_response->command,
+                                      data, "command", SF_COMMAND_LEN);
+            json_copy_int(&sfstmt->put_get_response->parallel, data,
+                          "parallel");
+            json_copy_bool(&sfstmt->put_get_response->auto_compress, data,
+                           "autoCompress");
+            json_copy_bool(&sfstmt->put_get_response->overwrite, data,
+                           "overwrite");
+            json_copy_string_no_alloc(
+                sfstmt->put_get_response->source_compression,
+                data, "sourceCompression",
+                SF_SOURCE_COMPRESSION_TYPE_LEN);
+            json_copy_bool(
+                &sfstmt->put_get_response->client_show_encryption_param,
+                data, "clientShowEncryptionParameter");
+
+            cJSON *enc_mat = snowflake_cJSON_GetObjectItem(data,
+                                                           "encryptionMaterial");
+
+            // In put command response, value of encryptionMaterial is an
+            // object, which in get command response, value is an array of
+            // object since different remote files might have different
+            // encryption material
+            if (snowflake_cJSON_IsArray(enc_mat))
+            {
+                json_detach_array_from_object(
+                  (cJSON **) (&sfstmt->put_get_response->enc_mat_get),
+                  data, "encryptionMaterial");
+            }
+            else
+            {
+                json_copy_string(
+                  &sfstmt->put_get_response->enc_mat_put->query_stage_master_key,
+                  enc_mat, "queryStageMasterKey");
+                json_copy_string_no_alloc(
+                  sfstmt->put_get_response->enc_mat_put->query_id,
+                  enc_mat, "queryId", SF_UUID4_LEN);
+                json_copy_int(&sfstmt->put_get_response->enc_mat_put->smk_id,
+                              enc_mat, "smkId");
+            }
+
+            cJSON *stage_info = snowflake_cJSON_GetObjectItem(data,
+                                                              "stageInfo");
+            cJSON *stage_cred = snowflake_cJSON_GetObjectItem(stage_info,
+                                                              "creds");
+
+            json_copy_string(
+                &sfstmt->put_get_response->stage_info->location_type,
+                stage_info, "locationType");
+            json_copy_string(
+                &sfstmt->put_get_response->stage_info->location,
+                stage_info, "location");
+            json_copy_string(&sfstmt->put_get_response->stage_info->path,
+                             stage_info, "path");
+            json_copy_string(&sfstmt->put_get_response->stage_info->region,
+                             stage_info, "region");
+            json_copy_string(
+                &sfstmt->put_get_response->stage_info->stage_cred->aws_secret_key,
+                stage_cred, "AWS_SECRET_KEY");
+            json_copy_string(
+                &sfstmt->put_get_response->stage_info->stage_cred->aws_key_id,
+                stage_cred, "AWS_KEY_ID");
+            json_copy_string(
+                &sfstmt->put_get_response->stage_info->stage_cred->aws_token,
+                stage_cred, "AWS_TOKEN");
+            json_copy_string(
+                &sfstmt->put_get_response->localLocation, data,
+                "localLocation");
+
+        } else {
+            // Set Database info
+            _mutex_lock(&sfstmt->connection->mutex_parameters);
+            /* Set other parameters. Ignore the status */
+            _set_current_objects(sfstmt, data);
+            _set_parameters_session_info(sfstmt->connection, data);
+            _mutex_unlock(&sfstmt->connection->mutex_parameters);
+            int64 stmt_type_id;
+            if (json_copy_int(&stmt_type_id, data, "statementTypeId")) {
+                /* failed to get statement type id */
+                sfstmt->is_dml = SF_BOOLEAN_FALSE;
+            } else {
+                sfstmt->is_dml = detect_stmt_type(stmt_type_id);
+            }
+            rowtype = snowflake_cJSON_GetObjectItem(data, "rowtype");
+            if (snowflake_cJSON_IsArray(rowtype)) {
+                sfstmt->total_fieldcount = snowflake_cJSON_GetArraySize(
+                  rowtype);
+                _snowflake_stmt_desc_reset(sfstmt);
+                sfstmt->desc = set_description(rowtype);
+            }
+            // The column types are needed up front to decode Arrow results, JSON results are only decoded
+            // ahead of time if asked for. The chunk downloader decodes the other chunks the same way.
+            result_format = snowflake_cJSON_GetObjectItem(data, "queryResultFormat");
+            arrow_format = snowflake_cJSON_IsString(result_format) &&
+                           strcmp(result_format->valuestring, "arrow") == 0;
+            if ((sfstmt->chunk_eager_decode || arrow_format) && sfstmt->desc && sfstmt->total_fieldcount > 0) {
+                decode_types = (SF_C_TYPE *) SF_CALLOC((size_t) sfstmt->total_fieldcount, sizeof(SF_C_TYPE));
+                if (!decode_types) {
+                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
+                                             SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                             "Out of memory decoding results.",
+                                             SF_SQLSTATE_MEMORY_ALLOCATION_ERROR,
+                                             sfstmt->sfqid);
+                    goto cleanup;
+                }
+                for (i = 0; i < (size_t) sfstmt->total_fieldcount; i++) {
+                    decode_types[i] = sfstmt->desc[i].c_type;
+                }
+            }
+            // Keep the rows in the same columnar form as the downloaded chunks
+            _snowflake_free_results(sfstmt);
+            sfstmt->cur_row_index = -1;
+            sfstmt->view_row_count = 0;
+            if (arrow_format) {
+                // Set results array
+                cJSON *rowset_base64 = snowflake_cJSON_GetObjectItem(data, "rowsetBase64");
+                if (!snowflake_cJSON_IsString(rowset_base64)) {
+                    log_error("No valid rowsetBase64 found in response");
+                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
+                                             SF_STATUS_ERROR_BAD_RESPONSE,
+                                             "Missing rowset from response. No results found.",
+                                             SF_SQLSTATE_APP_REJECT_CONNECTION,
+                                             sfstmt->sfqid);
+                    goto cleanup;
+                }
+                sfstmt->raw_results = arrow_chunk_from_base64(rowset_base64->valuestring,
+                                                              sfstmt->total_fieldcount, decode_types);
+                if (!sfstmt->raw_results) {
+                    log_error("Invalid Arrow rowset found in response");
+                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
+                                             SF_STATUS_ERROR_BAD_RESPONSE,
+                                             "Invalid rowset in response.",
+                                             SF_SQLSTATE_APP_REJECT_CONNECTION,
+                                             sfstmt->sfqid);
+                    goto cleanup;
+                }
+            } else {
+                // Set results array
+                cJSON *rowset = NULL;
+                if (json_detach_array_from_object(&rowset, data, "rowset")) {
+                    log_error("No valid rowset found in response");
+                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
+                                             SF_STATUS_ERROR_BAD_JSON,
+                                             "Missing rowset from response. No results found.",
+                                             SF_SQLSTATE_APP_REJECT_CONNECTION,
+                                             sfstmt->sfqid);
+                    goto cleanup;
+                }
+                sfstmt->raw_results = result_chunk_from_json(rowset, sfstmt->total_fieldcount);
+                snowflake_cJSON_Delete(rowset);
+                if (!sfstmt->raw_results) {
+                    log_error("Invalid rowset found in response");
+                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
+                                             SF_STATUS_ERROR_BAD_JSON,
+                                             "Invalid rowset in response.",
+                                             SF_SQLSTATE_APP_REJECT_CONNECTION,
+                                             sfstmt->sfqid);
+                    goto cleanup;
+                }
+                if (decode_types &&
+                    !result_chunk_decode((SF_RESULT_CHUNK *) sfstmt->raw_results, decode_types)) {
+                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
+                                             SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                             "Out of memory decoding results.",
+                                             SF_SQLSTATE_MEMORY_ALLOCATION_ERROR,
+                                             sfstmt->sfqid);
+                    goto cleanup;
+                }
+            }
+            // Get number of rows in this chunk
+            sfstmt->first_rowset = sfstmt->raw_results;
+            sfstmt->chunk_rowcount = ((SF_RESULT_CHUNK *) sfstmt->raw_results)->row_count;
+            if (json_copy_int(&sfstmt->total_rowcount, data, "total")) {
+                log_warn(
+                    "No total count found in response. Reverting to using array size of results");
+                sfstmt->total_rowcount = sfstmt->chunk_rowcount;
+            }
+
+            // Index starts at 0 and incremented each fetch
+            sfstmt->total_row_index = 0;
+            sfstmt->chunk_memory_peak = 0;
+
+            // Set large result set if one exists
+            if ((chunks = snowflake_cJSON_GetObjectItem(data, "chunks")) != NULL) {
+                // We don't care if there is no qrmk, so ignore return code
+                json_copy_string(&qrmk, data, "qrmk");
+                chunk_headers = snowflake_cJSON_GetObjectItem(data,
+                                                              "chunkHeaders");
+                sfstmt->chunk_downloader = chunk_downloader_init(
+                    qrmk,
+                    chunk_headers,
+                    chunks,
+                    sfstmt->total_fieldcount,
+                    decode_types,
+                    arrow_format,
+                    sfstmt->result_partitions ? 0 : sfstmt->chunk_download_threads,
+                    sfstmt->chunk_prefetch_slots,
+                    sfstmt->chunk_adaptive_prefetch,
+                    sfstmt->chunk_multi_download,
+                    sfstmt->chunk_memory_limit,
+                    sfstmt->chunk_spill_dir,
+                    &sfstmt->error,
+                    sfstmt->connection->insecure_mode);
+                if (!sfstmt->chunk_downloader) {
+                    // Unable to create chunk downloader. Error is set in chunk_downloader_init function.
+                    goto cleanup;
+                }
+            }
+        }
+    } else if (json_error != SF_JSON_ERROR_NONE) {
+        JSON_ERROR_MSG(json_error, error_msg, "Success code");
+        SET_SNOWFLAKE_STMT_ERROR(
+            &sfstmt->error, SF_STATUS_ERROR_BAD_JSON,
+            error_msg, SF_SQLSTATE_APP_REJECT_CONNECTION, sfstmt->sfqid);
+        goto cleanup;
+    } else if (!success) {
+        cJSON *messageJson = NULL;
+        char *message = NULL;
+        cJSON *codeJson = NULL;
+        int64 code = -1;
+        if (json_copy_string_no_alloc(sfstmt->error.sqlstate, data,
+                                      "sqlState", SF_SQLSTATE_LEN)) {
+            log_debug("No valid sqlstate found in response");
+        }
+        messageJson = snowflake_cJSON_GetObjectItem(resp, "message");
+        if (messageJson) {
+            message = messageJson->valuestring;
+        }
+        codeJson = snowflake_cJSON_GetObjectItem(resp, "code");
+        if (codeJson) {
+            code = (int64) atol(codeJson->valuestring);
+        } else {
+            log_debug("no code element.");
+        }
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, code,
+                                 message ? message
+                                         : "Query was not successful",
+                                 NULL, sfstmt->sfqid);
+        goto cleanup;
+    }
+
+    // Everything went well if we got to this point
+    ret = SF_STATUS_SUCCESS;
+
+cleanup:
+    snowflake_cJSON_free(s_resp);
+    SF_FREE(qrmk);
+    SF_FREE(decode_types);
+
+    return ret;
+}
+
+/**
+ * Writes the bound parameters of the statement, if any, as the bindings member of the query request body.
+ *
+ * @param sfstmt
+ * @param writer JSON writer with the query request body open
+ */
+static void STDCALL _snowflake_write_bindings(SF_STMT *sfstmt, SF_JSON_WRITER *writer) {
+    PARAM_TYPE param_style = _snowflake_get_current_param_style(sfstmt);
+    SF_BIND_INPUT *input;
+    const char *type;
+    char *value;
+    char idxbuf[20];
+    const char *name;
+    size_t i;
+
+    if (param_style != POSITIONAL && param_style != NAMED) {
+        return;
+    }
+    json_writer_begin_object(writer, "bindings");
+    for (i = 0; i < sfstmt->params_len; i++)
+    {
+        if (param_style == POSITIONAL) {
+            input = (SF_BIND_INPUT *) sf_param_store_get(sfstmt->params, i + 1, NULL);
+            sprintf(idxbuf, "%lu", (unsigned long) (i + 1));
+            name = idxbuf;
+        } else {
+            name = (char *)(((NamedParams *)sfstmt->name_list)->name_list[i]);
+            input = (SF_BIND_INPUT *) sf_param_store_get(sfstmt->params, 0, (char *) name);
+            if (input == NULL) {
+                log_error("_snowflake_execute_ex: No parameter by this name %s", name);
+            }
+        }
+        if (input == NULL) {
+            continue;
+        }
+        type = snowflake_type_to_string(
+                c_type_to_snowflake(input->c_type, SF_DB_TYPE_TIMESTAMP_NTZ));
+        value = value_to_string(input->value, input->len, input->c_type);
+        json_writer_begin_object(writer, name);
+        json_writer_string(writer, "type", type);
+        json_writer_string(writer, "value", value);
+        json_writer_end_object(writer);
+        if (value) {
+            SF_FREE(value);
+        }
+    }
+    json_writer_end_object(writer);
+}
+
+/**
+ * Sends the statement to Snowflake.
+ *
+ * @param sfstmt
+ * @param is_put_get_command
+ * @param async_exec Whether to return as soon as the query is submitted, with only the query id set
+ * @return 0 if success, otherwise an errno is returned
+ */
+static SF_STATUS STDCALL _snowflake_execute_query(SF_STMT *sfstmt, sf_bool is_put_get_command,
+                                                  sf_bool async_exec) {
     if (!sfstmt) {
         return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
     }
     clear_snowflake_error(&sfstmt->error);
     SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
-    SF_JSON_ERROR json_error;
-    const char *error_msg;
-    cJSON *body = NULL;
     cJSON *data = NULL;
-    cJSON *rowtype = NULL;
     cJSON *resp = NULL;
-    cJSON *chunks = NULL;
-    cJSON *chunk_headers = NULL;
-    char *qrmk = NULL;
     char *s_body = NULL;
-    char *s_resp = NULL;
     sf_bool success = SF_BOOLEAN_FALSE;
     uuid4_generate(sfstmt->request_id);
     URL_KEY_VALUE url_params[] = {
             {.key="requestId=", .value=sfstmt->request_id, .formatted_key=NULL, .formatted_value=NULL, .key_size=0, .value_size=0}
     };
-    size_t i;
-    cJSON *bindings = NULL;
-    SF_BIND_INPUT *input;
-    const char *type;
-    char *value;
+    SF_JSON_WRITER writer;
 
     _mutex_lock(&sfstmt->connection->mutex_sequence_counter);
     sfstmt->sequence_counter = ++sfstmt->connection->sequence_counter;
     _mutex_unlock(&sfstmt->connection->mutex_sequence_counter);
 
-    if (_snowflake_get_current_param_style(sfstmt) == POSITIONAL)
-    {
-        bindings = snowflake_cJSON_CreateObject();
-        for (i = 0; i < sfstmt->params_len; i++)
-        {
-            cJSON *binding;
-            input = (SF_BIND_INPUT *) sf_param_store_get(sfstmt->params,
-                    i+1,NULL);
-            if (input == NULL) {
-                continue;
-            }
-            // TODO check if input is null and either set error or write msg to log
-            type = snowflake_type_to_string(
-                    c_type_to_snowflake(input->c_type, SF_DB_TYPE_TIMESTAMP_NTZ));
-            value = value_to_string(input->value, input->len, input->c_type);
-            binding = snowflake_cJSON_CreateObject();
-            char idxbuf[20];
-            sprintf(idxbuf, "%lu", (unsigned long) (i + 1));
-            snowflake_cJSON_AddStringToObject(binding, "type", type);
-            snowflake_cJSON_AddStringToObject(binding, "value", value);
-            snowflake_cJSON_AddItemToObject(bindings, idxbuf, binding);
-            if (value) {
-                SF_FREE(value);
-            }
-        }
-    }
-    else if (_snowflake_get_current_param_style(sfstmt) == NAMED)
-    {
-        bindings = snowflake_cJSON_CreateObject();
-        char *named_param = NULL;
-        for(i = 0; i < sfstmt->params_len; i++)
-        {
-            cJSON *binding;
-            named_param = (char *)(((NamedParams *)sfstmt->name_list)->name_list[i]);
-            input = (SF_BIND_INPUT *) sf_param_store_get(sfstmt->params,
-                    0,named_param);
-            if (input == NULL)
-            {
-                log_error("_snowflake_execute_ex: No parameter by this name %s",named_param);
-                continue;
-            }
-            type = snowflake_type_to_string(
-                    c_type_to_snowflake(input->c_type, SF_DB_TYPE_TIMESTAMP_NTZ));
-            value = value_to_string(input->value, input->len, input->c_type);
-            binding = snowflake_cJSON_CreateObject();
-
-            snowflake_cJSON_AddStringToObject(binding, "type", type);
-            snowflake_cJSON_AddStringToObject(binding, "value", value);
-            snowflake_cJSON_AddItemToObject(bindings, named_param, binding);
-            if (value)
-            {
-                SF_FREE(value);
-            }
-        }
-    }
-
     if (is_string_empty(sfstmt->connection->directURL) &&
         (is_string_empty(sfstmt->connection->master_token) ||
          is_string_empty(sfstmt->connection->token))) {
@@ -1633,15 +2636,20 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
         goto cleanup;
     }
 
-    // Create Body
-    body = create_query_json_body(sfstmt->sql_text, sfstmt->sequence_counter,
-                                  is_string_empty(sfstmt->connection->directURL) ?
-                                  NULL : sfstmt->request_id);
-    if (bindings != NULL) {
-        /* binding parameters if exists */
-      snowflake_cJSON_AddItemToObject(body, "bindings", bindings);
+    // Create Body, written straight into one buffer since it can be large with many bindings
+    json_writer_init(&writer, (sfstmt->sql_text ? strlen(sfstmt->sql_text) : 0) + 256 + sfstmt->params_len * 48);
+    json_writer_begin_object(&writer, NULL);
+    write_query_json_body(&writer, sfstmt->sql_text, sfstmt->sequence_counter,
+                          is_string_empty(sfstmt->connection->directURL) ?
+                          NULL : sfstmt->request_id, async_exec);
+    _snowflake_write_bindings(sfstmt, &writer);
+    json_writer_end_object(&writer);
+    if (!(s_body = json_writer_detach(&writer, NULL))) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                 "Ran out of memory trying to create the query request body",
+                                 SF_SQLSTATE_MEMORY_ALLOCATION_ERROR, "");
+        goto cleanup;
     }
-    s_body = snowflake_cJSON_Print(body);
     log_debug("Created body");
     log_trace("Here is constructed body:\n%s", s_body);
 
@@ -1649,205 +2657,202 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
                      QUERY_URL : sfstmt->connection->directURL;
     int url_paramSize = is_string_empty(sfstmt->connection->directURL) ?
                         sizeof(url_params) / sizeof(URL_KEY_VALUE) : 0;
-    if (request(sfstmt->connection, &resp, queryURL, url_params,
-                url_paramSize , s_body, NULL,
-                POST_REQUEST_TYPE, &sfstmt->error, is_put_get_command)) {
-        s_resp = snowflake_cJSON_Print(resp);
-        log_trace("Here is JSON response:\n%s", s_resp);
+    sfstmt->result_poll_count = 0;
+    if (!request(sfstmt->connection, &resp, queryURL, url_params,
+                 url_paramSize , s_body, NULL,
+                 POST_REQUEST_TYPE, &sfstmt->error, is_put_get_command, SF_BOOLEAN_FALSE) ||
+        (!async_exec && !wait_for_query_result(sfstmt->connection, NULL, is_put_get_command, &resp, &sfstmt->error,
+                                               &sfstmt->result_poll_count))) {
+        log_trace("Connection failed");
+        goto cleanup;
+    }
+
+    if (async_exec && json_copy_bool(&success, resp, "success") == SF_JSON_ERROR_NONE && success) {
+        // Only the query id comes back, the result is attached later by snowflake_fetch_result_by_qid
         data = snowflake_cJSON_GetObjectItem(resp, "data");
-        if (json_copy_string_no_alloc(sfstmt->sfqid, data, "queryId",
-                                      SF_UUID4_LEN) && !is_put_get_command) {
-            log_debug("No valid sfqid found in response");
+        if (json_copy_string_no_alloc(sfstmt->sfqid, data, "queryId", SF_UUID4_LEN)) {
+            SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_BAD_RESPONSE,
+                                     "No query id found in response.", SF_SQLSTATE_APP_REJECT_CONNECTION, "");
+            goto cleanup;
         }
-        if ((json_error = json_copy_bool(&success, resp, "success")) ==
-            SF_JSON_ERROR_NONE && success) {
-            if (is_put_get_command) {
-                sfstmt->put_get_response = sf_put_get_response_allocate();
+        ret = SF_STATUS_SUCCESS;
+    } else {
+        ret = _snowflake_process_query_response(sfstmt, resp, is_put_get_command);
+    }
 
-                json_detach_array_from_object(
-                    (cJSON **) (&sfstmt->put_get_response->src_list),
-                    data, "src_locations");
-                json_copy_string_no_alloc(sfstmt->put_get_response->command,
-                                          data, "command", SF_COMMAND_LEN);
-                json_copy_int(&sfstmt->put_get_response->parallel, data,
-                              "parallel");
-                json_copy_bool(&sfstmt->put_get_response->auto_compress, data,
-                               "autoCompress");
-                json_copy_bool(&sfstmt->put_get_response->overwrite, data,
-                               "overwrite");
-                json_copy_string_no_alloc(
-                    sfstmt->put_get_response->source_compression,
-                    data, "sourceCompression",
-                    SF_SOURCE_COMPRESSION_TYPE_LEN);
-                json_copy_bool(
-                    &sfstmt->put_get_response->client_show_encryption_param,
-                    data, "clientShowEncryptionParameter");
-
-                cJSON *enc_mat = snowflake_cJSON_GetObjectItem(data,
-                                                               "encryptionMaterial");
-
-                // In put command response, value of encryptionMaterial is an
-                // object, which in get command response, value is an array of
-                // object since different remote files might have different
-                // encryption material
-                if (snowflake_cJSON_IsArray(enc_mat))
-                {
-                    json_detach_array_from_object(
-                      (cJSON **) (&sfstmt->put_get_response->enc_mat_get),
-                      data, "encryptionMaterial");
-                }
-                else
-                {
-                    json_copy_string(
-                      &sfstmt->put_get_response->enc_mat_put->query_stage_master_key,
-                      enc_mat, "queryStageMasterKey");
-                    json_copy_string_no_alloc(
-                      sfstmt->put_get_response->enc_mat_put->query_id,
-                      enc_mat, "queryId", SF_UUID4_LEN);
-                    json_copy_int(&sfstmt->put_get_response->enc_mat_put->smk_id,
-                                  enc_mat, "smkId");
-                }
+cleanup:
+    snowflake_cJSON_Delete(resp);
+    SF_FREE(s_body);
 
-                cJSON *stage_info = snowflake_cJSON_GetObjectItem(data,
-                                                                  "stageInfo");
-                cJSON *stage_cred = snowflake_cJSON_GetObjectItem(stage_info,
-                                                                  "creds");
+    return ret;
+}
 
-                json_copy_string(
-                    &sfstmt->put_get_response->stage_info->location_type,
-                    stage_info, "locationType");
-                json_copy_string(
-                    &sfstmt->put_get_response->stage_info->location,
-                    stage_info, "location");
-                json_copy_string(&sfstmt->put_get_response->stage_info->path,
-                                 stage_info, "path");
-                json_copy_string(&sfstmt->put_get_response->stage_info->region,
-                                 stage_info, "region");
-                json_copy_string(
-                    &sfstmt->put_get_response->stage_info->stage_cred->aws_secret_key,
-                    stage_cred, "AWS_SECRET_KEY");
-                json_copy_string(
-                    &sfstmt->put_get_response->stage_info->stage_cred->aws_key_id,
-                    stage_cred, "AWS_KEY_ID");
-                json_copy_string(
-                    &sfstmt->put_get_response->stage_info->stage_cred->aws_token,
-                    stage_cred, "AWS_TOKEN");
-                json_copy_string(
-                    &sfstmt->put_get_response->localLocation, data,
-                    "localLocation");
+SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
+                                        sf_bool is_put_get_command) {
+    return _snowflake_execute_query(sfstmt, is_put_get_command, SF_BOOLEAN_FALSE);
+}
 
-            } else {
-                // Set Database info
-                _mutex_lock(&sfstmt->connection->mutex_parameters);
-                /* Set other parameters. Ignore the status */
-                _set_current_objects(sfstmt, data);
-                _set_parameters_session_info(sfstmt->connection, data);
-                _mutex_unlock(&sfstmt->connection->mutex_parameters);
-                int64 stmt_type_id;
-                if (json_copy_int(&stmt_type_id, data, "statementTypeId")) {
-                    /* failed to get statement type id */
-                    sfstmt->is_dml = SF_BOOLEAN_FALSE;
-                } else {
-                    sfstmt->is_dml = detect_stmt_type(stmt_type_id);
-                }
-                rowtype = snowflake_cJSON_GetObjectItem(data, "rowtype");
-                if (snowflake_cJSON_IsArray(rowtype)) {
-                    sfstmt->total_fieldcount = snowflake_cJSON_GetArraySize(
-                      rowtype);
-                    _snowflake_stmt_desc_reset(sfstmt);
-                    sfstmt->desc = set_description(rowtype);
-                }
-                // Set results array
-                if (json_detach_array_from_object(
-                    (cJSON **) (&sfstmt->raw_results),
-                    data, "rowset")) {
-                    log_error("No valid rowset found in response");
-                    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
-                                             SF_STATUS_ERROR_BAD_JSON,
-                                             "Missing rowset from response. No results found.",
-                                             SF_SQLSTATE_APP_REJECT_CONNECTION,
-                                             sfstmt->sfqid);
-                    goto cleanup;
-                }
-                if (json_copy_int(&sfstmt->total_rowcount, data, "total")) {
-                    log_warn(
-                        "No total count found in response. Reverting to using array size of results");
-                    sfstmt->total_rowcount = snowflake_cJSON_GetArraySize(
-                      sfstmt->raw_results);
-                }
-                // Get number of rows in this chunk
-                sfstmt->chunk_rowcount = snowflake_cJSON_GetArraySize(
-                  sfstmt->raw_results);
-
-                // Index starts at 0 and incremented each fetch
-                sfstmt->total_row_index = 0;
-
-                // Set large result set if one exists
-                if ((chunks = snowflake_cJSON_GetObjectItem(data, "chunks")) != NULL) {
-                    // We don't care if there is no qrmk, so ignore return code
-                    json_copy_string(&qrmk, data, "qrmk");
-                    chunk_headers = snowflake_cJSON_GetObjectItem(data,
-                                                                  "chunkHeaders");
-                    sfstmt->chunk_downloader = chunk_downloader_init(
-                        qrmk,
-                        chunk_headers,
-                        chunks,
-                        2, // thread count
-                        4, // fetch slot
-                        &sfstmt->error,
-                        sfstmt->connection->insecure_mode);
-                    if (!sfstmt->chunk_downloader) {
-                        // Unable to create chunk downloader. Error is set in chunk_downloader_init function.
-                        goto cleanup;
-                    }
-                }
+SF_STATUS STDCALL snowflake_execute_async(SF_STMT *sfstmt) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    if (_is_put_get_command(sfstmt->sql_text)) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_BAD_REQUEST,
+                                 "PUT and GET commands can't be executed asynchronously.",
+                                 SF_SQLSTATE_GENERAL_ERROR, sfstmt->sfqid);
+        return SF_STATUS_ERROR_BAD_REQUEST;
+    }
+    return _snowflake_execute_query(sfstmt, SF_BOOLEAN_FALSE, SF_BOOLEAN_TRUE);
+}
+
+/**
+ * Maps a query status reported by Snowflake to the few states an application cares about.
+ */
+static SF_QUERY_STATUS STDCALL _snowflake_query_status_from_string(const char *status) {
+    if (strcmp(status, "QUEUED") == 0 || strcmp(status, "QUEUED_REPARING_WAREHOUSE") == 0 ||
+        strcmp(status, "RESUMING_WAREHOUSE") == 0 || strcmp(status, "BLOCKED") == 0) {
+        return SF_QUERY_STATUS_QUEUED;
+    }
+    if (strcmp(status, "RUNNING") == 0 || strcmp(status, "ABORTING") == 0 || strcmp(status, "RESTARTED") == 0) {
+        return SF_QUERY_STATUS_RUNNING;
+    }
+    if (strcmp(status, "SUCCESS") == 0) {
+        return SF_QUERY_STATUS_SUCCESS;
+    }
+    if (strcmp(status, "FAILED_WITH_ERROR") == 0 || strcmp(status, "FAILED_WITH_INCIDENT") == 0 ||
+        strcmp(status, "DISCONNECTED") == 0) {
+        return SF_QUERY_STATUS_FAILED;
+    }
+    if (strcmp(status, "ABORTED") == 0) {
+        return SF_QUERY_STATUS_ABORTED;
+    }
+    return SF_QUERY_STATUS_UNKNOWN;
+}
+
+SF_STATUS STDCALL snowflake_query_status(SF_CONNECT *sf, const char *qid, SF_QUERY_STATUS *status) {
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    cJSON *resp = NULL;
+    cJSON *data;
+    cJSON *query;
+    char url[sizeof(QUERY_MONITOR_URL_FORMAT) + SF_UUID4_LEN];
+    char query_status[64];
+    sf_bool success = SF_BOOLEAN_FALSE;
+
+    if (!sf) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+    clear_snowflake_error(&sf->error);
+    if (is_string_empty(qid) || strlen(qid) >= SF_UUID4_LEN || !status) {
+        SET_SNOWFLAKE_ERROR(&sf->error, SF_STATUS_ERROR_BAD_REQUEST, "Invalid query id or status.",
+                            SF_SQLSTATE_INVALID_USE_OF_NULL_POINTER);
+        return SF_STATUS_ERROR_BAD_REQUEST;
+    }
+    *status = SF_QUERY_STATUS_UNKNOWN;
+
+    snprintf(url, sizeof(url), QUERY_MONITOR_URL_FORMAT, qid);
+    if (!request(sf, &resp, url, NULL, 0, NULL, NULL, GET_REQUEST_TYPE, &sf->error, SF_BOOLEAN_TRUE,
+                 SF_BOOLEAN_FALSE)) {
+        goto cleanup;
+    }
+    if (json_copy_bool(&success, resp, "success") != SF_JSON_ERROR_NONE || !success) {
+        SET_SNOWFLAKE_ERROR(&sf->error, SF_STATUS_ERROR_BAD_RESPONSE, "Unable to get the status of the query.",
+                            SF_SQLSTATE_GENERAL_ERROR);
+        goto cleanup;
+    }
+
+    // Queries that haven't reached the monitoring service yet aren't listed
+    data = snowflake_cJSON_GetObjectItem(resp, "data");
+    query = snowflake_cJSON_GetArrayItem(snowflake_cJSON_GetObjectItem(data, "queries"), 0);
+    if (query && json_copy_string_no_alloc(query_status, query, "status", sizeof(query_status)) ==
+                 SF_JSON_ERROR_NONE) {
+        *status = _snowflake_query_status_from_string(query_status);
+    }
+    ret = SF_STATUS_SUCCESS;
+
+cleanup:
+    snowflake_cJSON_Delete(resp);
+    return ret;
+}
+
+SF_STATUS STDCALL snowflake_query_wait(SF_CONNECT *sf, const char **qids, size_t count, int64 timeout_ms,
+                                       size_t *index, SF_QUERY_STATUS *status) {
+    SF_STATUS ret;
+    SF_QUERY_STATUS query_status;
+    unsigned long long start;
+    unsigned long long elapsed;
+    unsigned int sleep_ms;
+    size_t i;
+
+    if (!sf) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+    clear_snowflake_error(&sf->error);
+    if (!qids || count == 0 || !index || !status) {
+        SET_SNOWFLAKE_ERROR(&sf->error, SF_STATUS_ERROR_BAD_REQUEST, "No queries to wait for.",
+                            SF_SQLSTATE_INVALID_USE_OF_NULL_POINTER);
+        return SF_STATUS_ERROR_BAD_REQUEST;
+    }
+
+    start = sf_get_monotonic_time_millis();
+    while (1) {
+        for (i = 0; i < count; i++) {
+            if ((ret = snowflake_query_status(sf, qids[i], &query_status)) != SF_STATUS_SUCCESS) {
+                return ret;
             }
-        } else if (json_error != SF_JSON_ERROR_NONE) {
-            JSON_ERROR_MSG(json_error, error_msg, "Success code");
-            SET_SNOWFLAKE_STMT_ERROR(
-                &sfstmt->error, SF_STATUS_ERROR_BAD_JSON,
-                error_msg, SF_SQLSTATE_APP_REJECT_CONNECTION, sfstmt->sfqid);
-            goto cleanup;
-        } else if (!success) {
-            cJSON *messageJson = NULL;
-            char *message = NULL;
-            cJSON *codeJson = NULL;
-            int64 code = -1;
-            if (json_copy_string_no_alloc(sfstmt->error.sqlstate, data,
-                                          "sqlState", SF_SQLSTATE_LEN)) {
-                log_debug("No valid sqlstate found in response");
+            if (query_status == SF_QUERY_STATUS_SUCCESS || query_status == SF_QUERY_STATUS_FAILED ||
+                query_status == SF_QUERY_STATUS_ABORTED) {
+                *index = i;
+                *status = query_status;
+                return SF_STATUS_SUCCESS;
             }
-            messageJson = snowflake_cJSON_GetObjectItem(resp, "message");
-            if (messageJson) {
-                message = messageJson->valuestring;
+        }
+
+        sleep_ms = QUERY_STATUS_POLL_INTERVAL_MS;
+        if (timeout_ms >= 0) {
+            elapsed = sf_get_monotonic_time_millis() - start;
+            if (elapsed >= (unsigned long long) timeout_ms) {
+                SET_SNOWFLAKE_ERROR(&sf->error, SF_STATUS_ERROR_REQUEST_TIMEOUT,
+                                    "No query completed before the timeout.", SF_SQLSTATE_GENERAL_ERROR);
+                return SF_STATUS_ERROR_REQUEST_TIMEOUT;
             }
-            codeJson = snowflake_cJSON_GetObjectItem(resp, "code");
-            if (codeJson) {
-                code = (int64) atol(codeJson->valuestring);
-            } else {
-                log_debug("no code element.");
+            if ((unsigned long long) timeout_ms - elapsed < sleep_ms) {
+                sleep_ms = (unsigned int) ((unsigned long long) timeout_ms - elapsed);
             }
-            SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, code,
-                                     message ? message
-                                             : "Query was not successful",
-                                     NULL, sfstmt->sfqid);
-            goto cleanup;
         }
-    } else {
-        log_trace("Connection failed");
-        goto cleanup;
+        sf_sleep_ms(sleep_ms);
     }
+}
 
-    // Everything went well if we got to this point
-    ret = SF_STATUS_SUCCESS;
+SF_STATUS STDCALL snowflake_fetch_result_by_qid(SF_STMT *sfstmt, const char *qid) {
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    cJSON *resp = NULL;
+    char url[sizeof(QUERY_RESULT_URL_FORMAT) + SF_UUID4_LEN];
+
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    _snowflake_stmt_reset(sfstmt);
+    if (is_string_empty(qid) || strlen(qid) >= SF_UUID4_LEN) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_BAD_REQUEST, "Invalid query id.",
+                                 SF_SQLSTATE_GENERAL_ERROR, sfstmt->sfqid);
+        return SF_STATUS_ERROR_BAD_REQUEST;
+    }
+    strncpy(sfstmt->sfqid, qid, SF_UUID4_LEN);
+
+    // The result URL answers the same way as the query request, still in progress until the query completes
+    snprintf(url, sizeof(url), QUERY_RESULT_URL_FORMAT, qid);
+    sfstmt->result_poll_count = 0;
+    if (!request(sfstmt->connection, &resp, url, NULL, 0, NULL, NULL, GET_REQUEST_TYPE, &sfstmt->error,
+                 SF_BOOLEAN_FALSE, SF_BOOLEAN_FALSE) ||
+        !wait_for_query_result(sfstmt->connection, NULL, SF_BOOLEAN_FALSE, &resp, &sfstmt->error,
+                               &sfstmt->result_poll_count)) {
+        goto cleanup;
+    }
+    ret = _snowflake_process_query_response(sfstmt, resp, SF_BOOLEAN_FALSE);
 
 cleanup:
-    snowflake_cJSON_Delete(body);
     snowflake_cJSON_Delete(resp);
-    SF_FREE(s_body);
-    SF_FREE(s_resp);
-    SF_FREE(qrmk);
-
     return ret;
 }
 
@@ -1919,6 +2924,38 @@ SF_STATUS STDCALL snowflake_stmt_get_attr(
         case SF_STMT_USER_REALLOC_FUNC:
             *value = sfstmt->user_realloc_func;
             break;
+        case SF_STMT_CHUNK_DOWNLOAD_THREADS:
+            *((uint64 *) value) = sfstmt->chunk_download_threads;
+            break;
+        case SF_STMT_CHUNK_PREFETCH_SLOTS:
+            *((uint64 *) value) = sfstmt->chunk_prefetch_slots;
+            break;
+        case SF_STMT_CHUNK_ADAPTIVE_PREFETCH:
+            *((sf_bool *) value) = sfstmt->chunk_adaptive_prefetch;
+            break;
+        case SF_STMT_CHUNK_EAGER_DECODE:
+            *((sf_bool *) value) = sfstmt->chunk_eager_decode;
+            break;
+        case SF_STMT_CHUNK_MULTI_DOWNLOAD:
+            *((sf_bool *) value) = sfstmt->chunk_multi_download;
+            break;
+        case SF_STMT_CHUNK_MEMORY_LIMIT:
+            *((uint64 *) value) = sfstmt->chunk_memory_limit;
+            break;
+        case SF_STMT_CHUNK_MEMORY_PEAK:
+            *((uint64 *) value) = sfstmt->chunk_downloader ?
+                                  chunk_downloader_memory_peak(sfstmt->chunk_downloader) :
+                                  sfstmt->chunk_memory_peak;
+            break;
+        case SF_STMT_CHUNK_SPILL_DIR:
+            *value = sfstmt->chunk_spill_dir;
+            break;
+        case SF_STMT_RESULT_PARTITIONS:
+            *((sf_bool *) value) = sfstmt->result_partitions;
+            break;
+        case SF_STMT_RESULT_POLL_COUNT:
+            *((uint64 *) value) = sfstmt->result_poll_count;
+            break;
         default:
             SET_SNOWFLAKE_ERROR(
                 &sfstmt->error, SF_STATUS_ERROR_BAD_ATTRIBUTE_TYPE,
@@ -1939,6 +2976,35 @@ SF_STATUS STDCALL snowflake_stmt_set_attr(
         case SF_STMT_USER_REALLOC_FUNC:
             sfstmt->user_realloc_func = value;
             break;
+        case SF_STMT_CHUNK_DOWNLOAD_THREADS:
+            sfstmt->chunk_download_threads = value && *((uint64 *) value) > 0 ?
+              *((uint64 *) value) : sfstmt->connection->chunk_download_threads;
+            break;
+        case SF_STMT_CHUNK_PREFETCH_SLOTS:
+            sfstmt->chunk_prefetch_slots = value && *((uint64 *) value) > 0 ?
+              *((uint64 *) value) : sfstmt->connection->chunk_prefetch_slots;
+            break;
+        case SF_STMT_CHUNK_ADAPTIVE_PREFETCH:
+            sfstmt->chunk_adaptive_prefetch = value ? *((sf_bool *) value) :
+                                              sfstmt->connection->chunk_adaptive_prefetch;
+            break;
+        case SF_STMT_CHUNK_EAGER_DECODE:
+            sfstmt->chunk_eager_decode = value ? *((sf_bool *) value) :
+                                         sfstmt->connection->chunk_eager_decode;
+            break;
+        case SF_STMT_CHUNK_MULTI_DOWNLOAD:
+            sfstmt->chunk_multi_download = value ? *((sf_bool *) value) :
+                                           sfstmt->connection->chunk_multi_download;
+            break;
+        case SF_STMT_CHUNK_MEMORY_LIMIT:
+            sfstmt->chunk_memory_limit = value ? *((uint64 *) value) : CHUNK_MEMORY_LIMIT;
+            break;
+        case SF_STMT_CHUNK_SPILL_DIR:
+            alloc_buffer_and_copy(&sfstmt->chunk_spill_dir, value);
+            break;
+        case SF_STMT_RESULT_PARTITIONS:
+            sfstmt->result_partitions = value ? *((sf_bool *) value) : SF_BOOLEAN_FALSE;
+            break;
         default:
             SET_SNOWFLAKE_ERROR(
                 &sfstmt->error, SF_STATUS_ERROR_BAD_ATTRIBUTE_TYPE,
@@ -1977,26 +3043,36 @@ SF_STATUS STDCALL snowflake_propagate_error(SF_CONNECT *sf, SF_STMT *sfstmt) {
     return SF_STATUS_SUCCESS;
 }
 
-// Make sure that idx is in bounds and that column exists
-SF_STATUS STDCALL _snowflake_get_cJSON_column(SF_STMT *sfstmt, int idx, cJSON **column_ptr) {
+// Make sure that idx is in bounds and that there is a current row. The value is NULL for a SQL NULL.
+SF_STATUS STDCALL _snowflake_get_column_value(SF_STMT *sfstmt, int idx, const char **value_ptr,
+                                              size_t *value_len_ptr) {
     if (idx > snowflake_num_fields(sfstmt) || idx <= 0) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_BOUNDS,
                                  "Column index must be between 1 and snowflake_num_fields()", "", sfstmt->sfqid);
         return SF_STATUS_ERROR_OUT_OF_BOUNDS;
     }
 
-    cJSON *column = snowflake_cJSON_GetArrayItem(sfstmt->cur_row, idx - 1);
-    if (!column) {
-        *column_ptr = NULL;
+    SF_RESULT_CHUNK *chunk = (SF_RESULT_CHUNK *) sfstmt->raw_results;
+    if (!chunk || sfstmt->cur_row_index < 0 || sfstmt->cur_row_index >= chunk->row_count ||
+        idx > chunk->column_count) {
+        *value_ptr = NULL;
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_MISSING_COLUMN_IN_ROW,
                                  "Column is missing from row.", "", sfstmt->sfqid);
         return SF_STATUS_ERROR_MISSING_COLUMN_IN_ROW;
     }
 
-    *column_ptr = column;
+    *value_ptr = result_chunk_get_value(chunk, sfstmt->cur_row_index, idx - 1, value_len_ptr);
     return SF_STATUS_SUCCESS;
 }
 
+// Gets the value converted when the chunk was received. Returns SF_BOOLEAN_FALSE if the column was not decoded to
+// this type. Only valid after a successful _snowflake_get_column_value call for a non-null value.
+static sf_bool STDCALL _snowflake_get_decoded_value(SF_STMT *sfstmt, int idx, SF_C_TYPE type,
+                                                    SF_CHUNK_DECODED_VALUE *decoded, SF_STATUS *decode_status) {
+    return result_chunk_get_decoded((SF_RESULT_CHUNK *) sfstmt->raw_results, sfstmt->cur_row_index, idx - 1,
+                                    type, decoded, decode_status);
+}
+
 // Does NULL checking and clears the SF_STMT error struct
 SF_STATUS STDCALL _snowflake_column_null_checks(SF_STMT *sfstmt, void *value_ptr) {
     if (!sfstmt) {
@@ -2014,38 +3090,54 @@ SF_STATUS STDCALL _snowflake_column_null_checks(SF_STMT *sfstmt, void *value_ptr
 
 SF_STATUS STDCALL snowflake_column_as_boolean(SF_STMT *sfstmt, int idx, sf_bool *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     sf_bool value = SF_BOOLEAN_FALSE;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
+    SF_CHUNK_DECODED_VALUE decoded;
+    SF_STATUS decode_status = SF_STATUS_SUCCESS;
     char *endptr;
     errno = 0;
     switch (sfstmt->desc[idx - 1].c_type) {
         case SF_C_TYPE_BOOLEAN:
-            value = strcmp("1", column->valuestring) == 0 ? SF_BOOLEAN_TRUE: SF_BOOLEAN_FALSE;
+            if (_snowflake_get_decoded_value(sfstmt, idx, SF_C_TYPE_BOOLEAN, &decoded, &decode_status)) {
+                value = decoded.bool_value;
+            } else {
+                value = strcmp("1", column) == 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+            }
             break;
         case SF_C_TYPE_FLOAT64: ;
-            float64 float_val = strtod(column->valuestring, &endptr);
+            float64 float_val;
+            if (_snowflake_get_decoded_value(sfstmt, idx, SF_C_TYPE_FLOAT64, &decoded, &decode_status)) {
+                float_val = decoded.float_value;
+            } else {
+                float_val = strtod(column, &endptr);
+                if (endptr == column) {
+                    decode_status = SF_STATUS_ERROR_CONVERSION_FAILURE;
+                } else if (errno == ERANGE || float_val == INFINITY || float_val == -INFINITY) {
+                    decode_status = SF_STATUS_ERROR_OUT_OF_RANGE;
+                }
+            }
             // Check for errors
-            if (endptr == column->valuestring) {
+            if (decode_status == SF_STATUS_ERROR_CONVERSION_FAILURE) {
                 SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                          "Cannot convert value into boolean from float64", "", sfstmt->sfqid);
                 status = SF_STATUS_ERROR_CONVERSION_FAILURE;
                 goto cleanup;
             }
-            if (errno == ERANGE || float_val == INFINITY || float_val == -INFINITY) {
+            if (decode_status == SF_STATUS_ERROR_OUT_OF_RANGE) {
                 SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
                                          "Value out of range for float64. Cannot convert value into boolean", "", sfstmt->sfqid);
                 status = SF_STATUS_ERROR_OUT_OF_RANGE;
@@ -2055,15 +3147,25 @@ SF_STATUS STDCALL snowflake_column_as_boolean(SF_STMT *sfstmt, int idx, sf_bool
             value = (float_val == 0.0) ? SF_BOOLEAN_FALSE : SF_BOOLEAN_TRUE;
             break;
         case SF_C_TYPE_INT64: ;
-            int64 int_val = strtoll(column->valuestring, &endptr, 10);
+            int64 int_val;
+            if (_snowflake_get_decoded_value(sfstmt, idx, SF_C_TYPE_INT64, &decoded, &decode_status)) {
+                int_val = decoded.int_value;
+            } else {
+                int_val = strtoll(column, &endptr, 10);
+                if (endptr == column) {
+                    decode_status = SF_STATUS_ERROR_CONVERSION_FAILURE;
+                } else if ((int_val == SF_INT64_MAX || int_val == SF_INT64_MIN) && errno == ERANGE) {
+                    decode_status = SF_STATUS_ERROR_OUT_OF_RANGE;
+                }
+            }
             // Check for errors
-            if (endptr == column->valuestring) {
+            if (decode_status == SF_STATUS_ERROR_CONVERSION_FAILURE) {
                 SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                          "Cannot convert value into boolean from int64", "", sfstmt->sfqid);
                 status = SF_STATUS_ERROR_CONVERSION_FAILURE;
                 goto cleanup;
             }
-            if ((int_val == SF_INT64_MAX || int_val == SF_INT64_MIN) && errno == ERANGE) {
+            if (decode_status == SF_STATUS_ERROR_OUT_OF_RANGE) {
                 SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
                                          "Value out of range for int64. Cannot convert value into boolean", "", sfstmt->sfqid);
                 status = SF_STATUS_ERROR_OUT_OF_RANGE;
@@ -2073,7 +3175,7 @@ SF_STATUS STDCALL snowflake_column_as_boolean(SF_STMT *sfstmt, int idx, sf_bool
             value = (int_val == 0) ? SF_BOOLEAN_FALSE : SF_BOOLEAN_TRUE;
             break;
         case SF_C_TYPE_STRING:
-            if (strlen(column->valuestring) == 0) {
+            if (strlen(column) == 0) {
                 value = SF_BOOLEAN_FALSE;
             } else {
                 value = SF_BOOLEAN_TRUE;
@@ -2093,51 +3195,51 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_uint8(SF_STMT *sfstmt, int idx, uint8 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
-    *value_ptr = (!snowflake_cJSON_IsNull(column)) ? (uint8) column->valuestring[0] : (uint8) 0;
+    *value_ptr = (column != NULL) ? (uint8) column[0] : (uint8) 0;
     return SF_STATUS_SUCCESS;
 }
 
 SF_STATUS STDCALL snowflake_column_as_uint32(SF_STMT *sfstmt, int idx, uint32 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     uint64 value = 0;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
     char *endptr;
     errno = 0;
-    value = strtoull(column->valuestring, &endptr, 10);
+    value = strtoull(column, &endptr, 10);
     // Check for errors
-    if (endptr == column->valuestring) {
+    if (endptr == column) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                  "Cannot convert value into uint32", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_CONVERSION_FAILURE;
         goto cleanup;
     }
-    sf_bool neg = (strchr(column->valuestring, '-') != NULL) ? SF_BOOLEAN_TRUE: SF_BOOLEAN_FALSE;
+    sf_bool neg = (strchr(column, '-') != NULL) ? SF_BOOLEAN_TRUE: SF_BOOLEAN_FALSE;
     // Check for out of range
     if (((value == ULONG_MAX || value == 0) && errno == ERANGE) ||
             (!neg && value > SF_UINT32_MAX) ||
@@ -2161,28 +3263,28 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_uint64(SF_STMT *sfstmt, int idx, uint64 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     uint64 value = 0;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
     char *endptr;
     errno = 0;
-    value = strtoull(column->valuestring, &endptr, 10);
+    value = strtoull(column, &endptr, 10);
     // Check for errors
-    if (endptr == column->valuestring) {
+    if (endptr == column) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                  "Cannot convert value into uint64", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_CONVERSION_FAILURE;
@@ -2204,45 +3306,45 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_int8(SF_STMT *sfstmt, int idx, int8 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
-    *value_ptr = (!snowflake_cJSON_IsNull(column)) ? (int8) column->valuestring[0] : (int8) 0;
+    *value_ptr = (column != NULL) ? (int8) column[0] : (int8) 0;
     return SF_STATUS_SUCCESS;
 }
 
 SF_STATUS STDCALL snowflake_column_as_int32(SF_STMT *sfstmt, int idx, int32 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     int64 value = 0;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
     char *endptr;
     errno = 0;
-    value = strtoll(column->valuestring, &endptr, 10);
+    value = strtoll(column, &endptr, 10);
     // Check for errors
-    if (endptr == column->valuestring) {
+    if (endptr == column) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                  "Cannot convert value into int32", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_CONVERSION_FAILURE;
@@ -2264,34 +3366,45 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_int64(SF_STMT *sfstmt, int idx, int64 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     int64 value = 0;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
+    SF_CHUNK_DECODED_VALUE decoded;
+    SF_STATUS decode_status = SF_STATUS_SUCCESS;
     char *endptr;
-    errno = 0;
-    value = strtoll(column->valuestring, &endptr, 10);
+    if (_snowflake_get_decoded_value(sfstmt, idx, SF_C_TYPE_INT64, &decoded, &decode_status)) {
+        value = decoded.int_value;
+    } else {
+        errno = 0;
+        value = strtoll(column, &endptr, 10);
+        if (endptr == column) {
+            decode_status = SF_STATUS_ERROR_CONVERSION_FAILURE;
+        } else if ((value == SF_INT64_MAX || value == SF_INT64_MIN) && errno == ERANGE) {
+            decode_status = SF_STATUS_ERROR_OUT_OF_RANGE;
+        }
+    }
     // Check for errors
-    if (endptr == column->valuestring) {
+    if (decode_status == SF_STATUS_ERROR_CONVERSION_FAILURE) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                  "Cannot convert value into int64", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_CONVERSION_FAILURE;
         goto cleanup;
     }
-    if ((value == SF_INT64_MAX || value == SF_INT64_MIN) && errno == ERANGE) {
+    if (decode_status == SF_STATUS_ERROR_OUT_OF_RANGE) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
                                  "Value out of range for int64", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_OUT_OF_RANGE;
@@ -2307,28 +3420,28 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_float32(SF_STMT *sfstmt, int idx, float32 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     float32 value = 0.0;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
     char *endptr;
     errno = 0;
-    value = strtof(column->valuestring, &endptr);
+    value = strtof(column, &endptr);
     // Check for errors
-    if (endptr == column->valuestring) {
+    if (endptr == column) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                  "Cannot convert value into float32", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_CONVERSION_FAILURE;
@@ -2350,34 +3463,45 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_float64(SF_STMT *sfstmt, int idx, float64 *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     float64 value = 0.0;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         status = SF_STATUS_SUCCESS;
         goto cleanup;
     }
 
+    SF_CHUNK_DECODED_VALUE decoded;
+    SF_STATUS decode_status = SF_STATUS_SUCCESS;
     char *endptr;
-    errno = 0;
-    value = strtod(column->valuestring, &endptr);
+    if (_snowflake_get_decoded_value(sfstmt, idx, SF_C_TYPE_FLOAT64, &decoded, &decode_status)) {
+        value = decoded.float_value;
+    } else {
+        errno = 0;
+        value = strtod(column, &endptr);
+        if (endptr == column) {
+            decode_status = SF_STATUS_ERROR_CONVERSION_FAILURE;
+        } else if (errno == ERANGE || value == INFINITY || value == -INFINITY) {
+            decode_status = SF_STATUS_ERROR_OUT_OF_RANGE;
+        }
+    }
     // Check for errors
-    if (endptr == column->valuestring) {
+    if (decode_status == SF_STATUS_ERROR_CONVERSION_FAILURE) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_CONVERSION_FAILURE,
                                  "Cannot convert value into float64", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_CONVERSION_FAILURE;
         goto cleanup;
     }
-    if (errno == ERANGE || value == INFINITY || value == -INFINITY) {
+    if (decode_status == SF_STATUS_ERROR_OUT_OF_RANGE) {
         SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
                                  "Value out of range for float64", "", sfstmt->sfqid);
         status = SF_STATUS_ERROR_OUT_OF_RANGE;
@@ -2393,19 +3517,19 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_as_timestamp(SF_STMT *sfstmt, int idx, SF_TIMESTAMP *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     SF_DB_TYPE db_type = sfstmt->desc[idx - 1].type;
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         snowflake_timestamp_from_parts(value_ptr, 0, 0, 0, 0, 1, 1, 1970, 0, 9, SF_DB_TYPE_TIMESTAMP_NTZ);
         return SF_STATUS_SUCCESS;
     }
@@ -2416,7 +3540,7 @@ SF_STATUS STDCALL snowflake_column_as_timestamp(SF_STMT *sfstmt, int idx, SF_TIM
         db_type == SF_DB_TYPE_TIMESTAMP_NTZ ||
         db_type == SF_DB_TYPE_TIMESTAMP_TZ) {
         return snowflake_timestamp_from_epoch_seconds(value_ptr,
-                                                      column->valuestring,
+                                                      column,
                                                       sfstmt->connection->timezone,
                                                       (int32) sfstmt->desc[idx - 1].scale,
                                                       db_type);
@@ -2427,32 +3551,33 @@ SF_STATUS STDCALL snowflake_column_as_timestamp(SF_STMT *sfstmt, int idx, SF_TIM
 
 SF_STATUS STDCALL snowflake_column_as_const_str(SF_STMT *sfstmt, int idx, const char **value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
-    *value_ptr = (!snowflake_cJSON_IsNull(column)) ? column->valuestring : NULL;
+    *value_ptr = column;
 
     return SF_STATUS_SUCCESS;
 }
 
 SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value_ptr, size_t *value_len_ptr, size_t *max_value_size_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
+    size_t column_len = 0;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, &column_len)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
@@ -2470,7 +3595,7 @@ SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value
         preallocated = SF_BOOLEAN_TRUE;
     }
 
-    if (snowflake_cJSON_IsNull(column)) {
+    if (column == NULL) {
         // If value is NULL, allocate buffer for empty string
         if (init_value_len == 0) {
             value = global_hooks.calloc(1, 1);
@@ -2493,7 +3618,7 @@ SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value
     switch (sfstmt->desc[idx - 1].type) {
         case SF_DB_TYPE_BOOLEAN: ;
             const char *bool_value;
-            if (strcmp(column->valuestring, "0") == 0) {
+            if (strcmp(column, "0") == 0) {
                 /* False */
                 bool_value = SF_BOOLEAN_FALSE_STR;
             } else {
@@ -2517,11 +3642,9 @@ SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value
             break;
         case SF_DB_TYPE_DATE:
             sec =
-              (time_t) strtol(column->valuestring, NULL, 10) *
+              (time_t) strtol(column, NULL, 10) *
               86400L;
-            _mutex_lock(&gmlocaltime_lock);
             tm_ptr = sf_gmtime(&sec, &tm_obj);
-            _mutex_unlock(&gmlocaltime_lock);
             if (tm_ptr == NULL) {
                 SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error,
                                     SF_STATUS_ERROR_CONVERSION_FAILURE,
@@ -2554,7 +3677,7 @@ SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value
         case SF_DB_TYPE_TIMESTAMP_TZ: ;
             SF_TIMESTAMP ts;
             if (snowflake_timestamp_from_epoch_seconds(&ts,
-                                                        column->valuestring,
+                                                        column,
                                                         sfstmt->connection->timezone,
                                                         (int32) sfstmt->desc[idx - 1].scale,
                                                         sfstmt->desc[idx - 1].type)) {
@@ -2593,7 +3716,7 @@ SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value
 
             break;
         default:
-            value_len = strlen(column->valuestring);
+            value_len = column_len;
             if (value_len + 1 > init_value_len) {
                 if (preallocated) {
                     value = global_hooks.realloc(value, value_len + 1);
@@ -2606,7 +3729,7 @@ SF_STATUS STDCALL snowflake_column_as_str(SF_STMT *sfstmt, int idx, char **value
             } else {
                 max_value_size = init_value_len;
             }
-            strncpy(value, column->valuestring, value_len + 1);
+            strncpy(value, column, value_len + 1);
             break;
     }
 
@@ -2626,40 +3749,37 @@ cleanup:
 
 SF_STATUS STDCALL snowflake_column_strlen(SF_STMT *sfstmt, int idx, size_t *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
+    size_t column_len = 0;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, &column_len)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
-    if (snowflake_cJSON_IsNull(column)) {
-        *value_ptr = 0;
-    } else {
-        *value_ptr = strlen(snowflake_cJSON_GetArrayItem(sfstmt->cur_row, idx - 1)->valuestring);
-    }
+    *value_ptr = column_len;
 
     return SF_STATUS_SUCCESS;
 }
 
 SF_STATUS STDCALL snowflake_column_is_null(SF_STMT *sfstmt, int idx, sf_bool *value_ptr) {
     SF_STATUS status;
-    cJSON *column = NULL;
+    const char *column = NULL;
 
     if ((status = _snowflake_column_null_checks(sfstmt, (void *) value_ptr)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
     // Get column
-    if ((status = _snowflake_get_cJSON_column(sfstmt, idx, &column)) != SF_STATUS_SUCCESS) {
+    if ((status = _snowflake_get_column_value(sfstmt, idx, &column, NULL)) != SF_STATUS_SUCCESS) {
         return status;
     }
 
-    *value_ptr = snowflake_cJSON_IsNull(column) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    *value_ptr = column == NULL ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
 
     return SF_STATUS_SUCCESS;
 }
@@ -2745,8 +3865,7 @@ SF_STATUS STDCALL snowflake_timestamp_from_epoch_seconds(SF_TIMESTAMP *ts, const
     time_t sec = 0L;
     int64 tzoffset = 0;
     struct tm *tm_ptr = NULL;
-    char tzname[64];
-    char *tzptr = (char *) timezone;
+    const SF_TIMEZONE *zone;
 
     memset(&ts->tm_obj, 0, sizeof(ts->tm_obj));
     ts->nsec = 0;
@@ -2786,38 +3905,35 @@ SF_STATUS STDCALL snowflake_timestamp_from_epoch_seconds(SF_TIMESTAMP *ts, const
     // Transform nsec to a 9 digit number to store in the timestamp struct
     ts->nsec = (int32) (nsec * pow10_int64[9-ts->scale]);
 
-    if (ts->ts_type == SF_DB_TYPE_TIMESTAMP_TZ) {
-        /* make up Timezone name from the tzoffset */
-        ldiv_t dm = ldiv((long) tzoffset, 60L);
-        sprintf(tzname, "UTC%c%02ld:%02ld",
-                dm.quot > 0 ? '+' : '-', labs(dm.quot), labs(dm.rem));
-        tzptr = tzname;
-        ts->tzoffset = (int32) tzoffset;
-    }
-
     /* replace a dot character with NULL */
     if (ts->ts_type == SF_DB_TYPE_TIMESTAMP_NTZ ||
         ts->ts_type == SF_DB_TYPE_TIME ||
         ts->ts_type == SF_DB_TYPE_DATE) {
         tm_ptr = sf_gmtime(&sec, &ts->tm_obj);
-    } else if (ts->ts_type == SF_DB_TYPE_TIMESTAMP_LTZ ||
-      ts->ts_type == SF_DB_TYPE_TIMESTAMP_TZ) {
-        /* set the environment variable TZ to the session timezone
-         * so that localtime_tz honors it.
-         */
-        _mutex_lock(&gmlocaltime_lock);
-        const char *prev_tz_ptr = sf_getenv("TZ");
-        sf_setenv("TZ", tzptr);
-        sf_tzset();
-        sec += tzoffset * 60 * 2; /* adjust for TIMESTAMP_TZ */
-        tm_ptr = sf_localtime(&sec, &ts->tm_obj);
-        if (prev_tz_ptr != NULL) {
-            sf_setenv("TZ", prev_tz_ptr); /* cannot set to NULL */
+    } else if (ts->ts_type == SF_DB_TYPE_TIMESTAMP_TZ) {
+        // The offset comes with the value
+        ts->tzoffset = (int32) tzoffset;
+        tm_ptr = sf_offset_time(sec, (int32) tzoffset * 60, &ts->tm_obj);
+    } else if (ts->ts_type == SF_DB_TYPE_TIMESTAMP_LTZ) {
+        if ((zone = sf_timezone_get(timezone)) != NULL) {
+            tm_ptr = sf_timezone_localtime(zone, sec, &ts->tm_obj);
         } else {
-            sf_unsetenv("TZ");
+            /* No tzfile for the session timezone, set the environment variable TZ to it
+             * so that localtime_tz honors it.
+             */
+            _mutex_lock(&gmlocaltime_lock);
+            const char *prev_tz_ptr = sf_getenv("TZ");
+            sf_setenv("TZ", timezone);
+            sf_tzset();
+            tm_ptr = sf_localtime(&sec, &ts->tm_obj);
+            if (prev_tz_ptr != NULL) {
+                sf_setenv("TZ", prev_tz_ptr); /* cannot set to NULL */
+            } else {
+                sf_unsetenv("TZ");
+            }
+            sf_tzset();
+            _mutex_unlock(&gmlocaltime_lock);
         }
-        sf_tzset();
-        _mutex_unlock(&gmlocaltime_lock);
     }
     if (tm_ptr == NULL) {
         ret = SF_STATUS_ERROR_GENERAL;
@@ -16,6 +16,9 @@
 #define HEADER_ACCEPT_TYPE_APPLICATION_JSON "accept: application/json"
 #define HEADER_C_API_USER_AGENT "User-Agent: c_api/0.1"
 #define HEADER_DIRECT_QUERY_TOKEN_FORMAT "Authorization: %s"
+#define HEADER_CONTENT_ENCODING_GZIP "Content-Encoding: gzip"
+// Keeps cURL from waiting for a 100 Continue response before sending bodies larger than 1KB
+#define HEADER_NO_EXPECT "Expect:"
 
 #define DEFAULT_SNOWFLAKE_BASE_URL "snowflakecomputing.com"
 #define DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT 60
@@ -24,6 +27,8 @@
 #define QUERY_URL "/queries/v1/query-request"
 #define RENEW_SESSION_URL "/session/token-request"
 #define DELETE_SESSION_URL "/session"
+#define QUERY_RESULT_URL_FORMAT "/queries/%s/result"
+#define QUERY_MONITOR_URL_FORMAT "/monitoring/queries/%s"
 
 #define URL_QUERY_DELIMITER "?"
 #define URL_PARAM_DELIM "&"
@@ -32,6 +37,9 @@
 #define QUERY_IN_PROGRESS_CODE "333333"
 #define QUERY_IN_PROGRESS_ASYNC_CODE "333334"
 
+// Time between status checks of snowflake_query_wait
+#define QUERY_STATUS_POLL_INTERVAL_MS 250
+
 #define REQUEST_TYPE_RENEW "RENEW"
 #define REQUEST_TYPE_CLONE "CLONE"
 #define REQUEST_TYPE_ISSUE "ISSUE"
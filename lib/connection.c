@@ -3,6 +3,7 @@
  */
 
 #include <string.h>
+#include <zlib.h>
 #include "connection.h"
 #include <snowflake/logger.h>
 #include "snowflake/platform.h"
@@ -14,6 +15,16 @@
 #define curl_easier_escape(curl, string) curl_easy_escape(curl, string, 0)
 #define QUERYCODE_LEN 7
 #define REQUEST_GUID_KEY_SIZE 13
+// Attempts of a result chunk download in a row that fail without receiving anything that can be resumed from
+#define CHUNK_TRANSFER_ATTEMPTS 3
+// Longest Retry-After delay that is taken from a response
+#define RETRY_AFTER_MAX_SECONDS 3600
+// First delay before checking the result of a query that is still running
+#define QUERY_POLL_INITIAL_INTERVAL_MS 50
+// Idle cURL handles kept by a connection, enough for the requests that usually run at the same time
+#define HTTP_SESSION_MAX_IDLE_HANDLES 8
+// Request headers a connection keeps, one for each accept type with and without a gzip content encoding
+#define HTTP_SESSION_HEADERS 4
 
 /*
  * Debug functions from curl example. Should update at somepoint, and possibly remove from header since these are private functions
@@ -151,6 +162,9 @@ cJSON *STDCALL create_auth_json_body(SF_CONNECT *sf,
                                       : SF_BOOLEAN_INTERNAL_FALSE_STR);
 
     snowflake_cJSON_AddStringToObject(session_parameters, "TIMEZONE", timezone);
+    if (sf->arrow_result_format) {
+        snowflake_cJSON_AddStringToObject(session_parameters, "C_API_QUERY_RESULT_FORMAT", "ARROW");
+    }
 
     //Create Request Data JSON blob
     data = snowflake_cJSON_CreateObject();
@@ -174,19 +188,16 @@ cJSON *STDCALL create_auth_json_body(SF_CONNECT *sf,
     return body;
 }
 
-cJSON *STDCALL create_query_json_body(const char *sql_text, int64 sequence_id, const char *request_id) {
-    cJSON *body;
-    // Create body
-    body = snowflake_cJSON_CreateObject();
-    snowflake_cJSON_AddStringToObject(body, "sqlText", sql_text);
-    snowflake_cJSON_AddBoolToObject(body, "asyncExec", SF_BOOLEAN_FALSE);
-    snowflake_cJSON_AddNumberToObject(body, "sequenceId", (double) sequence_id);
-    snowflake_cJSON_AddNumberToObject(body, "querySubmissionTime", (double) time(NULL) * 1000);
+void STDCALL write_query_json_body(SF_JSON_WRITER *writer, const char *sql_text, int64 sequence_id,
+                                   const char *request_id, sf_bool async_exec) {
+    json_writer_string(writer, "sqlText", sql_text);
+    json_writer_bool(writer, "asyncExec", async_exec);
+    json_writer_int64(writer, "sequenceId", sequence_id);
+    json_writer_int64(writer, "querySubmissionTime", (int64) time(NULL) * 1000);
     if (request_id)
     {
-        snowflake_cJSON_AddStringToObject(body, "requestId", request_id);
+        json_writer_string(writer, "requestId", request_id);
     }
-    return body;
 }
 
 cJSON *STDCALL create_renew_session_json_body(const char *old_token) {
@@ -207,6 +218,7 @@ struct curl_slist *STDCALL create_header_no_token(sf_bool use_application_json_a
                                HEADER_ACCEPT_TYPE_APPLICATION_JSON :
                                HEADER_ACCEPT_TYPE_APPLICATION_SNOWFLAKE);
     header = curl_slist_append(header, HEADER_C_API_USER_AGENT);
+    header = curl_slist_append(header, HEADER_NO_EXPECT);
     return header;
 }
 
@@ -220,6 +232,54 @@ struct curl_slist *STDCALL create_header_token(const char *header_token,
                                HEADER_ACCEPT_TYPE_APPLICATION_JSON :
                                HEADER_ACCEPT_TYPE_APPLICATION_SNOWFLAKE);
     header = curl_slist_append(header, HEADER_C_API_USER_AGENT);
+    header = curl_slist_append(header, HEADER_NO_EXPECT);
+    return header;
+}
+
+/**
+ * Creates the header of a request with whichever token the connection has.
+ *
+ * @return The header or NULL if there isn't enough memory, in which case the error is set.
+ */
+static struct curl_slist *STDCALL create_request_header(SF_CONNECT *sf, sf_bool use_application_json_accept_type,
+                                                        sf_bool gzip_body, SF_ERROR_STRUCT *error) {
+    struct curl_slist *header = NULL;
+    char *header_token = NULL;
+    size_t header_token_size;
+    if (sf->token) {
+        header_token_size = strlen(HEADER_SNOWFLAKE_TOKEN_FORMAT) - 2 +
+                            strlen(sf->token) + 1;
+        header_token = (char *) SF_CALLOC(1, header_token_size);
+        if (!header_token) {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                "Ran out of memory trying to create header token",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            return NULL;
+        }
+        snprintf(header_token, header_token_size,
+                 HEADER_SNOWFLAKE_TOKEN_FORMAT, sf->token);
+        header = create_header_token(header_token, use_application_json_accept_type);
+    } else if (sf->direct_query_token) {
+        header_token_size = strlen(HEADER_DIRECT_QUERY_TOKEN_FORMAT) - 2 +
+                            strlen(sf->direct_query_token) + 1;
+        header_token = (char *) SF_CALLOC(1, header_token_size);
+        if (!header_token) {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                "Ran out of memory trying to create header direct query token",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            return NULL;
+        }
+        snprintf(header_token, header_token_size,
+                 HEADER_DIRECT_QUERY_TOKEN_FORMAT, sf->direct_query_token);
+        header = create_header_token(header_token, use_application_json_accept_type);
+    } else {
+        header = create_header_no_token(use_application_json_accept_type);
+    }
+    // The header holds copies of the strings
+    SF_FREE(header_token);
+    if (header && gzip_body) {
+        header = curl_slist_append(header, HEADER_CONTENT_ENCODING_GZIP);
+    }
     return header;
 }
 
@@ -228,25 +288,22 @@ sf_bool STDCALL curl_post_call(SF_CONNECT *sf,
                                char *url,
                                struct curl_slist *header,
                                char *body,
+                               size_t compressed_len,
                                cJSON **json,
-                               SF_ERROR_STRUCT *error) {
+                               SF_ERROR_STRUCT *error,
+                               sf_bool wait_for_result) {
     const char *error_msg;
     SF_JSON_ERROR json_error;
     char query_code[QUERYCODE_LEN];
-    char *result_url = NULL;
-    cJSON *data = NULL;
-    struct curl_slist *new_header = NULL;
-    size_t header_token_size;
-    char *header_token = NULL;
+    SF_HTTP_HEADER *new_header = NULL;
     sf_bool ret = SF_BOOLEAN_FALSE;
-    sf_bool stop = SF_BOOLEAN_FALSE;
 
     // Set to 0
     memset(query_code, 0, QUERYCODE_LEN);
 
     do {
-        if (!http_perform(curl, POST_REQUEST_TYPE, url, header, body, json,
-                          sf->network_timeout, SF_BOOLEAN_FALSE, error, sf->insecure_mode) ||
+        if (!http_perform(curl, POST_REQUEST_TYPE, url, header, body, compressed_len, json,
+                          sf->network_timeout, NULL, NULL, error, sf->insecure_mode, NULL) ||
             !*json) {
             // Error is set in the perform function
             break;
@@ -272,76 +329,127 @@ sf_bool STDCALL curl_post_call(SF_CONNECT *sf,
                 // Error is set in renew session function
                 break;
             } else {
-                // TODO refactor creating the header token string
-                // Create new header since we have a new token
-                header_token_size = strlen(HEADER_SNOWFLAKE_TOKEN_FORMAT) - 2 +
-                                    strlen(sf->token) + 1;
-                header_token = (char *) SF_CALLOC(1, header_token_size);
-                if (!header_token) {
-                    SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
-                                        "Ran out of memory trying to create header token",
-                                        SF_SQLSTATE_UNABLE_TO_CONNECT);
+                // The header of the connection has the new token
+                if (!(new_header = http_session_acquire_header(sf, SF_BOOLEAN_FALSE, compressed_len > 0, error))) {
                     break;
                 }
-                snprintf(header_token, header_token_size,
-                         HEADER_SNOWFLAKE_TOKEN_FORMAT, sf->token);
-                new_header = create_header_token(header_token, SF_BOOLEAN_FALSE);
-                if (!curl_post_call(sf, curl, url, new_header, body, json,
-                                    error)) {
+                if (!curl_post_call(sf, curl, url, new_header->slist, body, compressed_len, json,
+                                    error, wait_for_result)) {
                     // Error is set in curl call
                     break;
                 }
             }
         }
 
-        while (strcmp(query_code, QUERY_IN_PROGRESS_CODE) == 0 ||
-               strcmp(query_code, QUERY_IN_PROGRESS_ASYNC_CODE) == 0) {
-            // Remove old result URL and query code if this isn't our first rodeo
-            SF_FREE(result_url);
-            memset(query_code, 0, QUERYCODE_LEN);
-            data = snowflake_cJSON_GetObjectItem(*json, "data");
-            if (json_copy_string(&result_url, data, "getResultUrl") !=
-                SF_JSON_ERROR_NONE) {
-                stop = SF_BOOLEAN_TRUE;
-                JSON_ERROR_MSG(json_error, error_msg, "Result URL");
-                SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON, error_msg,
-                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
-                break;
-            }
+        // Polls have no body, so they don't take the header of a compressed one
+        if (wait_for_result && !wait_for_query_result(sf, compressed_len ? NULL : header, SF_BOOLEAN_FALSE, json, error,
+                                                      NULL)) {
+            // Error is set in wait for query result function
+            break;
+        }
 
-            log_trace("ping pong starting...");
-            if (!request(sf, json, result_url, NULL, 0, NULL, header,
-                         GET_REQUEST_TYPE, error, SF_BOOLEAN_FALSE)) {
-                // Error came from request up, just break
-                stop = SF_BOOLEAN_TRUE;
-                break;
-            }
+        ret = SF_BOOLEAN_TRUE;
+    }
+    while (0); // Dummy loop to break out of
 
-            if (
-              (json_error = json_copy_string_no_alloc(query_code, *json, "code",
-                                                      QUERYCODE_LEN)) !=
-              SF_JSON_ERROR_NONE &&
-              json_error != SF_JSON_ERROR_ITEM_NULL) {
-                stop = SF_BOOLEAN_TRUE;
-                JSON_ERROR_MSG(json_error, error_msg, "Query code");
-                SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON, error_msg,
-                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
-                break;
-            }
+    http_session_release_header(sf, new_header);
+
+    return ret;
+}
+
+sf_bool STDCALL wait_for_query_result(SF_CONNECT *sf, struct curl_slist *header,
+                                      sf_bool use_application_json_accept_type, cJSON **json,
+                                      SF_ERROR_STRUCT *error, uint64 *poll_count) {
+    const char *error_msg;
+    SF_JSON_ERROR json_error;
+    char query_code[QUERYCODE_LEN];
+    char *result_url = NULL;
+    char *encoded_url = NULL;
+    cJSON *data = NULL;
+    CURL *curl = NULL;
+    SF_HTTP_HEADER *session_header = NULL;
+    DECORRELATE_JITTER_BACKOFF backoff = {
+      QUERY_POLL_INITIAL_INTERVAL_MS,     //base in ms
+      (uint32) sf->query_poll_max_interval //cap in ms
+    };
+    uint32 sleep_ms = 0;
+    uint32 retry_after_ms = 0;
+    sf_bool ret = SF_BOOLEAN_FALSE;
+
+    if (backoff.cap < backoff.base) {
+        backoff.base = backoff.cap;
+    }
+    memset(query_code, 0, QUERYCODE_LEN);
+    if ((json_error = json_copy_string_no_alloc(query_code, *json, "code", QUERYCODE_LEN)) != SF_JSON_ERROR_NONE &&
+        json_error != SF_JSON_ERROR_ITEM_NULL) {
+        JSON_ERROR_MSG(json_error, error_msg, "Query code");
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON, error_msg, SF_SQLSTATE_UNABLE_TO_CONNECT);
+        return SF_BOOLEAN_FALSE;
+    }
+
+    while (strcmp(query_code, QUERY_IN_PROGRESS_CODE) == 0 ||
+           strcmp(query_code, QUERY_IN_PROGRESS_ASYNC_CODE) == 0) {
+        // Remove old result URL and query code if this isn't our first rodeo
+        SF_FREE(result_url);
+        SF_FREE(encoded_url);
+        memset(query_code, 0, QUERYCODE_LEN);
+        data = snowflake_cJSON_GetObjectItem(*json, "data");
+        if ((json_error = json_copy_string(&result_url, data, "getResultUrl")) != SF_JSON_ERROR_NONE) {
+            JSON_ERROR_MSG(json_error, error_msg, "Result URL");
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON, error_msg, SF_SQLSTATE_UNABLE_TO_CONNECT);
+            goto cleanup;
         }
 
-        if (stop) {
-            break;
+        // Back off while the query keeps running, unless the server said how long to wait
+        sleep_ms = sleep_ms ? decorrelate_jitter_next_sleep(&backoff, sleep_ms) : backoff.base;
+        if (retry_after_ms) {
+            sleep_ms = uimin(retry_after_ms, backoff.cap);
         }
+        log_trace("ping pong in %u ms...", sleep_ms);
+        sf_sleep_ms(sleep_ms);
 
-        ret = SF_BOOLEAN_TRUE;
+        // One handle for all polls, which keeps the connection to the result URL open between them
+        if (!curl && !(curl = http_session_acquire_handle(sf))) {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_CURL, "Unable to create cURL handle",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            goto cleanup;
+        }
+        if (!(encoded_url = encode_url(curl, sf->protocol, sf->account, sf->host, sf->port, result_url, NULL, 0,
+                                       error, sf->directURL_param))) {
+            goto cleanup;
+        }
+        // The session token may have been renewed by the last poll
+        if (!header) {
+            http_session_release_header(sf, session_header);
+            if (!(session_header = http_session_acquire_header(sf, use_application_json_accept_type, SF_BOOLEAN_FALSE,
+                                                               error))) {
+                goto cleanup;
+            }
+        }
+        if (poll_count) {
+            (*poll_count)++;
+        }
+        if (!curl_get_call(sf, curl, encoded_url, header ? header : session_header->slist, json, error,
+                           &retry_after_ms)) {
+            // Error is set in curl call
+            goto cleanup;
+        }
+
+        if ((json_error = json_copy_string_no_alloc(query_code, *json, "code", QUERYCODE_LEN)) !=
+            SF_JSON_ERROR_NONE &&
+            json_error != SF_JSON_ERROR_ITEM_NULL) {
+            JSON_ERROR_MSG(json_error, error_msg, "Query code");
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON, error_msg, SF_SQLSTATE_UNABLE_TO_CONNECT);
+            goto cleanup;
+        }
     }
-    while (0); // Dummy loop to break out of
+    ret = SF_BOOLEAN_TRUE;
 
+cleanup:
+    http_session_release_header(sf, session_header);
+    http_session_release_handle(sf, curl);
+    SF_FREE(encoded_url);
     SF_FREE(result_url);
-    SF_FREE(header_token);
-    curl_slist_free_all(new_header);
-
     return ret;
 }
 
@@ -350,22 +458,21 @@ sf_bool STDCALL curl_get_call(SF_CONNECT *sf,
                               char *url,
                               struct curl_slist *header,
                               cJSON **json,
-                              SF_ERROR_STRUCT *error) {
+                              SF_ERROR_STRUCT *error,
+                              uint32 *retry_after_ms) {
     SF_JSON_ERROR json_error;
     const char *error_msg;
     char query_code[QUERYCODE_LEN];
     char *result_url = NULL;
-    struct curl_slist *new_header = NULL;
-    size_t header_token_size;
-    char *header_token = NULL;
+    SF_HTTP_HEADER *new_header = NULL;
     sf_bool ret = SF_BOOLEAN_FALSE;
 
     // Set to 0
     memset(query_code, 0, QUERYCODE_LEN);
 
     do {
-        if (!http_perform(curl, GET_REQUEST_TYPE, url, header, NULL, json,
-                          sf->network_timeout, SF_BOOLEAN_FALSE, error, sf->insecure_mode) ||
+        if (!http_perform(curl, GET_REQUEST_TYPE, url, header, NULL, 0, json,
+                          sf->network_timeout, NULL, NULL, error, sf->insecure_mode, retry_after_ms) ||
             !*json) {
             // Error is set in the perform function
             break;
@@ -391,21 +498,11 @@ sf_bool STDCALL curl_get_call(SF_CONNECT *sf,
                 // Error is set in renew session function
                 break;
             } else {
-                // TODO refactor creating the header token string
-                // Create new header since we have a new token
-                header_token_size = strlen(HEADER_SNOWFLAKE_TOKEN_FORMAT) - 2 +
-                                    strlen(sf->token) + 1;
-                header_token = (char *) SF_CALLOC(1, header_token_size);
-                if (!header_token) {
-                    SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
-                                        "Ran out of memory trying to create header token",
-                                        SF_SQLSTATE_UNABLE_TO_CONNECT);
+                // The header of the connection has the new token
+                if (!(new_header = http_session_acquire_header(sf, SF_BOOLEAN_FALSE, SF_BOOLEAN_FALSE, error))) {
                     break;
                 }
-                snprintf(header_token, header_token_size,
-                         HEADER_SNOWFLAKE_TOKEN_FORMAT, sf->token);
-                new_header = create_header_token(header_token, SF_BOOLEAN_FALSE);
-                if (!curl_get_call(sf, curl, url, new_header, json, error)) {
+                if (!curl_get_call(sf, curl, url, new_header->slist, json, error, retry_after_ms)) {
                     // Error is set in curl call
                     break;
                 }
@@ -417,8 +514,7 @@ sf_bool STDCALL curl_get_call(SF_CONNECT *sf,
     while (0); // Dummy loop to break out of
 
     SF_FREE(result_url);
-    SF_FREE(header_token);
-    curl_slist_free_all(new_header);
+    http_session_release_header(sf, new_header);
 
     return ret;
 }
@@ -749,7 +845,8 @@ ARRAY_LIST *json_get_object_keys(const cJSON *item) {
 }
 
 size_t
-json_resp_cb(char *data, size_t size, size_t nmemb, RAW_JSON_BUFFER *raw_json) {
+json_resp_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    RAW_JSON_BUFFER *raw_json = (RAW_JSON_BUFFER *) userdata;
     size_t data_size = size * nmemb;
     log_debug("Curl response size: %zu", data_size);
     raw_json->buffer = (char *) SF_REALLOC(raw_json->buffer,
@@ -762,16 +859,540 @@ json_resp_cb(char *data, size_t size, size_t nmemb, RAW_JSON_BUFFER *raw_json) {
     return data_size;
 }
 
+/**
+ * cURL header callback that picks up the delay a server asks for with a Retry-After header. Only the delay in
+ * seconds is understood, an HTTP date counts as no delay.
+ */
+static size_t retry_after_header_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    uint32 *retry_after_ms = (uint32 *) userdata;
+    size_t data_size = size * nmemb;
+    unsigned long seconds;
+    if (data_size > 5 && strncmp(data, "HTTP/", 5) == 0) {
+        // Headers of a new response, e.g. after a redirect
+        *retry_after_ms = 0;
+    } else if (data_size > 12 && sf_strncasecmp(data, "Retry-After:", 12) == 0) {
+        // Header lines end with CRLF, so parsing stops within the line
+        seconds = strtoul(&data[12], NULL, 10);
+        *retry_after_ms = seconds < RETRY_AFTER_MAX_SECONDS ? (uint32) seconds * 1000 :
+                          RETRY_AFTER_MAX_SECONDS * 1000;
+    }
+    return data_size;
+}
+
+/**
+ * Progress of a result chunk download across attempts. Once part of the body has been fed to the parser, a failed
+ * transfer is resumed with a Range request for the rest. That is only possible if the body isn't compressed on the
+ * wire, as the parser sees the decoded bytes while a range is about the encoded ones.
+ */
+typedef struct CHUNK_TRANSFER {
+    CURL *curl;
+    SF_CHUNK_PARSER *parser;
+    // Bytes of the body fed to the parser so far
+    uint64 received;
+    // Where the current attempt starts in the body
+    uint64 range_start;
+    // Start of the Content-Range of the current response, -1 if it has none
+    int64 content_range_start;
+    // Whether the current response is compressed
+    sf_bool encoded;
+    // Whether the body of the current response goes to the parser. Decided when the first bytes arrive
+    sf_bool checked;
+    sf_bool accepted;
+    // Set if the server answered the range request with a different range
+    sf_bool range_rejected;
+} CHUNK_TRANSFER;
+
+static size_t chunk_transfer_header_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    CHUNK_TRANSFER *transfer = (CHUNK_TRANSFER *) userdata;
+    size_t data_size = size * nmemb;
+    size_t i;
+    if (data_size > 5 && strncmp(data, "HTTP/", 5) == 0) {
+        // Headers of a new response, e.g. after a redirect
+        transfer->content_range_start = -1;
+        transfer->encoded = SF_BOOLEAN_FALSE;
+    } else if (data_size > 17 && sf_strncasecmp(data, "Content-Encoding:", 17) == 0) {
+        for (i = 17; i < data_size && (data[i] == ' ' || data[i] == '\t'); i++);
+        transfer->encoded = data_size - i >= 8 && sf_strncasecmp(&data[i], "identity", 8) == 0 ?
+                            SF_BOOLEAN_FALSE : SF_BOOLEAN_TRUE;
+    } else if (data_size > 20 && sf_strncasecmp(data, "Content-Range: bytes", 20) == 0) {
+        // Header lines end with CRLF, so parsing stops within the line
+        transfer->content_range_start = (int64) strtoll(&data[20], NULL, 10);
+    }
+    return data_size;
+}
+
+static size_t chunk_transfer_write_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    CHUNK_TRANSFER *transfer = (CHUNK_TRANSFER *) userdata;
+    size_t data_size = size * nmemb;
+    long int http_code = 0;
+    if (!transfer->checked) {
+        transfer->checked = SF_BOOLEAN_TRUE;
+        curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code == 206) {
+            // The rest of the body, as long as it starts where the last attempt stopped
+            transfer->accepted = transfer->range_start > 0 &&
+                                 transfer->content_range_start == (int64) transfer->range_start ?
+                                 SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+            transfer->range_rejected = !transfer->accepted;
+        } else if (http_code == 200) {
+            // The whole body, also if the server ignored the range
+            if (transfer->received > 0) {
+                chunk_parser_reset(transfer->parser);
+                transfer->received = 0;
+            }
+            transfer->accepted = SF_BOOLEAN_TRUE;
+        } else {
+            // Error bodies are dropped, the status is handled once the transfer is done
+            transfer->accepted = SF_BOOLEAN_FALSE;
+        }
+    }
+    if (!transfer->accepted) {
+        return data_size;
+    }
+    if (!chunk_parser_feed(transfer->parser, data, data_size)) {
+        // Returning less than data_size makes cURL fail the transfer with CURLE_WRITE_ERROR
+        return 0;
+    }
+    transfer->received += data_size;
+    return data_size;
+}
+
+/**
+ * Sets up the next attempt of a chunk download, after http_set_options.
+ */
+static sf_bool STDCALL start_chunk_transfer_attempt(CHUNK_TRANSFER *transfer) {
+    char range[32];
+    if (transfer->received == 0) {
+        chunk_parser_reset(transfer->parser);
+    }
+    transfer->range_start = transfer->received;
+    transfer->content_range_start = -1;
+    transfer->encoded = SF_BOOLEAN_FALSE;
+    transfer->checked = SF_BOOLEAN_FALSE;
+    transfer->accepted = SF_BOOLEAN_FALSE;
+    transfer->range_rejected = SF_BOOLEAN_FALSE;
+    if (curl_easy_setopt(transfer->curl, CURLOPT_HEADERFUNCTION, chunk_transfer_header_cb) != CURLE_OK ||
+        curl_easy_setopt(transfer->curl, CURLOPT_HEADERDATA, transfer) != CURLE_OK) {
+        log_error("Failed to set chunk header callback");
+        return SF_BOOLEAN_FALSE;
+    }
+    if (transfer->range_start > 0) {
+        snprintf(range, sizeof(range), "%llu-", (unsigned long long) transfer->range_start);
+        log_debug("Resuming chunk download at byte %s", range);
+        if (curl_easy_setopt(transfer->curl, CURLOPT_RANGE, range) != CURLE_OK) {
+            log_error("Failed to set chunk range");
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+/**
+ * Decides whether a chunk download that was cut off or got an unusable partial response is tried again. Attempts
+ * that received part of the body resume right away. Others are limited and back off before the next try.
+ */
+static sf_bool STDCALL retry_chunk_transfer(CHUNK_TRANSFER *transfer, DECORRELATE_JITTER_BACKOFF *backoff,
+                                            uint32 *sleep_ms, int *failed_attempts) {
+    sf_bool progress = transfer->received > transfer->range_start ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    if (transfer->encoded || transfer->range_rejected) {
+        // Nothing that a range could continue from
+        transfer->received = 0;
+        progress = SF_BOOLEAN_FALSE;
+    }
+    if (progress) {
+        *failed_attempts = 0;
+        return SF_BOOLEAN_TRUE;
+    }
+    if (++(*failed_attempts) >= CHUNK_TRANSFER_ATTEMPTS) {
+        return SF_BOOLEAN_FALSE;
+    }
+    *sleep_ms = decorrelate_jitter_next_sleep(backoff, *sleep_ms);
+    log_debug("Retrying chunk download in %u ms", *sleep_ms);
+    sf_sleep_ms(*sleep_ms);
+    return SF_BOOLEAN_TRUE;
+}
+
+/**
+ * cURL progress callback that aborts the transfer once the flag it is given is set.
+ */
+static int cancel_progress_cb(void *cancel, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                              curl_off_t ulnow) {
+    return _atomic_load((SF_ATOMIC_INT32 *) cancel) ? 1 : 0;
+}
+
+/**
+ * Whether a failed transfer is worth trying again, i.e. the network rather than the request was the problem.
+ */
+static sf_bool STDCALL is_retryable_transfer_error(CURLcode res) {
+    switch (res) {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+            return SF_BOOLEAN_TRUE;
+        default:
+            return SF_BOOLEAN_FALSE;
+    }
+}
+
+/*
+ * Process wide cache of DNS entries, TLS sessions and connections. Requests with and without OCSP checks use separate
+ * shares, as cURL doesn't compare the OCSP setting when it picks a cached connection or TLS session.
+ */
+static CURLSH *http_shares[2];
+static SF_MUTEX_HANDLE http_share_locks[CURL_LOCK_DATA_LAST];
+
+static void http_share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr) {
+    _mutex_lock(&http_share_locks[data]);
+}
+
+static void http_share_unlock(CURL *curl, curl_lock_data data, void *userptr) {
+    _mutex_unlock(&http_share_locks[data]);
+}
+
+sf_bool STDCALL http_share_init(void) {
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        _mutex_init(&http_share_locks[i]);
+    }
+    for (i = 0; i < 2; i++) {
+        http_shares[i] = curl_share_init();
+        if (!http_shares[i] ||
+            curl_share_setopt(http_shares[i], CURLSHOPT_LOCKFUNC, http_share_lock) != CURLSHE_OK ||
+            curl_share_setopt(http_shares[i], CURLSHOPT_UNLOCKFUNC, http_share_unlock) != CURLSHE_OK ||
+            curl_share_setopt(http_shares[i], CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+            curl_share_setopt(http_shares[i], CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK ||
+            curl_share_setopt(http_shares[i], CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK) {
+            log_error("Failed to create cURL share");
+            http_share_term();
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+void STDCALL http_share_term(void) {
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (http_shares[i]) {
+            curl_share_cleanup(http_shares[i]);
+            http_shares[i] = NULL;
+        }
+    }
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        _mutex_term(&http_share_locks[i]);
+    }
+}
+
+/*
+ * cURL handles and request headers of a connection. Handles are taken by one request at a time, headers are shared.
+ */
+typedef struct SF_HTTP_SESSION {
+    SF_MUTEX_HANDLE lock;
+    CURL *idle[HTTP_SESSION_MAX_IDLE_HANDLES];
+    size_t idle_count;
+    // Bit 0 of the index is set for the application/json accept type and bit 1 for a gzip compressed body
+    SF_HTTP_HEADER *headers[HTTP_SESSION_HEADERS];
+} SF_HTTP_SESSION;
+
+static void STDCALL unref_header(SF_HTTP_HEADER *header) {
+    if (header && --header->refs == 0) {
+        curl_slist_free_all(header->slist);
+        SF_FREE(header);
+    }
+}
+
+/**
+ * Drops the headers of the session. Called with the lock held.
+ */
+static void STDCALL drop_headers(SF_HTTP_SESSION *session) {
+    int i;
+    for (i = 0; i < HTTP_SESSION_HEADERS; i++) {
+        unref_header(session->headers[i]);
+        session->headers[i] = NULL;
+    }
+}
+
+sf_bool STDCALL http_session_init(SF_CONNECT *sf) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) SF_CALLOC(1, sizeof(SF_HTTP_SESSION));
+    if (!session) {
+        return SF_BOOLEAN_FALSE;
+    }
+    _mutex_init(&session->lock);
+    sf->http_session = session;
+    return SF_BOOLEAN_TRUE;
+}
+
+void STDCALL http_session_term(SF_CONNECT *sf) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    size_t i;
+    if (!session) {
+        return;
+    }
+    for (i = 0; i < session->idle_count; i++) {
+        curl_easy_cleanup(session->idle[i]);
+    }
+    drop_headers(session);
+    _mutex_term(&session->lock);
+    SF_FREE(session);
+    sf->http_session = NULL;
+}
+
+CURL *STDCALL http_session_acquire_handle(SF_CONNECT *sf) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    CURL *curl = NULL;
+    if (session) {
+        _mutex_lock(&session->lock);
+        if (session->idle_count > 0) {
+            curl = session->idle[--session->idle_count];
+        }
+        _mutex_unlock(&session->lock);
+    }
+    return curl ? curl : curl_easy_init();
+}
+
+void STDCALL http_session_release_handle(SF_CONNECT *sf, CURL *curl) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    if (!curl) {
+        return;
+    }
+    if (session) {
+        _mutex_lock(&session->lock);
+        if (session->idle_count < HTTP_SESSION_MAX_IDLE_HANDLES) {
+            session->idle[session->idle_count++] = curl;
+            curl = NULL;
+        }
+        _mutex_unlock(&session->lock);
+    }
+    // More requests ran at once than handles are kept
+    curl_easy_cleanup(curl);
+}
+
+SF_HTTP_HEADER *STDCALL http_session_acquire_header(SF_CONNECT *sf, sf_bool use_application_json_accept_type,
+                                                    sf_bool gzip_body, SF_ERROR_STRUCT *error) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    SF_HTTP_HEADER *header;
+    int index = (use_application_json_accept_type ? 1 : 0) | (gzip_body ? 2 : 0);
+    if (session) {
+        _mutex_lock(&session->lock);
+    }
+    header = session ? session->headers[index] : NULL;
+    if (!header) {
+        // The tokens only change with the lock held, so the header can't be out of date once it is cached
+        header = (SF_HTTP_HEADER *) SF_CALLOC(1, sizeof(SF_HTTP_HEADER));
+        if (!header) {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                "Ran out of memory trying to create header",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+        } else if (!(header->slist = create_request_header(sf, use_application_json_accept_type, gzip_body, error))) {
+            SF_FREE(header);
+        } else if (session) {
+            // Held by the session until the tokens change
+            header->refs = 1;
+            session->headers[index] = header;
+        }
+    }
+    if (header) {
+        header->refs++;
+    }
+    if (session) {
+        _mutex_unlock(&session->lock);
+    }
+    return header;
+}
+
+void STDCALL http_session_release_header(SF_CONNECT *sf, SF_HTTP_HEADER *header) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    if (!header) {
+        return;
+    }
+    if (session) {
+        _mutex_lock(&session->lock);
+    }
+    unref_header(header);
+    if (session) {
+        _mutex_unlock(&session->lock);
+    }
+}
+
+void STDCALL http_session_set_tokens(SF_CONNECT *sf, char *token, char *master_token) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    char *old_token;
+    char *old_master_token;
+    if (session) {
+        _mutex_lock(&session->lock);
+    }
+    old_token = sf->token;
+    old_master_token = sf->master_token;
+    sf->token = token;
+    sf->master_token = master_token;
+    if (session) {
+        drop_headers(session);
+        _mutex_unlock(&session->lock);
+    }
+    SF_FREE(old_token);
+    SF_FREE(old_master_token);
+}
+
+void STDCALL http_session_reset_headers(SF_CONNECT *sf) {
+    SF_HTTP_SESSION *session = (SF_HTTP_SESSION *) sf->http_session;
+    if (!session) {
+        return;
+    }
+    _mutex_lock(&session->lock);
+    drop_headers(session);
+    _mutex_unlock(&session->lock);
+}
+
+sf_bool STDCALL http_set_options(CURL *curl,
+                                 SF_REQUEST_TYPE request_type,
+                                 char *url,
+                                 struct curl_slist *header,
+                                 char *body,
+                                 size_t body_len,
+                                 curl_write_callback write_function,
+                                 void *write_data,
+                                 sf_bool accept_encoding,
+                                 sf_bool insecure_mode) {
+    static struct data trace_config = {1};
+    CURLcode res;
+    CURLSH *share = http_shares[insecure_mode || !SF_OCSP_CHECK ? 1 : 0];
+
+    res = curl_easy_setopt(curl, CURLOPT_URL, url);
+    if (res != CURLE_OK) {
+        log_error("Failed to set URL [%s]", curl_easy_strerror(res));
+        return SF_BOOLEAN_FALSE;
+    }
+
+    // Not set when the client wasn't initialized through snowflake_global_init
+    if (share) {
+        res = curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        if (res != CURLE_OK) {
+            log_error("Failed to set share [%s]", curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    if (DEBUG) {
+        curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
+        curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &trace_config);
+
+        /* the DEBUGFUNCTION has no effect until we enable VERBOSE */
+        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+    }
+
+    if (header) {
+        res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header);
+        if (res != CURLE_OK) {
+            log_error("Failed to set header [%s]", curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    // Post type stuffs
+    if (request_type == POST_REQUEST_TYPE) {
+        res = curl_easy_setopt(curl, CURLOPT_POST, 1);
+        if (res != CURLE_OK) {
+            log_error("Failed to set post [%s]", curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+
+        if (body) {
+            res = curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) (body_len ? body_len : strlen(body)));
+            if (res == CURLE_OK) {
+                res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+            }
+        } else {
+            res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+        }
+        if (res != CURLE_OK) {
+            log_error("Failed to set body [%s]", curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_function);
+    if (res != CURLE_OK) {
+        log_error("Failed to set writer [%s]", curl_easy_strerror(res));
+        return SF_BOOLEAN_FALSE;
+    }
+
+    res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_data);
+    if (res != CURLE_OK) {
+        log_error("Failed to set write data [%s]", curl_easy_strerror(res));
+        return SF_BOOLEAN_FALSE;
+    }
+
+    if (DISABLE_VERIFY_PEER) {
+        res = curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        if (res != CURLE_OK) {
+            log_error("Failed to disable peer verification [%s]",
+                      curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    if (CA_BUNDLE_FILE) {
+        res = curl_easy_setopt(curl, CURLOPT_CAINFO, CA_BUNDLE_FILE);
+        if (res != CURLE_OK) {
+            log_error("Unable to set certificate file [%s]",
+                      curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    res = curl_easy_setopt(curl, CURLOPT_SSLVERSION, SSL_VERSION);
+    if (res != CURLE_OK) {
+        log_error("Unable to set SSL Version [%s]",
+                  curl_easy_strerror(res));
+        return SF_BOOLEAN_FALSE;
+    }
+
+#ifndef _WIN32
+    // If insecure mode is set to true, skip OCSP check not matter the value of SF_OCSP_CHECK (global OCSP variable)
+    sf_bool ocsp_check;
+    if (insecure_mode) {
+        ocsp_check = SF_BOOLEAN_FALSE;
+    } else {
+        ocsp_check = SF_OCSP_CHECK;
+    }
+    res = curl_easy_setopt(curl, CURLOPT_SSL_SF_OCSP_CHECK, ocsp_check);
+    if (res != CURLE_OK) {
+        log_error("Unable to set OCSP check enable/disable [%s]",
+                  curl_easy_strerror(res));
+        return SF_BOOLEAN_FALSE;
+    }
+#endif
+
+    // Set chunk downloader specific stuff here
+    if (accept_encoding) {
+        res = curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+        if (res != CURLE_OK) {
+            log_error("Unable to set accepted content encoding",
+                      curl_easy_strerror(res));
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+
+    return SF_BOOLEAN_TRUE;
+}
+
 sf_bool STDCALL http_perform(CURL *curl,
                              SF_REQUEST_TYPE request_type,
                              char *url,
                              struct curl_slist *header,
                              char *body,
+                             size_t body_len,
                              cJSON **json,
                              int64 network_timeout,
-                             sf_bool chunk_downloader,
+                             SF_CHUNK_PARSER *chunk_parser,
+                             SF_ATOMIC_INT32 *cancel,
                              SF_ERROR_STRUCT *error,
-                             sf_bool insecure_mode) {
+                             sf_bool insecure_mode,
+                             uint32 *retry_after_ms) {
     CURLcode res;
     sf_bool ret = SF_BOOLEAN_FALSE;
     sf_bool retry = SF_BOOLEAN_FALSE;
@@ -789,12 +1410,21 @@ sf_bool STDCALL http_perform(CURL *curl,
     };
     */
     RAW_JSON_BUFFER buffer = {NULL, 0};
-    struct data config;
-    config.trace_ascii = 1;
+    // Result chunks are resumed where a failed attempt stopped
+    CHUNK_TRANSFER transfer;
+    DECORRELATE_JITTER_BACKOFF transfer_backoff = {
+      100,    //base in ms
+      2000    //cap in ms
+    };
+    uint32 transfer_sleep_ms = transfer_backoff.base;
+    int failed_transfers = 0;
 
     if (curl == NULL) {
         return SF_BOOLEAN_FALSE;
     }
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.curl = curl;
+    transfer.parser = chunk_parser;
 
     //TODO set error buffer
 
@@ -817,114 +1447,28 @@ sf_bool STDCALL http_perform(CURL *curl,
         }
 
         // Set parameters
-        res = curl_easy_setopt(curl, CURLOPT_URL, url);
-        if (res != CURLE_OK) {
-            log_error("Failed to set URL [%s]", curl_easy_strerror(res));
+        if (!http_set_options(curl, request_type, url, header, body, body_len,
+                              chunk_parser ? chunk_transfer_write_cb : json_resp_cb,
+                              chunk_parser ? (void *) &transfer : (void *) &buffer,
+                              chunk_parser ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE, insecure_mode) ||
+            (chunk_parser && !start_chunk_transfer_attempt(&transfer))) {
             break;
         }
-
-        if (DEBUG) {
-            curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-            curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &config);
-
-            /* the DEBUGFUNCTION has no effect until we enable VERBOSE */
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-        }
-
-        if (header) {
-            res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header);
-            if (res != CURLE_OK) {
-                log_error("Failed to set header [%s]", curl_easy_strerror(res));
-                break;
-            }
-        }
-
-        // Post type stuffs
-        if (request_type == POST_REQUEST_TYPE) {
-            res = curl_easy_setopt(curl, CURLOPT_POST, 1);
-            if (res != CURLE_OK) {
-                log_error("Failed to set post [%s]", curl_easy_strerror(res));
-                break;
-            }
-
-            if (body) {
-                res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
-            } else {
-                res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-            }
-            if (res != CURLE_OK) {
-                log_error("Failed to set body [%s]", curl_easy_strerror(res));
-                break;
-            }
-        }
-
-        res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, (void*)&json_resp_cb);
-        if (res != CURLE_OK) {
-            log_error("Failed to set writer [%s]", curl_easy_strerror(res));
-            break;
-        }
-
-        res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &buffer);
-        if (res != CURLE_OK) {
-            log_error("Failed to set write data [%s]", curl_easy_strerror(res));
-            break;
-        }
-
-        if (DISABLE_VERIFY_PEER) {
-            res = curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            if (res != CURLE_OK) {
-                log_error("Failed to disable peer verification [%s]",
-                          curl_easy_strerror(res));
-                break;
-            }
-        }
-
-        if (CA_BUNDLE_FILE) {
-            res = curl_easy_setopt(curl, CURLOPT_CAINFO, CA_BUNDLE_FILE);
-            if (res != CURLE_OK) {
-                log_error("Unable to set certificate file [%s]",
-                          curl_easy_strerror(res));
-                break;
-            }
-        }
-
-        res = curl_easy_setopt(curl, CURLOPT_SSLVERSION, SSL_VERSION);
-        if (res != CURLE_OK) {
-            log_error("Unable to set SSL Version [%s]",
-                      curl_easy_strerror(res));
-            break;
-        }
-
-#ifndef _WIN32
-        // If insecure mode is set to true, skip OCSP check not matter the value of SF_OCSP_CHECK (global OCSP variable)
-        sf_bool ocsp_check;
-        if (insecure_mode) {
-            ocsp_check = SF_BOOLEAN_FALSE;
-        } else {
-            ocsp_check = SF_OCSP_CHECK;
-        }
-        res = curl_easy_setopt(curl, CURLOPT_SSL_SF_OCSP_CHECK, ocsp_check);
-        if (res != CURLE_OK) {
-            log_error("Unable to set OCSP check enable/disable [%s]",
-                      curl_easy_strerror(res));
+        // The progress callback is also called while the transfer stalls, so a cancelled request stops soon
+        if (cancel &&
+            (curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_progress_cb) != CURLE_OK ||
+             curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *) cancel) != CURLE_OK ||
+             curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L) != CURLE_OK)) {
+            log_error("Failed to set progress callback");
             break;
         }
-#endif
-
-        // Set chunk downloader specific stuff here
-        if (chunk_downloader) {
-            res = curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
-            if (res != CURLE_OK) {
-                log_error("Unable to set accepted content encoding",
-                          curl_easy_strerror(res));
+        if (retry_after_ms && !chunk_parser) {
+            *retry_after_ms = 0;
+            if (curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, retry_after_header_cb) != CURLE_OK ||
+                curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) retry_after_ms) != CURLE_OK) {
+                log_error("Failed to set header callback");
                 break;
             }
-
-            // Set the first character in the buffer as a bracket
-            buffer.buffer = (char *) SF_CALLOC(1,
-                                               2); // Don't forget null terminator
-            buffer.size = 1;
-            strncpy(buffer.buffer, "[", 2);
         }
 
         // Be optimistic
@@ -933,7 +1477,11 @@ sf_bool STDCALL http_perform(CURL *curl,
         log_trace("Running curl call");
         res = curl_easy_perform(curl);
         /* Check for errors */
-        if (res != CURLE_OK) {
+        if (res == CURLE_WRITE_ERROR && chunk_parser && chunk_parser->state == CHUNK_PARSER_ERROR) {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON,
+                                "Unable to parse JSON text response.",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+        } else if (res != CURLE_OK) {
             char msg[1024];
             if (res == CURLE_SSL_CACERT_BADFILE) {
                 snprintf(msg, sizeof(msg), "curl_easy_perform() failed. err: %s, CA Cert file: %s",
@@ -944,9 +1492,14 @@ sf_bool STDCALL http_perform(CURL *curl,
             }
             msg[sizeof(msg)-1] = (char)0;
             log_error(msg);
-            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_CURL,
-                                msg,
-                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            if (chunk_parser && is_retryable_transfer_error(res) && !(cancel && _atomic_load(cancel))) {
+                retry = retry_chunk_transfer(&transfer, &transfer_backoff, &transfer_sleep_ms, &failed_transfers);
+            }
+            if (!retry) {
+                SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_CURL,
+                                    msg,
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+            }
         } else {
             if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code) !=
                 CURLE_OK) {
@@ -955,7 +1508,16 @@ sf_bool STDCALL http_perform(CURL *curl,
                 SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_CURL,
                                     "Unable to get http response code",
                                     SF_SQLSTATE_UNABLE_TO_CONNECT);
-            } else if (http_code != 200) {
+            } else if (chunk_parser && (transfer.range_rejected || http_code == 416)) {
+                // The range can't be served, so the chunk is downloaded again in full
+                transfer.range_rejected = SF_BOOLEAN_TRUE;
+                retry = retry_chunk_transfer(&transfer, &transfer_backoff, &transfer_sleep_ms, &failed_transfers);
+                if (!retry) {
+                    SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_RETRY,
+                                        "Unable to resume chunk download",
+                                        SF_SQLSTATE_UNABLE_TO_CONNECT);
+                }
+            } else if (http_code != 200 && !(chunk_parser && http_code == 206)) {
                 retry = is_retryable_http_code(http_code);
                 if (!retry) {
                     SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_RETRY,
@@ -973,18 +1535,9 @@ sf_bool STDCALL http_perform(CURL *curl,
     }
     while (retry);
 
-    // We were successful so parse JSON from text
-    if (ret) {
-        if (chunk_downloader) {
-            buffer.buffer = (char *) SF_REALLOC(buffer.buffer, buffer.size +
-                                                               2); // 1 byte for closing bracket, 1 for null terminator
-            memcpy(&buffer.buffer[buffer.size], "]", 1);
-            buffer.size += 1;
-            // Set null terminator
-            buffer.buffer[buffer.size] = '\0';
-        }
+    // We were successful so parse JSON from text. Result chunks have already been parsed into the chunk parser.
+    if (ret && !chunk_parser) {
         snowflake_cJSON_Delete(*json);
-        *json = NULL;
         *json = snowflake_cJSON_Parse(buffer.buffer);
         if (*json) {
             ret = SF_BOOLEAN_TRUE;
@@ -1006,6 +1559,42 @@ sf_bool STDCALL is_retryable_http_code(long int code) {
             code == 408) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
 }
 
+/**
+ * Compresses a request body with gzip.
+ *
+ * @return The compressed body, to be freed with SF_FREE, or NULL if it can't be compressed.
+ */
+static char *STDCALL gzip_body(const char *body, size_t body_len, size_t *compressed_len) {
+    z_stream stream;
+    char *compressed;
+    uLong cap;
+    int res;
+
+    memset(&stream, 0, sizeof(stream));
+    // Window bits above 15 ask for the gzip wrapper instead of the zlib one
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    cap = deflateBound(&stream, (uLong) body_len);
+    compressed = (char *) SF_MALLOC((size_t) cap);
+    if (compressed) {
+        stream.next_in = (Bytef *) body;
+        stream.avail_in = (uInt) body_len;
+        stream.next_out = (Bytef *) compressed;
+        stream.avail_out = (uInt) cap;
+        // The output buffer is big enough for the whole body, so one call finishes the stream
+        res = deflate(&stream, Z_FINISH);
+        if (res == Z_STREAM_END) {
+            *compressed_len = (size_t) stream.total_out;
+        } else {
+            log_warn("Unable to compress request body [%d]", res);
+            SF_FREE(compressed);
+        }
+    }
+    deflateEnd(&stream);
+    return compressed;
+}
+
 sf_bool STDCALL request(SF_CONNECT *sf,
                         cJSON **json,
                         const char *url,
@@ -1015,52 +1604,37 @@ sf_bool STDCALL request(SF_CONNECT *sf,
                         struct curl_slist *header,
                         SF_REQUEST_TYPE request_type,
                         SF_ERROR_STRUCT *error,
-                        sf_bool use_application_json_accept_type) {
+                        sf_bool use_application_json_accept_type,
+                        sf_bool wait_for_result) {
     sf_bool ret = SF_BOOLEAN_FALSE;
     CURL *curl = NULL;
     char *encoded_url = NULL;
     struct curl_slist *my_header = NULL;
-    char *header_token = NULL;
-    size_t header_token_size;
-    char *header_direct_query_token = NULL;
-    size_t header_direct_query_token_size;
-    curl = curl_easy_init();
+    SF_HTTP_HEADER *session_header = NULL;
+    char *compressed_body = NULL;
+    size_t compressed_len = 0;
+    size_t body_len;
+    curl = http_session_acquire_handle(sf);
     if (curl) {
+        // Large bodies on the session header are sent compressed, unless compressing doesn't make them smaller
+        if (!header && body && request_type == POST_REQUEST_TYPE && sf->request_compression_threshold > 0 &&
+            (body_len = strlen(body)) >= sf->request_compression_threshold &&
+            (compressed_body = gzip_body(body, body_len, &compressed_len)) && compressed_len >= body_len) {
+            SF_FREE(compressed_body);
+        }
+        if (!compressed_body) {
+            compressed_len = 0;
+        }
+
         // Use passed in header if one exists
         if (header) {
             my_header = header;
         } else {
-            // Create header
-            if (sf->token) {
-                header_token_size = strlen(HEADER_SNOWFLAKE_TOKEN_FORMAT) - 2 +
-                                    strlen(sf->token) + 1;
-                header_token = (char *) SF_CALLOC(1, header_token_size);
-                if (!header_token) {
-                    SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
-                                        "Ran out of memory trying to create header token",
-                                        SF_SQLSTATE_UNABLE_TO_CONNECT);
-                    goto cleanup;
-                }
-                snprintf(header_token, header_token_size,
-                         HEADER_SNOWFLAKE_TOKEN_FORMAT, sf->token);
-                my_header = create_header_token(header_token, use_application_json_accept_type);
-            } else if (sf->direct_query_token) {
-                header_direct_query_token_size = strlen(HEADER_DIRECT_QUERY_TOKEN_FORMAT) - 2 +
-                                    strlen(sf->direct_query_token) + 1;
-                header_direct_query_token = (char *) SF_CALLOC(1, header_direct_query_token_size);
-                if (!header_direct_query_token) {
-                    SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
-                                        "Ran out of memory trying to create header direct query token",
-                                        SF_SQLSTATE_UNABLE_TO_CONNECT);
-                    goto cleanup;
-                }
-                snprintf(header_direct_query_token, header_direct_query_token_size,
-                         HEADER_DIRECT_QUERY_TOKEN_FORMAT, sf->direct_query_token);
-                my_header = create_header_token(header_direct_query_token, use_application_json_accept_type);
-            } else {
-                my_header = create_header_no_token(use_application_json_accept_type);
+            if (!(session_header = http_session_acquire_header(sf, use_application_json_accept_type,
+                                                               compressed_body != NULL, error))) {
+                goto cleanup;
             }
-            log_trace("Created header");
+            my_header = session_header->slist;
         }
 
         encoded_url = encode_url(curl, sf->protocol, sf->account, sf->host,
@@ -1072,10 +1646,10 @@ sf_bool STDCALL request(SF_CONNECT *sf,
 
         // Execute request and set return value to result
         if (request_type == POST_REQUEST_TYPE) {
-            ret = curl_post_call(sf, curl, encoded_url, my_header, body, json,
-                                 error);
+            ret = curl_post_call(sf, curl, encoded_url, my_header, compressed_body ? compressed_body : body,
+                                 compressed_len, json, error, wait_for_result);
         } else if (request_type == GET_REQUEST_TYPE) {
-            ret = curl_get_call(sf, curl, encoded_url, my_header, json, error);
+            ret = curl_get_call(sf, curl, encoded_url, my_header, json, error, NULL);
         } else {
             SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_REQUEST,
                                 "An unknown request type was passed to the request function",
@@ -1085,13 +1659,10 @@ sf_bool STDCALL request(SF_CONNECT *sf,
     }
 
 cleanup:
-    // If we created our own header, then delete it
-    if (!header) {
-        curl_slist_free_all(my_header);
-    }
-    curl_easy_cleanup(curl);
-    SF_FREE(header_token);
+    http_session_release_header(sf, session_header);
+    http_session_release_handle(sf, curl);
     SF_FREE(encoded_url);
+    SF_FREE(compressed_body);
 
     return ret;
 }
@@ -1162,7 +1733,7 @@ sf_bool STDCALL renew_session(CURL *curl, SF_CONNECT *sf, SF_ERROR_STRUCT *error
 
     // Successful call, non-null json, successful success code, data object and session token must all be present
     // otherwise set an error
-    if (!curl_post_call(sf, curl, encoded_url, header, s_body, &json, error) ||
+    if (!curl_post_call(sf, curl, encoded_url, header, s_body, 0, &json, error, SF_BOOLEAN_TRUE) ||
         !json) {
         // Do nothing, let error propogate up from post call
         log_error("Curl call failed during renew session");
@@ -1205,7 +1776,7 @@ cleanup:
     curl_slist_free_all(header);
     snowflake_cJSON_Delete(body);
     snowflake_cJSON_Delete(json);
-    SF_FREE(s_body);
+    snowflake_cJSON_free(s_body);
     SF_FREE(header_token);
     SF_FREE(encoded_url);
 
@@ -1241,8 +1812,10 @@ sf_bool STDCALL set_tokens(SF_CONNECT *sf,
                            const char *session_token_str,
                            const char *master_token_str,
                            SF_ERROR_STRUCT *error) {
+    char *token = NULL;
+    char *master_token = NULL;
     // Get token
-    if (json_copy_string(&sf->token, data, session_token_str)) {
+    if (json_copy_string(&token, data, session_token_str)) {
         log_error("No valid token found in response");
         SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON,
                             "Cannot find valid session token in response",
@@ -1250,13 +1823,17 @@ sf_bool STDCALL set_tokens(SF_CONNECT *sf,
         return SF_BOOLEAN_FALSE;
     }
     // Get master token
-    if (json_copy_string(&sf->master_token, data, master_token_str)) {
+    if (json_copy_string(&master_token, data, master_token_str)) {
         log_error("No valid master token found in response");
         SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON,
                             "Cannot find valid master token in response",
                             SF_SQLSTATE_UNABLE_TO_CONNECT);
+        SF_FREE(token);
+        SF_FREE(master_token);
         return SF_BOOLEAN_FALSE;
     }
 
+    // Requests that are running keep using the header with the old token
+    http_session_set_tokens(sf, token, master_token);
     return SF_BOOLEAN_TRUE;
 }
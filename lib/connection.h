@@ -21,6 +21,8 @@ extern "C" {
 #include "snowflake/platform.h"
 #include "cJSON.h"
 #include "arraylist.h"
+#include "chunk_parser.h"
+#include "json_writer.h"
 
 /**
  * Request type
@@ -149,14 +151,17 @@ cJSON *STDCALL create_auth_json_body(SF_CONNECT *sf, const char *application, co
                                      const char *int_app_version, const char* timezone, sf_bool autocommit);
 
 /**
- * Creates a cJSON blob used to execute queries. cJSON blob must be freed by the caller using cJSON_Delete.
+ * Writes the members of the body used to execute queries into the object the writer has open. The caller adds the
+ * bindings, if any, and closes the object.
  *
+ * @param writer JSON writer with the top level object open.
  * @param sql_text The sql query to send to Snowflake
  * @param sequence_id Sequence ID from the Snowflake Connection object.
  * @param request_id  requestId to be passed as a part of body instead of header.
- * @return Query cJSON Body.
+ * @param async_exec Whether Snowflake should respond as soon as the query is submitted.
  */
-cJSON *STDCALL create_query_json_body(const char *sql_text, int64 sequence_id, const char *request_id);
+void STDCALL write_query_json_body(SF_JSON_WRITER *writer, const char *sql_text, int64 sequence_id,
+                                   const char *request_id, sf_bool async_exec);
 
 /**
  * Creates a cJSON blob that is used to renew a session with Snowflake. cJSON blob must be freed by the caller using
@@ -193,12 +198,32 @@ struct curl_slist * STDCALL create_header_token(const char *header_token,
  * @param url URL to send the request to
  * @param header Header passed to cURL for use in the request
  * @param body Body passed to cURL for use in the request
+ * @param compressed_len Size of the body if it is gzip compressed, 0 if the body is a JSON string
  * @param json Reference to a cJSON pointer that is used to store the JSON response upon a successful request
  * @param error Reference to the Snowflake Error object to set an error if one occurs
+ * @param wait_for_result Whether to poll the result of a query that is still in progress until it is done, or to
+ *                        return the in progress response
  * @return Success/failure status of post call. 1 = Success; 0 = Failure
  */
 sf_bool STDCALL curl_post_call(SF_CONNECT *sf, CURL *curl, char *url, struct curl_slist *header, char *body,
-                               cJSON **json, SF_ERROR_STRUCT *error);
+                               size_t compressed_len, cJSON **json, SF_ERROR_STRUCT *error, sf_bool wait_for_result);
+
+/**
+ * Polls the result URL of a query for as long as the response says that the query is still in progress. Returns
+ * right away if it isn't. The delay between polls grows up to the query_poll_max_interval of the connection, or is
+ * the one the server asks for with a Retry-After header.
+ *
+ * @param sf Snowflake Connection object
+ * @param header Header to use in the requests, NULL to create one from the session token
+ * @param use_application_json_accept_type Accept type of the created header, true for put/get command
+ * @param json Reference to the last response, replaced by the final one
+ * @param error Reference to the Snowflake Error object to set an error if one occurs
+ * @param poll_count Incremented for every poll. Can be NULL
+ * @return Success/failure status. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL wait_for_query_result(SF_CONNECT *sf, struct curl_slist *header,
+                                      sf_bool use_application_json_accept_type, cJSON **json,
+                                      SF_ERROR_STRUCT *error, uint64 *poll_count);
 
 /**
  * Used to issue a cURL GET call to Snowflake. Includes support for renew session. If the request was successful,
@@ -210,10 +235,12 @@ sf_bool STDCALL curl_post_call(SF_CONNECT *sf, CURL *curl, char *url, struct cur
  * @param header Header passed to cURL for use in the request
  * @param json Reference to a cJSON pointer that is used to store the JSON response upon a successful request
  * @param error Reference to the Snowflake Error object to set an error if one occurs
+ * @param retry_after_ms Set to the delay the server asked for with a Retry-After header, 0 if there was none. Can be
+ *                       NULL
  * @return Success/failure status of get call. 1 = Success; 0 = Failure
  */
 sf_bool STDCALL curl_get_call(SF_CONNECT *sf, CURL *curl, char *url, struct curl_slist *header, cJSON **json,
-                              SF_ERROR_STRUCT *error);
+                              SF_ERROR_STRUCT *error, uint32 *retry_after_ms);
 
 /**
  * Used to determine the sleep time during the next backoff caused by request failure.
@@ -348,10 +375,123 @@ ARRAY_LIST *json_get_object_keys(const cJSON *item);
  * @param data The data to copy in the buffer.
  * @param size The size (in bytes) of each data member.
  * @param nmemb The number of data members.
- * @param raw_json The Raw JSON Buffer object that grows in size to copy multiple writes for a single cURL call.
+ * @param userdata The RAW_JSON_BUFFER object that grows in size to copy multiple writes for a single cURL call.
  * @return The number of bytes copied into the buffer.
  */
-size_t json_resp_cb(char *data, size_t size, size_t nmemb, RAW_JSON_BUFFER *raw_json);
+size_t json_resp_cb(char *data, size_t size, size_t nmemb, void *userdata);
+
+/**
+ * Creates the process wide cURL shares. Every request made through http_set_options then reuses DNS lookups, TLS
+ * sessions and open connections of earlier requests.
+ *
+ * @return Success/failure of creating the shares. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL http_share_init(void);
+
+/**
+ * Frees the cURL shares. All cURL handles that used them must have been cleaned up already.
+ */
+void STDCALL http_share_term(void);
+
+/**
+ * Request header with a token of the connection, shared by the requests that run at the same time. A header stays
+ * valid until the last request that acquired it releases it, also if the tokens change in the meantime.
+ */
+typedef struct SF_HTTP_HEADER {
+    struct curl_slist *slist;
+    uint64 refs;
+} SF_HTTP_HEADER;
+
+/**
+ * Creates the cURL handles and request headers that are kept for the lifetime of a connection.
+ *
+ * @param sf Snowflake Connection object
+ * @return Success/failure status. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL http_session_init(SF_CONNECT *sf);
+
+/**
+ * Frees the idle cURL handles and the request headers of a connection. No request may be running.
+ *
+ * @param sf Snowflake Connection object
+ */
+void STDCALL http_session_term(SF_CONNECT *sf);
+
+/**
+ * Takes an idle cURL handle of the connection, which still has its connection to Snowflake open, or creates a new
+ * one if there is none.
+ *
+ * @param sf Snowflake Connection object
+ * @return The handle or NULL if it can't be created
+ */
+CURL *STDCALL http_session_acquire_handle(SF_CONNECT *sf);
+
+/**
+ * Gives a cURL handle back to the connection once the request is done.
+ *
+ * @param sf Snowflake Connection object
+ * @param curl cURL handle. Can be NULL
+ */
+void STDCALL http_session_release_handle(SF_CONNECT *sf, CURL *curl);
+
+/**
+ * Returns the request header with the current token of the connection, creating it if the tokens changed since it
+ * was last created.
+ *
+ * @param sf Snowflake Connection object
+ * @param use_application_json_accept_type true for put/get command
+ * @param gzip_body Whether the header is for a gzip compressed body
+ * @param error Reference to the Snowflake Error object to set an error if one occurs
+ * @return The header, to be released with http_session_release_header, or NULL if there isn't enough memory
+ */
+SF_HTTP_HEADER *STDCALL http_session_acquire_header(SF_CONNECT *sf, sf_bool use_application_json_accept_type,
+                                                    sf_bool gzip_body, SF_ERROR_STRUCT *error);
+
+/**
+ * Releases a header acquired with http_session_acquire_header.
+ *
+ * @param sf Snowflake Connection object
+ * @param header Header. Can be NULL
+ */
+void STDCALL http_session_release_header(SF_CONNECT *sf, SF_HTTP_HEADER *header);
+
+/**
+ * Replaces the session and master token of the connection and the request headers made from them in one step, so
+ * that concurrent requests use either the old or the new token.
+ *
+ * @param sf Snowflake Connection object
+ * @param token New session token, owned by the connection afterwards
+ * @param master_token New master token, owned by the connection afterwards
+ */
+void STDCALL http_session_set_tokens(SF_CONNECT *sf, char *token, char *master_token);
+
+/**
+ * Drops the request headers of the connection so that they are created again from its tokens, e.g. after the direct
+ * query token has been set.
+ *
+ * @param sf Snowflake Connection object
+ */
+void STDCALL http_session_reset_headers(SF_CONNECT *sf);
+
+/**
+ * Sets all cURL options for a single HTTP request without running it. Used by http_perform and by callers that run
+ * the request themselves, e.g. through a cURL multi handle.
+ *
+ * @param curl The cURL object to set up.
+ * @param request_type The type of HTTP request.
+ * @param url The fully qualified URL to use for the HTTP request.
+ * @param header The header to use for the HTTP request. Can be NULL.
+ * @param body The body to send over the HTTP request. If running GET request, set this to NULL.
+ * @param body_len Size of the body, 0 if the body is a NUL terminated string.
+ * @param write_function The cURL write callback that receives the response.
+ * @param write_data The user data passed to write_function.
+ * @param accept_encoding Whether to accept compressed responses, used for result chunks.
+ * @param insecure_mode Insecure mode disable OCSP check when set to true
+ * @return Success/failure of setting the options. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL http_set_options(CURL *curl, SF_REQUEST_TYPE request_type, char *url, struct curl_slist *header,
+                                 char *body, size_t body_len, curl_write_callback write_function, void *write_data,
+                                 sf_bool accept_encoding, sf_bool insecure_mode);
 
 /**
  * Performs an HTTP request with retry.
@@ -361,19 +501,25 @@ size_t json_resp_cb(char *data, size_t size, size_t nmemb, RAW_JSON_BUFFER *raw_
  * @param url The fully qualified URL to use for the HTTP request.
  * @param header The header to use for the HTTP request.
  * @param body The body to send over the HTTP request. If running GET request, set this to NULL.
- * @param json A reference to a cJSON pointer where we should store a successful request.
+ * @param body_len Size of the body, 0 if the body is a NUL terminated string.
+ * @param json A reference to a cJSON pointer where we should store a successful request. Not used for result chunks.
  * @param network_timeout The network request timeout to use for each request try.
- * @param chunk_downloader A boolean value determining whether or not we are running this request from the chunk
- *                         downloader. Each chunk that we download from AWS is invalid JSON so we need to add an
- *                         opening square bracket at the beginning of the text buffer and a closing square bracket
- *                         at the end of the text buffer.
+ * @param chunk_parser Chunk parser to feed the response into when we are running this request from the chunk
+ *                     downloader, NULL otherwise. Each chunk that we download from AWS is a list of rows without the
+ *                     enclosing square brackets. The caller takes the rows with chunk_parser_finish. Transfers that
+ *                     are cut off are resumed with a Range request where possible.
+ * @param cancel Aborts the request once another thread sets it to a non-zero value, e.g. when a hedged download of
+ *               the same chunk won. Can be NULL.
  * @param error Reference to the Snowflake Error object to set an error if one occurs.
  * @param insecure_mode Insecure mode disable OCSP check when set to true
+ * @param retry_after_ms Set to the delay the server asked for with a Retry-After header, 0 if there was none. Not
+ *                       used for result chunks. Can be NULL.
  * @return Success/failure status of http request call. 1 = Success; 0 = Failure
  */
 sf_bool STDCALL http_perform(CURL *curl, SF_REQUEST_TYPE request_type, char *url, struct curl_slist *header,
-                             char *body, cJSON **json, int64 network_timeout, sf_bool chunk_downloader,
-                             SF_ERROR_STRUCT *error, sf_bool insecure_mode);
+                             char *body, size_t body_len, cJSON **json, int64 network_timeout,
+                             SF_CHUNK_PARSER *chunk_parser, SF_ATOMIC_INT32 *cancel, SF_ERROR_STRUCT *error,
+                             sf_bool insecure_mode, uint32 *retry_after_ms);
 
 /**
  * Returns true if HTTP code is retryable, false otherwise.
@@ -406,11 +552,12 @@ sf_bool STDCALL renew_session(CURL * curl, SF_CONNECT *sf, SF_ERROR_STRUCT *erro
  * @param request_type Type of request.
  * @param error Reference to the Snowflake Error object to set an error if one occurs.
  * @param use_application_json_accept_type true for put/get command, default is false
+ * @param wait_for_result For POST requests, whether to wait for a query that is still in progress to finish
  * @return Success/failure status of request. 1 = Success; 0 = Failure
  */
 sf_bool STDCALL request(SF_CONNECT *sf, cJSON **json, const char *url, URL_KEY_VALUE* url_params, int num_url_params,
                         char *body, struct curl_slist *header, SF_REQUEST_TYPE request_type, SF_ERROR_STRUCT *error,
-                        sf_bool use_application_json_accept_type);
+                        sf_bool use_application_json_accept_type, sf_bool wait_for_result);
 
 /**
  * Resets curl instance.
@@ -17,6 +17,8 @@ extern char *CA_BUNDLE_FILE;
 extern int32 SSL_VERSION;
 extern sf_bool DEBUG;
 extern sf_bool SF_OCSP_CHECK;
+extern uint64 CHUNK_MEMORY_LIMIT;
+extern char *CHUNK_SPILL_DIR;
 
 #ifdef __cplusplus
 }
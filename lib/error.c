@@ -76,11 +76,13 @@ void STDCALL set_snowflake_error(SF_ERROR_STRUCT *error,
 }
 
 void STDCALL clear_snowflake_error(SF_ERROR_STRUCT *error) {
-    _mutex_lock(&mutex_shared_msg);
-    memset(_shared_msg, 0, sizeof(_shared_msg));
-    _mutex_unlock(&mutex_shared_msg);
-    if (strncmp(error->sqlstate, SF_SQLSTATE_NO_ERROR,
-                sizeof(SF_SQLSTATE_NO_ERROR)) && !error->is_shared_msg) {
+    // Called on every fetch, so the shared buffer is only touched by the error that is using it
+    if (error->is_shared_msg) {
+        _mutex_lock(&mutex_shared_msg);
+        _shared_msg[0] = '\0';
+        _mutex_unlock(&mutex_shared_msg);
+    } else if (strncmp(error->sqlstate, SF_SQLSTATE_NO_ERROR,
+                       sizeof(SF_SQLSTATE_NO_ERROR))) {
         /* Error already set and msg is not on shared mem */
         SF_FREE(error->msg);
     }
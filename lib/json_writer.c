@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "json_writer.h"
+#include "memory.h"
+
+#define JSON_WRITER_MIN_CAP 256
+
+/**
+ * Makes room for extra more bytes and the terminating NUL.
+ */
+static sf_bool STDCALL reserve(SF_JSON_WRITER *writer, size_t extra) {
+    size_t cap;
+    char *buf;
+    if (writer->failed) {
+        return SF_BOOLEAN_FALSE;
+    }
+    if (writer->len + extra + 1 <= writer->cap) {
+        return SF_BOOLEAN_TRUE;
+    }
+    cap = writer->cap ? writer->cap : JSON_WRITER_MIN_CAP;
+    while (cap < writer->len + extra + 1) {
+        cap *= 2;
+    }
+    buf = (char *) SF_REALLOC(writer->buf, cap);
+    if (!buf) {
+        writer->failed = SF_BOOLEAN_TRUE;
+        return SF_BOOLEAN_FALSE;
+    }
+    buf[writer->len] = '\0';
+    writer->buf = buf;
+    writer->cap = cap;
+    return SF_BOOLEAN_TRUE;
+}
+
+static void STDCALL append(SF_JSON_WRITER *writer, const char *data, size_t len) {
+    if (reserve(writer, len)) {
+        memcpy(writer->buf + writer->len, data, len);
+        writer->len += len;
+        writer->buf[writer->len] = '\0';
+    }
+}
+
+static void STDCALL append_string(SF_JSON_WRITER *writer, const char *value) {
+    const unsigned char *p;
+    size_t escaped_len = 2;
+    char *out;
+
+    // Size the escaped string first so that it is copied in one pass
+    for (p = (const unsigned char *) value; *p; p++) {
+        if (*p == '"' || *p == '\\' || *p == '\b' || *p == '\f' || *p == '\n' || *p == '\r' || *p == '\t') {
+            escaped_len += 2;
+        } else if (*p < 32) {
+            escaped_len += 6;
+        } else {
+            escaped_len++;
+        }
+    }
+    if (!reserve(writer, escaped_len)) {
+        return;
+    }
+
+    out = writer->buf + writer->len;
+    *out++ = '"';
+    for (p = (const unsigned char *) value; *p; p++) {
+        if (*p >= 32 && *p != '"' && *p != '\\') {
+            *out++ = (char) *p;
+            continue;
+        }
+        *out++ = '\\';
+        switch (*p) {
+            case '"':
+                *out++ = '"';
+                break;
+            case '\\':
+                *out++ = '\\';
+                break;
+            case '\b':
+                *out++ = 'b';
+                break;
+            case '\f':
+                *out++ = 'f';
+                break;
+            case '\n':
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = 'r';
+                break;
+            case '\t':
+                *out++ = 't';
+                break;
+            default:
+                sprintf(out, "u%04x", *p);
+                out += 5;
+                break;
+        }
+    }
+    *out++ = '"';
+    *out = '\0';
+    writer->len += escaped_len;
+}
+
+/**
+ * Writes the separator and the name of the next member.
+ */
+static void STDCALL append_key(SF_JSON_WRITER *writer, const char *key) {
+    if (writer->need_separator) {
+        append(writer, ",", 1);
+    }
+    if (key) {
+        append_string(writer, key);
+        append(writer, ":", 1);
+    }
+    writer->need_separator = SF_BOOLEAN_TRUE;
+}
+
+void STDCALL json_writer_init(SF_JSON_WRITER *writer, size_t initial_cap) {
+    memset(writer, 0, sizeof(SF_JSON_WRITER));
+    reserve(writer, initial_cap);
+}
+
+void STDCALL json_writer_term(SF_JSON_WRITER *writer) {
+    SF_FREE(writer->buf);
+    memset(writer, 0, sizeof(SF_JSON_WRITER));
+}
+
+void STDCALL json_writer_begin_object(SF_JSON_WRITER *writer, const char *key) {
+    append_key(writer, key);
+    append(writer, "{", 1);
+    writer->need_separator = SF_BOOLEAN_FALSE;
+}
+
+void STDCALL json_writer_end_object(SF_JSON_WRITER *writer) {
+    append(writer, "}", 1);
+    // The enclosing object has at least this member
+    writer->need_separator = SF_BOOLEAN_TRUE;
+}
+
+void STDCALL json_writer_string(SF_JSON_WRITER *writer, const char *key, const char *value) {
+    append_key(writer, key);
+    if (value) {
+        append_string(writer, value);
+    } else {
+        append(writer, "null", 4);
+    }
+}
+
+void STDCALL json_writer_int64(SF_JSON_WRITER *writer, const char *key, int64 value) {
+    char digits[24];
+    int len = snprintf(digits, sizeof(digits), "%lld", (long long) value);
+    append_key(writer, key);
+    append(writer, digits, (size_t) len);
+}
+
+void STDCALL json_writer_bool(SF_JSON_WRITER *writer, const char *key, sf_bool value) {
+    append_key(writer, key);
+    if (value) {
+        append(writer, "true", 4);
+    } else {
+        append(writer, "false", 5);
+    }
+}
+
+sf_bool STDCALL json_writer_failed(SF_JSON_WRITER *writer) {
+    return writer->failed;
+}
+
+char *STDCALL json_writer_detach(SF_JSON_WRITER *writer, size_t *len) {
+    char *buf = NULL;
+    // An empty document still comes back as a string
+    if (reserve(writer, 0)) {
+        buf = writer->buf;
+        writer->buf = NULL;
+        if (len) {
+            *len = writer->len;
+        }
+    }
+    json_writer_term(writer);
+    return buf;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_JSON_WRITER_H
+#define SNOWFLAKE_JSON_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <snowflake/basic_types.h>
+#include <snowflake/platform.h>
+
+/**
+ * Writes compact JSON straight into one growable buffer, without building a cJSON tree first. Members are written
+ * in the order they are added and objects must be closed in reverse order of opening.
+ *
+ * Running out of memory is remembered instead of being reported by every call, check json_writer_failed or the
+ * result of json_writer_detach once the document is complete.
+ */
+typedef struct SF_JSON_WRITER {
+    char *buf;
+    size_t len;
+    size_t cap;
+    // Whether the next member of the innermost object needs a separator
+    sf_bool need_separator;
+    sf_bool failed;
+} SF_JSON_WRITER;
+
+/**
+ * Initializes a writer.
+ *
+ * @param writer Writer.
+ * @param initial_cap Expected size of the document. The buffer grows as needed.
+ */
+void STDCALL json_writer_init(SF_JSON_WRITER *writer, size_t initial_cap);
+
+/**
+ * Frees the buffer of a writer that was not detached.
+ *
+ * @param writer Writer.
+ */
+void STDCALL json_writer_term(SF_JSON_WRITER *writer);
+
+/**
+ * Opens an object.
+ *
+ * @param writer Writer.
+ * @param key Member name in the enclosing object, NULL for the top level object.
+ */
+void STDCALL json_writer_begin_object(SF_JSON_WRITER *writer, const char *key);
+
+/**
+ * Closes the innermost object.
+ *
+ * @param writer Writer.
+ */
+void STDCALL json_writer_end_object(SF_JSON_WRITER *writer);
+
+/**
+ * Adds a string member, escaped the same way cJSON does.
+ *
+ * @param writer Writer.
+ * @param key Member name.
+ * @param value NUL terminated value, NULL is written as null.
+ */
+void STDCALL json_writer_string(SF_JSON_WRITER *writer, const char *key, const char *value);
+
+/**
+ * Adds an integer member.
+ *
+ * @param writer Writer.
+ * @param key Member name.
+ * @param value Value.
+ */
+void STDCALL json_writer_int64(SF_JSON_WRITER *writer, const char *key, int64 value);
+
+/**
+ * Adds a boolean member.
+ *
+ * @param writer Writer.
+ * @param key Member name.
+ * @param value Value.
+ */
+void STDCALL json_writer_bool(SF_JSON_WRITER *writer, const char *key, sf_bool value);
+
+/**
+ * @param writer Writer.
+ * @return SF_BOOLEAN_TRUE if memory ran out at any point.
+ */
+sf_bool STDCALL json_writer_failed(SF_JSON_WRITER *writer);
+
+/**
+ * Takes the document out of the writer, which is empty afterwards.
+ *
+ * @param writer Writer.
+ * @param len Set to the length of the document if not NULL.
+ * @return NUL terminated document to be freed with SF_FREE, or NULL if memory ran out.
+ */
+char *STDCALL json_writer_detach(SF_JSON_WRITER *writer, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_JSON_WRITER_H
@@ -36,6 +36,39 @@ static struct {
     int quiet;
 } L;
 
+int log_min_level = SF_LOG_TRACE;
+
+// Default size of the queue of the async backend
+#define LOG_ASYNC_BUFFER_SIZE (1024 * 1024)
+// Longest time a line waits in the queue before it is written
+#define LOG_ASYNC_FLUSH_INTERVAL_MS 200
+// Lines up to this size are formatted on the stack
+#define LOG_LINE_SIZE 1024
+
+/*
+ * Async backend. Lines are formatted by the threads that log them and appended to a ring of bytes, the lock only
+ * covers the copy. A writer thread takes everything queued since its last pass and writes it in one go, without the
+ * ring lock, since producers only ever write into the free part of the ring.
+ */
+static struct {
+    // Whether lines go through the queue. Only changes with the lock held
+    volatile int running;
+    int initialized;
+    SF_CRITICAL_SECTION_HANDLE lock;
+    // Wakes the writer up before the flush interval is over
+    SF_CONDITION_HANDLE wake;
+    // Signaled whenever the writer is done with a batch
+    SF_CONDITION_HANDLE written;
+    SF_THREAD_HANDLE writer;
+    int stopping;
+    char *buf;
+    size_t cap;
+    // Positions only grow, the offset in buf is the position modulo cap. Bytes between tail and head are queued
+    unsigned long long head;
+    unsigned long long tail;
+    SF_LOG_ASYNC_STATS stats;
+} A;
+
 
 static const char *level_names[] = {
     "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -48,6 +81,11 @@ static const char *level_colors[] = {
 #endif
 
 
+static void update_min_level(void) {
+    log_min_level = L.quiet && !L.fp ? SF_LOG_FATAL + 1 : L.level;
+}
+
+
 static void lock(void) {
     if (L.lock) {
         L.lock(L.udata, 1);
@@ -73,7 +111,10 @@ void log_set_lock(log_LockFn fn) {
 
 
 void log_set_fp(FILE *fp) {
+    // Queued lines go to the file they were logged for
+    log_flush();
     L.fp = fp;
+    update_min_level();
 }
 
 int log_get_level()
@@ -83,11 +124,13 @@ int log_get_level()
 
 void log_set_level(int level) {
     L.level = level;
+    update_min_level();
 }
 
 
 void log_set_quiet(int enable) {
     L.quiet = enable ? 1 : 0;
+    update_min_level();
 }
 
 void log_log(int level, const char *file, int line, const char *ns,
@@ -100,10 +143,243 @@ void log_log(int level, const char *file, int line, const char *ns,
 }
 
 
+/**
+ * Formats a line the way it appears in the log file. Returns the line, which is either buf or allocated when it
+ * doesn't fit into buf, and sets its length.
+ */
+static char *format_line(char *buf, size_t buf_size, size_t *len, int level, const char *file, int line,
+                         const char *ns, const char *fmt, va_list args) {
+    char tsbuf[50];    /* timestamp buffer*/
+    char *basename = sf_filename_from_path(file);
+    char *text = buf;
+    int prefix_len;
+    int message_len;
+    va_list copy;
+
+    sf_log_timestamp(tsbuf, sizeof(tsbuf));
+    prefix_len = snprintf(buf, buf_size, SF_LOG_TIMESTAMP_FORMAT, tsbuf, level_names[level], ns, basename, line);
+    if (prefix_len < 0) {
+        return NULL;
+    }
+    // Most lines fit into buf, which leaves room for the newline
+    if ((size_t) prefix_len + 1 < buf_size) {
+        va_copy(copy, args);
+        message_len = vsnprintf(buf + prefix_len, buf_size - prefix_len - 1, fmt, copy);
+        va_end(copy);
+    } else {
+        va_copy(copy, args);
+        message_len = vsnprintf(NULL, 0, fmt, copy);
+        va_end(copy);
+    }
+    if (message_len < 0) {
+        return NULL;
+    }
+    *len = (size_t) prefix_len + (size_t) message_len + 1;
+    if (*len + 1 > buf_size) {
+        if (!(text = (char *) malloc(*len + 1))) {
+            return NULL;
+        }
+        snprintf(text, (size_t) prefix_len + 1, SF_LOG_TIMESTAMP_FORMAT, tsbuf, level_names[level], ns, basename,
+                 line);
+        va_copy(copy, args);
+        vsnprintf(text + prefix_len, (size_t) message_len + 1, fmt, copy);
+        va_end(copy);
+    }
+    text[*len - 1] = '\n';
+    text[*len] = '\0';
+    return text;
+}
+
+/**
+ * Appends a line to the queue of the async backend, or drops it if the queue is full. Waits until the line is
+ * written for FATAL messages. Returns 0 if the async backend isn't running.
+ */
+static int enqueue_line(int level, const char *file, int line, const char *ns, const char *fmt, va_list args) {
+    char buf[LOG_LINE_SIZE];
+    char *text;
+    size_t len = 0;
+    size_t offset;
+    size_t first;
+    unsigned long long end;
+
+    if (!A.running) {
+        return 0;
+    }
+    text = format_line(buf, sizeof(buf), &len, level, file, line, ns, fmt, args);
+
+    _critical_section_lock(&A.lock);
+    // Once the writer is stopping it may already be gone, so lines are written directly
+    if (!A.running || A.stopping) {
+        _critical_section_unlock(&A.lock);
+        if (text != buf) {
+            free(text);
+        }
+        return 0;
+    }
+    if (!text || A.head - A.tail + len > A.cap) {
+        A.stats.dropped++;
+    } else {
+        offset = (size_t) (A.head % A.cap);
+        first = A.cap - offset < len ? A.cap - offset : len;
+        memcpy(A.buf + offset, text, first);
+        memcpy(A.buf, text + first, len - first);
+        A.head += len;
+        A.stats.queued++;
+        if (level >= SF_LOG_FATAL || A.head - A.tail > A.cap / 2) {
+            _cond_signal(&A.wake);
+        }
+        // A fatal error may well be the last thing the process does
+        end = A.head;
+        while (level >= SF_LOG_FATAL && A.tail < end && A.running) {
+            _cond_wait(&A.written, &A.lock);
+        }
+    }
+    _critical_section_unlock(&A.lock);
+
+    if (text && text != buf) {
+        free(text);
+    }
+    return 1;
+}
+
+static void write_batch(const char *data, size_t len) {
+    lock();
+    if (!L.quiet) {
+        fwrite(data, 1, len, stderr);
+        fflush(stderr);
+    }
+    if (L.fp) {
+        fwrite(data, 1, len, L.fp);
+        fflush(L.fp);
+    }
+    unlock();
+}
+
+static void *log_writer_thread(void *unused) {
+    unsigned long long start;
+    unsigned long long end;
+    size_t offset;
+    size_t first;
+
+    _critical_section_lock(&A.lock);
+    while (1) {
+        if (A.head == A.tail && !A.stopping) {
+            _cond_timed_wait(&A.wake, &A.lock, LOG_ASYNC_FLUSH_INTERVAL_MS);
+        }
+        start = A.tail;
+        end = A.head;
+        if (start == end) {
+            if (A.stopping) {
+                break;
+            }
+            continue;
+        }
+        _critical_section_unlock(&A.lock);
+
+        // Producers don't touch the queued bytes, so they are written without the lock
+        offset = (size_t) (start % A.cap);
+        first = A.cap - offset < end - start ? A.cap - offset : (size_t) (end - start);
+        write_batch(A.buf + offset, first);
+        if (end - start > first) {
+            write_batch(A.buf, (size_t) (end - start) - first);
+        }
+
+        _critical_section_lock(&A.lock);
+        A.tail = end;
+        A.stats.batches++;
+        _cond_broadcast(&A.written);
+    }
+    _critical_section_unlock(&A.lock);
+    return NULL;
+}
+
+int log_set_async(int enable, size_t buffer_size) {
+    char *buf;
+    if (!A.initialized) {
+        if (!enable) {
+            return 0;
+        }
+        _critical_section_init(&A.lock);
+        _cond_init(&A.wake);
+        _cond_init(&A.written);
+        A.initialized = 1;
+    }
+
+    if (!enable) {
+        if (!A.running) {
+            return 0;
+        }
+        // The writer drains the queue before it stops
+        _critical_section_lock(&A.lock);
+        A.stopping = 1;
+        _cond_signal(&A.wake);
+        _critical_section_unlock(&A.lock);
+        _thread_join(A.writer);
+
+        _critical_section_lock(&A.lock);
+        A.running = 0;
+        A.stopping = 0;
+        buf = A.buf;
+        A.buf = NULL;
+        // Wakes up anybody still waiting for a fatal message
+        _cond_broadcast(&A.written);
+        _critical_section_unlock(&A.lock);
+        free(buf);
+        return 0;
+    }
+
+    if (A.running) {
+        return 0;
+    }
+    A.cap = buffer_size ? buffer_size : LOG_ASYNC_BUFFER_SIZE;
+    if (!(A.buf = (char *) malloc(A.cap))) {
+        return -1;
+    }
+    A.head = A.tail = 0;
+    if (_thread_init(&A.writer, log_writer_thread, NULL) != 0) {
+        free(A.buf);
+        A.buf = NULL;
+        return -1;
+    }
+    _critical_section_lock(&A.lock);
+    A.running = 1;
+    _critical_section_unlock(&A.lock);
+    return 0;
+}
+
+void log_flush(void) {
+    unsigned long long end;
+    if (!A.running) {
+        return;
+    }
+    _critical_section_lock(&A.lock);
+    end = A.head;
+    _cond_signal(&A.wake);
+    while (A.running && A.tail < end) {
+        _cond_wait(&A.written, &A.lock);
+    }
+    _critical_section_unlock(&A.lock);
+}
+
+void log_get_async_stats(SF_LOG_ASYNC_STATS *stats) {
+    if (!A.initialized) {
+        memset(stats, 0, sizeof(SF_LOG_ASYNC_STATS));
+        return;
+    }
+    _critical_section_lock(&A.lock);
+    *stats = A.stats;
+    _critical_section_unlock(&A.lock);
+}
+
 void
 log_log_va_list(int level, const char *file, int line, const char *ns,
                 const char *fmt, va_list args) {
-    if (level < L.level) {
+    // Also checked by the log macros, but external callers like the AWS logger come here directly
+    if (!log_enabled(level)) {
+        return;
+    }
+
+    if (enqueue_line(level, file, line, ns, fmt, args)) {
         return;
     }
 
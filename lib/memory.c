@@ -2,10 +2,56 @@
  * Copyright (c) 2017-2018 Snowflake Computing, Inc. All rights reserved.
  */
 
+#include <stdint.h>
+#include <string.h>
 #include <snowflake/logger.h>
 #include "memory.h"
 #include "snowflake/platform.h"
 
+SF_INTERNAL_MEM_HOOKS global_hooks = {malloc, free, realloc, calloc};
+
+// Number of sets of counters. Threads are spread over them so that they rarely update the same cache line
+#define SF_MEMORY_SHARDS 32
+
+#ifdef _WIN32
+#define SF_THREAD_LOCAL __declspec(thread)
+#else
+#define SF_THREAD_LOCAL __thread
+#endif
+
+static struct memory_shard {
+    SF_ATOMIC_INT64 live_bytes;
+    SF_ATOMIC_INT64 live_allocations;
+    SF_ATOMIC_INT64 total_allocations;
+    // Keeps each shard on its own cache line
+    char padding[64 - 3 * sizeof(SF_ATOMIC_INT64)];
+} memory_shards[SF_MEMORY_SHARDS];
+
+static SF_ATOMIC_INT64 next_shard;
+static SF_THREAD_LOCAL struct memory_shard *thread_shard;
+
+static void count_allocation(int64 bytes, int64 allocations) {
+    struct memory_shard *shard = thread_shard;
+    if (!shard) {
+        shard = &memory_shards[_atomic_add64(&next_shard, 1) % SF_MEMORY_SHARDS];
+        thread_shard = shard;
+    }
+    _atomic_add64(&shard->live_bytes, bytes);
+    if (allocations) {
+        _atomic_add64(&shard->live_allocations, allocations);
+        if (allocations > 0) {
+            _atomic_add64(&shard->total_allocations, allocations);
+        }
+    }
+}
+
+static void out_of_memory(size_t size) {
+    log_fatal("Could not allocate %zu bytes of memory. Most likely out of memory. Exiting...", size);
+    exit(EXIT_FAILURE);
+}
+
+#ifdef SF_MEMORY_TRACKING
+
 // Basic hashing function. Works well for memory addresses
 #define sf_ptr_hash(p, t) (((unsigned long) (p) >> 3) & (sizeof (t)/sizeof ((t)[0]) - 1))
 #define SF_ALLOC_MAP_SIZE 2048
@@ -80,16 +126,16 @@ void *sf_malloc(size_t size, const char *file, int line) {
     if (size == 0) {
         return NULL;
     }
-    void *data = malloc(size);
+    void *data = global_hooks.alloc(size);
     // If we could not allocate the needed data, exit
     if (data == NULL) {
-        log_fatal("Could not allocate %zu bytes of memory. Most likely out of memory. Exiting...", size);
-        exit(EXIT_FAILURE);
+        out_of_memory(size);
     }
 
     _mutex_lock(&allocation_lock);
     alloc_insert(data, size, file, line);
     _mutex_unlock(&allocation_lock);
+    count_allocation((int64) size, 1);
 
     return data;
 }
@@ -99,34 +145,41 @@ void *sf_calloc(size_t num, size_t size, const char *file, int line) {
     if (size == 0 || num == 0) {
         return NULL;
     }
-    void *data = calloc(num, size);
+    void *data = global_hooks.calloc(num, size);
     // If we could not allocate the needed data, exit
     if (data == NULL) {
-        log_fatal("Could not allocate %zu bytes of memory. Most likely out of memory. Exiting...", (num * size));
-        exit(EXIT_FAILURE);
+        out_of_memory(num * size);
     }
 
     _mutex_lock(&allocation_lock);
     alloc_insert(data, num * size, file, line);
     _mutex_unlock(&allocation_lock);
+    count_allocation((int64) (num * size), 1);
 
     return data;
 }
 
 void *sf_realloc(void *ptr, size_t size, const char *file, int line) {
     struct allocation *alloc;
+    int64 old_size = 0;
+    void *data;
+    // Same as realloc for a size of 0, the block is freed
+    if (size == 0) {
+        sf_free(ptr, file, line);
+        return NULL;
+    }
     // New pointer returned by realloc
-    void *data = realloc(ptr, size);
+    data = global_hooks.realloc(ptr, size);
     // If we could not allocate the needed data, exit
     if (data == NULL && size > 0) {
-        log_fatal("Could not allocate %zu bytes of memory. Most likely out of memory. Exiting...", size);
-        exit(EXIT_FAILURE);
+        out_of_memory(size);
     }
 
     _mutex_lock(&allocation_lock);
     alloc = alloc_find(ptr);
     // If we don't find old entry then create new one
     if (alloc) {
+        old_size = (int64) alloc->size;
         // No need to rehash since pointer is the same. Just update associated fields
         if (ptr == data) {
             alloc->size = size;
@@ -141,16 +194,24 @@ void *sf_realloc(void *ptr, size_t size, const char *file, int line) {
         alloc_insert(data, size, file, line);
     }
     _mutex_unlock(&allocation_lock);
+    count_allocation((int64) size - old_size, alloc ? 0 : 1);
 
     return data;
 }
 
 void sf_free(void *ptr, const char *file, int line) {
+    struct allocation *alloc;
+    int64 size = 0;
     if (ptr) {
         _mutex_lock(&allocation_lock);
-        free(ptr);
-        alloc_remove(ptr);
+        global_hooks.dealloc(ptr);
+        alloc = alloc_find(ptr);
+        if (alloc) {
+            size = (int64) alloc->size;
+            alloc_remove(ptr);
+        }
         _mutex_unlock(&allocation_lock);
+        count_allocation(-size, alloc ? -1 : 0);
     }
 }
 
@@ -173,6 +234,111 @@ void sf_alloc_map_to_log(sf_bool cleanup) {
                 alloc = link;
             }
         }
+        if (cleanup) {
+            alloc_map[i] = NULL;
+        }
     }
     _mutex_unlock(&allocation_lock);
 }
+
+#else
+
+/*
+ * Without the allocation map, the size of each block is kept in front of it so that the counters can be updated
+ * when it is freed. The header is as large as the alignment malloc guarantees.
+ */
+#define SF_ALLOC_HEADER_SIZE 16
+#define sf_alloc_base(p) ((char *) (p) - SF_ALLOC_HEADER_SIZE)
+#define sf_alloc_size(p) (*(size_t *) sf_alloc_base(p))
+
+void sf_memory_init() {
+}
+
+void sf_memory_term() {
+}
+
+static void *alloc_finish(char *base, size_t size) {
+    *(size_t *) base = size;
+    count_allocation((int64) size, 1);
+    return base + SF_ALLOC_HEADER_SIZE;
+}
+
+void *sf_malloc(size_t size, const char *file, int line) {
+    char *base;
+    // If size is 0, we should return a NULL pointer instead of exiting.
+    if (size == 0) {
+        return NULL;
+    }
+    base = size <= SIZE_MAX - SF_ALLOC_HEADER_SIZE ? global_hooks.alloc(size + SF_ALLOC_HEADER_SIZE) : NULL;
+    // If we could not allocate the needed data, exit
+    if (base == NULL) {
+        out_of_memory(size);
+    }
+    return alloc_finish(base, size);
+}
+
+void *sf_calloc(size_t num, size_t size, const char *file, int line) {
+    char *base;
+    // If size or num is 0, we should return a NULL pointer instead of exiting.
+    if (size == 0 || num == 0) {
+        return NULL;
+    }
+    base = num <= (SIZE_MAX - SF_ALLOC_HEADER_SIZE) / size ?
+           global_hooks.calloc(1, num * size + SF_ALLOC_HEADER_SIZE) : NULL;
+    // If we could not allocate the needed data, exit
+    if (base == NULL) {
+        out_of_memory(num * size);
+    }
+    return alloc_finish(base, num * size);
+}
+
+void *sf_realloc(void *ptr, size_t size, const char *file, int line) {
+    size_t old_size;
+    char *base;
+    if (!ptr) {
+        return sf_malloc(size, file, line);
+    }
+    // Same as realloc for a size of 0, the block is freed
+    if (size == 0) {
+        sf_free(ptr, file, line);
+        return NULL;
+    }
+    old_size = sf_alloc_size(ptr);
+    base = size <= SIZE_MAX - SF_ALLOC_HEADER_SIZE ?
+           global_hooks.realloc(sf_alloc_base(ptr), size + SF_ALLOC_HEADER_SIZE) : NULL;
+    // If we could not allocate the needed data, exit
+    if (base == NULL) {
+        out_of_memory(size);
+    }
+    *(size_t *) base = size;
+    count_allocation((int64) size - (int64) old_size, 0);
+    return base + SF_ALLOC_HEADER_SIZE;
+}
+
+void sf_free(void *ptr, const char *file, int line) {
+    if (ptr) {
+        count_allocation(-(int64) sf_alloc_size(ptr), -1);
+        global_hooks.dealloc(sf_alloc_base(ptr));
+    }
+}
+
+void sf_alloc_map_to_log(sf_bool cleanup) {
+    SF_MEMORY_STATS stats;
+    sf_memory_stats(&stats);
+    if (stats.live_allocations) {
+        log_warn("%lld allocations of %lld bytes of memory were not freed. Build with SF_MEMORY_TRACKING to see "
+                 "where they were made", (long long) stats.live_allocations, (long long) stats.live_bytes);
+    }
+}
+
+#endif
+
+void sf_memory_stats(SF_MEMORY_STATS *stats) {
+    int i;
+    memset(stats, 0, sizeof(SF_MEMORY_STATS));
+    for (i = 0; i < SF_MEMORY_SHARDS; i++) {
+        stats->live_bytes += _atomic_load64(&memory_shards[i].live_bytes);
+        stats->live_allocations += _atomic_load64(&memory_shards[i].live_allocations);
+        stats->total_allocations += _atomic_load64(&memory_shards[i].total_allocations);
+    }
+}
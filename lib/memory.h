@@ -25,7 +25,21 @@ typedef struct SF_INTERNAL_MEM_HOOKS {
     void *(*calloc)(size_t nitems, size_t size);
 } SF_INTERNAL_MEM_HOOKS;
 
-static SF_INTERNAL_MEM_HOOKS global_hooks = {malloc, free, realloc, calloc};
+/**
+ * Allocation functions used by the library, set up from SF_USER_MEM_HOOKS by snowflake_global_init.
+ */
+extern SF_INTERNAL_MEM_HOOKS global_hooks;
+
+/**
+ * Memory allocated with SF_MALLOC and friends that hasn't been freed yet. The counters are kept per thread group and
+ * summed up when read, so they cost no locking to maintain.
+ */
+typedef struct SF_MEMORY_STATS {
+    int64 live_bytes;
+    int64 live_allocations;
+    // Allocations made since the process started, including freed ones
+    int64 total_allocations;
+} SF_MEMORY_STATS;
 
 void sf_memory_init();
 void sf_memory_term();
@@ -33,7 +47,12 @@ void *sf_malloc(size_t size, const char *file, int line);
 void *sf_calloc(size_t num, size_t size, const char *file, int line);
 void *sf_realloc(void *ptr, size_t size, const char *file, int line);
 void sf_free(void *ptr, const char *file, int line);
+/**
+ * Logs the memory that hasn't been freed. With SF_MEMORY_TRACKING every allocation is tracked and logged with the
+ * place where it was made, otherwise only the totals are.
+ */
 void sf_alloc_map_to_log(sf_bool cleanup);
+void sf_memory_stats(SF_MEMORY_STATS *stats);
 
 #ifdef __cplusplus
 }
@@ -163,6 +163,26 @@ _cond_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *crit) {
 #endif
 }
 
+int STDCALL
+_cond_timed_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *crit, unsigned int timeout_ms) {
+#ifdef _WIN32
+    BOOL ret = SleepConditionVariableCS(cond, crit, timeout_ms);
+    return ret ? 0 : 1;
+#else
+    // Condition variables are created with the default clock, which is the wall clock
+    struct timeval now;
+    struct timespec deadline;
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+    deadline.tv_nsec = (long) now.tv_usec * 1000 + (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, crit, &deadline);
+#endif
+}
+
 int STDCALL _cond_term(SF_CONDITION_HANDLE *cond) {
 #ifdef _WIN32
     // nop
@@ -493,7 +513,9 @@ void STDCALL sf_log_timestamp(char *tsbuf, size_t tsbufsize) {
     /* Get current time */
     struct timeval tmnow;
     gettimeofday(&tmnow, NULL);
-    struct tm *lt = gmtime(&tmnow.tv_sec);
+    // Threads format their log lines concurrently
+    struct tm tmbuf;
+    struct tm *lt = sf_gmtime(&tmnow.tv_sec, &tmbuf);
     char msec[10];    /* Microsecond buffer */
 
     snprintf(msec, sizeof(msec), "%03d", (int) tmnow.tv_usec / 1000);
@@ -559,4 +581,31 @@ void STDCALL sf_get_tmp_dir(char * tmpDir)
     tmpDir[oldLen+1] = '\0';
   }
 #endif
-}
\ No newline at end of file
+}
+
+unsigned long long STDCALL sf_get_monotonic_time_millis(void)
+{
+#ifdef _WIN32
+  return (unsigned long long) GetTickCount64();
+#elif defined(__linux__)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+void STDCALL sf_sleep_ms(unsigned int ms)
+{
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long) (ms % 1000) * 1000000;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
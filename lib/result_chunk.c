@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "result_chunk.h"
+#include "memory.h"
+
+#define RESULT_CHUNK_MIN_ARENA_SIZE 64
+#define RESULT_CHUNK_MIN_ROW_CAPACITY 16
+
+static size_t decoded_value_size(SF_C_TYPE type) {
+    return type == SF_C_TYPE_INT64 ? sizeof(int64) : type == SF_C_TYPE_FLOAT64 ? sizeof(float64) : sizeof(sf_bool);
+}
+
+static sf_bool grow_arena(SF_CHUNK_COLUMN *column, size_t needed) {
+    size_t cap = column->arena_cap ? column->arena_cap : RESULT_CHUNK_MIN_ARENA_SIZE;
+    char *arena;
+    while (cap < needed) {
+        cap *= 2;
+    }
+    arena = (char *) SF_REALLOC(column->arena, cap);
+    if (!arena) {
+        return SF_BOOLEAN_FALSE;
+    }
+    column->arena = arena;
+    column->arena_cap = cap;
+    return SF_BOOLEAN_TRUE;
+}
+
+static sf_bool grow_rows(SF_RESULT_CHUNK *chunk, int64 row_capacity) {
+    int64 i;
+    SF_CHUNK_COLUMN *column;
+    size_t *offsets;
+    size_t *lengths;
+    sf_bool *nulls;
+    for (i = 0; i < chunk->column_count; i++) {
+        column = &chunk->columns[i];
+        offsets = (size_t *) SF_REALLOC(column->offsets, (size_t) row_capacity * sizeof(size_t));
+        if (!offsets) {
+            return SF_BOOLEAN_FALSE;
+        }
+        column->offsets = offsets;
+        lengths = (size_t *) SF_REALLOC(column->lengths, (size_t) row_capacity * sizeof(size_t));
+        if (!lengths) {
+            return SF_BOOLEAN_FALSE;
+        }
+        column->lengths = lengths;
+        nulls = (sf_bool *) SF_REALLOC(column->nulls, (size_t) row_capacity * sizeof(sf_bool));
+        if (!nulls) {
+            return SF_BOOLEAN_FALSE;
+        }
+        column->nulls = nulls;
+    }
+    chunk->row_capacity = row_capacity;
+    return SF_BOOLEAN_TRUE;
+}
+
+SF_RESULT_CHUNK *STDCALL result_chunk_init(int64 column_count, int64 row_capacity, size_t size_hint) {
+    SF_RESULT_CHUNK *chunk = (SF_RESULT_CHUNK *) SF_CALLOC(1, sizeof(SF_RESULT_CHUNK));
+    int64 i;
+    size_t arena_size;
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->column_count = column_count > 0 ? column_count : 0;
+    if (chunk->column_count > 0) {
+        chunk->columns = (SF_CHUNK_COLUMN *) SF_CALLOC((size_t) chunk->column_count, sizeof(SF_CHUNK_COLUMN));
+        if (!chunk->columns) {
+            goto error;
+        }
+        // Spread the expected size evenly over the columns, plus room for the null terminators
+        arena_size = size_hint / (size_t) chunk->column_count + (size_t) (row_capacity > 0 ? row_capacity : 0);
+        for (i = 0; i < chunk->column_count; i++) {
+            if (!grow_arena(&chunk->columns[i], arena_size)) {
+                goto error;
+            }
+        }
+    }
+    if (!grow_rows(chunk, row_capacity > RESULT_CHUNK_MIN_ROW_CAPACITY ? row_capacity
+                                                                       : RESULT_CHUNK_MIN_ROW_CAPACITY)) {
+        goto error;
+    }
+    return chunk;
+
+error:
+    result_chunk_term(chunk);
+    return NULL;
+}
+
+void STDCALL result_chunk_term(SF_RESULT_CHUNK *chunk) {
+    int64 i;
+    if (!chunk) {
+        return;
+    }
+    if (chunk->columns) {
+        for (i = 0; i < chunk->column_count; i++) {
+            SF_FREE(chunk->columns[i].arena);
+            SF_FREE(chunk->columns[i].offsets);
+            SF_FREE(chunk->columns[i].lengths);
+            SF_FREE(chunk->columns[i].nulls);
+            SF_FREE(chunk->columns[i].decoded);
+            SF_FREE(chunk->columns[i].decode_status);
+            SF_FREE(chunk->columns[i].spare_decoded);
+            SF_FREE(chunk->columns[i].spare_decode_status);
+        }
+        SF_FREE(chunk->columns);
+    }
+    SF_FREE(chunk);
+}
+
+void STDCALL result_chunk_clear(SF_RESULT_CHUNK *chunk) {
+    int64 i;
+    SF_CHUNK_COLUMN *col;
+    for (i = 0; i < chunk->column_count; i++) {
+        col = &chunk->columns[i];
+        col->arena_size = 0;
+        // A NULL decoded array means the column isn't decoded, so the arrays move aside until the next decoding
+        if (col->decoded) {
+            SF_FREE(col->spare_decoded);
+            SF_FREE(col->spare_decode_status);
+            col->spare_decoded = col->decoded;
+            col->spare_decoded_size = col->decoded_rows * decoded_value_size(col->decoded_type);
+            col->spare_decode_status = col->decode_status;
+            col->spare_rows = col->decoded_rows;
+            col->decoded = NULL;
+            col->decode_status = NULL;
+        }
+    }
+    chunk->row_count = 0;
+    chunk->cur_column = 0;
+    chunk->value_start = 0;
+    chunk->next_free = NULL;
+}
+
+sf_bool STDCALL result_chunk_append(SF_RESULT_CHUNK *chunk, const char *data, size_t len) {
+    SF_CHUNK_COLUMN *column;
+    if (chunk->cur_column >= chunk->column_count) {
+        return SF_BOOLEAN_FALSE;
+    }
+    column = &chunk->columns[chunk->cur_column];
+    // Always leave room for the null terminator
+    if (column->arena_size + len + 1 > column->arena_cap &&
+        !grow_arena(column, column->arena_size + len + 1)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    if (len > 0) {
+        memcpy(&column->arena[column->arena_size], data, len);
+        column->arena_size += len;
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL result_chunk_end_value(SF_RESULT_CHUNK *chunk, sf_bool is_null) {
+    SF_CHUNK_COLUMN *column;
+    int64 row = chunk->row_count;
+    if (chunk->cur_column >= chunk->column_count) {
+        return SF_BOOLEAN_FALSE;
+    }
+    if (row >= chunk->row_capacity && !grow_rows(chunk, chunk->row_capacity * 2)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    column = &chunk->columns[chunk->cur_column];
+    if (is_null) {
+        column->arena_size = chunk->value_start;
+        column->offsets[row] = 0;
+        column->lengths[row] = 0;
+        column->nulls[row] = SF_BOOLEAN_TRUE;
+    } else {
+        // There is always room for the terminator, see result_chunk_append
+        if (column->arena_size + 1 > column->arena_cap && !grow_arena(column, column->arena_size + 1)) {
+            return SF_BOOLEAN_FALSE;
+        }
+        column->arena[column->arena_size++] = '\0';
+        column->offsets[row] = chunk->value_start;
+        column->lengths[row] = column->arena_size - chunk->value_start - 1;
+        column->nulls[row] = SF_BOOLEAN_FALSE;
+    }
+    chunk->cur_column++;
+    chunk->value_start = chunk->cur_column < chunk->column_count ? chunk->columns[chunk->cur_column].arena_size : 0;
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL result_chunk_end_row(SF_RESULT_CHUNK *chunk) {
+    if (chunk->cur_column != chunk->column_count) {
+        return SF_BOOLEAN_FALSE;
+    }
+    chunk->row_count++;
+    chunk->cur_column = 0;
+    chunk->value_start = chunk->column_count > 0 ? chunk->columns[0].arena_size : 0;
+    return SF_BOOLEAN_TRUE;
+}
+
+const char *STDCALL result_chunk_current_value(SF_RESULT_CHUNK *chunk) {
+    if (chunk->cur_column >= chunk->column_count) {
+        return NULL;
+    }
+    return &chunk->columns[chunk->cur_column].arena[chunk->value_start];
+}
+
+SF_RESULT_CHUNK *STDCALL result_chunk_from_json(cJSON *rowset, int64 column_count) {
+    SF_RESULT_CHUNK *chunk;
+    cJSON *row;
+    cJSON *item;
+    char *text;
+    sf_bool success;
+
+    if (!snowflake_cJSON_IsArray(rowset)) {
+        return NULL;
+    }
+    if (column_count <= 0) {
+        column_count = snowflake_cJSON_GetArraySize(snowflake_cJSON_GetArrayItem(rowset, 0));
+    }
+    chunk = result_chunk_init(column_count, snowflake_cJSON_GetArraySize(rowset), 0);
+    if (!chunk) {
+        return NULL;
+    }
+
+    for (row = rowset->child; row; row = row->next) {
+        if (!snowflake_cJSON_IsArray(row)) {
+            goto error;
+        }
+        for (item = row->child; item; item = item->next) {
+            if (snowflake_cJSON_IsNull(item)) {
+                success = result_chunk_end_value(chunk, SF_BOOLEAN_TRUE);
+            } else if (snowflake_cJSON_IsString(item)) {
+                success = result_chunk_append(chunk, item->valuestring, strlen(item->valuestring)) &&
+                          result_chunk_end_value(chunk, SF_BOOLEAN_FALSE);
+            } else {
+                // Anything else is kept as its JSON text, the same as the chunk parser does
+                text = snowflake_cJSON_PrintUnformatted(item);
+                success = text && result_chunk_append(chunk, text, strlen(text)) &&
+                          result_chunk_end_value(chunk, SF_BOOLEAN_FALSE);
+                snowflake_cJSON_free(text);
+            }
+            if (!success) {
+                goto error;
+            }
+        }
+        if (!result_chunk_end_row(chunk)) {
+            goto error;
+        }
+    }
+    return chunk;
+
+error:
+    result_chunk_term(chunk);
+    return NULL;
+}
+
+SF_STATUS STDCALL result_chunk_decode_value(const char *value, SF_C_TYPE type, SF_CHUNK_DECODED_VALUE *decoded) {
+    char *endptr;
+    errno = 0;
+    switch (type) {
+        case SF_C_TYPE_INT64:
+            decoded->int_value = strtoll(value, &endptr, 10);
+            if (endptr == value) {
+                return SF_STATUS_ERROR_CONVERSION_FAILURE;
+            }
+            if ((decoded->int_value == SF_INT64_MAX || decoded->int_value == SF_INT64_MIN) && errno == ERANGE) {
+                return SF_STATUS_ERROR_OUT_OF_RANGE;
+            }
+            break;
+        case SF_C_TYPE_FLOAT64:
+            decoded->float_value = strtod(value, &endptr);
+            if (endptr == value) {
+                return SF_STATUS_ERROR_CONVERSION_FAILURE;
+            }
+            if (errno == ERANGE || decoded->float_value == INFINITY || decoded->float_value == -INFINITY) {
+                return SF_STATUS_ERROR_OUT_OF_RANGE;
+            }
+            break;
+        default:
+            decoded->bool_value = strcmp("1", value) == 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+            break;
+    }
+    return SF_STATUS_SUCCESS;
+}
+
+sf_bool STDCALL result_chunk_alloc_decoded(SF_RESULT_CHUNK *chunk, int64 column, SF_C_TYPE type) {
+    SF_CHUNK_COLUMN *col = &chunk->columns[column];
+    size_t rows = (size_t) (chunk->row_count > chunk->row_capacity ? chunk->row_count : chunk->row_capacity);
+    size_t size = decoded_value_size(type);
+    // Allocate at least one element so that a decoded column is never NULL
+    rows = rows > 0 ? rows : 1;
+    // Reuse the arrays of a cleared decoding if they are large enough
+    if (col->spare_decoded && col->spare_rows >= rows && col->spare_decoded_size >= rows * size) {
+        col->decoded = col->spare_decoded;
+        col->decode_status = col->spare_decode_status;
+        col->decoded_rows = rows;
+        col->spare_decoded = NULL;
+        col->spare_decode_status = NULL;
+        memset(col->decoded, 0, rows * size);
+        memset(col->decode_status, 0, rows * sizeof(SF_STATUS));
+        col->decoded_type = type;
+        return SF_BOOLEAN_TRUE;
+    }
+    col->decoded = SF_CALLOC(rows, size);
+    col->decode_status = (SF_STATUS *) SF_CALLOC(rows, sizeof(SF_STATUS));
+    col->decoded_rows = rows;
+    if (!col->decoded || !col->decode_status) {
+        SF_FREE(col->decoded);
+        SF_FREE(col->decode_status);
+        return SF_BOOLEAN_FALSE;
+    }
+    col->decoded_type = type;
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL result_chunk_decode_column(SF_RESULT_CHUNK *chunk, int64 column, SF_C_TYPE type) {
+    SF_CHUNK_COLUMN *col = &chunk->columns[column];
+    SF_CHUNK_DECODED_VALUE value;
+    int64 row;
+    if (col->decoded) {
+        return SF_BOOLEAN_TRUE;
+    }
+    if (!result_chunk_alloc_decoded(chunk, column, type)) {
+        return SF_BOOLEAN_FALSE;
+    }
+    for (row = 0; row < chunk->row_count; row++) {
+        if (col->nulls[row]) {
+            continue;
+        }
+        col->decode_status[row] = result_chunk_decode_value(&col->arena[col->offsets[row]], type, &value);
+        if (type == SF_C_TYPE_INT64) {
+            ((int64 *) col->decoded)[row] = value.int_value;
+        } else if (type == SF_C_TYPE_FLOAT64) {
+            ((float64 *) col->decoded)[row] = value.float_value;
+        } else {
+            ((sf_bool *) col->decoded)[row] = value.bool_value;
+        }
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL result_chunk_decode(SF_RESULT_CHUNK *chunk, const SF_C_TYPE *column_types) {
+    int64 i;
+    for (i = 0; i < chunk->column_count; i++) {
+        if ((column_types[i] == SF_C_TYPE_INT64 || column_types[i] == SF_C_TYPE_FLOAT64 ||
+             column_types[i] == SF_C_TYPE_BOOLEAN) && !result_chunk_decode_column(chunk, i, column_types[i])) {
+            return SF_BOOLEAN_FALSE;
+        }
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL result_chunk_get_decoded(const SF_RESULT_CHUNK *chunk, int64 row, int64 column, SF_C_TYPE type,
+                                         SF_CHUNK_DECODED_VALUE *value, SF_STATUS *status) {
+    const SF_CHUNK_COLUMN *col;
+    if (row < 0 || row >= chunk->row_count || column < 0 || column >= chunk->column_count) {
+        return SF_BOOLEAN_FALSE;
+    }
+    col = &chunk->columns[column];
+    if (!col->decoded || col->decoded_type != type || col->nulls[row]) {
+        return SF_BOOLEAN_FALSE;
+    }
+    if (type == SF_C_TYPE_INT64) {
+        value->int_value = ((const int64 *) col->decoded)[row];
+    } else if (type == SF_C_TYPE_FLOAT64) {
+        value->float_value = ((const float64 *) col->decoded)[row];
+    } else {
+        value->bool_value = ((const sf_bool *) col->decoded)[row];
+    }
+    *status = col->decode_status[row];
+    return SF_BOOLEAN_TRUE;
+}
+
+const char *STDCALL result_chunk_get_value(const SF_RESULT_CHUNK *chunk, int64 row, int64 column, size_t *len) {
+    const SF_CHUNK_COLUMN *col;
+    // Values outside of the chunk read as NULL
+    if (row < 0 || row >= chunk->row_count || column < 0 || column >= chunk->column_count ||
+        chunk->columns[column].nulls[row]) {
+        if (len) {
+            *len = 0;
+        }
+        return NULL;
+    }
+    col = &chunk->columns[column];
+    if (len) {
+        *len = col->lengths[row];
+    }
+    return &col->arena[col->offsets[row]];
+}
+
+SF_RESULT_CHUNK *STDCALL result_chunk_copy(const SF_RESULT_CHUNK *chunk) {
+    SF_RESULT_CHUNK *copy = result_chunk_init(chunk->column_count, chunk->row_count, 0);
+    size_t rows = chunk->row_count > 0 ? (size_t) chunk->row_count : 0;
+    size_t size;
+    int64 i;
+    const SF_CHUNK_COLUMN *src;
+    SF_CHUNK_COLUMN *dst;
+    if (!copy) {
+        return NULL;
+    }
+    for (i = 0; i < chunk->column_count; i++) {
+        src = &chunk->columns[i];
+        dst = &copy->columns[i];
+        if (src->arena_size + 1 > dst->arena_cap && !grow_arena(dst, src->arena_size + 1)) {
+            goto error;
+        }
+        if (src->arena_size > 0) {
+            memcpy(dst->arena, src->arena, src->arena_size);
+        }
+        dst->arena_size = src->arena_size;
+        if (rows > 0) {
+            memcpy(dst->offsets, src->offsets, rows * sizeof(size_t));
+            memcpy(dst->lengths, src->lengths, rows * sizeof(size_t));
+            memcpy(dst->nulls, src->nulls, rows * sizeof(sf_bool));
+        }
+        if (src->decoded) {
+            if (!result_chunk_alloc_decoded(copy, i, src->decoded_type)) {
+                goto error;
+            }
+            size = src->decoded_type == SF_C_TYPE_INT64 ? sizeof(int64) :
+                   src->decoded_type == SF_C_TYPE_FLOAT64 ? sizeof(float64) : sizeof(sf_bool);
+            if (rows > 0) {
+                memcpy(dst->decoded, src->decoded, rows * size);
+                memcpy(dst->decode_status, src->decode_status, rows * sizeof(SF_STATUS));
+            }
+        }
+    }
+    copy->row_count = chunk->row_count;
+    return copy;
+
+error:
+    result_chunk_term(copy);
+    return NULL;
+}
+
+size_t STDCALL result_chunk_memory_size(const SF_RESULT_CHUNK *chunk) {
+    size_t size;
+    size_t rows;
+    int64 i;
+    const SF_CHUNK_COLUMN *col;
+    if (!chunk) {
+        return 0;
+    }
+    rows = chunk->row_capacity > 0 ? (size_t) chunk->row_capacity : 1;
+    size = sizeof(SF_RESULT_CHUNK) + (size_t) chunk->column_count * sizeof(SF_CHUNK_COLUMN);
+    for (i = 0; i < chunk->column_count; i++) {
+        col = &chunk->columns[i];
+        size += col->arena_cap;
+        if (col->offsets) {
+            size += rows * (2 * sizeof(size_t) + sizeof(sf_bool));
+        }
+        if (col->decoded) {
+            size += rows * sizeof(SF_STATUS);
+            size += rows * (col->decoded_type == SF_C_TYPE_INT64 ? sizeof(int64) :
+                            col->decoded_type == SF_C_TYPE_FLOAT64 ? sizeof(float64) : sizeof(sf_bool));
+        }
+        if (col->spare_decoded) {
+            size += col->spare_decoded_size + col->spare_rows * sizeof(SF_STATUS);
+        }
+    }
+    return size;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_RESULT_CHUNK_H
+#define SNOWFLAKE_RESULT_CHUNK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <snowflake/basic_types.h>
+#include <snowflake/client.h>
+#include "cJSON.h"
+
+/**
+ * A value converted to its native type. Which member is set depends on the type the column was decoded to.
+ */
+typedef union SF_CHUNK_DECODED_VALUE {
+    int64 int_value;
+    float64 float_value;
+    sf_bool bool_value;
+} SF_CHUNK_DECODED_VALUE;
+
+/**
+ * Values of one column of a result chunk. All values are stored back to back in a single arena, each followed by
+ * a null terminator, and are located through the offset/length vectors which are indexed by row.
+ */
+typedef struct SF_CHUNK_COLUMN {
+    char *arena;
+    size_t arena_size;
+    size_t arena_cap;
+    size_t *offsets;
+    size_t *lengths;
+    sf_bool *nulls;
+
+    // Values converted to decoded_type, an int64, float64 or sf_bool array indexed by row, and the conversion
+    // status of every value. NULL unless the column has been decoded.
+    SF_C_TYPE decoded_type;
+    void *decoded;
+    SF_STATUS *decode_status;
+    // Number of rows the decoded arrays have room for
+    size_t decoded_rows;
+    // Arrays of a decoding that was cleared, kept for the next one, and their size in bytes
+    void *spare_decoded;
+    size_t spare_decoded_size;
+    SF_STATUS *spare_decode_status;
+    size_t spare_rows;
+} SF_CHUNK_COLUMN;
+
+/**
+ * Columnar in-memory representation of a set of result rows (the first rowset or a downloaded chunk).
+ */
+typedef struct SF_RESULT_CHUNK {
+    int64 column_count;
+    int64 row_count;
+    int64 row_capacity;
+    SF_CHUNK_COLUMN *columns;
+
+    // Column and arena offset of the value currently being appended
+    int64 cur_column;
+    size_t value_start;
+
+    // Next chunk in a list of cleared chunks waiting to be reused
+    struct SF_RESULT_CHUNK *next_free;
+} SF_RESULT_CHUNK;
+
+/**
+ * Creates an empty result chunk.
+ *
+ * @param column_count Number of columns in every row.
+ * @param row_capacity Expected number of rows. The chunk grows if more rows are added.
+ * @param size_hint Expected total size of all values in bytes, used to size the column arenas. Can be 0.
+ * @return The new chunk or NULL if out of memory.
+ */
+SF_RESULT_CHUNK *STDCALL result_chunk_init(int64 column_count, int64 row_capacity, size_t size_hint);
+
+/**
+ * Frees a result chunk.
+ *
+ * @param chunk Chunk to free. Can be NULL.
+ */
+void STDCALL result_chunk_term(SF_RESULT_CHUNK *chunk);
+
+/**
+ * Removes every row from a chunk but keeps the memory it has, so that the chunk can be filled again without
+ * allocating.
+ *
+ * @param chunk Result chunk.
+ */
+void STDCALL result_chunk_clear(SF_RESULT_CHUNK *chunk);
+
+/**
+ * Appends bytes to the value that is currently being built.
+ *
+ * @param chunk Result chunk.
+ * @param data Bytes to append.
+ * @param len Number of bytes.
+ * @return SF_BOOLEAN_FALSE if the row already has a value for every column or we are out of memory.
+ */
+sf_bool STDCALL result_chunk_append(SF_RESULT_CHUNK *chunk, const char *data, size_t len);
+
+/**
+ * Completes the current value and moves on to the next column.
+ *
+ * @param chunk Result chunk.
+ * @param is_null Whether the value is a SQL NULL. Anything appended to it is discarded.
+ * @return SF_BOOLEAN_FALSE if the row already has a value for every column or we are out of memory.
+ */
+sf_bool STDCALL result_chunk_end_value(SF_RESULT_CHUNK *chunk, sf_bool is_null);
+
+/**
+ * Completes the current row.
+ *
+ * @param chunk Result chunk.
+ * @return SF_BOOLEAN_FALSE if the row does not have exactly one value per column.
+ */
+sf_bool STDCALL result_chunk_end_row(SF_RESULT_CHUNK *chunk);
+
+/**
+ * Returns the value that is currently being built. Only valid until the next append.
+ *
+ * @param chunk Result chunk.
+ * @return Pointer to the first byte of the current value.
+ */
+const char *STDCALL result_chunk_current_value(SF_RESULT_CHUNK *chunk);
+
+/**
+ * Converts a JSON rowset (an array of row arrays) into a result chunk.
+ *
+ * @param rowset JSON rowset.
+ * @param column_count Number of columns. If not positive, the size of the first row is used.
+ * @return The new chunk or NULL if the rowset is malformed.
+ */
+SF_RESULT_CHUNK *STDCALL result_chunk_from_json(cJSON *rowset, int64 column_count);
+
+/**
+ * Converts a single value to int64, float64 or boolean the same way the snowflake_column_as_* functions do.
+ *
+ * @param value Null terminated value.
+ * @param type SF_C_TYPE_INT64, SF_C_TYPE_FLOAT64 or SF_C_TYPE_BOOLEAN.
+ * @param decoded Set to the converted value.
+ * @return SF_STATUS_SUCCESS, SF_STATUS_ERROR_CONVERSION_FAILURE or SF_STATUS_ERROR_OUT_OF_RANGE.
+ */
+SF_STATUS STDCALL result_chunk_decode_value(const char *value, SF_C_TYPE type, SF_CHUNK_DECODED_VALUE *decoded);
+
+/**
+ * Allocates the decoded value and status arrays of a column for every row the chunk has room for. The caller fills
+ * them in.
+ *
+ * @param chunk Result chunk.
+ * @param column Zero based column index.
+ * @param type SF_C_TYPE_INT64, SF_C_TYPE_FLOAT64 or SF_C_TYPE_BOOLEAN.
+ * @return SF_BOOLEAN_FALSE if out of memory.
+ */
+sf_bool STDCALL result_chunk_alloc_decoded(SF_RESULT_CHUNK *chunk, int64 column, SF_C_TYPE type);
+
+/**
+ * Converts the values of one column to int64, float64 or boolean. Does nothing if the column is already decoded.
+ *
+ * @param chunk Result chunk.
+ * @param column Zero based column index.
+ * @param type SF_C_TYPE_INT64, SF_C_TYPE_FLOAT64 or SF_C_TYPE_BOOLEAN.
+ * @return SF_BOOLEAN_FALSE if out of memory.
+ */
+sf_bool STDCALL result_chunk_decode_column(SF_RESULT_CHUNK *chunk, int64 column, SF_C_TYPE type);
+
+/**
+ * Converts the values of every int64, float64 and boolean column to their native type so that they do not have to
+ * be parsed again on every access. Conversion errors are recorded per value. Other columns are left as they are.
+ *
+ * @param chunk Result chunk.
+ * @param column_types C type of every column.
+ * @return SF_BOOLEAN_FALSE if out of memory.
+ */
+sf_bool STDCALL result_chunk_decode(SF_RESULT_CHUNK *chunk, const SF_C_TYPE *column_types);
+
+/**
+ * Returns a decoded value from the chunk. No bounds checking is done.
+ *
+ * @param chunk Result chunk.
+ * @param row Zero based row index.
+ * @param column Zero based column index.
+ * @param type The C type the value is wanted as.
+ * @param value Set to the decoded value.
+ * @param status Set to the conversion status of the value.
+ * @return SF_BOOLEAN_FALSE if the column was not decoded to the given type, the value is a SQL NULL or the row or
+ *         column is outside of the chunk.
+ */
+sf_bool STDCALL result_chunk_get_decoded(const SF_RESULT_CHUNK *chunk, int64 row, int64 column, SF_C_TYPE type,
+                                         SF_CHUNK_DECODED_VALUE *value, SF_STATUS *status);
+
+/**
+ * Returns a value from the chunk.
+ *
+ * @param chunk Result chunk.
+ * @param row Zero based row index.
+ * @param column Zero based column index.
+ * @param len If not NULL, set to the length of the value.
+ * @return Null terminated value, or NULL for a SQL NULL or a row or column outside of the chunk.
+ */
+const char *STDCALL result_chunk_get_value(const SF_RESULT_CHUNK *chunk, int64 row, int64 column, size_t *len);
+
+/**
+ * Makes an independent copy of a complete chunk, including decoded columns.
+ *
+ * @param chunk Result chunk.
+ * @return The new chunk or NULL if out of memory.
+ */
+SF_RESULT_CHUNK *STDCALL result_chunk_copy(const SF_RESULT_CHUNK *chunk);
+
+/**
+ * Returns the number of bytes allocated for the chunk, including room reserved for rows and values that were not
+ * added.
+ *
+ * @param chunk Result chunk. Can be NULL.
+ * @return Size of the chunk in bytes.
+ */
+size_t STDCALL result_chunk_memory_size(const SF_RESULT_CHUNK *chunk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_RESULT_CHUNK_H
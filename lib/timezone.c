@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "timezone.h"
+#include "memory.h"
+#include <snowflake/logger.h>
+
+#define TZ_DEFAULT_DIR "/usr/share/zoneinfo"
+// Much larger than any real tzfile
+#define TZ_MAX_FILE_SIZE (1024 * 1024)
+#define TZ_MAX_NAME 255
+#define TZ_HEADER_SIZE 44
+#define SECONDS_IN_A_DAY 86400
+
+static SF_MUTEX_HANDLE zones_lock;
+/*
+ * Every zone looked up so far, including names without a tzfile, which have no types. Zones are only ever prepended
+ * and aren't changed once published, so readers walk the list without taking the lock.
+ */
+static SF_TIMEZONE *zones = NULL;
+static char *zoneinfo_dir = NULL;
+
+static int64 floor_div(int64 a, int64 b) {
+    return a / b - (a % b < 0);
+}
+
+static int64 floor_mod(int64 a, int64 b) {
+    return a - floor_div(a, b) * b;
+}
+
+static sf_bool is_leap_year(int64 year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static int days_in_month(int64 year, int month) {
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return days[month - 1] + (month == 2 && is_leap_year(year));
+}
+
+/**
+ * Days since the epoch of a date in the proleptic Gregorian calendar.
+ */
+static int64 days_from_civil(int64 year, int month, int day) {
+    int64 era;
+    int64 year_of_era;
+    int64 day_of_year;
+    year -= month <= 2;
+    era = floor_div(year, 400);
+    year_of_era = year - era * 400;
+    day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    return era * 146097 + year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year - 719468;
+}
+
+/**
+ * Year of a number of seconds since the epoch.
+ */
+static int64 year_of(int64 t) {
+    int64 days = floor_div(t, SECONDS_IN_A_DAY) + 719468;
+    int64 era = floor_div(days, 146097);
+    int64 day_of_era = days - era * 146097;
+    int64 year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64 day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64 month = (5 * day_of_year + 2) / 153;
+    // The computation above starts years in March
+    return year_of_era + era * 400 + (month >= 10);
+}
+
+/**
+ * Seconds since the epoch of the midnight a rule switches on, in local time.
+ */
+static int64 rule_day(int64 year, const SF_TZ_RULE_DATE *date) {
+    int64 days;
+    int64 first;
+    int64 mday;
+    if (date->kind == 'J') {
+        // February 29 is never counted
+        days = days_from_civil(year, 1, 1) + date->day - 1 + (is_leap_year(year) && date->day >= 60);
+    } else if (date->kind == 'D') {
+        days = days_from_civil(year, 1, 1) + date->day;
+    } else {
+        first = days_from_civil(year, date->month, 1);
+        // The epoch was a Thursday
+        mday = 1 + floor_mod(date->day - floor_mod(first + 4, 7), 7) + (date->week - 1) * 7;
+        // Week 5 is the last one, which may be the fourth
+        if (mday > days_in_month(year, date->month)) {
+            mday -= 7;
+        }
+        days = first + mday - 1;
+    }
+    return days * SECONDS_IN_A_DAY;
+}
+
+static const SF_TZ_TYPE *rule_type(const SF_TIMEZONE *tz, int64 t) {
+    int64 year;
+    int64 start;
+    int64 end;
+    sf_bool dst;
+    if (!tz->rule_has_dst) {
+        return &tz->rule_std;
+    }
+    year = year_of(t + tz->rule_std.utoff);
+    // The switch to daylight saving time is given in standard time and the switch back in daylight saving time
+    start = rule_day(year, &tz->rule_start) + tz->rule_start.time - tz->rule_std.utoff;
+    end = rule_day(year, &tz->rule_end) + tz->rule_end.time - tz->rule_dst.utoff;
+    if (start <= end) {
+        dst = t >= start && t < end;
+    } else {
+        // Southern hemisphere, daylight saving time spans the new year
+        dst = t < end || t >= start;
+    }
+    return dst ? &tz->rule_dst : &tz->rule_std;
+}
+
+static const SF_TZ_TYPE *find_type(const SF_TIMEZONE *tz, int64 t) {
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    if (tz->transition_count == 0 || t >= tz->transitions[tz->transition_count - 1]) {
+        if (tz->has_rule) {
+            return rule_type(tz, t);
+        }
+        if (tz->transition_count == 0) {
+            return &tz->types[0];
+        }
+    } else if (t < tz->transitions[0]) {
+        return &tz->types[0];
+    }
+    // Last transition at or before t
+    lo = 0;
+    hi = tz->transition_count;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (tz->transitions[mid] <= t) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &tz->types[tz->transition_types[lo]];
+}
+
+static struct tm *civil_time(int64 t, const SF_TZ_TYPE *type, struct tm *result) {
+    time_t local = (time_t) (t + type->utoff);
+    if (!sf_gmtime(&local, result)) {
+        return NULL;
+    }
+    result->tm_isdst = type->isdst ? 1 : 0;
+#if defined(__linux__) || defined(__APPLE__)
+    result->tm_gmtoff = type->utoff;
+    result->tm_zone = (char *) type->abbr;
+#endif
+    return result;
+}
+
+struct tm *STDCALL sf_timezone_localtime(const SF_TIMEZONE *tz, time_t t, struct tm *result) {
+    return civil_time((int64) t, find_type(tz, (int64) t), result);
+}
+
+struct tm *STDCALL sf_offset_time(time_t t, int32 utoff, struct tm *result) {
+    SF_TZ_TYPE type;
+    type.utoff = utoff;
+    type.isdst = SF_BOOLEAN_FALSE;
+    type.abbr = "UTC";
+    return civil_time((int64) t, &type, result);
+}
+
+static int64 read_be(const unsigned char *p, size_t bytes) {
+    uint64 value = 0;
+    size_t i;
+    for (i = 0; i < bytes; i++) {
+        value = value << 8 | p[i];
+    }
+    return bytes == 4 ? (int64) (int32) (uint32) value : (int64) value;
+}
+
+static const char *parse_tz_number(const char *p, const char *end, long min, long max, long *value) {
+    const char *start = p;
+    long v = 0;
+    while (p < end && isdigit((unsigned char) *p)) {
+        v = v * 10 + (*p - '0');
+        if (v > max) {
+            return NULL;
+        }
+        p++;
+    }
+    if (p == start || v < min) {
+        return NULL;
+    }
+    *value = v;
+    return p;
+}
+
+/**
+ * Parses a zone abbreviation, either letters or anything between < and >.
+ */
+static const char *parse_tz_name(const char *p, const char *end, char *name, size_t size) {
+    const char *start;
+    size_t len;
+    if (p < end && *p == '<') {
+        start = ++p;
+        while (p < end && *p != '>') {
+            p++;
+        }
+        if (p == end) {
+            return NULL;
+        }
+        len = (size_t) (p++ - start);
+    } else {
+        start = p;
+        while (p < end && isalpha((unsigned char) *p)) {
+            p++;
+        }
+        len = (size_t) (p - start);
+    }
+    if (len < 3 || len >= size) {
+        return NULL;
+    }
+    memcpy(name, start, len);
+    name[len] = '\0';
+    return p;
+}
+
+/**
+ * Parses [+|-]hh[:mm[:ss]] into seconds.
+ */
+static const char *parse_tz_time(const char *p, const char *end, long max_hours, int32 *seconds) {
+    long sign = 1;
+    long hours;
+    long minutes = 0;
+    long secs = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        sign = *p++ == '-' ? -1 : 1;
+    }
+    if (!(p = parse_tz_number(p, end, 0, max_hours, &hours))) {
+        return NULL;
+    }
+    if (p < end && *p == ':') {
+        if (!(p = parse_tz_number(p + 1, end, 0, 59, &minutes))) {
+            return NULL;
+        }
+        if (p < end && *p == ':' && !(p = parse_tz_number(p + 1, end, 0, 59, &secs))) {
+            return NULL;
+        }
+    }
+    *seconds = (int32) (sign * (hours * 3600 + minutes * 60 + secs));
+    return p;
+}
+
+static const char *parse_tz_rule_date(const char *p, const char *end, SF_TZ_RULE_DATE *date) {
+    long value = 0;
+    memset(date, 0, sizeof(SF_TZ_RULE_DATE));
+    if (p < end && *p == 'J') {
+        date->kind = 'J';
+        p = parse_tz_number(p + 1, end, 1, 365, &value);
+        date->day = (int) value;
+    } else if (p < end && *p == 'M') {
+        date->kind = 'M';
+        if (!(p = parse_tz_number(p + 1, end, 1, 12, &value)) || p == end || *p != '.') {
+            return NULL;
+        }
+        date->month = (int) value;
+        if (!(p = parse_tz_number(p + 1, end, 1, 5, &value)) || p == end || *p != '.') {
+            return NULL;
+        }
+        date->week = (int) value;
+        p = parse_tz_number(p + 1, end, 0, 6, &value);
+        date->day = (int) value;
+    } else {
+        date->kind = 'D';
+        p = parse_tz_number(p, end, 0, 365, &value);
+        date->day = (int) value;
+    }
+    // Switches happen at 2am unless said otherwise. Times past a day or negative ones are allowed since version 3
+    date->time = 7200;
+    if (p && p < end && *p == '/') {
+        p = parse_tz_time(p + 1, end, 167, &date->time);
+    }
+    return p;
+}
+
+/**
+ * Parses the POSIX TZ string at the end of a tzfile, e.g. PST8PDT,M3.2.0,M11.1.0. Offsets in it are west of UTC.
+ */
+static sf_bool parse_tz_rule(SF_TIMEZONE *tz, const char *p, const char *end) {
+    char std_name[TZ_MAX_NAME + 1];
+    char dst_name[TZ_MAX_NAME + 1];
+    int32 offset;
+    int32 dst_offset;
+    size_t std_len;
+    dst_name[0] = '\0';
+    if (!(p = parse_tz_name(p, end, std_name, sizeof(std_name))) || !(p = parse_tz_time(p, end, 24, &offset))) {
+        return SF_BOOLEAN_FALSE;
+    }
+    tz->rule_std.utoff = -offset;
+    tz->rule_std.isdst = SF_BOOLEAN_FALSE;
+    if (p < end) {
+        if (!(p = parse_tz_name(p, end, dst_name, sizeof(dst_name)))) {
+            return SF_BOOLEAN_FALSE;
+        }
+        dst_offset = offset - 3600;
+        if (p < end && *p != ',' && !(p = parse_tz_time(p, end, 24, &dst_offset))) {
+            return SF_BOOLEAN_FALSE;
+        }
+        // tzfiles always spell out when daylight saving time starts and ends
+        if (p == end || *p != ',' || !(p = parse_tz_rule_date(p + 1, end, &tz->rule_start)) ||
+            p == end || *p != ',' || !(p = parse_tz_rule_date(p + 1, end, &tz->rule_end))) {
+            return SF_BOOLEAN_FALSE;
+        }
+        tz->rule_dst.utoff = -dst_offset;
+        tz->rule_dst.isdst = SF_BOOLEAN_TRUE;
+        tz->rule_has_dst = SF_BOOLEAN_TRUE;
+    }
+    if (p != end) {
+        return SF_BOOLEAN_FALSE;
+    }
+    std_len = strlen(std_name);
+    tz->rule_abbrs = (char *) SF_CALLOC(1, std_len + strlen(dst_name) + 2);
+    if (!tz->rule_abbrs) {
+        return SF_BOOLEAN_FALSE;
+    }
+    strcpy(tz->rule_abbrs, std_name);
+    strcpy(tz->rule_abbrs + std_len + 1, dst_name);
+    tz->rule_std.abbr = tz->rule_abbrs;
+    tz->rule_dst.abbr = tz->rule_abbrs + std_len + 1;
+    return SF_BOOLEAN_TRUE;
+}
+
+SF_TIMEZONE *STDCALL sf_timezone_parse(const char *name, const char *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    const unsigned char *end = p + len;
+    const char *footer;
+    const char *footer_end;
+    size_t isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+    size_t time_size = 4;
+    size_t data_size;
+    size_t i;
+    char version;
+    SF_TIMEZONE *tz = NULL;
+
+    if (len < TZ_HEADER_SIZE || memcmp(p, "TZif", 4) != 0) {
+        return NULL;
+    }
+    version = (char) p[4];
+    for (;;) {
+        isutcnt = (size_t) read_be(p + 20, 4);
+        isstdcnt = (size_t) read_be(p + 24, 4);
+        leapcnt = (size_t) read_be(p + 28, 4);
+        timecnt = (size_t) read_be(p + 32, 4);
+        typecnt = (size_t) read_be(p + 36, 4);
+        charcnt = (size_t) read_be(p + 40, 4);
+        // Type indexes are single bytes, and none of the counts can exceed the size of the file
+        if (typecnt == 0 || typecnt > 256 || isutcnt > len || isstdcnt > len || leapcnt > len || timecnt > len ||
+            charcnt > len) {
+            return NULL;
+        }
+        p += TZ_HEADER_SIZE;
+        data_size = timecnt * time_size + timecnt + typecnt * 6 + charcnt + leapcnt * (time_size + 4) + isstdcnt +
+                    isutcnt;
+        if ((size_t) (end - p) < data_size) {
+            return NULL;
+        }
+        if (time_size == 8 || version < '2') {
+            break;
+        }
+        // Version 2 and later repeat the data with 64-bit times after the 32-bit one
+        p += data_size;
+        if ((size_t) (end - p) < TZ_HEADER_SIZE || memcmp(p, "TZif", 4) != 0) {
+            return NULL;
+        }
+        time_size = 8;
+    }
+
+    tz = (SF_TIMEZONE *) SF_CALLOC(1, sizeof(SF_TIMEZONE));
+    tz->name = (char *) SF_CALLOC(1, strlen(name) + 1);
+    strcpy(tz->name, name);
+    tz->transition_count = timecnt;
+    tz->transitions = (int64 *) SF_CALLOC(timecnt, sizeof(int64));
+    tz->transition_types = (uint8 *) SF_CALLOC(timecnt, sizeof(uint8));
+    tz->type_count = typecnt;
+    tz->types = (SF_TZ_TYPE *) SF_CALLOC(typecnt, sizeof(SF_TZ_TYPE));
+    tz->abbrs = (char *) SF_CALLOC(1, charcnt + 1);
+
+    for (i = 0; i < timecnt; i++) {
+        tz->transitions[i] = read_be(p + i * time_size, time_size);
+        if (i > 0 && tz->transitions[i] <= tz->transitions[i - 1]) {
+            goto error;
+        }
+    }
+    p += timecnt * time_size;
+    for (i = 0; i < timecnt; i++) {
+        if (p[i] >= typecnt) {
+            goto error;
+        }
+        tz->transition_types[i] = p[i];
+    }
+    p += timecnt;
+    for (i = 0; i < typecnt; i++, p += 6) {
+        if (p[5] >= charcnt) {
+            goto error;
+        }
+        tz->types[i].utoff = (int32) read_be(p, 4);
+        tz->types[i].isdst = p[4] ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+        tz->types[i].abbr = tz->abbrs + p[5];
+    }
+    memcpy(tz->abbrs, p, charcnt);
+    // Leap seconds are ignored, like zones without them do
+    p += charcnt + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+
+    if (time_size == 8 && p < end && *p == '\n') {
+        footer = (const char *) p + 1;
+        footer_end = memchr(footer, '\n', (size_t) (end - p - 1));
+        if (footer_end && footer_end > footer) {
+            tz->has_rule = parse_tz_rule(tz, footer, footer_end);
+            if (!tz->has_rule) {
+                log_warn("Ignoring the unsupported rule %.*s of time zone %s", (int) (footer_end - footer), footer,
+                         name);
+            }
+        }
+    }
+    return tz;
+
+error:
+    sf_timezone_free(tz);
+    return NULL;
+}
+
+void STDCALL sf_timezone_free(SF_TIMEZONE *tz) {
+    if (!tz) {
+        return;
+    }
+    SF_FREE(tz->name);
+    SF_FREE(tz->transitions);
+    SF_FREE(tz->transition_types);
+    SF_FREE(tz->types);
+    SF_FREE(tz->abbrs);
+    SF_FREE(tz->rule_abbrs);
+    SF_FREE(tz);
+}
+
+/**
+ * Reads the tzfile of a zone. Names must be relative to the zoneinfo directory.
+ */
+static SF_TIMEZONE *load_zone(const char *name) {
+    char path[4096];
+    FILE *file;
+    char *data;
+    size_t len;
+    SF_TIMEZONE *tz = NULL;
+    if (name[0] == '\0' || name[0] == '/' || strlen(name) > TZ_MAX_NAME || strstr(name, "..") ||
+        strchr(name, '\\')) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/%s", zoneinfo_dir ? zoneinfo_dir : TZ_DEFAULT_DIR, name);
+    if (!(file = fopen(path, "rb"))) {
+        return NULL;
+    }
+    data = (char *) SF_MALLOC(TZ_MAX_FILE_SIZE);
+    len = fread(data, 1, TZ_MAX_FILE_SIZE, file);
+    fclose(file);
+    tz = sf_timezone_parse(name, data, len);
+    SF_FREE(data);
+    if (!tz) {
+        log_warn("Invalid tzfile %s", path);
+    }
+    return tz;
+}
+
+static SF_TIMEZONE *find_zone(SF_TIMEZONE *list, const char *name) {
+    while (list && strcmp(list->name, name) != 0) {
+        list = list->next;
+    }
+    return list;
+}
+
+const SF_TIMEZONE *STDCALL sf_timezone_get(const char *name) {
+    SF_TIMEZONE *tz;
+    if (!name) {
+        return NULL;
+    }
+    // Same as TZ, a leading colon says the rest is a file name
+    if (name[0] == ':') {
+        name++;
+    }
+    tz = find_zone((SF_TIMEZONE *) _atomic_load_ptr(&zones), name);
+    if (!tz) {
+        _mutex_lock(&zones_lock);
+        // Another thread may have loaded it in the meantime
+        tz = find_zone(zones, name);
+        if (!tz) {
+            tz = load_zone(name);
+            if (!tz) {
+                tz = (SF_TIMEZONE *) SF_CALLOC(1, sizeof(SF_TIMEZONE));
+                tz->name = (char *) SF_CALLOC(1, strlen(name) + 1);
+                strcpy(tz->name, name);
+            }
+            tz->next = zones;
+            _atomic_store_ptr(&zones, tz);
+        }
+        _mutex_unlock(&zones_lock);
+    }
+    return tz->type_count > 0 ? tz : NULL;
+}
+
+void STDCALL sf_timezone_init() {
+    const char *dir = sf_getenv("TZDIR");
+    _mutex_init(&zones_lock);
+    // Read once, the environment can't be read safely while other threads change it
+    if (dir && dir[0]) {
+        zoneinfo_dir = (char *) SF_CALLOC(1, strlen(dir) + 1);
+        strcpy(zoneinfo_dir, dir);
+    }
+}
+
+void STDCALL sf_timezone_term() {
+    SF_TIMEZONE *tz;
+    while ((tz = zones)) {
+        zones = tz->next;
+        sf_timezone_free(tz);
+    }
+    SF_FREE(zoneinfo_dir);
+    _mutex_term(&zones_lock);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2018 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_TIMEZONE_H
+#define SNOWFLAKE_TIMEZONE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+#include <snowflake/basic_types.h>
+#include <snowflake/platform.h>
+
+/**
+ * Offset from UTC in effect for a span of time.
+ */
+typedef struct SF_TZ_TYPE {
+    // Seconds east of UTC
+    int32 utoff;
+    sf_bool isdst;
+    // Abbreviation, e.g. PST
+    const char *abbr;
+} SF_TZ_TYPE;
+
+/**
+ * Day of the year a POSIX TZ rule switches on, e.g. M3.2.0 for the second Sunday of March.
+ */
+typedef struct SF_TZ_RULE_DATE {
+    // 'J' for a day from 1 to 365 without February 29, 'D' for a day from 0 to 365, 'M' for a week day of a month
+    char kind;
+    int day;
+    int week;
+    int month;
+    // Seconds after midnight in the local time in effect before the switch
+    int32 time;
+} SF_TZ_RULE_DATE;
+
+/**
+ * Time zone loaded from an IANA tzfile. Times before the last transition are looked up in the transition table,
+ * later ones follow the POSIX TZ rule at the end of the file.
+ */
+typedef struct SF_TIMEZONE {
+    char *name;
+    // Start of every span of time in seconds since the epoch, in increasing order, and its type
+    int64 *transitions;
+    uint8 *transition_types;
+    size_t transition_count;
+    SF_TZ_TYPE *types;
+    size_t type_count;
+    // Abbreviations the types point into
+    char *abbrs;
+
+    sf_bool has_rule;
+    sf_bool rule_has_dst;
+    SF_TZ_TYPE rule_std;
+    // The rest is only set if the rule has daylight saving time
+    SF_TZ_TYPE rule_dst;
+    SF_TZ_RULE_DATE rule_start;
+    SF_TZ_RULE_DATE rule_end;
+    char *rule_abbrs;
+
+    struct SF_TIMEZONE *next;
+} SF_TIMEZONE;
+
+void STDCALL sf_timezone_init();
+void STDCALL sf_timezone_term();
+
+/**
+ * Finds a time zone by its IANA name, e.g. America/Los_Angeles. Every zone is read from the zoneinfo directory once
+ * and kept until sf_timezone_term, so looking up a zone that was used before takes no lock.
+ *
+ * @param name Name of the time zone.
+ * @return The time zone, or NULL if there is no tzfile for it.
+ */
+const SF_TIMEZONE *STDCALL sf_timezone_get(const char *name);
+
+/**
+ * Reads a tzfile.
+ *
+ * @param name Name to give the time zone.
+ * @param data Contents of the file.
+ * @param len Size of the file.
+ * @return The time zone, to be freed with sf_timezone_free, or NULL if the file is invalid.
+ */
+SF_TIMEZONE *STDCALL sf_timezone_parse(const char *name, const char *data, size_t len);
+
+void STDCALL sf_timezone_free(SF_TIMEZONE *tz);
+
+/**
+ * Converts a time to the civil time in a time zone, the same way localtime_r does with TZ set to the zone.
+ *
+ * @param tz Time zone.
+ * @param t Seconds since the epoch.
+ * @param result Set to the civil time.
+ * @return result, or NULL if the time is out of range.
+ */
+struct tm *STDCALL sf_timezone_localtime(const SF_TIMEZONE *tz, time_t t, struct tm *result);
+
+/**
+ * Converts a time to the civil time at a fixed offset from UTC.
+ *
+ * @param t Seconds since the epoch.
+ * @param utoff Seconds east of UTC.
+ * @param result Set to the civil time.
+ * @return result, or NULL if the time is out of range.
+ */
+struct tm *STDCALL sf_offset_time(time_t t, int32 utoff, struct tm *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_TIMEZONE_H